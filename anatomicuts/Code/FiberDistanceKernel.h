@@ -0,0 +1,121 @@
+#ifndef _FiberDistanceKernel_h
+#define _FiberDistanceKernel_h
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+// Fixed-length (resampled) fibres stored in one flat float array, with the
+// distance kernels of EuclideanMembershipFunction and HausdorffMembershipFunction
+// written over it. Each fibre is stored as all x, then all y, then all z
+// coordinates, so the loops over points are unit stride and vectorise.
+class FiberDistanceKernel
+{
+	public:
+		enum MetricType { Euclidean = 0, Hausdorff = 1 };
+
+		FiberDistanceKernel(): m_numberOfFibers(0), m_numberOfPoints(0), m_normalization(1), m_metric(Euclidean) {}
+
+		// numberOfPoints is the number of points compared per fibre (the
+		// membership functions skip the last point of each polyline);
+		// normalization is what the euclidean sum is divided by.
+		void Allocate(int numberOfFibers, int numberOfPoints, int normalization)
+		{
+			m_numberOfFibers = numberOfFibers;
+			m_numberOfPoints = numberOfPoints;
+			m_normalization = normalization;
+			m_points.assign((size_t)numberOfFibers * 3 * numberOfPoints, 0.0f);
+		}
+
+		template<class TVector> void SetFiber(int id, const TVector& mv)
+		{
+			float* p = this->GetFiber(id);
+			for (int i = 0; i < m_numberOfPoints; i++)
+			{
+				p[i] = mv[i*3];
+				p[m_numberOfPoints + i] = mv[i*3+1];
+				p[2*m_numberOfPoints + i] = mv[i*3+2];
+			}
+		}
+
+		void SetMetric(MetricType metric) { m_metric = metric; }
+		MetricType GetMetric() const { return m_metric; }
+		int GetNumberOfFibers() const { return m_numberOfFibers; }
+		int GetNumberOfPoints() const { return m_numberOfPoints; }
+
+		float* GetFiber(int id) { return &m_points[(size_t)id * 3 * m_numberOfPoints]; }
+		const float* GetFiber(int id) const { return &m_points[(size_t)id * 3 * m_numberOfPoints]; }
+
+		double Evaluate(int a, int b) const
+		{
+			return (m_metric == Hausdorff) ? this->EvaluateHausdorff(a, b) : this->EvaluateEuclidean(a, b);
+		}
+
+		// affinities of fibre a against the n fibres in others
+		void EvaluateBatch(int a, const int* others, int n, float* out) const
+		{
+			for (int k = 0; k < n; k++)
+				out[k] = this->Evaluate(a, others[k]);
+		}
+
+		// mean point to point distance, taking the better of the two
+		// orientations of b
+		double EvaluateEuclidean(int a, int b) const
+		{
+			const int n = m_numberOfPoints;
+			const float *ax = this->GetFiber(a), *ay = ax + n, *az = ay + n;
+			const float *bx = this->GetFiber(b), *by = bx + n, *bz = by + n;
+			float dist = 0, dist_inv = 0;
+#ifdef HAVE_OPENMP
+			#pragma omp simd reduction(+:dist,dist_inv)
+#endif
+			for (int i = 0; i < n; i++)
+			{
+				const float dx = ax[i] - bx[i], dy = ay[i] - by[i], dz = az[i] - bz[i];
+				const int r = n - 1 - i;
+				const float rx = ax[i] - bx[r], ry = ay[i] - by[r], rz = az[i] - bz[r];
+				dist += std::sqrt(dx*dx + dy*dy + dz*dz);
+				dist_inv += std::sqrt(rx*rx + ry*ry + rz*rz);
+			}
+			const double d = std::min(dist, dist_inv) / (double)m_normalization;
+			return 1.0 / (d + 1);
+		}
+
+		// symmetric hausdorff distance on squared point distances
+		double EvaluateHausdorff(int a, int b) const
+		{
+			const int n = m_numberOfPoints;
+			const float *ax = this->GetFiber(a), *ay = ax + n, *az = ay + n;
+			const float *bx = this->GetFiber(b), *by = bx + n, *bz = by + n;
+			float max1 = 0, max2 = 0;
+			for (int i = 0; i < n; i++)
+			{
+				float min1 = std::numeric_limits<float>::max();
+				float min2 = std::numeric_limits<float>::max();
+				const float px = ax[i], py = ay[i], pz = az[i];
+				const float qx = bx[i], qy = by[i], qz = bz[i];
+#ifdef HAVE_OPENMP
+				#pragma omp simd reduction(min:min1,min2)
+#endif
+				for (int j = 0; j < n; j++)
+				{
+					const float dx = px - bx[j], dy = py - by[j], dz = pz - bz[j];
+					const float ex = qx - ax[j], ey = qy - ay[j], ez = qz - az[j];
+					min1 = std::min(min1, dx*dx + dy*dy + dz*dz);
+					min2 = std::min(min2, ex*ex + ey*ey + ez*ez);
+				}
+				max1 = std::max(max1, min1);
+				max2 = std::max(max2, min2);
+			}
+			return 1.0 / (std::max(max1, max2) + 1.0);
+		}
+
+	private:
+		int m_numberOfFibers;
+		int m_numberOfPoints;
+		int m_normalization;
+		MetricType m_metric;
+		std::vector<float> m_points;
+};
+#endif
@@ -15,6 +15,9 @@
 #include "itkWeightedCentroidKdTreeGenerator.h"
 #include "itkMeshToMeshFilter.h"
 #include "ThreadedMembershipFunction.h"
+#include "ThreadedFiberAffinity.h"
+#include "EuclideanMembershipFunction.h"
+#include "HausdorffMembershipFunction.h"
 #if ITK_VERSION_MAJOR < 4
 #include "itkMaximumDecisionRule2.h"
 #else
@@ -147,11 +150,12 @@ class NormalizedCutsFilter :
 
 		std::vector<std::pair<int,int>> SelectCentroids(typename SampleType::Pointer samples, const typename MembershipFunctionType::Pointer);
 		std::vector<std::pair<int,int>> SelectCentroidsParallel(typename SampleType::Pointer samples, const typename MembershipFunctionType::Pointer);
+		bool SetUpFiberKernel(typename SampleType::Pointer samples);
 		MeshPointerType input;
 		std::vector<std::string> labels;
 		ListOfOutputMeshTypePointer m_Output;
 		int numberOfClusters;
-		NormalizedCutsFilter() {}
+		NormalizedCutsFilter() : m_useFiberKernel(false) {}
 		~NormalizedCutsFilter() {}
 
 		//    virtual void GenerateData (void);
@@ -164,6 +168,10 @@ class NormalizedCutsFilter :
 		int m_numberOfFibersForEigenDecomposition;
 //		void SaveClustersInMeshes(MembershipFunctionVectorType mfv);
 		MembershipFunctionVectorType *m_membershipFunctions; 
+		// flat fibre array used instead of the membership function for the
+		// euclidean and hausdorff metrics, indexed by cell id
+		FiberDistanceKernel m_fiberKernel;
+		bool m_useFiberKernel;
 };  
 #include "NormalizedCutsFilter.txx"
 #endif
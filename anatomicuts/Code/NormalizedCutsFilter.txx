@@ -60,6 +60,7 @@ NormalizedCutsFilter < TMesh,TMembershipFunctionType >::Update()
 		mv.SetCell(this->GetInput(), i) ; //inputCellIt.Value());
 		sample->PushBack(mv);
 	}
+	this->m_useFiberKernel = this->SetUpFiberKernel(sample);
 	std::string lastLabel="1";
 	std::priority_queue<PriorityNode<SampleType>> queue;	
 	queue.push(PriorityNode<SampleType>(sample->Size(),lastLabel,sample));
@@ -74,7 +75,32 @@ NormalizedCutsFilter < TMesh,TMembershipFunctionType >::Update()
 		typename SampleType::Pointer samplePositives = SampleType::New();
 		typename SampleType::Pointer sampleNegatives = SampleType::New();
 		
-		if(sample->Size() > this->GetNumberOfFibersForEigenDecomposition())
+		if(sample->Size() > this->GetNumberOfFibersForEigenDecomposition() && this->m_useFiberKernel)
+		{
+			std::vector<int> rows(sample->Size()), columns(centroidIndeces.size());
+			for(int j=0; j< sample->Size();j++)
+				rows[j] = sample->GetMeasurementVector(j).GetCellId();
+			for(int i=0; i< centroidIndeces.size();i++)
+				columns[i] = sample->GetMeasurementVector(centroidIndeces[i].second).GetCellId();
+
+			ThreadedFiberAffinity::Pointer affinity = ThreadedFiberAffinity::New();
+			affinity->SetRows(rows);
+			affinity->SetColumns(columns);
+			affinity->SetMode(ThreadedFiberAffinity::ArgMax);
+			affinity->Compute(&this->m_fiberKernel);
+			const std::vector<int>& maxvals = affinity->GetArgMax();
+			for(int j=0; j< sample->Size();j++)
+			{
+				int argmax=maxvals[j];
+				labels[rows[j]]=lastLabel +std::to_string(centroidIndeces[argmax].first) ;
+
+				if(centroidIndeces[argmax].first==0)
+					samplePositives->PushBack(sample->GetMeasurementVector(j));
+				else
+					sampleNegatives->PushBack(sample->GetMeasurementVector(j));
+			}
+		}
+		else if(sample->Size() > this->GetNumberOfFibersForEigenDecomposition())
 		{
 			//Multi-thread
 			std::vector<std::pair<int, int>> inIndeces;
@@ -189,15 +215,35 @@ NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::SelectCentroidsParallel(
 		}
 	}
 
-	typename ThreadedMembershipFunctionType::Pointer threadedMembershipFunction = ThreadedMembershipFunctionType::New();
-	typename ThreadedMembershipFunctionType::DomainType domain;
-	domain[0]=0;
-	domain[1]= inIndeces.size()-1;
-	//std::cout <<  "domain "<< domain[1] << std::endl;
-	typename MembershipFunctionType::Pointer hola = (*this->GetMembershipFunctionVector())[0];
-	threadedMembershipFunction->SetStuff(samples,inIndeces, outIndeces,hola,n);
-	threadedMembershipFunction->Execute(hola ,domain);
-	vnl_sparse_matrix<double>* ms= threadedMembershipFunction->GetResults();
+	vnl_sparse_matrix<double>* ms;
+	if(this->m_useFiberKernel)
+	{
+		std::vector<int> ids(n);
+		for (unsigned i=0; i<n; i++) 
+			ids[i] = samples->GetMeasurementVector(selected[i]).GetCellId();
+		ThreadedFiberAffinity::Pointer affinity = ThreadedFiberAffinity::New();
+		affinity->SetRows(ids);
+		affinity->SetColumns(ids);
+		affinity->SetSymmetric(true);
+		affinity->Compute(&this->m_fiberKernel);
+		const std::vector<float>& values = affinity->GetAffinities();
+		ms = new vnl_sparse_matrix<double>(n,n);
+		for (unsigned i=0; i<n; i++) 
+			for (unsigned j=i; j<n; j++) 
+				(*ms)(i,j) = (*ms)(j,i) = values[(size_t)i*n+j];
+	}
+	else
+	{
+		typename ThreadedMembershipFunctionType::Pointer threadedMembershipFunction = ThreadedMembershipFunctionType::New();
+		typename ThreadedMembershipFunctionType::DomainType domain;
+		domain[0]=0;
+		domain[1]= inIndeces.size()-1;
+		//std::cout <<  "domain "<< domain[1] << std::endl;
+		typename MembershipFunctionType::Pointer hola = (*this->GetMembershipFunctionVector())[0];
+		threadedMembershipFunction->SetStuff(samples,inIndeces, outIndeces,hola,n);
+		threadedMembershipFunction->Execute(hola ,domain);
+		ms= threadedMembershipFunction->GetResults();
+	}
 	for (unsigned i=0; i<n; i++) 
 	{
 		
@@ -243,6 +289,42 @@ NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::SelectCentroidsParallel(
 	delete ms;
 	return indices;
 }
+// The euclidean and hausdorff metrics only look at the point coordinates, so
+// they can be evaluated on the flat fibre array. Returns false (and the
+// membership function is used) for any other metric.
+template< class TMesh,class  TMembershipFunctionType>
+	bool
+NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::SetUpFiberKernel(typename SampleType::Pointer samples)
+{
+	typedef EuclideanMembershipFunction<MeasurementVectorType> EuclideanType;
+	typedef HausdorffMembershipFunction<MeasurementVectorType> HausdorffType;
+
+	MembershipFunctionType* function = (*this->GetMembershipFunctionVector())[0].GetPointer();
+	if(dynamic_cast<EuclideanType*>(function))
+		this->m_fiberKernel.SetMetric(FiberDistanceKernel::Euclidean);
+	else if(dynamic_cast<HausdorffType*>(function))
+		this->m_fiberKernel.SetMetric(FiberDistanceKernel::Hausdorff);
+	else
+		return false;
+
+	if(samples->Size() == 0)
+		return false;
+	const int numberOfLabels = samples->GetMeasurementVector(0).GetLabels()->size();
+	if(numberOfLabels < 2)
+		return false;
+
+	this->m_fiberKernel.Allocate(samples->Size(), numberOfLabels-1, numberOfLabels);
+	for(unsigned int i=0; i< samples->Size(); i++)
+	{
+		const MeasurementVectorType& mv = samples->GetMeasurementVector(i);
+		if(mv.GetLabels()->size() != numberOfLabels || mv.GetCellId() < 0 || mv.GetCellId() >= (int)samples->Size())
+			return false;
+		this->m_fiberKernel.SetFiber(mv.GetCellId(), mv);
+	}
+	std::cout << " flat fiber kernel: " << samples->Size() << " fibers, " << numberOfLabels-1 << " points" << std::endl;
+	return true;
+}
+
 template< class TMesh,class  TMembershipFunctionType>
 	std::vector<std::pair<int,int>>	
 NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::SelectCentroids(typename SampleType::Pointer samples, const typename MembershipFunctionType::Pointer membershipFunction )
@@ -0,0 +1,131 @@
+#ifndef _ThreadedFiberAffinity_h
+#define _ThreadedFiberAffinity_h
+
+#include "itkDomainThreader.h"
+#include "itkThreadedIndexedContainerPartitioner.h"
+#include "FiberDistanceKernel.h"
+#include <vector>
+#include <utility>
+
+// Tiled, multithreaded affinity builder over a FiberDistanceKernel. Rows and
+// columns are fibre ids in the kernel. In Dense mode the (rows x columns)
+// affinity matrix is filled tile by tile (only the upper triangle of tiles
+// when symmetric, in which case rows and columns must be the same list); in
+// ArgMax mode each row only keeps the column with the largest affinity, so
+// the full matrix is never stored.
+class ThreadedFiberAffinity :  public itk::DomainThreader<itk::ThreadedIndexedContainerPartitioner, FiberDistanceKernel>
+{
+	public :
+		using Self = ThreadedFiberAffinity;
+		using Superclass =  itk::DomainThreader<itk::ThreadedIndexedContainerPartitioner, FiberDistanceKernel>;
+		using Pointer =  itk::SmartPointer<Self>;
+		using ConstPointer = itk::SmartPointer<const Self>;
+		using DomainType = typename Superclass::DomainType;
+		itkNewMacro(Self);
+
+		enum ModeType { Dense = 0, ArgMax = 1 };
+
+		void SetRows(const std::vector<int>& rows) { m_rows = rows; }
+		void SetColumns(const std::vector<int>& columns) { m_columns = columns; }
+		void SetSymmetric(bool on) { m_symmetric = on; }
+		void SetMode(ModeType mode) { m_mode = mode; }
+		void SetTileSize(int tileSize) { m_tileSize = tileSize; }
+
+		void Compute(FiberDistanceKernel* kernel)
+		{
+			const int nr = (m_rows.size() + m_tileSize - 1) / m_tileSize;
+			const int nc = (m_columns.size() + m_tileSize - 1) / m_tileSize;
+			m_tiles.clear();
+			if (m_mode == ArgMax)
+			{
+				m_argMax.assign(m_rows.size(), 0);
+				m_maxValue.assign(m_rows.size(), 0);
+				for (int ti = 0; ti < nr; ti++)
+					m_tiles.push_back(std::pair<int,int>(ti, -1));
+			}
+			else
+			{
+				m_affinities.assign(m_rows.size() * m_columns.size(), 0);
+				for (int ti = 0; ti < nr; ti++)
+					for (int tj = (m_symmetric ? ti : 0); tj < nc; tj++)
+						m_tiles.push_back(std::pair<int,int>(ti, tj));
+			}
+			if (m_tiles.empty())
+				return;
+			DomainType domain;
+			domain[0] = 0;
+			domain[1] = m_tiles.size() - 1;
+			this->Execute(kernel, domain);
+		}
+
+		// row-major rows x columns
+		const std::vector<float>& GetAffinities() const { return m_affinities; }
+		// per row, the index into the columns with the largest affinity
+		const std::vector<int>& GetArgMax() const { return m_argMax; }
+		const std::vector<float>& GetMaxValues() const { return m_maxValue; }
+
+	protected:
+		ThreadedFiberAffinity(): m_symmetric(false), m_mode(Dense), m_tileSize(64) {}
+		~ThreadedFiberAffinity(){}
+
+		void ThreadedExecution(const DomainType& subDomain, const itk::ThreadIdType)
+		{
+			const int ncol = m_columns.size();
+			std::vector<float> values(m_tileSize);
+			for (itk::IndexValueType t = subDomain[0]; t <= subDomain[1]; ++t)
+			{
+				const int r0 = m_tiles[t].first * m_tileSize;
+				const int r1 = std::min<int>(r0 + m_tileSize, m_rows.size());
+				if (m_mode == ArgMax)
+				{
+					// column tiles in order, so ties go to the first column
+					for (int c0 = 0; c0 < ncol; c0 += m_tileSize)
+					{
+						const int c1 = std::min(c0 + m_tileSize, ncol);
+						for (int i = r0; i < r1; i++)
+						{
+							this->m_Associate->EvaluateBatch(m_rows[i], &m_columns[c0], c1 - c0, &values[0]);
+							for (int j = c0; j < c1; j++)
+							{
+								if (values[j-c0] > m_maxValue[i])
+								{
+									m_maxValue[i] = values[j-c0];
+									m_argMax[i] = j;
+								}
+							}
+						}
+					}
+				}
+				else
+				{
+					const int c0 = m_tiles[t].second * m_tileSize;
+					const int c1 = std::min(c0 + m_tileSize, ncol);
+					for (int i = r0; i < r1; i++)
+					{
+						const int cb = (m_symmetric && c0 == r0) ? i : c0;
+						if (cb >= c1)
+							continue;
+						this->m_Associate->EvaluateBatch(m_rows[i], &m_columns[cb], c1 - cb, &values[0]);
+						for (int j = cb; j < c1; j++)
+						{
+							m_affinities[(size_t)i * ncol + j] = values[j-cb];
+							if (m_symmetric)
+								m_affinities[(size_t)j * ncol + i] = values[j-cb];
+						}
+					}
+				}
+			}
+		}
+
+	private:
+		std::vector<int> m_rows;
+		std::vector<int> m_columns;
+		bool m_symmetric;
+		ModeType m_mode;
+		int m_tileSize;
+		std::vector<std::pair<int,int>> m_tiles;
+		std::vector<float> m_affinities;
+		std::vector<int> m_argMax;
+		std::vector<float> m_maxValue;
+};
+#endif
@@ -43,7 +43,7 @@ class ThreadedMembershipFunction :  public itk::DomainThreader<itk::ThreadedInde
 		//std::vector<vnl_sparse_matrix<double>*> m_results;
 		std::vector<std::vector<int>> m_maxIndex;
 		std::vector<std::vector<double>> m_maxValue;
-		int* m_results2;
+		double* m_results2;
 		typename MembershipFunctionType::Pointer m_membershipFunction;
 		void BeforeThreadedExecution();
 		void ThreadedExecution(const DomainType&, const itk::ThreadIdType);
@@ -25,7 +25,7 @@ ThreadedMembershipFunction< TMembershipFunctionType >::BeforeThreadedExecution()
 		this->m_maxValue[ii].resize(m_matrixDim,0);
 //		this->m_results[ii] = new vnl_sparse_matrix<double>(m_matrixDim, m_matrixDim);
 	}
-	this->m_results2 = new int[m_indeces.size()];
+	this->m_results2 = new double[m_indeces.size()];
 
 }
 template< class  TMembershipFunctionType> void
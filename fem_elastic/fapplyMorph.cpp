@@ -134,6 +134,7 @@ struct IoParams
   std::string strTemplate;
   std::string strTransform;
   std::string strGcam; // option to export gcam -- not yet implemented
+  std::string strEltCache; // element lookups saved for the next run
 
   unsigned int zlibBuffer;
 
@@ -200,6 +201,10 @@ main(int argc, char** argv)
   std::cout << " loaded transform\n";
   initOctree(*pmorph);
 
+  if ( !params.strEltCache.empty() &&
+       pmorph->load_element_cache( params.strEltCache.c_str() ) )
+    std::cout << " loaded element cache " << params.strEltCache << std::endl;
+
   typedef std::vector<std::shared_ptr<AbstractFilter> > FilterContainerType;
   FilterContainerType filterContainer;
 
@@ -277,6 +282,16 @@ main(int argc, char** argv)
     exit(1);
   }
 
+  try
+  {
+    if ( !params.strEltCache.empty() )
+      pmorph->save_element_cache( params.strEltCache.c_str() );
+  }
+  catch (const char* msg)
+  {
+    std::cerr << " Failed saving element cache " << msg << std::endl;
+  }
+
   // apply morph to one point for debug if needed
   if ( !g_vDbgCoords.empty() )
   {
@@ -305,6 +320,7 @@ IoParams::parse(int ac, char** av)
   // optional
   parser.addArgument("--zlib_buffer", 1, Int);
   parser.addArgument("--dbg_coords", 3, Int);
+  parser.addArgument("--elt_cache", 1, String);
   // help text
   parser.addHelp(applyMorph_help_xml, applyMorph_help_xml_len);
   parser.parse(ac, av);
@@ -321,6 +337,10 @@ IoParams::parse(int ac, char** av)
     g_vDbgCoords = parser.retrieve<std::vector<int>>("dbg_coords");
   }
 
+  if (parser.exists("elt_cache")) {
+    strEltCache = parser.retrieve<std::string>("elt_cache");
+  }
+
   typedef std::vector<std::string> StringVector;
   StringVector container = parser.retrieve<StringVector>("inputs");
 
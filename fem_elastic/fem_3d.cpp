@@ -488,6 +488,13 @@ Element3d::dir_img(const tDblCoords& src_coords) const
 
 }
 
+void
+Element3d::prepare_dir_img() const
+{
+  if ( !m_isInterpolUpdated )
+    update_interpol_coefs();
+}
+
 double
 Element3d::shape_fct(int node_id,
                      const tCoords& pt) const
@@ -626,11 +633,13 @@ private:
 CMesh3d::CMesh3d()
     : TMesh3d(),
     m_maxNodes(20),
+    m_maxWalk(64),
     m_poctree(NULL)
 {}
 
 CMesh3d::CMesh3d(const CMesh3d& cmesh)
-    : TMesh3d(cmesh), m_maxNodes(cmesh.m_maxNodes)
+    : TMesh3d(cmesh), m_maxNodes(cmesh.m_maxNodes),
+    m_maxWalk(cmesh.m_maxWalk), m_vnbr(cmesh.m_vnbr)
 {
   if ( cmesh.m_poctree )
   {
@@ -679,9 +688,54 @@ CMesh3d::build_index_src()
   std::cout << " done building octree - total elements = "
   << m_poctree->getElementCount() << std::endl;
 
+  this->build_neighbors();
+
   return 0;
 }
 
+void
+CMesh3d::build_neighbors()
+{
+  m_vnbr.clear();
+
+  const unsigned int nelts = this->get_no_elts();
+  for (unsigned int ui=0; ui < nelts; ++ui)
+    if ( m_vpElements[ui]->get_id() != (int)ui ||
+         m_vpElements[ui]->no_nodes() != 4 )
+      return;
+
+  // the element across each face shares its 3 nodes, so it is one of the
+  // elements of the face's first node
+  m_vnbr.resize( 4*nelts, -1 );
+  tNode* pnode[4];
+  tNode* pother;
+  tNode::tElt_citer cit, cend;
+  for (unsigned int ui=0; ui < nelts; ++ui)
+  {
+    for (int k=0; k<4; ++k)
+      m_vpElements[ui]->get_node(k, &pnode[k]);
+    for (int k=0; k<4; ++k)
+    {
+      tNode* pface[3];
+      for (int a=0, b=0; a<4; ++a)
+        if ( a != k ) pface[b++] = pnode[a];
+
+      pface[0]->get_elt_citer(cit, cend);
+      for ( ; cit != cend && m_vnbr[4*ui+k] < 0; ++cit )
+      {
+        if ( *cit == ui || *cit >= nelts ) continue;
+        int shared = 0;
+        for (int a=0; a<4; ++a)
+        {
+          m_vpElements[*cit]->get_node(a, &pother);
+          if ( pother == pface[1] || pother == pface[2] ) ++shared;
+        }
+        if ( shared == 2 ) m_vnbr[4*ui+k] = *cit;
+      }
+    } // next k
+  } // next ui
+}
+
 const CMesh3d::tElement*
 CMesh3d::element_at_point(const tCoords& c) const
 {
@@ -700,6 +754,72 @@ CMesh3d::element_at_point(const tCoords& c)
 
 
 
+static double
+signed_volume(const tDblCoords& c1, const tDblCoords& c2,
+              const tDblCoords& c3, const tDblCoords& c4)
+{
+  tDblCoords a = c2-c1, b = c3-c1, d = c4-c1;
+  return a(0) * ( b(1)*d(2) - b(2)*d(1) )
+         - a(1) * ( b(0)*d(2) - b(2)*d(0) )
+         + a(2) * ( b(0)*d(1) - b(1)*d(0) );
+}
+
+const CMesh3d::tElement*
+CMesh3d::element_at_point(const tCoords& c, int& hint) const
+{
+  if ( hint >= 0 && (unsigned int)hint < this->get_no_elts() && !m_vnbr.empty() )
+  {
+    int idx = hint;
+    tNode* pnode[4];
+    for (unsigned int step=0; step < m_maxWalk && idx >= 0; ++step)
+    {
+      const tElement* cpelt = m_vpElements[idx];
+      if ( cpelt->src_contains(c) )
+      {
+        hint = idx;
+        return cpelt;
+      }
+
+      // leave through the face opposite the node with the most negative
+      // barycentric coordinate
+      for (int k=0; k<4; ++k)
+        cpelt->get_node(k, &pnode[k]);
+      double dvol = signed_volume( pnode[0]->coords(), pnode[1]->coords(),
+                                   pnode[2]->coords(), pnode[3]->coords() );
+      if ( dvol == 0 ) break;
+
+      int kmin = -1;
+      double dmin = 0;
+      for (int k=0; k<4; ++k)
+      {
+        tDblCoords pt[4];
+        for (int a=0; a<4; ++a)
+          pt[a] = (a==k) ? c : pnode[a]->coords();
+        double dbary = signed_volume(pt[0], pt[1], pt[2], pt[3]) / dvol;
+        if ( dbary < dmin )
+        {
+          dmin = dbary;
+          kmin = k;
+        }
+      }
+      if ( kmin < 0 ) break;
+      idx = m_vnbr[4*idx+kmin];
+    } // next step
+  }
+
+  const tElement* cpelt = this->element_at_point(c);
+  hint = cpelt ? cpelt->get_id() : -1;
+  return cpelt;
+}
+
+void
+CMesh3d::prepare_dir_img() const
+{
+  for ( ElementConstIterator cit = m_vpElements.begin();
+        cit != m_vpElements.end(); ++cit )
+    static_cast<const Element3d*>(*cit)->prepare_dir_img();
+}
+
 const CMesh3d::tNode*
 CMesh3d::closest_node(const tCoords& c) const
 {
@@ -49,6 +49,10 @@ public:
   virtual void print(std::ostream& os) const;
 
   virtual double shape_fct(int node_id, const tCoords& pt) const;
+
+  // computes the coefficients dir_img would otherwise compute on first use,
+  // so that it can then be called from several threads
+  void prepare_dir_img() const;
 private:
   bool contains(const tDblCoords& c1, const tDblCoords& c2,
                 const tDblCoords& c3, const tDblCoords& c4,
@@ -169,6 +173,14 @@ public:
   tNode* closest_node(const tCoords& c);
   tElement* element_at_point(const tCoords& c);
 
+  // walks across faces from the element of index hint toward c, which is
+  // cheap when hint is the element of a nearby point (e.g. the previous
+  // voxel of a scanline), and falls back on the octree if the walk fails
+  const tElement* element_at_point(const tCoords& c, int& hint) const;
+
+  // prepares all the elements for dir_img from several threads
+  void prepare_dir_img() const;
+
   // this function's implementation actually uses an octree
   //
   //      since this is a virtual function, the argument will
@@ -176,12 +188,19 @@ public:
   unsigned int m_maxNodes;
   int build_index_src();
 
+  unsigned int m_maxWalk; // elements visited by a walk before using the octree
+
 protected:
 
 private:
   typedef toct::Octree<ElementProxy,3> OctreeType;
   OctreeType* m_poctree;
   std::vector<ElementProxy> m_vpEltBlock;
+
+  // 4 per element, the element across the face opposite each node,
+  // -1 on the boundary; empty if element ids are not their positions
+  std::vector<int> m_vnbr;
+  void build_neighbors();
 };
 
 
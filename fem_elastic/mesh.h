@@ -143,6 +143,15 @@ public:
   virtual tNode* closest_node(const tCoords& c) = 0;
   virtual tElement* element_at_point(const tCoords& c) = 0;
 
+  // same, with hint the index of an element near c to start the search
+  // from, updated to the index of the element found (-1 if none)
+  virtual const tElement* element_at_point(const tCoords& c, int& hint) const
+  {
+    const tElement* cpelt = this->element_at_point(c);
+    hint = cpelt ? cpelt->get_id() : -1;
+    return cpelt;
+  }
+
   unsigned int add_node(tNode* pnode);
   //---------------------------
 
@@ -183,6 +192,9 @@ public:
   //    an invalid point will be returned
   tCoords        dir_img(const tCoords&,
                          bool signalTopology = false) const /*throw(gmpErr) */;
+  tCoords        dir_img(const tCoords&,
+                         bool signalTopology,
+                         int& hint) const;
   void           get_dst_box(tCoords& cmin,
                              tCoords& cmax) const;
   //----------------------------
@@ -1254,6 +1266,25 @@ TMesh<Cstr,n>::dir_img(const tCoords& c_src,
   return img;
 }
 
+template<class Cstr, int n>
+TCoords<double,n>
+TMesh<Cstr,n>::dir_img(const tCoords& c_src,
+                       bool signalTopology,
+                       int& hint) const
+{
+  tCoords img;
+  const tElement* pelt = this->element_at_point( c_src, hint );
+
+  if ( !pelt )
+    img.status() = cOutOfBounds;
+  else if ( pelt->orientation_pb() )
+    img.invalidate();
+  else
+    img = pelt->dir_img( c_src );
+
+  return img;
+}
+
 template<class Cstr, int n>
 bool
 TMesh<Cstr,n>::check_elt_id() const
@@ -1,4 +1,5 @@
 
+#include <cstring>
 #include <stdexcept>
 
 #include <itkLinearInterpolateImageFunction.h>
@@ -11,6 +12,11 @@
 
 #include "tag_fio.h"
 
+#include "romp_support.h"
+
+// ints per thread in the FEM lookup hints, so threads do not share cache lines
+#define FEM_HINT_STRIDE 16
+
 template<class T>
 T mySqr(T x)
 {
@@ -555,10 +561,46 @@ FemTransform3d::doOwnImg(const tCoords& pt) const
   if (!m_sharedMesh)
     throw std::logic_error("FemTransform3d img -> NULL mesh");
 
+  if ( int* phint = this->thread_hint() )
+    return m_sharedMesh->dir_img(pt, m_signalTopology, *phint);
+
   return m_sharedMesh->dir_img(pt, m_signalTopology);
 
 }
 
+int*
+FemTransform3d::thread_hint() const
+{
+  int tid = 0;
+#ifdef HAVE_OPENMP
+  tid = omp_get_thread_num();
+#endif
+  if ( (tid+1)*FEM_HINT_STRIDE > (int)m_vhint.size() ) return NULL;
+  return &m_vhint[tid*FEM_HINT_STRIDE];
+}
+
+int&
+FemTransform3d::hint() const
+{
+  int* phint = this->thread_hint();
+  if ( !phint )
+    throw std::logic_error("FemTransform3d hint -> threads not prepared");
+  return *phint;
+}
+
+void
+FemTransform3d::prepare_threads() const
+{
+  int nthreads = 1;
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  m_vhint.assign( nthreads*FEM_HINT_STRIDE, -1 );
+
+  if ( std::shared_ptr<CMesh3d> pmesh = std::dynamic_pointer_cast<CMesh3d>(m_sharedMesh) )
+    pmesh->prepare_dir_img();
+}
+
 void
 FemTransform3d::doInput(std::istream& is)
 {
@@ -580,6 +622,7 @@ void
 FemTransform3d::doOwnInit()
 {
   m_sharedMesh->build_index_src();
+  m_vhint.clear();
 }
 
 void
@@ -597,6 +640,7 @@ FemTransform3d::invert()
   pmesh->build_index_src();
 
   m_sharedMesh = pmesh;
+  m_vhint.clear();
 
 }
 
@@ -665,6 +709,7 @@ VolumeMorph::VolumeMorph()
 
   initVolGeom(&m_vgFixed);
   initVolGeom(&m_vgMoving);
+  initVolGeom(&m_vgEltCache);
 }
 
 VolumeMorph::~VolumeMorph()
@@ -673,6 +718,109 @@ VolumeMorph::~VolumeMorph()
     MRIfree(&mriCache);
 }
 
+static void
+collect_fem_transforms(gmp::Transform<3>* ptransform,
+                       std::vector<FemTransform3d*>& vfem)
+{
+  if ( !ptransform ) return;
+
+  // the initial transforms are applied first
+  collect_fem_transforms( ptransform->initial().get(), vfem );
+  if ( FemTransform3d* pfem = dynamic_cast<FemTransform3d*>(ptransform) )
+    vfem.push_back(pfem);
+}
+
+void
+VolumeMorph::get_fem_transforms(std::vector<FemTransform3d*>& vfem) const
+{
+  vfem.clear();
+  for ( TransformContainerType::const_iterator cit = m_transforms.begin();
+        cit != m_transforms.end(); ++cit )
+    collect_fem_transforms( cit->get(), vfem );
+}
+
+void
+VolumeMorph::clear_element_cache()
+{
+  m_eltCache.clear();
+  initVolGeom(&m_vgEltCache);
+}
+
+std::string
+VolumeMorph::PrepareTagEltCache()
+{
+  std::vector<FemTransform3d*> vfem;
+  this->get_fem_transforms(vfem);
+
+  std::ostringstream oss;
+  oss << this->PrepareTagVolGeom(m_vgEltCache);
+  TWrite(oss, (unsigned int)vfem.size() );
+
+  // neighboring voxels mostly share their element, so this compresses well
+  ZlibStringCompressor compressor;
+  const std::string strRaw( (const char*)&m_eltCache[0],
+                            sizeof(int) * m_eltCache.size() );
+  oss << compressor.compress( strRaw, Z_BEST_COMPRESSION );
+
+  return oss.str();
+}
+
+void
+VolumeMorph::ReadTagEltCache(const std::string& strData)
+{
+  std::istringstream iss(strData);
+  this->ReadTagVolGeom( strData, m_vgEltCache );
+
+  // skip the volume geometry
+  iss.seekg( this->PrepareTagVolGeom(m_vgEltCache).size() );
+  unsigned int nfem = TRead<unsigned int>(iss);
+
+  ZlibStringCompressor compressor;
+  const std::string strInflated =
+    compressor.inflate( strData.substr( iss.tellg() ) );
+
+  std::vector<FemTransform3d*> vfem;
+  this->get_fem_transforms(vfem);
+  size_t nvox = (size_t)m_vgEltCache.width * m_vgEltCache.height * m_vgEltCache.depth;
+  if ( nfem != vfem.size() || strInflated.size() != sizeof(int) * nvox * nfem )
+  {
+    std::cerr << " VolumeMorph - element cache does not match the morph, ignored\n";
+    this->clear_element_cache();
+    return;
+  }
+  m_eltCache.resize( nvox * nfem );
+  memcpy( &m_eltCache[0], strInflated.c_str(), strInflated.size() );
+}
+
+void
+VolumeMorph::save_element_cache(const char* fname)
+{
+  if ( m_eltCache.empty() )
+    throw "VolumeMorph save_element_cache - empty cache";
+
+  std::string strTag = ftags::CreateTag( tagEltCache,
+                                         this->PrepareTagEltCache() );
+
+  std::ofstream ofs(fname, std::ios::binary);
+  if ( !ofs )
+    throw "VolumeMorph save_element_cache - failed to open output stream";
+  ofs.write( strTag.c_str(), strTag.size() );
+}
+
+bool
+VolumeMorph::load_element_cache(const char* fname)
+{
+  std::ifstream ifs(fname, std::ios::binary);
+  if ( !ifs ) return false;
+
+  ftags::TagReader tagReader(ifs);
+  while ( tagReader.Read() )
+    if ( tagReader.m_tag == tagEltCache )
+      this->ReadTagEltCache( std::string(tagReader.m_data, tagReader.m_len) );
+
+  return !m_eltCache.empty();
+}
+
 MRI*
 VolumeMorph::apply_transforms(MRI* input,
                               bool cacheField,
@@ -770,19 +918,51 @@ VolumeMorph::apply_transforms(MRI* input,
                                  MRI_FLOAT, 4 ); // 4 frames - one for each direction + 1 to indicate a valid voxel
   }
 
-  try
+  // the element lookups of the FEM transforms start from the element found
+  // for the previous voxel of the scanline, or the one cached for the voxel
+  std::vector<FemTransform3d*> vfem;
+  this->get_fem_transforms(vfem);
+  for (unsigned int ui=0; ui<vfem.size(); ++ui)
+    vfem[ui]->prepare_threads();
+  const size_t nvox = (size_t)mriOut->width * mriOut->height * mriOut->depth;
+  const bool useEltCache = !m_eltCache.empty() &&
+                           m_eltCache.size() == nvox * vfem.size() &&
+                           vg_isEqual(&vg, &m_vgEltCache);
+  if ( !useEltCache )
   {
-    unsigned int voxInvalid(0), voxValid(0);
-    tCoords pt, img;
-    TransformContainerType::const_iterator cit;
-    double val;
-    float valvect[nframes];
-    
-    if ( cacheField )
-      for (int z=0; z<mriOut->depth; ++z)
-        for (int y=0; y<mriOut->height; ++y)
-          for (int x=0; x<mriOut->width; ++x)
-            MRIsetVoxVal(mriCache, x,y,z, 3, 0);
+    m_eltCache.assign( nvox * vfem.size(), -1 );
+    m_vgEltCache = vg;
+  }
+
+  unsigned int voxInvalid(0), voxValid(0);
+  bool failed = false;
+
+  if ( cacheField )
+    for (int z=0; z<mriOut->depth; ++z)
+      for (int y=0; y<mriOut->height; ++y)
+        for (int x=0; x<mriOut->width; ++x)
+          MRIsetVoxVal(mriCache, x,y,z, 3, 0);
+
+  // slabs of constant z are independent. Each thread has its own
+  // element hints, and they are reset at the start of every slab, so the
+  // element found for a voxel does not depend on how slabs are scheduled.
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+:voxInvalid,voxValid)
+#endif
+  for (int z=0; z<mriOut->depth; ++z)
+  {
+    ROMP_PFLB_begin
+    bool stop;
+#ifdef HAVE_OPENMP
+    #pragma omp atomic read
+#endif
+    stop = failed;
+    if ( stop ) ROMP_PFLB_continue;
+    if ( !(z%10) ) std::cout << " z = " << z << std::endl;
+    if ( !useEltCache )
+      for (unsigned int ui=0; ui<vfem.size(); ++ui)
+        vfem[ui]->hint() = -1;
 
     VECTOR *vFixed, *vMoving, *vTmp;
     vFixed  = VectorAlloc(4, MATRIX_REAL);
@@ -792,13 +972,20 @@ VolumeMorph::apply_transforms(MRI* input,
     vTmp    = VectorAlloc(4, MATRIX_REAL);
     VECTOR_ELT(vTmp,4) = 1.0;
 
-    for (int z=0; z<mriOut->depth; ++z)
+    tCoords pt, img;
+    double val;
+    float valvect[nframes];
+
+    try
     {
-      if ( !(z%10) ) std::cout << " z = " << z << std::endl;
       for (int y=0; y<mriOut->height; ++y)
         for (int x=0; x<mriOut->width; ++x)
         {
-          //std::cout << " in the FOR loop " << std::endl;
+          const size_t vox = ( (size_t)z * mriOut->height + y ) * mriOut->width + x;
+          if ( useEltCache )
+            for (unsigned int ui=0; ui<vfem.size(); ++ui)
+              vfem[ui]->hint() = m_eltCache[ui*nvox + vox];
+
           //-------------------------
           // do RAS conversion
           VECTOR_ELT(vTmp, 1) = x;
@@ -806,7 +993,6 @@ VolumeMorph::apply_transforms(MRI* input,
           VECTOR_ELT(vTmp, 3) = z;
 
           vFixed = MatrixMultiply( mat_template, vTmp, vFixed );
-          //std::cout << " vFixed computed " << std::endl;
 
           pt.validate();
           pt(0) = V3_X( vFixed );
@@ -815,7 +1001,9 @@ VolumeMorph::apply_transforms(MRI* input,
           //-------------------------
 
           img = this->image(pt);
-          //std::cout << " img computed " << std::endl;
+
+          for (unsigned int ui=0; ui<vfem.size(); ++ui)
+            m_eltCache[ui*nvox + vox] = vfem[ui]->hint();
 
           if ( !img.isValid() )
           {
@@ -834,12 +1022,10 @@ VolumeMorph::apply_transforms(MRI* input,
           V3_Z(vTmp) = img(2);
 
           vMoving = MatrixMultiply( mat_subject, vTmp, vMoving );
-          //std::cout << " vMoving computed " << std::endl;
 
           img(0) = V3_X( vMoving);
           img(1) = V3_Y( vMoving);
           img(2) = V3_Z( vMoving);
-          //std::cout << " img assigned " << img(0) <<"," << img(1) <<"," <<img(2) << std::endl;
 
           //--------------------------
           // do nothing if out of bounds
@@ -868,20 +1054,37 @@ VolumeMorph::apply_transforms(MRI* input,
               MRIsetVoxVal( mriCache, x,y,z, dir, bufPt(dir) );
             MRIsetVoxVal( mriCache, x,y,z, 3, 1);
           }
-        } // next x,y,z
+        } // next x,y
     }
-    std::cout << " Invalid voxels = " << voxInvalid << std::endl
-    << " Valid = " << voxValid << std::endl;
-  }
-  catch (const gmpErr& excp)
-  {
-    std::cerr << " Exception caught -> " << excp.what() << std::endl;
-  }
-  catch (...)
-  {
-    std::cerr << " Unhandled exception!!!\n";
-    exit(1);
-  }
+    catch (const gmpErr& excp)
+    {
+#ifdef HAVE_OPENMP
+      #pragma omp critical
+#endif
+      std::cerr << " Exception caught -> " << excp.what() << std::endl;
+#ifdef HAVE_OPENMP
+      #pragma omp atomic write
+#endif
+      failed = true;
+    }
+    catch (...)
+    {
+      std::cerr << " Unhandled exception!!!\n";
+      exit(1);
+    }
+
+    VectorFree(&vFixed);
+    VectorFree(&vMoving);
+    VectorFree(&vTmp);
+    ROMP_PFLB_end
+  } // next z
+  ROMP_PF_end
+
+  std::cout << " Invalid voxels = " << voxInvalid << std::endl
+  << " Valid = " << voxValid << std::endl;
+
+  MatrixFree(&mat_template);
+  MatrixFree(&mat_subject);
 
   return mriOut;
 }
@@ -1239,6 +1442,14 @@ VolumeMorph::save(const char* fname)
             );
   } // next transform
 
+  // element cache, which older readers skip
+  if ( !m_eltCache.empty() )
+  {
+    strTag = ftags::CreateTag( tagEltCache,
+                               this->PrepareTagEltCache() );
+    os.write( strTag.c_str(), strTag.size() );
+  }
+
   std::cout << " writing morph to file " << fname << std::endl;
   // write compressed buffer to file
   std::ofstream ofs(fname, std::ios::binary);
@@ -1377,6 +1588,10 @@ VolumeMorph::load_new(const char* fname,
   ftags::TagReader tagReader(ifs);
 
   if ( clearExisting ) m_transforms.clear();
+  this->clear_element_cache();
+
+  // the cache needs the transforms, so read it last
+  std::string strEltCache;
 
   while ( tagReader.Read() )
   {
@@ -1411,10 +1626,16 @@ VolumeMorph::load_new(const char* fname,
       m_transforms.push_back(t);
     }
     break;
+    case tagEltCache:
+      strEltCache = std::string(tagReader.m_data, tagReader.m_len);
+      break;
     default:
       ;
     }
   } // tagReader
+
+  if ( !strEltCache.empty() )
+    this->ReadTagEltCache(strEltCache);
 }
 
 std::string
@@ -1652,6 +1873,7 @@ VolumeMorph::invert()
     //counter ++;
   } // next it
   m_transforms = tmpContainer;
+  this->clear_element_cache();
 
   //std::cout << "in morph:invert ==> counter = " <<  counter-1 << std::endl;
 }
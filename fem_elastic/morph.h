@@ -20,6 +20,7 @@ polymorphic way.
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <vector>
 
 // ITK
 #include <itkImage.h>
@@ -311,12 +312,22 @@ public:
   bool m_signalTopology;
 
   TransformType* convert_to_delta() const;
+
+  // Makes img safe to call from several threads. Each thread then starts
+  // its element lookups from the element it found last, which hint()
+  // gets and sets for the calling thread.
+  void prepare_threads() const;
+  int& hint() const;
 protected:
   void doInput(std::istream& is);
   void doOutput(std::ostream& os) const;
   void doOwnInit();
 
   virtual tCoords doOwnImg(const tCoords& pt) const;
+
+private:
+  mutable std::vector<int> m_vhint;
+  int* thread_hint() const;
 };
 
 
@@ -416,6 +427,17 @@ public:
     return m_vgMoving;
   }
 
+  //----------
+  // element cache
+  //
+  // For each FEM transform of the chain, the element found for each voxel
+  // by the last apply_transforms, which starts the lookups of the next one
+  // on the same output geometry. It only speeds up the lookups, so a stale
+  // cache is harmless. It is saved with the morph, or on its own.
+  void clear_element_cache();
+  void save_element_cache(const char* fname);
+  bool load_element_cache(const char* fname);
+
 protected:
   // purposely not implemented
   VolumeMorph(const VolumeMorph&);
@@ -425,7 +447,8 @@ protected:
   {
     tagVgFixed = 1,
     tagVgMoving,
-    tagTransform
+    tagTransform,
+    tagEltCache
   };
 
 private:
@@ -434,6 +457,12 @@ private:
 
   mutable MRI* mriCache;
 
+  mutable VOL_GEOM m_vgEltCache;
+  mutable std::vector<int> m_eltCache;
+  void get_fem_transforms(std::vector<FemTransform3d*>& vfem) const;
+  std::string PrepareTagEltCache();
+  void ReadTagEltCache(const std::string& strData);
+
   void load_old(const char* fname, unsigned int bufferMultiplier = 5,
                 bool clearExisting = true);
   void load_new(const char* fname, unsigned int bufferMultiplier = 5,
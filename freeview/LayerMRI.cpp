@@ -1122,12 +1122,16 @@ void LayerMRI::OnContourThreadFinished(int thread_id)
       {
         foreach (int n, labels)
         {
+          // an edited label gets a new actor
+          if (m_labelActors.contains(n) && m_labelActors[n] != m_labelActorsTemp[n])
+            m_labelActors[n]->Delete();
           m_labelActors[n] = m_labelActorsTemp[n];
 #if VTK_MAJOR_VERSION > 5
           m_labelActors[n]->ForceTranslucentOn();
 #endif
           m_labelActors[n]->GetMapper()->SetLookupTable( GetProperty()->GetLUTTable() );
         }
+        m_labelContourInfo = m_labelContourInfoTemp;
         OnLabelContourChanged();
         emit ActorChanged();
       }
@@ -4256,6 +4260,7 @@ void LayerMRI::RebuildContour()
     m_labelActors[i]->Delete();
   }
   m_labelActors.clear();
+  m_labelContourInfo.clear();
   UpdateContour();
 }
 
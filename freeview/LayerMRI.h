@@ -23,6 +23,7 @@
 
 #include "LayerVolumeBase.h"
 #include "vtkSmartPointer.h"
+#include "vtkLabelContourExtractor.h"
 #include <QString>
 #include <QList>
 
@@ -505,6 +506,9 @@ protected:
   int         m_nThreadID;
   vtkSmartPointer<vtkActor>       m_actorContourTemp;
   QMap<int, vtkActor*>            m_labelActorsTemp;
+  // voxels of each label when its actor was built, to rebuild only labels that were edited
+  QMap<int, vtkLabelContourExtractor::LabelInfo> m_labelContourInfo;
+  QMap<int, vtkLabelContourExtractor::LabelInfo> m_labelContourInfoTemp;
 
   QList<SurfaceRegion*>           m_surfaceRegions;
   SurfaceRegion*                  m_currentSurfaceRegion;
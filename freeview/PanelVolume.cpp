@@ -2130,7 +2130,11 @@ void PanelVolume::OnButtonContourUpdate()
   QList<LayerMRI*> layers = GetSelectedLayers<LayerMRI*>();
   foreach (LayerMRI* layer, layers)
   {
-    layer->RebuildContour();
+    // label contours are rebuilt only for the labels that were edited
+    if (layer->GetProperty()->GetShowAsLabelContour())
+      layer->UpdateContour();
+    else
+      layer->RebuildContour();
   }
 }
 
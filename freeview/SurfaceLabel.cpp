@@ -193,6 +193,7 @@ bool SurfaceLabel::LoadLabel( const QString& filename )
       int vtxno = MHTfindClosestVertexNoXYZ(hash, mris, v.x,v.y,v.z, &dmin);
       if (vtxno >= 0)
         m_label->lv[i].vno = vtxno;
+      LabelInvalidateVertexIndex(m_label);
     }
     if (m_label->lv[i].stat < m_dHeatscaleMin)
       m_dHeatscaleMin = m_label->lv[i].stat;
@@ -456,6 +457,7 @@ void SurfaceLabel::EditVertices(const QVector<int> &verts, bool bAdd)
     for (int i = 0; i < list.size(); i++)
       m_label->lv[i] = list[i];
     m_label->n_points = list.size();
+    LabelInvalidateVertexIndex(m_label);
   }
 
   m_bModified = true;
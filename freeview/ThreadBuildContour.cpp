@@ -18,6 +18,8 @@
 #include "LayerCollection.h"
 #include "MainWindow.h"
 #include "MyVTKUtils.h"
+#include "vtkLabelContourExtractor.h"
+#include "vtkPolyData.h"
 #include "vtkSmartPointer.h"
 #include "vtkActor.h"
 #include "vtkPolyDataMapper.h"
@@ -72,23 +74,58 @@ void ThreadBuildContour::run()
     imagedata = extract->GetOutput();
   }
   QMap<int, vtkActor*> map = m_mri->m_labelActors;
+  QMap<int, vtkLabelContourExtractor::LabelInfo> infoMap = m_mri->m_labelContourInfo;
   labelList = m_mri->GetAvailableLabels();
   if (bLabelContour && !labelList.isEmpty())
   {
+    // one pass over the volume for the bounding boxes of all the labels, then
+    // only the labels without an actor or whose voxels changed are rebuilt
+    std::vector<int> labels(labelList.begin(), labelList.end());
+    std::map<int, vtkLabelContourExtractor::LabelInfo> info = vtkLabelContourExtractor::ScanLabels(imagedata, labels);
+    std::map<int, vtkLabelContourExtractor::LabelInfo> changed;
     foreach (int i, labelList)
     {
-      if (!map.contains(i))
-      {
-        vtkActor* actor = vtkActor::New();
+      if (!map.contains(i) || !infoMap.contains(i) || infoMap[i] != info[i])
+        changed[i] = info[i];
+      infoMap[i] = info[i];
+    }
+
+    bool bVoxelized = m_mri->GetProperty()->GetShowVoxelizedContour();
+    std::map<int, vtkSmartPointer<vtkPolyData> > polys;
+    if (!bVoxelized)
+    {
+      vtkLabelContourExtractor::Options options;
+      options.SmoothIterations = nSmoothFactor;
+      options.AllRegions = bExtractAllRegions;
+      options.Upsample = bUpsampleContour;
+      options.Dilate = m_mri->GetProperty()->GetContourDilateFirst();
+      polys = vtkLabelContourExtractor::BuildContours(imagedata, changed, options);
+    }
+
+    for (std::map<int, vtkLabelContourExtractor::LabelInfo>::iterator it = changed.begin(); it != changed.end(); ++it)
+    {
+      int i = it->first;
+      vtkActor* actor = vtkActor::New();
 #if VTK_MAJOR_VERSION > 5
-        actor->ForceOpaqueOn();
+      actor->ForceOpaqueOn();
 #endif
-        actor->SetMapper( vtkSmartPointer<vtkPolyDataMapper>::New() );
-        actor->GetMapper()->ScalarVisibilityOn();
+      actor->SetMapper( vtkSmartPointer<vtkPolyDataMapper>::New() );
+      actor->GetMapper()->ScalarVisibilityOn();
+      if (bVoxelized)
+      {
         MyVTKUtils::BuildLabelContourActor(imagedata, i, actor, nSmoothFactor, NULL, bExtractAllRegions, bUpsampleContour,
-                                           m_mri->GetProperty()->GetShowVoxelizedContour(), m_mri->GetProperty()->GetContourDilateFirst());
-        map[i] = actor;
+                                           bVoxelized, m_mri->GetProperty()->GetContourDilateFirst());
+      }
+      else
+      {
+        vtkPolyDataMapper* mapper = vtkPolyDataMapper::SafeDownCast(actor->GetMapper());
+#if VTK_MAJOR_VERSION > 5
+        mapper->SetInputData(polys[i]);
+#else
+        mapper->SetInput(polys[i]);
+#endif
       }
+      map[i] = actor;
     }
   }
   else
@@ -100,6 +137,7 @@ void ThreadBuildContour::run()
     actor->Delete();
   }
   m_mri->m_labelActorsTemp = map;
+  m_mri->m_labelContourInfoTemp = infoMap;
 
   emit Finished(m_nThreadID);
 }
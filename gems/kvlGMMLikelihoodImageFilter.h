@@ -59,6 +59,16 @@ protected:
 
   virtual void ThreadedGenerateData(const RegionType & outputRegionForThread, itk::ThreadIdType);
 
+  // Likelihoods of numberOfVoxels voxels that have all contrasts present. intensities holds
+  // the voxels contrast by contrast (blockSize apart); likelihoods is filled class by class
+  template< int NumberOfContrasts >
+  void EvaluateBlock( const double* intensities, int numberOfVoxels, int blockSize,
+                      double* exponents, double* likelihoods ) const;
+
+  // Likelihood of Gaussian gaussianNumber, times its mixture weight, for the nPresent
+  // present contrasts (in pattern index) of a single voxel, minus the means
+  double EvaluateWeightedGaussian( int gaussianNumber, int index, int nPresent, const double* centered ) const;
+
 private:
   GMMLikelihoodImageFilter(const Self &);
   void operator=(const Self &);
@@ -69,6 +79,13 @@ private:
   std::vector< std::vector< double > >  m_OneOverSqrtDetCov;
   std::vector< double >  m_MixtureWeights;
   std::vector< int >  m_NumberOfGaussiansPerClass;
+
+  // For each Gaussian and pattern of present contrasts: the inverse of the lower Cholesky
+  // factor of the covariance, packed row by row (empty if the covariance is not positive
+  // definite), and log( mixtureWeight / sqrt( det( 2 pi cov ) ) )
+  std::vector< std::vector< std::vector< double > > >  m_InverseCholeskyFactors;
+  std::vector< std::vector< double > >  m_LogNormalizers;
+  bool  m_UseBlockKernel;
   
 };
 
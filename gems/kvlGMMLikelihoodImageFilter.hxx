@@ -5,14 +5,82 @@
 #include "itkImageRegionIterator.h"
 #include "itkProgressReporter.h"
 #include "vnl/vnl_inverse.h"
+#include <cmath>
 //#include <iomanip>
 
 namespace kvl
 {
+
+//
+// Computes the inverse M of the lower Cholesky factor L of cov (cov = L L'), packed row by
+// row, so that x' inv(cov) x = | M x |^2. Also returns log( sqrt( det( cov ) ) ). Returns
+// false if cov is not positive definite.
+//
+inline bool
+GMMComputeInverseCholeskyFactor( const vnl_matrix< double >& cov, std::vector< double >& packed, double& logSqrtDet )
+{
+  const int  n = cov.rows();
+  vnl_matrix< double >  L( n, n, 0.0 );
+  logSqrtDet = 0.0;
+  for ( int j = 0; j < n; j++ )
+    {
+    double  d = cov[ j ][ j ];
+    for ( int k = 0; k < j; k++ )
+      {
+      d -= L[ j ][ k ] * L[ j ][ k ];
+      }
+    if ( !( d > 0 ) )
+      {
+      packed.clear();
+      return false;
+      }
+    L[ j ][ j ] = sqrt( d );
+    logSqrtDet += log( L[ j ][ j ] );
+    for ( int i = j + 1; i < n; i++ )
+      {
+      double  v = cov[ i ][ j ];
+      for ( int k = 0; k < j; k++ )
+        {
+        v -= L[ i ][ k ] * L[ j ][ k ];
+        }
+      L[ i ][ j ] = v / L[ j ][ j ];
+      }
+    }
+
+  // Forward substitution, column by column of the identity
+  vnl_matrix< double >  M( n, n, 0.0 );
+  for ( int j = 0; j < n; j++ )
+    {
+    M[ j ][ j ] = 1.0 / L[ j ][ j ];
+    for ( int i = j + 1; i < n; i++ )
+      {
+      double  v = 0.0;
+      for ( int k = j; k < i; k++ )
+        {
+        v -= L[ i ][ k ] * M[ k ][ j ];
+        }
+      M[ i ][ j ] = v / L[ i ][ i ];
+      }
+    }
+
+  packed.resize( n * ( n + 1 ) / 2 );
+  int  p = 0;
+  for ( int i = 0; i < n; i++ )
+    {
+    for ( int j = 0; j <= i; j++ )
+      {
+      packed[ p++ ] = M[ i ][ j ];
+      }
+    }
+  return true;
+}
+
+
 //----------------------------------------------------------------------------
 template< typename TInputImage >
 GMMLikelihoodImageFilter< TInputImage >
 ::GMMLikelihoodImageFilter()
+  : m_UseBlockKernel( false )
 {
 #if ITK_VERSION_MAJOR >= 5
   // use classic void ThreadedGenerateData( const OutputRegionType& threadRegion, ThreadIdType threadId )
@@ -78,6 +146,8 @@ GMMLikelihoodImageFilter< TInputImage >
   // we precompute (and store) everything that's need to efficiently evaluate the GMM likelihood in
   // such cases
   m_Precisions.resize( numberOfGaussians ); 
+  m_InverseCholeskyFactors.resize( numberOfGaussians );
+  m_LogNormalizers.resize( numberOfGaussians );
 
   // We are going to compute 1/sqrt(det(COV)) for all possible covariances given all possible combinations of available channels
   // We use a binary representation for this. For instance, 6 = [1 1 0] means that we have channel 1 not available, but channels 2 and 3 available.
@@ -89,6 +159,8 @@ GMMLikelihoodImageFilter< TInputImage >
     vnl_matrix<double>  FullCov = variances[ gaussianNumber ];
     m_OneOverSqrtDetCov[gaussianNumber].resize(nCombos);
     m_Precisions[gaussianNumber].resize(nCombos);
+    m_InverseCholeskyFactors[gaussianNumber].assign(nCombos, std::vector<double>());
+    m_LogNormalizers[gaussianNumber].assign(nCombos, 0.0);
     m_OneOverSqrtDetCov[gaussianNumber][0]=0;
     for(int n=1; n<nCombos; n++) 
       {
@@ -127,9 +199,27 @@ GMMLikelihoodImageFilter< TInputImage >
       
       m_Precisions[gaussianNumber][n]=vnl_inverse<double>(PartialCov);
       m_OneOverSqrtDetCov[gaussianNumber][n]=1.0/sqrt(vnl_determinant(PartialCov));
+
+      // Factorised form: w * N(x) = exp( log(w) - n/2 log(2 pi) - log(sqrt(det)) - |M x|^2 / 2 )
+      double logSqrtDet = 0.0;
+      if(GMMComputeInverseCholeskyFactor(PartialCov, m_InverseCholeskyFactors[gaussianNumber][n], logSqrtDet))
+        {
+        m_LogNormalizers[gaussianNumber][n] = log(m_MixtureWeights[gaussianNumber])
+                                              - 0.5 * nPresent * log(2 * itk::Math::pi) - logSqrtDet;
+        }
       }
     }  
 
+  // The blocked kernel handles the common case of 1-4 contrasts that are all present
+  m_UseBlockKernel = ( numberOfContrasts <= 4 );
+  for ( int gaussianNumber = 0; gaussianNumber < numberOfGaussians; gaussianNumber++ )
+    {
+    if ( m_InverseCholeskyFactors[ gaussianNumber ][ nCombos - 1 ].empty() )
+      {
+      m_UseBlockKernel = false;
+      }
+    }
+
   // We also compute the constant term for number of channels from 0 to numberOfContrasts
   m_piTermMultiv.resize(numberOfContrasts+1);
   for(int i=0; i<=numberOfContrasts; i++) 
@@ -285,32 +375,66 @@ GMMLikelihoodImageFilter< TInputImage >
     inputItContainer.push_back(iit);
     }
 
+  // Voxels with all contrasts present are gathered into blocks, stored contrast by contrast,
+  // and evaluated Gaussian by Gaussian; the others are evaluated one at a time
+  const int  blockSize = 256;
+  const int  allPresent = ( 1 << numberOfContrasts ) - 1;
+  std::vector< double >  blockIntensities;
+  std::vector< double >  blockExponents;
+  std::vector< double >  blockLikelihoods;
+  std::vector< OutputPixelType* >  blockPixels;
+  if ( m_UseBlockKernel )
+    {
+    blockIntensities.resize( numberOfContrasts * blockSize );
+    blockExponents.resize( blockSize );
+    blockLikelihoods.resize( numberOfClasses * blockSize );
+    blockPixels.reserve( blockSize );
+    }
+  std::vector< double >  intensity( numberOfContrasts );
+  std::vector< double >  centered( numberOfContrasts );
+
+  // Evaluates the queued voxels and writes their likelihoods
+  auto  evaluateBlock = [ & ]()
+    {
+    const int  numberOfVoxels = blockPixels.size();
+    switch ( numberOfContrasts )
+      {
+      case 1: this->template EvaluateBlock< 1 >( &blockIntensities[ 0 ], numberOfVoxels, blockSize, &blockExponents[ 0 ], &blockLikelihoods[ 0 ] ); break;
+      case 2: this->template EvaluateBlock< 2 >( &blockIntensities[ 0 ], numberOfVoxels, blockSize, &blockExponents[ 0 ], &blockLikelihoods[ 0 ] ); break;
+      case 3: this->template EvaluateBlock< 3 >( &blockIntensities[ 0 ], numberOfVoxels, blockSize, &blockExponents[ 0 ], &blockLikelihoods[ 0 ] ); break;
+      default: this->template EvaluateBlock< 4 >( &blockIntensities[ 0 ], numberOfVoxels, blockSize, &blockExponents[ 0 ], &blockLikelihoods[ 0 ] ); break;
+      }
+    for ( int i = 0; i < numberOfVoxels; i++ )
+      {
+      OutputPixelType pix( numberOfClasses );
+      for ( int classNumber = 0; classNumber < numberOfClasses; classNumber++ )
+        {
+        pix[ classNumber ] = blockLikelihoods[ classNumber * blockSize + i ];
+        }
+      *blockPixels[ i ] = pix;
+      }
+    blockPixels.clear();
+    };
+
   // Now loop over all pixels
   while ( !oit.IsAtEnd() )
     {
     // Retrieve the input intensity. At the same time, detect the number and pattern of
     // zeroes (interpreted as missing intensities) in the various input channels
-    std::vector< bool >  isThere( numberOfContrasts );
     int nPresent=0;
     int index=0;
     int aux=1;
-    vnl_vector< InputPixelType > aux_v( numberOfContrasts, 0.0 );
     for ( int contrastNumber = 0; contrastNumber < numberOfContrasts; contrastNumber++ )
       {
       const InputPixelType p = inputItContainer[ contrastNumber ].Get();
       ++( inputItContainer[ contrastNumber ] );
 
+      intensity[ contrastNumber ] = p;
       if( p != 0 )
         {
-        isThere[ contrastNumber ] = true;
-        aux_v[ nPresent ] = p;
         nPresent++;
         index += aux;
         }
-      else
-        {
-        isThere[ contrastNumber ] = false;
-        }
       aux = aux << 1;
       } // End loop over all contrasts
       
@@ -326,71 +450,164 @@ GMMLikelihoodImageFilter< TInputImage >
       continue;
       }
 
-      
-    // Move on with what we actually have
-    OutputPixelType pix( numberOfClasses );
-    vnl_vector< InputPixelType >  intensity_v = aux_v.extract( nPresent ); 
-    int  shift = 0;
-    for ( int classNumber = 0; classNumber < numberOfClasses; classNumber++ )
+    if ( m_UseBlockKernel && index == allPresent )
       {
-      // Evaluate the Gaussian mixture model likelihood of this class at the intensity of this pixel
-      double  likelihood = 0.0;
-      const int  numberOfComponents = m_NumberOfGaussiansPerClass[ classNumber ];
-      for ( int componentNumber = 0; componentNumber < numberOfComponents; componentNumber++ )
+      // Queue the voxel; the block is evaluated once it is full
+      const int  i = blockPixels.size();
+      for ( int contrastNumber = 0; contrastNumber < numberOfContrasts; contrastNumber++ )
         {
-        const int  gaussianNumber = shift + componentNumber;
-        double  gauss = 0.0;
-        if ( numberOfContrasts == 1 )
-          {
-          gauss = exp( -0.5 * m_Precisions[ gaussianNumber ][1][0][0] * pow( intensity_v[ 0 ] - m_Means[ gaussianNumber ][0] , 2 )) / 
-                                      sqrt(  2 * itk::Math::pi / m_Precisions[ gaussianNumber ][1][0][0] );
-          }
-        else
+        blockIntensities[ contrastNumber * blockSize + i ] = intensity[ contrastNumber ];
+        }
+      blockPixels.push_back( &oit.Value() );
+      }
+    else
+      {
+      // Move on with what we actually have
+      OutputPixelType pix( numberOfClasses );
+      int  shift = 0;
+      for ( int classNumber = 0; classNumber < numberOfClasses; classNumber++ )
+        {
+        // Evaluate the Gaussian mixture model likelihood of this class at the intensity of this pixel
+        double  likelihood = 0.0;
+        const int  numberOfComponents = m_NumberOfGaussiansPerClass[ classNumber ];
+        for ( int componentNumber = 0; componentNumber < numberOfComponents; componentNumber++ )
           {
-          
-          vnl_vector<double>  dataV(intensity_v.size());
+          const int  gaussianNumber = shift + componentNumber;
           int c=0;
           for( int contrastNumber=0; contrastNumber < numberOfContrasts; contrastNumber++)
             {
-            if( isThere[ contrastNumber ] )
+            if( intensity[ contrastNumber ] != 0 )
               {
-              dataV[c]=intensity_v[c]-m_Means[ gaussianNumber ][ contrastNumber ];
+              centered[c]=intensity[ contrastNumber ]-m_Means[ gaussianNumber ][ contrastNumber ];
               c++;
               }
             }
-
-          gauss= exp( -0.5 * dot_product(dataV,m_Precisions[ gaussianNumber ][index]*dataV)) * m_OneOverSqrtDetCov[ gaussianNumber ][index] * m_piTermMultiv[nPresent];
-
-          } // End test number of contrasts
+          likelihood += this->EvaluateWeightedGaussian( gaussianNumber, index, nPresent, &centered[ 0 ] );
+          } // End loop over components in mixture model for the current class
      
         //
-        const double  mixtureWeight = m_MixtureWeights[ gaussianNumber ];
-        likelihood += gauss * mixtureWeight;
-     
-        } // End loop over components in mixture model for the current class
-     
-     
-      //
-      pix[ classNumber ] = likelihood;
-      shift += numberOfComponents;
-
-#if 0
-      {
-      const double d = likelihood;
-      uint64_t u;
-      memcpy(&u, &d, sizeof(d));
-      std::cout << std::hex << u << std::endl;
-      }
-#endif      
-      
-      } // End loop over classes  
+        pix[ classNumber ] = likelihood;
+        shift += numberOfComponents;
+        } // End loop over classes  
           
-    // Fill in the output pixel and move on
-    //std::cout << "pix: " << pix << std::endl;
-    oit.Value() = pix;
+      // Fill in the output pixel
+      //std::cout << "pix: " << pix << std::endl;
+      oit.Value() = pix;
+      }
+
     ++oit;
     progress.CompletedPixel();
+
+    // Evaluate the queued voxels when the block is full
+    if ( (int)blockPixels.size() == blockSize )
+      {
+      evaluateBlock();
+      }
     } // End loop over all pixels
+
+  // and whatever is left queued at the end of the region
+  if ( !blockPixels.empty() )
+    {
+    evaluateBlock();
+    }
+}
+
+
+//----------------------------------------------------------------------------
+template< typename TInputImage >
+double
+GMMLikelihoodImageFilter< TInputImage >
+::EvaluateWeightedGaussian( int gaussianNumber, int index, int nPresent, const double* centered ) const
+{
+  const std::vector< double >&  factor = m_InverseCholeskyFactors[ gaussianNumber ][ index ];
+  if ( factor.empty() )
+    {
+    // Covariance is not positive definite; keep the behaviour of the plain formula
+    vnl_vector< double >  dataV( centered, nPresent );
+    const double  gauss = exp( -0.5 * dot_product( dataV, m_Precisions[ gaussianNumber ][ index ] * dataV ) ) 
+                          * m_OneOverSqrtDetCov[ gaussianNumber ][ index ] * m_piTermMultiv[ nPresent ];
+    return gauss * m_MixtureWeights[ gaussianNumber ];
+    }
+
+  double  mahalanobis = 0.0;
+  int  k = 0;
+  for ( int r = 0; r < nPresent; r++ )
+    {
+    double  s = 0.0;
+    for ( int c = 0; c <= r; c++ )
+      {
+      s += factor[ k++ ] * centered[ c ];
+      }
+    mahalanobis += s * s;
+    }
+  return exp( m_LogNormalizers[ gaussianNumber ][ index ] - 0.5 * mahalanobis );
+}
+
+
+//----------------------------------------------------------------------------
+template< typename TInputImage >
+template< int NumberOfContrasts >
+void
+GMMLikelihoodImageFilter< TInputImage >
+::EvaluateBlock( const double* intensities, int numberOfVoxels, int blockSize,
+                 double* exponents, double* likelihoods ) const
+{
+  const int  numberOfClasses = m_NumberOfGaussiansPerClass.size();
+  const int  allPresent = ( 1 << NumberOfContrasts ) - 1;
+  const int  numberOfFactors = NumberOfContrasts * ( NumberOfContrasts + 1 ) / 2;
+
+  int  gaussianNumber = 0;
+  for ( int classNumber = 0; classNumber < numberOfClasses; classNumber++ )
+    {
+    double*  likelihood = likelihoods + classNumber * blockSize;
+    for ( int i = 0; i < numberOfVoxels; i++ )
+      {
+      likelihood[ i ] = 0.0;
+      }
+
+    for ( int componentNumber = 0; componentNumber < m_NumberOfGaussiansPerClass[ classNumber ]; 
+          componentNumber++, gaussianNumber++ )
+      {
+      // Hoist the parameters of this Gaussian so the voxel loops below have no indirection
+      double  mean[ NumberOfContrasts ];
+      double  factor[ numberOfFactors ];
+      for ( int c = 0; c < NumberOfContrasts; c++ )
+        {
+        mean[ c ] = m_Means[ gaussianNumber ][ c ];
+        }
+      for ( int k = 0; k < numberOfFactors; k++ )
+        {
+        factor[ k ] = m_InverseCholeskyFactors[ gaussianNumber ][ allPresent ][ k ];
+        }
+      const double  logNormalizer = m_LogNormalizers[ gaussianNumber ][ allPresent ];
+
+      // Unit stride over voxels, with the contrast loops unrolled at compile time
+      for ( int i = 0; i < numberOfVoxels; i++ )
+        {
+        double  centered[ NumberOfContrasts ];
+        for ( int c = 0; c < NumberOfContrasts; c++ )
+          {
+          centered[ c ] = intensities[ c * blockSize + i ] - mean[ c ];
+          }
+        double  mahalanobis = 0.0;
+        int  k = 0;
+        for ( int r = 0; r < NumberOfContrasts; r++ )
+          {
+          double  s = 0.0;
+          for ( int c = 0; c <= r; c++ )
+            {
+            s += factor[ k++ ] * centered[ c ];
+            }
+          mahalanobis += s * s;
+          }
+        exponents[ i ] = logNormalizer - 0.5 * mahalanobis;
+        }
+      for ( int i = 0; i < numberOfVoxels; i++ )
+        {
+        likelihood[ i ] += exp( exponents[ i ] );
+        }
+      } // End loop over components in mixture model for the current class
+    } // End loop over classes
 }
 
 } // end namespace kvl
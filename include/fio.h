@@ -49,6 +49,12 @@ int   fwrite2(int v, FILE *fp) ;
 int   fwrite3(int v, FILE *fp) ;
 int   fwrite4(int v, FILE *fp) ;
 
+/* whole arrays of big-endian values; return the number of elements transferred */
+size_t freadFloatArray(float *v, size_t n, FILE *fp) ;
+size_t freadIntArray(int *v, size_t n, FILE *fp) ;
+size_t fwriteFloatArray(const float *v, size_t n, FILE *fp) ;
+size_t fwriteIntArray(const int *v, size_t n, FILE *fp) ;
+
 /* znzlib support routines */
 int   znzread1(int *v, znzFile fp) ;
 int   znzread2(int *v, znzFile fp) ;
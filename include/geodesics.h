@@ -15,8 +15,28 @@ typedef struct {
   float dist[MAX_GEODESICS];  // distances to vertices
 } Geodesics;
 
+// compact (CSR) geodesic neighbourhoods: the neighbours of vertex k are
+// v[offset[k]] .. v[offset[k+1]-1], sorted by vertex number, with the
+// matching distances in dist[]
+typedef struct {
+  int nvertices;
+  long nnbrs;       // total number of neighbours
+  long *offset;     // nvertices+1
+  int *v;           // nnbrs neighbour vertex numbers
+  float *dist;      // nnbrs distances
+  void *mmap_base;  // non-NULL if the arrays point into a mapped file
+  size_t mmap_len;
+} GeodesicsCSR;
+
 // computes and returns the nearest geodesics for every vertex in the surface:
 Geodesics* computeGeodesics(MRIS* surf, float maxdist);
+GeodesicsCSR* computeGeodesicsCSR(MRIS* surf, float maxdist);
+void geodesicsCSRfree(GeodesicsCSR** pgeo);
+float geodesicsCSRdist(GeodesicsCSR* geo, int vno1, int vno2);
+Geodesics* geodesicsCSRtoGeodesics(GeodesicsCSR* csr);
+GeodesicsCSR* geodesicsCSRfromGeodesics(Geodesics* geo, int nvertices);
+int geodesicsCSRwrite(GeodesicsCSR* geo, const char* fname);
+GeodesicsCSR* geodesicsCSRread(const char* fname, int use_mmap);
 
 // save/load geodesics:
 void geodesicsWrite(Geodesics* geo, int nvertices, char* fname);
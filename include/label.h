@@ -45,6 +45,8 @@ struct LABEL_VERTEX
   float         stat ;     /* statistic (might not be used) */
 };
 
+struct LABEL_VNO_INDEX ;  // private to label.cpp
+
 struct LABEL
 {
   int    max_points ;         /* # of points allocated */
@@ -62,6 +64,7 @@ struct LABEL
   MRI    *mri_template ;
   MHT    *mht ;
   MRIS   *mris ; 
+  LABEL_VNO_INDEX *vno_index ;  // built on demand by the vertex lookups, NULL until then
 };
 
 #define LABEL_COORDS_NONE         FS_COORDS_UNKNOWN
@@ -88,6 +91,8 @@ LABEL   *LabelRead(const char *subject_name,const char *label_name) ;
 LABEL   *LabelReadFrom(const char *subject_name, FILE *fp) ;
 int     LabelWriteInto(LABEL *area, FILE *fp) ;
 int     LabelWrite(LABEL *area,const char *fname) ;
+int     LabelWriteBinaryInto(LABEL *area, FILE *fp) ;
+void    LabelInvalidateVertexIndex(LABEL *area) ;
 int     LabelToCurrent(LABEL *area, MRI_SURFACE *mris) ;
 int     LabelToCanonical(LABEL *area, MRI_SURFACE *mris) ;
 int     LabelThreshold(LABEL *area, float thresh) ;
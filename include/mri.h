@@ -414,6 +414,8 @@ typedef VOL_GEOM VG;
 #define MGZ_INTENT_WARPMAP      3
 #define MGZ_INTENT_WARPMAP_INV  4
 
+struct MRI_BRICK_STORE;  // sparse image storage, see MRIallocSparse()
+
 class MRI : public VOL_GEOM
 {
 public:
@@ -434,7 +436,7 @@ public:
   };
 
   MRI(const VOL_GEOM& vg, int dtype, int nframes=1, int HeaderOnly=1);
-  MRI(const Shape volshape, int dtype, bool alloc = true);
+  MRI(const Shape volshape, int dtype, bool alloc = true, bool zero = true);
   //MRI(const std::string& filename);
   ~MRI();
 
@@ -557,8 +559,12 @@ public:
   size_t vox_total = 0;         // total number of voxels in the volume
   int ischunked;                // indicates whether the buffer is chunked (contiguous)
   bool owndata = true;          // indicates ownership of the chunked buffer data
+  size_t pool_bytes = 0;        // nonzero if chunk and slices came from the MRI buffer pool (FS_MRI_POOL)
+  int pool_nslices = 0;         // shape of the slice table at the time it was pooled
+  int pool_height = 0;
   BUFTYPE ***slices = nullptr;  // fallback non-contiguous storage for 3D-indexed image data
   void *chunk = nullptr;        // default contiguous storage for image data
+  MRI_BRICK_STORE *bricks = nullptr;  // sparse storage (MRIallocSparse), slices and chunk are NULL then
 };
 
 
@@ -627,6 +633,38 @@ double MRIptr2dbl(void *pmric, int mritype);
 
 size_t MRIsizeof(int mritype);
 
+/*
+  Sparse traversal of mostly-empty volumes (labels, masks). The volume is cut
+  into MRI_BRICK_SIZE^3 bricks and MRInonzeroBricks lists the ones with a
+  nonzero voxel in the frame, so loops over the foreground can skip the
+  background. A newly allocated (zeroed) volume that is only written where it
+  is nonzero never touches the pages of its empty rows, and those pages use no
+  memory; mghRead, MRIcopy and MRIbinarize fill volumes that way.
+
+  MRIallocSparse creates a volume stored as bricks instead of one buffer. Every
+  brick starts out as a shared all-zero brick and gets its own memory on the
+  first nonzero write. MRIcopy of a sparse volume shares the bricks, which are
+  copied when either volume writes to them. Sparse volumes are accessed through
+  MRIgetVoxVal/MRIsetVoxVal, MRIsparseGetRow/MRIsparseSetRow and
+  MRInonzeroBricks; they have no slices, so MRIvox and the other *_vox macros
+  cannot be used on them. MRIcopy converts between the two storages, and
+  mghRead(fname, TRUE, -1, true) reads an mgh/mgz file into a sparse volume.
+  Several threads may write one sparse volume at once; two volumes sharing
+  bricks must not be written at the same time.
+*/
+#define MRI_BRICK_SIZE 16
+struct MRI_BRICK
+{
+  int x0, y0, z0;  // first voxel
+  int x1, y1, z1;  // one past the last voxel
+};
+std::vector<MRI_BRICK> MRInonzeroBricks(const MRI *mri, int frame);
+bool MRIbufferIsZero(const void *buf, size_t nbytes);
+MRI *MRIallocSparse(int width, int height, int depth, int type, int nframes);
+void MRIsparseGetRow(const MRI *mri, int y, int z, int frame, void *row);
+void MRIsparseSetRow(MRI *mri, int y, int z, int frame, const void *row);
+size_t MRIsparseBytes(const MRI *mri);
+
 const char * MRIprecisionString(int PrecisionCode);
 int MRIprecisionCode(const char *PrecisionString);
 
@@ -1757,7 +1795,7 @@ MATRIX *MRIgetVoxelToVoxelXform(MRI *mri_src, MRI *mri_dst) ;
 MATRIX *GetSurfaceRASToVoxelMatrix(VOL_GEOM *mri);
 
 // functions read/write MRI_MGH_FILE
-MRI *mghRead(const char *fname, int read_volume=TRUE, int frame=-1);
+MRI *mghRead(const char *fname, int read_volume=TRUE, int frame=-1, bool sparse=false);
 int mghWrite(MRI *mri, const char *fname, int frame=-1);
 
 /* Zero-padding for 3d analyze (ie, spm) format */
@@ -0,0 +1,52 @@
+/**
+ * @brief exact separable euclidean distance transform of label volumes
+ *
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRI_EDT_H
+#define MRI_EDT_H
+
+#include "mri.h"
+
+/*
+  Exact euclidean distance transform using the lower envelope of parabolas
+  (Felzenszwalb & Huttenlocher), applied separably along x, y and z. Each
+  axis pass is parallel over the lines of the volume, so the result does not
+  depend on the number of threads.
+
+  mode is one of the DTRANS_MODE_* constants in mri.h. As in the fast
+  marching code, the zero level sits on the label boundary, so the voxels on
+  either side of it are +/- half a voxel away. Values are clipped to
+  +/- max_dist (max_dist <= 0 means no clipping).
+
+  If in_mm is set the distances (and max_dist) are in mm using the voxel
+  sizes of mri_src. Otherwise they are in units of the x voxel size, which
+  for isotropic volumes is the voxel units returned by MRIextractDistanceMap.
+*/
+MRI *MRIexactDistanceTransform(MRI *mri_src, MRI *mri_dst, int label, float max_dist, int mode, int in_mm);
+
+/*
+  Squared euclidean distance transform of a contiguous float array in place
+  (x fastest). On input, feature voxels must be 0 and all others
+  MRI_EDT_INFINITY. spacing[] gives the voxel size along each axis.
+*/
+#define MRI_EDT_INFINITY 1e20f
+int MRIcomputeSquaredEDT(float *f, int width, int height, int depth, const double spacing[3]);
+
+// returns 1 if MRIdistanceTransform and MRIextractDistanceMap should use the exact
+// transform instead of fast marching when there is no mask (FS_DTRANS_EXACT set)
+int MRIuseExactDistanceTransform(void);
+
+#endif
@@ -20,6 +20,9 @@ typedef struct {
 volFraction MRIcomputeVoxelFractions(octTreeVoxel V, int vno, double acc, int max_depth, MRI_SURFACE *mris);
 octTreeVoxel octTreeVoxelCreate (double *vox, double *vsize);
 octTreeVoxel octTreeVoxelDivide (int type, octTreeVoxel v);
+/* fraction of each voxel inside the surface: exact when acc <= 0, otherwise
+   from an octree subdivision of the shell voxels with error at most acc */
 MRI* MRIcomputeVolumeFractionFromSurface(MRI_SURFACE*, double, MRI*, MRI*);
+MRI* MRIcomputeVolumeFractionFromSurfaceExact(MRI_SURFACE*, MRI*, MRI*);
 
 #endif
@@ -25,6 +25,12 @@ MHT_VIRTUAL int MHT_FUNCTION(findClosestVertexGeneric)      (MHT_THIS_PARAMETER
                                                                                                    double in_max_distance_mm, int in_max_halfmhts, 
                                                                                                    int *vtxnum,  double *vtx_distance               ) MHT_ABSTRACT;
 
+// findClosestVertexNoXYZ for each of npoints points (xyz holds x,y,z per point), in parallel; vno[n] and
+// min_dist[n] (min_dist may be NULL) are exactly what findClosestVertexNoXYZ would give for point n
+//
+MHT_VIRTUAL void MHT_FUNCTION(findClosestVerticesBatch)     (MHT_THIS_PARAMETER MHT_MRIS_PARAMETER int npoints, float const *xyz, 
+                                                                                                   int *vno, float *min_dist                        ) MHT_ABSTRACT;
+
 // Find closest face
 //
 MHT_VIRTUAL void MHT_FUNCTION(findClosestFaceNoGeneric)(MHT_THIS_PARAMETER MHT_MRIS_PARAMETER 
@@ -979,6 +979,10 @@ double       MRISPfunctionValTraceable(MRI_SURFACE_PARAMETERIZATION *mrisp,
 double       MRISPfunctionVal(MRI_SURFACE_PARAMETERIZATION *mrisp,
                               float desired_radius,
                               float x, float y, float z, int fno) ;
+void         MRISPfunctionVals(MRI_SURFACE_PARAMETERIZATION *mrisp,
+                              float desired_radius, int npoints,
+                              const float *x, const float *y, const float *z,
+                              int fno, double *vals) ;
                               
 MRI_SP       *MRIStoParameterizationBarycentric(MRI_SURFACE *mris, MRI_SP *mrisp, float scale, int fno) ;
 MRI_SURFACE  *MRISfromParameterizationBarycentric(MRI_SP *mrisp, MRI_SURFACE *mris, int fno) ;
@@ -1507,6 +1511,9 @@ MRI *MRISmakeBoundingVolume(MRIS *mris, double resolution);
 MRI *MRISfillInterior(MRI_SURFACE *mris,
                       double resolution,
                       MRI *mri_interior) ;
+MRI *MRISfillInteriorParity(MRI_SURFACE *mris,
+                            double resolution,
+                            MRI *mri_interior) ;
 int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp);
 MRI   *MRISshell(MRI *mri_src,
                  MRI_SURFACE *mris,
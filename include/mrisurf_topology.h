@@ -49,6 +49,7 @@ void MRIS_VertexNeighbourInfo_load_from_VERTEX (MRIS_VertexNeighbourInfo* info,
 void MRIS_check_vertexNeighbours(MRIS* mris);
 
 void MRIS_setNsizeCur(MRIS *mris, int vno, int nsize);
+void mrisSetVertexNeighborhood(MRIS *mris, int vno, int v2num, int v3num, int const * v);
 
 
 // Vertices and Faces interact via edges
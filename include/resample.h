@@ -20,6 +20,8 @@
 #include "mrisurf.h"
 #include "label.h"
 
+#include <vector>
+
 /* float-to-integer conversions */
 #define FLT2INT_ROUND 0  /* c = (int)rint(x) */
 #define FLT2INT_FLOOR 1  /* c = (int)floor(x) */
@@ -105,6 +107,31 @@ MRI *vol2surf_linear(MRI *SrcVol,
 MRI *MRISapplyRegBCI(MRIS *reg1, MRIS *reg2, MRI *in); // barycentric interp
 MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs,
 		  int ReverseMapFlag, int DoJac, int UseHash);
+
+// The sparse map MRISapplyReg() applies, one row per target vertex (CSR).
+// Each row is the sum of src[col]/den over its entries, divided by rowden.
+// Building it is the expensive part (nearest vertex searches), so it can
+// be saved and reused for every input mapped through the same surfaces.
+typedef struct
+{
+  int nsrc, ntrg;                 // number of source and target vertices
+  int ReverseMapFlag, DoJac;      // options it was built with
+  unsigned long reghash;          // MRISregOperatorHash() of the surfaces it was built from
+  std::vector<int> rowptr;        // ntrg+1
+  std::vector<int> col;           // source vertex of each entry
+  std::vector<float> den;         // source hits with DoJac, else 1
+  std::vector<float> rowden;      // target hits without DoJac, else 1
+} MRIS_REG_OPERATOR;
+
+MRIS_REG_OPERATOR *MRISbuildRegOperator(MRI_SURFACE **SurfReg, int nsurfs,
+                                        int ReverseMapFlag, int DoJac, int UseHash);
+MRI *MRISapplyRegOperator(const MRIS_REG_OPERATOR *op, MRI *SrcSurfVals, MRI *TrgSurfVals);
+int MRISwriteRegOperator(const MRIS_REG_OPERATOR *op, const char *fname);
+MRIS_REG_OPERATOR *MRISreadRegOperator(const char *fname);
+void MRISfreeRegOperator(MRIS_REG_OPERATOR **pop);
+unsigned long MRISregOperatorHash(MRI_SURFACE **SurfReg, int nsurfs);
+MRIS_REG_OPERATOR *MRISreadOrBuildRegOperator(const char *fname, MRI_SURFACE **SurfReg, int nsurfs,
+                                              int ReverseMapFlag, int DoJac, int UseHash);
 MRI *surf2surf_nnfr(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
                     MRI_SURFACE *TrgSurfReg, MRI **SrcHits,
                     MRI **SrcDist, MRI **TrgHits, MRI **TrgDist,
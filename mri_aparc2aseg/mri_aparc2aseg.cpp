@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <vector>
 #include "macros.h"
 #include "mrisurf.h"
 #include "mrisutils.h"
@@ -49,6 +50,7 @@
 #include "cma.h"
 #include "gca.h"
 #include "cmdargs.h"
+#include "timer.h"
 #ifdef _OPENMP
 #include "romp_support.h"
 #endif
@@ -71,6 +73,7 @@ int FindClosestLRWPVertexNo(int c, int r, int s,
                             MHT *lhwhite_hash, MHT *lhpial_hash,
                             MHT *rhwhite_hash, MHT *rhpial_hash);
 int CCSegment(MRI *seg, int segid, int segidunknown);
+static int VoxelNeedsClosestVertex(int c, int r, int s);
 
 int main(int argc, char *argv[]) ;
 
@@ -537,6 +540,49 @@ int main(int argc, char **argv)
     Ggca_x = Gx ; Ggca_y = Gy ; Ggca_z = Gz ; // diagnostics
   }
 
+  // Find the closest surface vertices for all the voxels the loop below will
+  // query, one batch per surface. qstart[c] is the first query of column c.
+  std::vector<int> qstart, qvox, qvno[4];
+  std::vector<float> qxyz, qdist[4];
+  if(UseHash) {
+    MRIS *qsurf[4] = {lhwhite, lhpial, rhwhite, rhpial};
+    MHT  *qhash[4] = {lhwhite_hash, lhpial_hash, rhwhite_hash, rhpial_hash};
+    MATRIX *CRS, *RAS;
+    int r, s, k, nq;
+    Timer timer;
+    CRS = MatrixAlloc(4,1,MATRIX_REAL);
+    CRS->rptr[4][1] = 1;
+    RAS = MatrixAlloc(4,1,MATRIX_REAL);
+    RAS->rptr[4][1] = 1;
+    qstart.resize(ASeg->width+1);
+    for (c=0; c < ASeg->width; c++){
+      qstart[c] = qvox.size();
+      for (r=0; r < ASeg->height; r++){
+        for (s=0; s < ASeg->depth; s++){
+          if(!VoxelNeedsClosestVertex(c,r,s)) continue;
+          CRS->rptr[1][1] = c;
+          CRS->rptr[2][1] = r;
+          CRS->rptr[3][1] = s;
+          RAS = MatrixMultiply(Vox2RAS,CRS,RAS);
+          qvox.push_back(r*ASeg->depth+s);
+          qxyz.push_back(RAS->rptr[1][1]);
+          qxyz.push_back(RAS->rptr[2][1]);
+          qxyz.push_back(RAS->rptr[3][1]);
+        }
+      }
+    }
+    qstart[ASeg->width] = nq = qvox.size();
+    MatrixFree(&CRS);
+    MatrixFree(&RAS);
+    for(k=0; k < 4; k++){
+      if((k < 2 && !DoLH) || (k >= 2 && !DoRH)) continue;
+      qvno[k].resize(nq);
+      qdist[k].resize(nq);
+      MHTfindClosestVerticesBatch(qhash[k],qsurf[k],nq,qxyz.data(),qvno[k].data(),qdist[k].data());
+    }
+    printf("Found closest vertices for %d voxels in %g sec\n",nq,timer.seconds());
+  }
+
   // Go through each voxel in the aseg
   printf("\nLabeling Slice (%d)\n",ASeg->width);
   
@@ -551,6 +597,7 @@ int main(int argc, char **argv)
     float dlhw,drhw,dlhp,drhp,dmin=1e7;
     struct { float x,y,z; } vtx;
     MATRIX *CRS, *RAS;
+    int q = UseHash ? qstart[c] : 0;
 
     printf("%3d ",c);
     if (c%20 ==19) printf("\n");
@@ -661,19 +708,34 @@ int main(int argc, char **argv)
         // Get the index of the closest vertex in the
         // lh.white, lh.pial, rh.white, rh.pial
         if(UseHash) {
-	  if(DoLH){
-	    lhwvtx = MHTfindClosestVertexNoXYZ(lhwhite_hash,lhwhite,vtx.x,vtx.y,vtx.z,&dlhw);
-	    lhpvtx = MHTfindClosestVertexNoXYZ(lhpial_hash, lhpial, vtx.x,vtx.y,vtx.z,&dlhp);
-	  } else {
-	    lhwvtx = -1;
-	    lhpvtx = -1;
+	  if(q < qstart[c+1] && qvox[q] == r*ASeg->depth+s) {
+	    // looked up in the batch above
+	    lhwvtx = lhpvtx = rhwvtx = rhpvtx = -1;
+	    if(DoLH){
+	      lhwvtx = qvno[0][q]; dlhw = qdist[0][q];
+	      lhpvtx = qvno[1][q]; dlhp = qdist[1][q];
+	    }
+	    if(DoRH){
+	      rhwvtx = qvno[2][q]; drhw = qdist[2][q];
+	      rhpvtx = qvno[3][q]; drhp = qdist[3][q];
+	    }
+	    q++;
 	  }
-	  if(DoRH){
-	    rhwvtx = MHTfindClosestVertexNoXYZ(rhwhite_hash,rhwhite,vtx.x,vtx.y,vtx.z,&drhw);
-	    rhpvtx = MHTfindClosestVertexNoXYZ(rhpial_hash, rhpial, vtx.x,vtx.y,vtx.z,&drhp);
-	  } else {
-	    rhwvtx = -1;
-	    rhpvtx = -1;
+	  else {
+	    if(DoLH){
+	      lhwvtx = MHTfindClosestVertexNoXYZ(lhwhite_hash,lhwhite,vtx.x,vtx.y,vtx.z,&dlhw);
+	      lhpvtx = MHTfindClosestVertexNoXYZ(lhpial_hash, lhpial, vtx.x,vtx.y,vtx.z,&dlhp);
+	    } else {
+	      lhwvtx = -1;
+	      lhpvtx = -1;
+	    }
+	    if(DoRH){
+	      rhwvtx = MHTfindClosestVertexNoXYZ(rhwhite_hash,rhwhite,vtx.x,vtx.y,vtx.z,&drhw);
+	      rhpvtx = MHTfindClosestVertexNoXYZ(rhpial_hash, rhpial, vtx.x,vtx.y,vtx.z,&drhp);
+	    } else {
+	      rhwvtx = -1;
+	      rhpvtx = -1;
+	    }
 	  }
           if (lhwvtx < 0 && lhpvtx < 0 && rhwvtx < 0 && rhpvtx < 0) {
             /*
@@ -1736,6 +1798,52 @@ int FindClosestLRWPVertexNo(int c, int r, int s,
   changed. The voxels in the other clusters are set to
   segidunknown.
 */
+/*---------------------------------------------------------------*/
+/* Whether the labeling loop in main() looks up the closest surface
+   vertices for voxel (c,r,s). This must follow the tests the loop
+   makes before its lookup; the loop only changes the voxel it is on,
+   so the answer is the same before the loop as inside it. */
+static int VoxelNeedsClosestVertex(int c, int r, int s)
+{
+  int asegid, IsCortex, IsWM, IsCblumCtx, RibbonVal, lhRibbonVal, rhRibbonVal;
+
+  asegid = MRIgetVoxVal(ASeg,c,r,s,0);
+  if(LHOnly && (asegid == Right_Cerebral_Cortex || asegid == Right_Cerebral_White_Matter)) return(0);
+  if(RHOnly && (asegid ==  Left_Cerebral_Cortex || asegid ==  Left_Cerebral_White_Matter)) return(0);
+  IsCortex = IS_CORTEX(asegid) ;
+  IsWM = (asegid == Left_Cerebral_White_Matter || asegid == Right_Cerebral_White_Matter);
+  IsCblumCtx = (asegid == Left_Cerebellum_Cortex || asegid == Right_Cerebellum_Cortex || asegid == 172);
+  if(IS_HYPO(asegid) && LabelHypoAsWM && MRIgetVoxVal(filled,c,r,s,0)) IsWM = 1;
+
+  if(UseNewRibbon && (IsCortex || IsWM || (asegid==Unknown || asegid == CSF) || IsCblumCtx)) {
+    RibbonVal = MRIgetVoxVal(RibbonSeg,c,r,s,0);
+    if(RibbonVal==Left_Cerebral_White_Matter || RibbonVal==Right_Cerebral_White_Matter) {
+      IsWM = 1;
+      IsCortex = 0;
+    }
+    else if(RibbonVal==Left_Cerebral_Cortex || RibbonVal==Right_Cerebral_Cortex) {
+      IsWM = 0;
+      IsCortex = 1;
+    }
+    if(RibbonVal==Unknown) {
+      IsWM = 0;
+      IsCortex = 0;
+    }
+  }
+
+  if(!IsCortex && !IsWM) return(0);
+  if(IsWM && !LabelWM) return(0);
+
+  if(UseRibbon && IsCortex) {
+    lhRibbonVal = 0;
+    rhRibbonVal = 0;
+    if(DoLH) lhRibbonVal = MRIgetVoxVal(lhRibbon,c,r,s,0);
+    if(DoRH) rhRibbonVal = MRIgetVoxVal(rhRibbon,c,r,s,0);
+    if(lhRibbonVal < 0.5 && rhRibbonVal < 0.5) return(0);
+  }
+  return(1);
+}
+
 int CCSegment(MRI *seg, int segid, int segidunknown)
 {
   MRI_SEGMENTATION *sgmnt;
@@ -102,6 +102,8 @@ typedef struct {
   int DoBF; 
   double BFLim;
   int BFNSamp;
+  int nMultiStart;
+  double MultiStartLim;
   char *outparamfile;
   char *outcostfile;
   double fwhmc, fwhmr, fwhms;
@@ -133,6 +135,9 @@ int WriteDoubleMatrix(const char *fname, const char *fmt, double **M, int rows,
 int PrintDoubleMatrix(FILE *fp, const char *fmt, double **M, int rows, int cols);
 double *SumVectorDoubleMatrix(double **M, int rows, int cols, int dim, double *sumvect, int *nv);
 
+// COREGhist() accumulates a partial histogram for each chunk of ref
+// columns, so the result does not depend on the number of threads
+#define COREG_NCHUNKS 32
 typedef struct {
   MRI *ref, *mov, *refmask, *movmask;
   int seplist[10],nsep,sep,sepmin;
@@ -168,6 +173,11 @@ typedef struct {
   int optschema;
   int debug;
   int seed;
+  // ref sample points at sep, in the order COREGhist() visits them
+  int refsampsep;
+  long refsampchunk[COREG_NCHUNKS+1]; // first point of each chunk
+  double *refsampc, *refsampr, *refsamps; // ref col, row, slice (dithered)
+  unsigned char *refsampbin; // ref histogram bin
 } COREG;
 
 double COREGcost(COREG *coreg);
@@ -178,6 +188,12 @@ int COREGfwhm(MRI *mri, double sep, double fwhm[3]);
 int COREGpreproc(COREG *coreg);
 LTA *LTAcreate(MRI *src, MRI *dst, MATRIX *T, int type);
 int COREGhist(COREG *coreg);
+int COREGrefSamples(COREG *coreg);
+COREG *COREGcopy(COREG *coreg);
+int COREGfreeCopy(COREG **pcoreg);
+int COREGlogCost(COREG *coreg);
+float COREGcostPowellThread(float *pPowel);
+int COREGMinPowellMultiStart(int nstarts, double lim);
 long COREGvolIndex(int ncols, int nrows, int nslices, int c, int r, int s);
 double COREGsamp(unsigned char *f, const double c, const double r, const double s, 
 		  const int ncols, const int nrows, const int nslices);
@@ -221,6 +237,8 @@ int main(int argc, char *argv[]) {
   cmdargs->DoBF = 1;
   cmdargs->BFLim = 30;
   cmdargs->BFNSamp = 30;
+  cmdargs->nMultiStart = 1;
+  cmdargs->MultiStartLim = 2;
   cmdargs->SmoothRef = 0;
   cmdargs->SatPct = 99.99;
   cmdargs->MovOOBFlag = 0;
@@ -495,7 +513,10 @@ int main(int argc, char *argv[]) {
     printf("sep = %d -----------------------------------\n",coreg->sep);
     if(n==0 && cmdargs->DoBF) COREGoptBruteForce(coreg, cmdargs->BFLim, 1, cmdargs->BFNSamp);
     coreg->startmin = 1;
-    COREGMinPowell();
+    if(n==0 && cmdargs->nMultiStart > 1) 
+      COREGMinPowellMultiStart(cmdargs->nMultiStart, cmdargs->MultiStartLim);
+    else
+      COREGMinPowell();
   }
   if(coreg->fplogcost) fclose(coreg->fplogcost);
 
@@ -717,6 +738,16 @@ static int parse_commandline(int argc, char **argv) {
       sscanf(pargv[0],"%d",&cmdargs->BFNSamp);
       nargsused = 1;
     } 
+    else if (!strcasecmp(option, "--multistart")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&cmdargs->nMultiStart);
+      nargsused = 1;
+    } 
+    else if (!strcasecmp(option, "--multistart-lim")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%lf",&cmdargs->MultiStartLim);
+      nargsused = 1;
+    } 
     else if (!strcasecmp(option, "--6")) cmdargs->dof = 6;
     else if (!strcasecmp(option, "--9")) cmdargs->dof = 9;
     else if (!strcasecmp(option, "--12")) cmdargs->dof = 12;
@@ -1048,6 +1079,8 @@ static void print_usage(void) {
   printf("   --no-bf : do not do brute force search\n");
   printf("   --bf-lim lim : constrain brute force search to +/-lim\n");
   printf("   --bf-nsamp nsamples : number of samples in brute force search\n");
+  printf("   --multistart nstarts : run nstarts Powell searches concurrently at the first sep and keep the best\n");
+  printf("   --multistart-lim lim : perturb the trans and rot of each start by up to +/-lim (default %g)\n",cmdargs->MultiStartLim);
   printf("   --no-smooth : do not apply smoothing to either ref or mov\n");
   printf("   --ref-fwhm fwhm : apply smoothing to ref\n");
   printf("   --mov-oob : count mov voxels that are out-of-bounds as 0\n");
@@ -1141,6 +1174,8 @@ static void dump_options(FILE *fp) {
   fprintf(fp,"bf       %d\n",cmdargs->DoBF);
   fprintf(fp,"bflim    %lf\n",cmdargs->BFLim);
   fprintf(fp,"bfnsamp    %d\n",cmdargs->BFNSamp);
+  if(cmdargs->nMultiStart > 1)
+    fprintf(fp,"multistart %d %lf\n",cmdargs->nMultiStart,cmdargs->MultiStartLim);
   fprintf(fp,"SmoothRef %d\n",cmdargs->SmoothRef);
   fprintf(fp,"SatPct    %lf\n",cmdargs->SatPct);
   fprintf(fp,"MovOOB %d\n",cmdargs->MovOOBFlag);
@@ -1196,13 +1231,93 @@ double COREGsamp(unsigned char *f, const double c, const double r, const double
 }
 
 
+/*!
+  \fn int COREGrefSamples(COREG *coreg)
+  \brief Computes the ref sample points at coreg->sep (with the
+  coordinate dither) and their ref histogram bins, stored by chunk in
+  the order COREGhist() visits them. These do not depend on the
+  registration, so they are only recomputed when the sep changes.
+ */
+int COREGrefSamples(COREG *coreg)
+{
+  int const nchunks = COREG_NCHUNKS;
+
+  if(coreg->refsampsep == coreg->sep) return(0);
+
+  free(coreg->refsampc);
+  free(coreg->refsampr);
+  free(coreg->refsamps);
+  free(coreg->refsampbin);
+
+  // Calculate the number of iterations the original loop did
+  int const niters    = (coreg->ref->width  + coreg->sep - 1) / coreg->sep;
+  int const nrows     = (coreg->ref->height + coreg->sep - 1) / coreg->sep;
+  int const nslices   = (coreg->ref->depth  + coreg->sep - 1) / coreg->sep;
+  int const chunkSize = (niters             + nchunks    - 1) / nchunks;
+  long const nsamp = (long)niters*nrows*nslices;
+
+  coreg->refsampc   = (double *)calloc(sizeof(double),nsamp);
+  coreg->refsampr   = (double *)calloc(sizeof(double),nsamp);
+  coreg->refsamps   = (double *)calloc(sizeof(double),nsamp);
+  coreg->refsampbin = (unsigned char *)calloc(sizeof(unsigned char),nsamp);
+  if(!coreg->refsampc || !coreg->refsampr || !coreg->refsamps || !coreg->refsampbin){
+    printf("ERROR: COREGrefSamples(): could not alloc %ld samples\n",nsamp);
+    exit(1);
+  }
+
+  long k = 0;
+  int chunk;
+  for (chunk = 0; chunk < nchunks; chunk++) {
+    coreg->refsampchunk[chunk] = k;
+
+    int const crefBegin = (chunk+0)*chunkSize*coreg->sep;
+    int       crefEnd   = (chunk+1)*chunkSize*coreg->sep;
+    if (crefEnd > coreg->ref->width) crefEnd = coreg->ref->width;
+
+    int cref;
+    for(cref=crefBegin; cref < crefEnd; cref += coreg->sep){
+      int rref,sref;
+      for(rref=0; rref < coreg->ref->height; rref += coreg->sep){
+	for(sref=0; sref < coreg->ref->depth; sref += coreg->sep){
+
+          double dcref = cref, drref = rref, dsref = sref;
+
+	  if(coreg->DoCoordDither){
+	    // dither is uniform(0,1), scale by separation to sample entire vol
+	    dcref += coreg->sep*MRIgetVoxVal(coreg->cdither,cref,rref,sref,0);
+	    drref += coreg->sep*MRIgetVoxVal(coreg->cdither,cref,rref,sref,1);
+	    dsref += coreg->sep*MRIgetVoxVal(coreg->cdither,cref,rref,sref,2);
+	    if(dcref > coreg->ref->width-1)  dcref = coreg->ref->width-1;
+	    if(drref > coreg->ref->height-1) drref = coreg->ref->height-1;
+	    if(dsref > coreg->ref->depth-1)  dsref = coreg->ref->depth-1;
+	  }
+
+	  double vg = COREGsamp(coreg->g, dcref, drref, dsref, coreg->ref->width,coreg->ref->height,coreg->ref->depth);
+
+	  coreg->refsampc[k]   = dcref;
+	  coreg->refsampr[k]   = drref;
+	  coreg->refsamps[k]   = dsref;
+	  coreg->refsampbin[k] = floor(vg+0.5);
+	  k++;
+	}
+      }
+    }
+  }
+  coreg->refsampchunk[nchunks] = k;
+  coreg->refsampsep = coreg->sep;
+
+  return(0);
+}
+
 /*!
   \fn int COREGhist(COREG *coreg)
   \brief Compute joint histogram. Somewhat based on spm_hist2.c
  */
 int COREGhist(COREG *coreg)
 {
-  int const nchunks = 32;
+  int const nchunks = COREG_NCHUNKS;
+
+  COREGrefSamples(coreg);
 
   // Pack vox2voxl matrix into an array for speed
   //
@@ -1233,12 +1348,8 @@ int COREGhist(COREG *coreg)
   
   long nhits = 0;
 
-  // Calculate the number of iterations the original loop did
   // Do in chunks in parallel to get deterministic results independent of the number of threads used
   //
-  int const niters    = (coreg->ref->width + coreg->sep - 1) / coreg->sep;
-  int const chunkSize = (niters            + nchunks    - 1) / nchunks;
-  
   int chunk;
   ROMP_PF_begin
   #ifdef HAVE_OPENMP
@@ -1247,63 +1358,43 @@ int COREGhist(COREG *coreg)
   for (chunk = 0; chunk < nchunks; chunk++) {
     ROMP_PFLB_begin
     
-    int const crefBegin = (chunk+0)*chunkSize*coreg->sep;
-    int       crefEnd   = (chunk+1)*chunkSize*coreg->sep;
-    if (crefEnd > coreg->ref->width) crefEnd = coreg->ref->width;
-    
-    int cref;
-    for(cref=crefBegin; cref < crefEnd; cref += coreg->sep){
-  
-      double * const H = HH[chunk];
-
-      int rref,sref;
-      for(rref=0; rref < coreg->ref->height; rref += coreg->sep){
-	for(sref=0; sref < coreg->ref->depth; sref += coreg->sep){
-
-          double dcref = cref, drref = rref, dsref = sref;
+    double * const H = HH[chunk];
 
-	  if(coreg->DoCoordDither){
-	    // dither is uniform(0,1), scale by separation to sample entire vol
-	    dcref += coreg->sep*MRIgetVoxVal(coreg->cdither,cref,rref,sref,0);
-	    drref += coreg->sep*MRIgetVoxVal(coreg->cdither,cref,rref,sref,1);
-	    dsref += coreg->sep*MRIgetVoxVal(coreg->cdither,cref,rref,sref,2);
-	    if(dcref > coreg->ref->width-1)  dcref = coreg->ref->width-1;
-	    if(drref > coreg->ref->height-1) drref = coreg->ref->height-1;
-	    if(dsref > coreg->ref->depth-1)  dsref = coreg->ref->depth-1;
-	  }
+    long k;
+    for(k = coreg->refsampchunk[chunk]; k < coreg->refsampchunk[chunk+1]; k++){
 
-	  double dcmov  = V2V[0]*dcref + V2V[4]*drref + V2V[ 8]*dsref +  V2V[12];
-	  double drmov  = V2V[1]*dcref + V2V[5]*drref + V2V[ 9]*dsref +  V2V[13];
+      double const dcref = coreg->refsampc[k];
+      double const drref = coreg->refsampr[k];
+      double const dsref = coreg->refsamps[k];
 
-	  int oob = 0;
-	  if(dcmov < 0 || dcmov > coreg->mov->width-1)  oob = 1;
-	  if(drmov < 0 || drmov > coreg->mov->height-1) oob = 1;
+      double dcmov  = V2V[0]*dcref + V2V[4]*drref + V2V[ 8]*dsref +  V2V[12];
+      double drmov  = V2V[1]*dcref + V2V[5]*drref + V2V[ 9]*dsref +  V2V[13];
 
-          double dsmov = 0;
-	  if(coreg->optschema != 2 && coreg->optschema != 4 && coreg->optschema != 5){
-            // not z-only
-	    dsmov  = V2V[2]*dcref + V2V[6]*drref + V2V[10]*dsref +  V2V[14];
-	    if(dsmov < 0 || dsmov > coreg->mov->depth-1)  oob = 1;
-	  }
+      int oob = 0;
+      if(dcmov < 0 || dcmov > coreg->mov->width-1)  oob = 1;
+      if(drmov < 0 || drmov > coreg->mov->height-1) oob = 1;
 
-          double vf;
-	  if(!oob) {
-	    vf = COREGsamp(coreg->f, dcmov, drmov, dsmov, coreg->mov->width,coreg->mov->height,coreg->mov->depth);
-	    nhits ++;
-	  } else {
-	    if(coreg->MovOOBFlag) vf = 0;
-	    else continue;
-	  }
+      double dsmov = 0;
+      if(coreg->optschema != 2 && coreg->optschema != 4 && coreg->optschema != 5){
+        // not z-only
+        dsmov  = V2V[2]*dcref + V2V[6]*drref + V2V[10]*dsref +  V2V[14];
+        if(dsmov < 0 || dsmov > coreg->mov->depth-1)  oob = 1;
+      }
 
+      double vf;
+      if(!oob) {
+        vf = COREGsamp(coreg->f, dcmov, drmov, dsmov, coreg->mov->width,coreg->mov->height,coreg->mov->depth);
+        nhits ++;
+      } else {
+        if(coreg->MovOOBFlag) vf = 0;
+        else continue;
+      }
 
-	  double vg = COREGsamp(coreg->g, dcref, drref, dsref, coreg->ref->width,coreg->ref->height,coreg->ref->depth);
 
-	  int const ivf = floor(vf);
-	  int const ivg = floor(vg+0.5);
-	  H[ivf+ivg*256] += (1-(vf-ivf));
-	  if(ivf<255) H[ivf+1+ivg*256] += (vf-ivf);
-	}
-      }
+      int const ivf = floor(vf);
+      int const ivg = coreg->refsampbin[k];
+      H[ivf+ivg*256] += (1-(vf-ivf));
+      if(ivf<255) H[ivf+1+ivg*256] += (vf-ivf);
     }
     ROMP_PFLB_end
   }
@@ -1810,6 +1901,18 @@ double COREGcost(COREG *coreg)
   free(g1); g1=NULL;
   free(g2); g2=NULL;
 
+  COREGlogCost(coreg);
+
+  return(coreg->cost);
+}
+
+/*!
+  \fn int COREGlogCost(COREG *coreg)
+  \brief Logs the current params and cost and counts the evaluation
+ */
+int COREGlogCost(COREG *coreg)
+{
+  int n;
   if(coreg->fplogcost){
     FILE *fp;
     fp = coreg->fplogcost;
@@ -1819,8 +1922,37 @@ double COREGcost(COREG *coreg)
     fflush(fp);
   }
   coreg->nCostEvaluations++;
+  return(0);
+}
 
-  return(coreg->cost);
+/*!
+  \fn COREG *COREGcopy(COREG *coreg)
+  \brief Copy of coreg for evaluating the cost in a separate thread. The
+  volumes, dither, and ref samples are shared (and must not change while
+  the copy is in use); the matrices and histograms belong to the copy,
+  and it does not log. Free with COREGfreeCopy().
+ */
+COREG *COREGcopy(COREG *coreg)
+{
+  COREG *copy = (COREG *) calloc(sizeof(COREG),1);
+  *copy = *coreg;
+  copy->M   = NULL;
+  copy->V2V = NULL;
+  copy->H0  = NULL;
+  copy->fplogcost = NULL;
+  copy->nCostEvaluations = 0;
+  return(copy);
+}
+
+int COREGfreeCopy(COREG **pcoreg)
+{
+  COREG *copy = *pcoreg;
+  if(copy->M)   MatrixFree(&copy->M);
+  if(copy->V2V) MatrixFree(&copy->V2V);
+  if(copy->H0)  FreeDoubleMatrix(copy->H0,256,256);
+  free(copy);
+  *pcoreg = NULL;
+  return(0);
 }
 
 
@@ -1925,6 +2057,133 @@ int COREGMinPowell()
   return(NO_ERROR) ;
 }
 
+/*--------------------------------------------------------------------------*/
+// The copy of coreg each thread optimizes in COREGMinPowellMultiStart()
+static COREG **coregThread = NULL;
+
+/*!
+  \fn float COREGcostPowellThread(float *pPowel)
+  \brief Powell cost function for COREGMinPowellMultiStart(). Evaluates
+  the cost with the calling thread's copy of coreg and does not print.
+ */
+float COREGcostPowellThread(float *pPowel)
+{
+  int n, tid = 0;
+  #ifdef HAVE_OPENMP
+  tid = omp_get_thread_num();
+  #endif
+  COREG *c = coregThread[tid];
+  for(n=0; n < c->nparams; n++) c->params[n] = pPowel[n+1];
+  return((float)COREGcost(c));
+}
+
+/*!
+  \fn int COREGMinPowellMultiStart(int nstarts, double lim)
+  \brief Runs Powell from nstarts starting points concurrently and keeps
+  the one with the lowest final cost. The first start is the current
+  params; the others add a uniform random offset in +/-lim to the
+  translations and rotations. The offsets come from coreg->seed, and
+  each start is optimized independently, so the result does not depend
+  on the number of threads.
+ */
+int COREGMinPowellMultiStart(int nstarts, double lim)
+{
+  extern COREG *coreg;
+  int n, nthstart, dof, nperturb, nthreads = 1, best;
+  double **pstart, *fcost;
+  int *niters, *nevals;
+  Timer timer;
+
+  timer.reset();
+  dof = coreg->nparams;
+  // only the translations and rotations are perturbed
+  nperturb = 6;
+  if(coreg->optschema == 2 || coreg->optschema == 4 || coreg->optschema == 5) nperturb = 3;
+  if(nperturb > dof) nperturb = dof;
+
+  printf("\n\n---------------------------------\n");
+  printf("Multi-start Powell nstarts = %d, lim = %g, sep = %d\n",nstarts,lim,coreg->sep);
+
+  pstart = (double **) calloc(sizeof(double*),nstarts);
+  fcost  = (double *)  calloc(sizeof(double),nstarts);
+  niters = (int *)     calloc(sizeof(int),nstarts);
+  nevals = (int *)     calloc(sizeof(int),nstarts);
+  setRandomSeed(coreg->seed);
+  for(nthstart=0; nthstart < nstarts; nthstart++){
+    pstart[nthstart] = (double *) calloc(sizeof(double),dof);
+    for(n=0; n < dof; n++) pstart[nthstart][n] = coreg->params[n];
+    if(nthstart == 0) continue;
+    for(n=0; n < nperturb; n++) pstart[nthstart][n] += randomNumber(-lim,lim);
+  }
+
+  // The ref samples are shared by the copies, so compute them here
+  COREGrefSamples(coreg);
+  #ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+  #endif
+  coregThread = (COREG **) calloc(sizeof(COREG*),nthreads);
+
+  ROMP_PF_begin
+  #ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+  #endif
+  for(nthstart=0; nthstart < nstarts; nthstart++){
+    ROMP_PFLB_begin
+    int tid = 0, r, c;
+    #ifdef HAVE_OPENMP
+    tid = omp_get_thread_num();
+    #endif
+    COREG *copy = COREGcopy(coreg);
+    coregThread[tid] = copy;
+    float *pPowel = vector(1, dof);
+    float **xi = matrix(1, dof, 1, dof);
+    for (r = 1 ; r <= dof ; r++) {
+      pPowel[r] = pstart[nthstart][r-1];
+      for (c = 1 ; c <= dof ; c++) xi[r][c] = r == c ? 1 : 0 ;
+    }
+    float fret;
+    OpenPowell2(pPowel, xi, dof, copy->ftol, copy->linmintol, copy->nitersmax,
+		&niters[nthstart], &fret, COREGcostPowellThread);
+    for(r=0; r < dof; r++) pstart[nthstart][r] = pPowel[r+1];
+    for(r=0; r < dof; r++) copy->params[r] = pPowel[r+1];
+    fcost[nthstart] = COREGcost(copy);
+    nevals[nthstart] = copy->nCostEvaluations;
+    coregThread[tid] = NULL;
+    COREGfreeCopy(&copy);
+    free_matrix(xi, 1, dof, 1, dof);
+    free_vector(pPowel, 1, dof);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  free(coregThread); coregThread = NULL;
+
+  best = 0;
+  for(nthstart=0; nthstart < nstarts; nthstart++){
+    printf("#MS# %2d %2d niters=%d ",coreg->sep,nthstart,niters[nthstart]);
+    for(n=0; n < dof; n++) printf("%9.5f ",pstart[nthstart][n]);
+    printf("  %9.7f\n",fcost[nthstart]);
+    if(fcost[nthstart] < fcost[best]) best = nthstart;
+    coreg->nCostEvaluations += nevals[nthstart];
+  }
+  printf("Best start %d\n",best);
+  printf("OptTimeSec %4.1f sec\n",timer.seconds());
+  printf("nEvals %d\n",coreg->nCostEvaluations);
+
+  coreg->niters = niters[best];
+  for(n=0; n < dof; n++) coreg->params[n] = pstart[best][n];
+  COREGcost(coreg);
+  printf("Final cost %20.15lf\n ",coreg->cost);
+  fflush(stdout);
+
+  for(nthstart=0; nthstart < nstarts; nthstart++) free(pstart[nthstart]);
+  free(pstart);
+  free(fcost);
+  free(niters);
+  free(nevals);
+  printf("\n\n---------------------------------\n");
+  return(NO_ERROR) ;
+}
+
 int COREGpreproc(COREG *coreg)
 {
   int n, DoSmooth;
@@ -2082,6 +2341,8 @@ int COREGoptBruteForce(COREG *coreg, double lim0, int niters, int n1d)
   double lim;
   FILE *fp;
   int dof,BakMovOOBFlag;
+  int k,np;
+  double *plist, *costlist;
 
   printf("COREGoptBruteForce() %g %d %d\n",lim0,niters,n1d);
 
@@ -2094,6 +2355,12 @@ int COREGoptBruteForce(COREG *coreg, double lim0, int niters, int n1d)
     printf("Turning on MovOOB for BruteForce Search\n");
   }
 
+  // The ref samples are shared by the copies, so compute them here
+  COREGrefSamples(coreg);
+  // a few extra in case round-off adds a point to the 1d search
+  plist    = (double *) calloc(sizeof(double),n1d+3);
+  costlist = (double *) calloc(sizeof(double),n1d+3);
+
   mincost = 10e10;
   lim = lim0;
   for(iter = 0; iter < niters; iter++){
@@ -2102,12 +2369,33 @@ int COREGoptBruteForce(COREG *coreg, double lim0, int niters, int n1d)
       pmax = coreg->params[nthp] + lim;
       pdelta = (pmax-pmin)/n1d;
 
+      // Evaluate the points along this parameter in parallel, each
+      // with its own copy of coreg, then scan them in order
+      np = 0;
+      for(p=pmin; p<=pmax && np < n1d+3; p+=pdelta) plist[np++] = p;
+      ROMP_PF_begin
+      #ifdef HAVE_OPENMP
+      #pragma omp parallel for if_ROMP(assume_reproducible)
+      #endif
+      for(k=0; k < np; k++){
+	ROMP_PFLB_begin
+	COREG *copy = COREGcopy(coreg);
+	copy->params[nthp] = plist[k];
+	costlist[k] = COREGcost(copy);
+	COREGfreeCopy(&copy);
+	ROMP_PFLB_end
+      }
+      ROMP_PF_end
+
       nth1d = 0;
       popt = coreg->params[nthp];
       newmin = 0;
-      for(p=pmin; p<=pmax; p+=pdelta){
+      for(k=0; k < np; k++){
+	p = plist[k];
 	coreg->params[nthp] = p;
-	curcost = COREGcost(coreg);
+	curcost = costlist[k];
+	coreg->cost = curcost;
+	COREGlogCost(coreg);
 	if(mincost > curcost){
 	  mincost = curcost;
 	  popt = p;
@@ -2136,6 +2424,8 @@ int COREGoptBruteForce(COREG *coreg, double lim0, int niters, int n1d)
 
   if(BakMovOOBFlag == 0) printf("Turning  MovOOB back off after brute force search\n");
   coreg->MovOOBFlag = BakMovOOBFlag;
+  free(plist);
+  free(costlist);
 
   return(0);
 }
@@ -83,6 +83,9 @@ USAGE: ./mri_glmfit
 
    --sim nulltype nsim thresh csdbasename : simulation perm, mc-full, mc-z
    --sim-sign signstring : abs, pos, or neg. Default is abs.
+   --sim-threads N : run N simulation iterations at a time (default 1)
+   --sim-checkpoint N : rewrite the CSD files every N iterations (default 1)
+   --sim-resume : continue an interrupted simulation from its CSD files
    --uniform min max : use uniform distribution instead of gaussian
 
    --pca : perform pca/svd analysis on residual
@@ -475,9 +478,13 @@ csdbasename - base name of the file to store the CSD data in. Each
 
 Multiple simulations can be run in parallel by specifying different
 csdbasenames. Then pass the multiple CSD files to mri_surfcluster
-and mri_volcluster. The Full CSD file is written on each iteration,
-which means that the CSD file will be valid if the simulation
-is aborted or crashes.
+and mri_volcluster. The Full CSD file is written on each iteration
+(or every N iterations with --sim-checkpoint), which means that the
+CSD file will be valid if the simulation is aborted or crashes. Run
+the same command with --sim-resume to continue from where it stopped.
+Each iteration draws its noise or permutation from its own random
+stream (derived from the seed and the iteration number), so the
+result does not depend on --sim-threads or on resuming.
 
 In the cases where the design matrix is a single columns of ones
 (ie, one-sample group mean), it makes no sense to permute the
@@ -552,6 +559,9 @@ double round(double x);
 #include "image.h"
 #include "stats.h"
 #include "evschutils.h"
+#include "romp_support.h"
+
+#include <vector>
 
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag);
 int RandPermMatrixAndPVR(MATRIX *X, MRI **pvrs, int npvrs);
@@ -565,6 +575,20 @@ static void print_version(void) ;
 static void dump_options(FILE *fp);
 static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel);
 
+// Per-thread state for the simulation iterations
+typedef struct {
+  MRIGLM *mriglm;    // private copy of the GLM (shares the inputs)
+  RFS *rfs;          // mc-z and mc-t
+  MRI *z, *zabs, *sig;
+  MRI *ar1, *fwhmmap; // perm with non-stationary correction
+} GLMSIM_WORKER;
+static GLMSIM_WORKER *SimWorkerAlloc(void);
+static int SimIteration(GLMSIM_WORKER *w, int nthsim);
+static long SimIterationSeed(long seed, int nthsim);
+static char *SimCSDFileName(CSD *csd, int n, char *fname);
+static int SimWriteCSDs(int nreps);
+static int SimResumeCSDs(void);
+
 int main(int argc, char *argv[]) ;
 
 const char *Progname = "mri_glmfit";
@@ -658,7 +682,7 @@ SURFCLUSTERSUM *SurfClustList;
 int nClusters;
 char *subject=NULL, *hemi=NULL, *simbase=NULL;
 MRI_SURFACE *surf=NULL;
-int nsim,nthsim;
+int nsim;
 double csize;
 MRI *fwhmmap = NULL;
 
@@ -721,6 +745,10 @@ STAT_TABLE *StatTable=NULL, *OutStatTable=NULL, *GammaStatTable=NULL;
 int  UseCortexLabel = 1;
 
 char *SimDoneFile = NULL;
+int nSimThreads = 1;
+int SimResume = 0;
+int SimCheckpoint = 1;
+int nSimStart = 0;
 int tSimSign = 0;
 int FWHMSet = 0;
 int DoKurtosis = 0;
@@ -779,8 +807,7 @@ int main(int argc, char **argv) {
   MATRIX *wvect=NULL, *Mtmp=NULL, *Xselfreg=NULL, *Ex=NULL, *XgNew=NULL;
   MATRIX *Ct, *CCt;
   FILE *fp;
-  double Ccond, dtmp, threshadj, eff;
-  const char *tmpstr2=NULL;
+  double Ccond, dtmp, eff;
 
   setenv("FS_MRIMASK_ALLOW_DIFF_GEOM","0",1);
   eresfwhm = -1;
@@ -1718,16 +1745,11 @@ int main(int argc, char **argv) {
       rfs->name = strcpyalloc("gaussian");
       rfs->params[0] = 0;
       rfs->params[1] = 1;
-      //z = MRIalloc(mriglm->y->width,mriglm->y->height,mriglm->y->depth,MRI_FLOAT);
-      z = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-      zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
     }
     if (!strcmp(csd->simtype,"mc-t")) {
       rfs = RFspecInit(SynthSeed,NULL);
       rfs->name = strcpyalloc("t");
       rfs->params[0] = mriglm->glm->dof;
-      z = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-      zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
     }
     printf("thresh = %g, threshadj = %g \n",csd->thresh,csd->thresh-log10(2.0));
 
@@ -1746,223 +1768,55 @@ int main(int argc, char **argv) {
 	    csdList[nthThresh][nthSign][n] = CSDcopy(csd,NULL);
 	    csdList[nthThresh][nthSign][n]->thresh = ThreshList[nthThresh];
 	    csdList[nthThresh][nthSign][n]->threshsign = SignList[nthSign];
+	    // Change sign to abs for F-tests
+	    if(mriglm->glm->C[n]->rows > 1) csdList[nthThresh][nthSign][n]->threshsign = 0;
 	    csdList[nthThresh][nthSign][n]->seed = csd->seed;
+	    strcpy(csdList[nthThresh][nthSign][n]->contrast,mriglm->glm->Cname[n]);
 	  }
 	}
       }
     }
 
-    printf("\n\nStarting simulation sim over %d trials\n",nsim);
-    mytimer.reset() ;
-    for (nthsim=0; nthsim < nsim; nthsim++) {
-      msecFitTime = mytimer.milliseconds();
-      if(debug) printf("%d/%d t=%g ---------------------------------\n",
-             nthsim+1,nsim,msecFitTime/(1000*60.0));
+    nSimStart = 0;
+    if(SimResume) nSimStart = SimResumeCSDs();
 
-      if (!strcmp(csd->simtype,"mc-full")) {
-	if(! UseUniform)
-	  MRIrandn(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		   mriglm->y->nframes,0,1,mriglm->y);
-	else
-	  MRIdrand48(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		  mriglm->y->nframes,UniformMin,UniformMax,mriglm->y);
-        if(logflag) MRIlog(mriglm->y,mriglm->mask,-1,1,mriglm->y);
-        if(FWHM > 0)
-          SmoothSurfOrVol(surf, mriglm->y, mriglm->mask, SmoothLevel);
-      }
-      if (!strcmp(csd->simtype,"perm")) {
-        if (!OneSamplePerm) RandPermMatrixAndPVR(mriglm->Xg,mriglm->pvr,mriglm->npvr);
-        else {
-          for (n=0; n < mriglm->y->nframes; n++) {
-            if (drand48() > 0.5) m = +1;
-            else                 m = -1;
-            mriglm->Xg->rptr[n+1][1] = m;
-          }
-          //MatrixPrint(stdout,mriglm->Xg);
-        }
-      }
+    // Iterations are independent, so they can be run in any order. A
+    // checkpoint only ever covers the iterations before the first one
+    // that has not finished yet.
+    if(DiagCluster) nSimThreads = 1;
+    std::vector<GLMSIM_WORKER*> SimWorkers(nSimThreads);
+    for(n=0; n < nSimThreads; n++) SimWorkers[n] = SimWorkerAlloc();
+    std::vector<char> SimIterDone(nsim,0);
+    int nSimDone = nSimStart, nSimSaved = nSimStart;
 
-      // Variance smoothing
-      if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-        // If variance smoothing, then need to test and fit separately
-        if (VarFWHM > 0) {
-          if(!DoSim) printf("Starting fit\n");
-          MRIglmFit(mriglm);
-          if(!DoSim) printf("Variance smoothing\n");
-          SmoothSurfOrVol(surf, mriglm->rvar, mriglm->mask, VarSmoothLevel);
-          if(!DoSim) printf("Starting test\n");
-          MRIglmTest(mriglm);
-        }
-	else {
-          if(!DoSim) printf("Starting fit and test\n");
-          MRIglmFitAndTest(mriglm);
-	  // If using permutation with non-stationary correction, compute fwhmmap here
-	  if(!strcmp(csd->simtype,"perm") && PermNonStatCor) {
-	    if(ar1)     MRIfree(&ar1);
-	    if(fwhmmap) MRIfree(&fwhmmap);
-	    ar1 = MRISar1(surf, mriglm->eres, mriglm->mask, NULL);
-	    fwhmmap = MRISfwhmFromAR1Map(surf, mriglm->mask, ar1);
-	    // MRISsmoothMRI(surf, fwhmmap, SmthLevel, mriglm->mask, fwhmmap)
-	  }
-        }
-	if(simcontrastdir){
-	  for (n=0; n < mriglm->glm->ncontrasts; n++) {
-	    sprintf(tmpstr,"%s/%s.z.%05d.%s",simcontrastdir,mriglm->glm->Cname[n],nthsim,format);
-	    MRIwrite(mriglm->z[n],tmpstr);
-	  }
+    printf("\n\nStarting simulation sim over %d trials\n",nsim);
+    if(nSimStart > 0) printf("Resuming at trial %d\n",nSimStart+1);
+    if(nSimThreads > 1) printf("Running %d trials at a time\n",nSimThreads);
+    mytimer.reset() ;
+    int nthsim;
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for num_threads(nSimThreads) schedule(dynamic,1)
+#endif
+    for (nthsim=nSimStart; nthsim < nsim; nthsim++) {
+      int tid = 0;
+#ifdef HAVE_OPENMP
+      tid = omp_get_thread_num();
+#endif
+      SimIteration(SimWorkers[tid], nthsim);
+#ifdef HAVE_OPENMP
+      #pragma omp critical(glmfit_sim_csd)
+#endif
+      {
+	SimIterDone[nthsim] = 1;
+	while(nSimDone < nsim && SimIterDone[nSimDone]) nSimDone++;
+	// Re-write the full CSD files every SimCheckpoint iterations. This
+	// assures output can be used immediately regardless of whether the
+	// job terminated properly or not, and can be resumed with --sim-resume
+	if(nSimDone == nsim || nSimDone - nSimSaved >= SimCheckpoint){
+	  SimWriteCSDs(nSimDone);
+	  nSimSaved = nSimDone;
 	}
       }
-
-      for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
-	for(nthSign = 0; nthSign < nSignList; nthSign++){
-	  // Go through each contrast.
-	  for (n=0; n < mriglm->glm->ncontrasts; n++) {
-	    if(DoSimThreshLoop) {
-	      csd = csdList[nthThresh][nthSign][n];
-	      tSimSign = SignList[nthSign];
-	    }
-	    if(debug) printf("%2d %d %5.1f  %d %2d %5.1f\n",nthsim,nthThresh,
-			     csd->thresh,nthSign,tSimSign,mytimer.seconds());
-
-	    // Change sign to abs for F-tests
-	    csd->threshsign = tSimSign;
-	    if(mriglm->glm->C[n]->rows > 1) csd->threshsign = 0;
-	    
-	    // Adjust threshold for one- or two-sided
-	    if(csd->threshsign == 0) threshadj = csd->thresh;
-	    else threshadj = csd->thresh - log10(2.0); // one-sided test
-
-	    if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,mriglm->gamma[n],0);
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      // Get Fmax at sig max 
-	      Fmax = MRIgetVoxVal(mriglm->F[n],cmax,rmax,smax,0);
-	      if(csd->threshsign != 0) Fmax = Fmax*SIGN(sigmax);
-	    } 
-	    else {
-	      // mc-z or mc-t: synth z-field, smooth, rescale,
-	      // compute p, compute sig
-	      // This should do the same thing as AFNI's AlphaSim
-	      // Synth and rescale without the mask, otherwise smoothing
-	      // smears the 0s into the mask area. Also, the stuff outisde
-	      // the mask area wont get zeroed.
-	      if(nthThresh == 0 && nthSign == 0) {
-		RFsynth(z,rfs,mriglm->mask); // z or t, as needed
-		if (SmoothLevel > 0) {
-		  SmoothSurfOrVol(surf, z, mriglm->mask, SmoothLevel);
-		  if(DiagCluster) {
-		    sprintf(tmpstr,"./%s-zsm0.%s",mriglm->glm->Cname[n],format);
-		    printf("Saving z into %s\n",tmpstr);
-		    MRIwrite(z,tmpstr);
-		    // Exits below
-		  }
-		  RFrescale(z,rfs,mriglm->mask,z);
-		}
-	      }
-	      if(DiagCluster) {
-		sprintf(tmpstr,"./%s-zsm1.%s",mriglm->glm->Cname[n],format);
-		printf("Saving z into %s\n",tmpstr);
-		MRIwrite(z,tmpstr);
-		// Exits below
-	      }
-	      // Slightly tortured way to get the right p-values because
-	      //   RFstat2P() computes one-sided, but I handle sidedness
-	      //   during thresholding.
-	      // First, use zabs to get a two-sided pval bet 0 and 0.5
-	      zabs = MRIabs(z,zabs);
-	      mriglm->p[n] = RFstat2P(zabs,rfs,mriglm->mask,0,mriglm->p[n]);
-	      // Next, mult pvals by 2 to get two-sided bet 0 and 1
-	      MRIscalarMul(mriglm->p[n],mriglm->p[n],2);
-	      // sig = -log10(p)
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,z,0);
-
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      Fmax = MRIgetVoxVal(z,cmax,rmax,smax,0);
-	      if(csd->threshsign == 0) Fmax = fabs(Fmax);
-	    }
-	    if(mriglm->mask) MRImask(sig,mriglm->mask,sig,0.0,0.0);
-
-	    if(surf) {
-	      // surface clustering -------------
-	      MRIScopyMRI(surf, sig, 0, "val");
-	      if(debug || Gdiag_no > 0) printf("Clustering on surface %lf\n",
-					       mytimer.seconds());
-	      SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						    0,&nClusters,NULL,fwhmmap);
-	      csize = sclustMaxClusterArea(SurfClustList, nClusters);
-	    } 
-	    else {
-	      // volume clustering -------------
-	      if (debug) printf("Clustering on volume\n");
-	      VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
-					      mriglm->mask, &nClusters, NULL);
-	      csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
-	      if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
-	      clustFreeClusterList(&VolClustList,nClusters);
-	    }
-	    if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
-			     mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
-
-	    // Re-write the full CSD file each time. Should not take that
-	    // long and assures output can be used immediately regardless
-	    // of whether the job terminated properly or not
-	    strcpy(csd->contrast,mriglm->glm->Cname[n]);
-	    if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
-	      if(round(csd->threshsign) ==  0) tmpstr2 = "abs"; 
-	      if(round(csd->threshsign) == +1) tmpstr2 = "pos"; 
-	      if(round(csd->threshsign) == -1) tmpstr2 = "neg"; 
-	      //sprintf(tmpstr,"%s-%s.th%04d.%s.csd",simbase,mriglm->glm->Cname[n],
-	      //      (int)round(csd->thresh*100),tmpstr2);
-	      sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
-		      (int)round(csd->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
-	    }
-	    else
-	      sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
-	    if(debug) printf("csd %s \n",tmpstr);
-	    fflush(stdout);
-	    fp = fopen(tmpstr,"w");
-	    if (fp == NULL) {
-	      printf("ERROR: opening %s\n",tmpstr);
-	      exit(1);
-	    }
-	    fprintf(fp,"# ClusterSimulationData 2\n");
-	    fprintf(fp,"# mri_glmfit simulation sim\n");
-	    fprintf(fp,"# hostname %s\n",uts.nodename);
-	    fprintf(fp,"# machine  %s\n",uts.machine);
-	    fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
-	    fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
-	    if (mriglm->mask) fprintf(fp,"# masking 1\n");
-	    else             fprintf(fp,"# masking 0\n");
-	    fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
-	    fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
-	    fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
-	    csd->nreps = nthsim+1;
-	    csd->nClusters[nthsim] = nClusters;
-	    csd->MaxClusterSize[nthsim] = csize;
-	    csd->MaxSig[nthsim] = sigmax;
-	    csd->MaxStat[nthsim] = Fmax;
-	    CSDprint(fp, csd);
-	    fclose(fp);
-	    if(debug) CSDprint(stdout, csd);
-
-	    if(DiagCluster) {
-	      sprintf(tmpstr,"./%s-sig.%s",mriglm->glm->Cname[n],format);
-	      printf("Saving sig into %s and exiting ... \n",tmpstr);
-	      MRIwrite(sig,tmpstr);
-	      exit(1);
-	    }
-	    free(SurfClustList);
-	  } // contrasts
-	} // sign list
-      } // thresh list
-      //MRIfree(&sig);
-
     }// simulation loop
     if(SimDoneFile){
       fp = fopen(SimDoneFile,"w");
@@ -3125,6 +2979,19 @@ static int parse_commandline(int argc, char **argv) {
       SubSample = 1;
       nargsused = 2;
     } 
+    else if (!strcmp(option, "--sim-threads")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&nSimThreads);
+      if(nSimThreads < 1) nSimThreads = 1;
+      nargsused = 1;
+    } 
+    else if (!strcmp(option, "--sim-checkpoint")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&SimCheckpoint);
+      if(SimCheckpoint < 1) SimCheckpoint = 1;
+      nargsused = 1;
+    } 
+    else if (!strcmp(option, "--sim-resume")) SimResume = 1;
     else if (!strcmp(option, "--sim-done")) {
       if(nargc < 1) CMDargNErr(option,1);
       SimDoneFile = pargv[0];
@@ -3203,6 +3070,9 @@ printf("   --kurtosis : compute kurtosis and p-value for kurtosis\n");
 printf("\n");
 printf("   --sim nulltype nsim thresh csdbasename : simulation perm, mc-full, mc-z\n");
 printf("   --sim-sign signstring : abs, pos, or neg. Default is abs.\n");
+printf("   --sim-threads N : run N simulation iterations at a time (default 1)\n");
+printf("   --sim-checkpoint N : rewrite the CSD files every N iterations (default 1)\n");
+printf("   --sim-resume : continue an interrupted simulation from its CSD files\n");
 printf("   --uniform min max : use uniform distribution instead of gaussian\n");
 printf("   --permute-input : good for testing (not related to sim)\n");
 printf("\n");
@@ -3607,9 +3477,13 @@ printf("  name to the base name). A '.csd' is appended to each file name.\n");
 printf("\n");
 printf("Multiple simulations can be run in parallel by specifying different\n");
 printf("csdbasenames. Then pass the multiple CSD files to mri_surfcluster\n");
-printf("and mri_volcluster. The Full CSD file is written on each iteration,\n");
-printf("which means that the CSD file will be valid if the simulation\n");
-printf("is aborted or crashes.\n");
+printf("and mri_volcluster. The Full CSD file is written on each iteration\n");
+printf("(or every N iterations with --sim-checkpoint), which means that the\n");
+printf("CSD file will be valid if the simulation is aborted or crashes. Run\n");
+printf("the same command with --sim-resume to continue from where it stopped.\n");
+printf("Each iteration draws its noise or permutation from its own random\n");
+printf("stream (derived from the seed and the iteration number), so the\n");
+printf("result does not depend on --sim-threads or on resuming.\n");
 printf("\n");
 printf("In the cases where the design matrix is a single columns of ones\n");
 printf("(ie, one-sample group mean), it makes no sense to permute the\n");
@@ -3906,6 +3780,416 @@ static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel) {
   return(0);
 }
 
+/*--------------------------------------------------------------------
+  SimIterationSeed() - seed for the nth simulation iteration. It is a
+  hash (splitmix64) of the base seed and the iteration number, so
+  each iteration draws from its own stream regardless of which thread
+  runs it or whether the simulation was resumed.
+  --------------------------------------------------------------------*/
+static long SimIterationSeed(long seed, int nthsim)
+{
+  unsigned long long x;
+  x = (unsigned long long) seed * 0x9E3779B97F4A7C15ULL + (unsigned long long) nthsim + 1;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x = x ^ (x >> 31);
+  x &= 0x7fffffff;
+  if(x == 0) x = 1;
+  return((long)x);
+}
+
+/*--------------------------------------------------------------------
+  SimWorkerAlloc() - state for running simulation iterations on one
+  thread. The input data, mask and weights are shared; everything an
+  iteration changes (the design matrix for perm, the data for mc-full,
+  the GLM and its outputs, the synthesized fields) is private.
+  --------------------------------------------------------------------*/
+static GLMSIM_WORKER *SimWorkerAlloc(void)
+{
+  GLMSIM_WORKER *w;
+  MRIGLM *wglm;
+  int n;
+
+  w = (GLMSIM_WORKER *) calloc(sizeof(GLMSIM_WORKER),1);
+  wglm = (MRIGLM *) calloc(sizeof(MRIGLM),1);
+  w->mriglm = wglm;
+
+  wglm->y = mriglm->y;
+  if(!strcmp(csd->simtype,"mc-full")) wglm->y = MRIcopy(mriglm->y,NULL);
+  wglm->Xg = MatrixCopy(mriglm->Xg,NULL);
+  wglm->npvr = mriglm->npvr;
+  for(n=0; n < mriglm->npvr; n++){
+    wglm->pvr[n] = mriglm->pvr[n];
+    if(!strcmp(csd->simtype,"perm")) wglm->pvr[n] = MRIcopy(mriglm->pvr[n],NULL);
+  }
+  wglm->nregtot    = mriglm->nregtot;
+  wglm->w          = mriglm->w;
+  wglm->wg         = mriglm->wg;
+  wglm->skipweight = mriglm->skipweight;
+  wglm->mask       = mriglm->mask;
+  wglm->yffxvar    = mriglm->yffxvar;
+  wglm->ffxdof     = mriglm->ffxdof;
+  wglm->FrameMask  = mriglm->FrameMask;
+  // cond and yhat are not used by the simulation
+
+  wglm->glm = GLMalloc();
+  wglm->glm->ncontrasts = mriglm->glm->ncontrasts;
+  for(n=0; n < mriglm->glm->ncontrasts; n++){
+    wglm->glm->C[n]         = MatrixCopy(mriglm->glm->C[n],NULL);
+    wglm->glm->Cname[n]     = mriglm->glm->Cname[n];
+    wglm->glm->UseGamma0[n] = mriglm->glm->UseGamma0[n];
+    wglm->glm->gamma0[n]    = mriglm->glm->gamma0[n];
+    wglm->glm->ypmfflag[n]  = mriglm->glm->ypmfflag[n];
+  }
+  wglm->glm->dof          = mriglm->glm->dof;
+  wglm->glm->AllowZeroDOF = mriglm->glm->AllowZeroDOF;
+  wglm->glm->ffxdof       = mriglm->glm->ffxdof;
+  wglm->glm->ReScaleX     = mriglm->glm->ReScaleX;
+  wglm->glm->DoPCC        = mriglm->glm->DoPCC;
+  GLMallocX(wglm->glm,mriglm->y->nframes,mriglm->nregtot);
+  GLMallocY(wglm->glm);
+  if(DoPCC) {
+    MatrixFree(&wglm->glm->X);
+    wglm->glm->X = wglm->Xg;
+  }
+  GLMcMatrices(wglm->glm);
+
+  if(!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t")) {
+    w->rfs = RFspecInit(csd->seed,NULL);
+    w->rfs->name = strcpyalloc(rfs->name);
+    w->rfs->params[0] = rfs->params[0];
+    w->rfs->params[1] = rfs->params[1];
+    w->z    = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+    w->zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+  }
+  return(w);
+}
+
+/*--------------------------------------------------------------------
+  SimIteration() - runs the nthsim iteration of the simulation on the
+  given worker and stores the max cluster size, max sig and max stat
+  for each threshold, sign, and contrast in csdList.
+  --------------------------------------------------------------------*/
+static int SimIteration(GLMSIM_WORKER *w, int nthsim)
+{
+  MRIGLM *wglm = w->mriglm;
+  CSD *csd;
+  SURFCLUSTERSUM *SurfClustList;
+  VOLCLUSTER **VolClustList;
+  int n, m, nthThresh, nthSign, nClusters, cmax, rmax, smax;
+  double threshadj, sigmax, Fmax, csize;
+  long seed;
+
+  if(debug) printf("%d/%d t=%g ---------------------------------\n",
+		   nthsim+1,nsim,mytimer.minutes());
+
+  seed = SimIterationSeed(csdList[0][0][0]->seed,nthsim);
+
+  // drand48() has a single global state, so the draws are serialized
+  if (!strcmp(::csd->simtype,"mc-full") || !strcmp(::csd->simtype,"perm")) {
+#ifdef HAVE_OPENMP
+    #pragma omp critical(glmfit_sim_rng)
+#endif
+    {
+      srand48(seed);
+      if (!strcmp(::csd->simtype,"mc-full")) {
+	if(! UseUniform)
+	  MRIrandn(wglm->y->width,wglm->y->height,wglm->y->depth,
+		   wglm->y->nframes,0,1,wglm->y);
+	else
+	  MRIdrand48(wglm->y->width,wglm->y->height,wglm->y->depth,
+		     wglm->y->nframes,UniformMin,UniformMax,wglm->y);
+      }
+      else if (!OneSamplePerm) {
+	// Permute the original design rather than the previous permutation
+	MatrixCopy(mriglm->Xg,wglm->Xg);
+	for (n=0; n < wglm->npvr; n++) MRIcopy(mriglm->pvr[n],wglm->pvr[n]);
+	RandPermMatrixAndPVR(wglm->Xg,wglm->pvr,wglm->npvr);
+      }
+      else {
+	for (n=0; n < wglm->y->nframes; n++) {
+	  if (drand48() > 0.5) m = +1;
+	  else                 m = -1;
+	  wglm->Xg->rptr[n+1][1] = m;
+	}
+      }
+    }
+  }
+  else RFspecSetSeed(w->rfs,seed);
+
+  if (!strcmp(::csd->simtype,"mc-full")) {
+    if(logflag) MRIlog(wglm->y,wglm->mask,-1,1,wglm->y);
+    if(FWHM > 0)
+      SmoothSurfOrVol(surf, wglm->y, wglm->mask, SmoothLevel);
+  }
+
+  // Variance smoothing
+  if (!strcmp(::csd->simtype,"mc-full") || !strcmp(::csd->simtype,"perm")) {
+    // If variance smoothing, then need to test and fit separately
+    if (VarFWHM > 0) {
+      MRIglmFit(wglm);
+      SmoothSurfOrVol(surf, wglm->rvar, wglm->mask, VarSmoothLevel);
+      MRIglmTest(wglm);
+    }
+    else {
+      MRIglmFitAndTest(wglm);
+      // If using permutation with non-stationary correction, compute fwhmmap here
+      if(!strcmp(::csd->simtype,"perm") && PermNonStatCor) {
+	if(w->ar1)     MRIfree(&w->ar1);
+	if(w->fwhmmap) MRIfree(&w->fwhmmap);
+	w->ar1 = MRISar1(surf, wglm->eres, wglm->mask, NULL);
+	// MRISfwhmFromAR1Map() recomputes the metric properties of the
+	// shared surface, so it must not overlap the clustering below
+#ifdef HAVE_OPENMP
+	#pragma omp critical(glmfit_sim_surf)
+#endif
+	w->fwhmmap = MRISfwhmFromAR1Map(surf, wglm->mask, w->ar1);
+      }
+    }
+    if(simcontrastdir){
+      for (n=0; n < wglm->glm->ncontrasts; n++) {
+	char fname[2000];
+	sprintf(fname,"%s/%s.z.%05d.%s",simcontrastdir,wglm->glm->Cname[n],nthsim,format);
+#ifdef HAVE_OPENMP
+	#pragma omp critical(glmfit_sim_io)
+#endif
+	MRIwrite(wglm->z[n],fname);
+      }
+    }
+  }
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      // Go through each contrast.
+      for (n=0; n < wglm->glm->ncontrasts; n++) {
+	csd = csdList[nthThresh][nthSign][n];
+	if(debug) printf("%2d %d %5.1f  %d %2d %5.1f\n",nthsim,nthThresh,
+			 csd->thresh,nthSign,(int)csd->threshsign,mytimer.seconds());
+
+	// Adjust threshold for one- or two-sided
+	if(csd->threshsign == 0) threshadj = csd->thresh;
+	else threshadj = csd->thresh - log10(2.0); // one-sided test
+
+	if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+	  w->sig = MRIlog10(wglm->p[n],NULL,w->sig,1);
+	  // If test is not ABS then apply the sign
+	  if(csd->threshsign != 0) MRIsetSign(w->sig,wglm->gamma[n],0);
+	  sigmax = MRIframeMax(w->sig,0,wglm->mask,csd->threshsign,
+			       &cmax,&rmax,&smax);
+	  // Get Fmax at sig max
+	  Fmax = MRIgetVoxVal(wglm->F[n],cmax,rmax,smax,0);
+	  if(csd->threshsign != 0) Fmax = Fmax*SIGN(sigmax);
+	}
+	else {
+	  // mc-z or mc-t: synth z-field, smooth, rescale,
+	  // compute p, compute sig
+	  // This should do the same thing as AFNI's AlphaSim
+	  // Synth and rescale without the mask, otherwise smoothing
+	  // smears the 0s into the mask area. Also, the stuff outisde
+	  // the mask area wont get zeroed.
+	  if(nthThresh == 0 && nthSign == 0) {
+	    RFsynth(w->z,w->rfs,wglm->mask); // z or t, as needed
+	    if (SmoothLevel > 0) {
+	      SmoothSurfOrVol(surf, w->z, wglm->mask, SmoothLevel);
+	      if(DiagCluster) {
+		sprintf(tmpstr,"./%s-zsm0.%s",wglm->glm->Cname[n],format);
+		printf("Saving z into %s\n",tmpstr);
+		MRIwrite(w->z,tmpstr);
+		// Exits below
+	      }
+	      RFrescale(w->z,w->rfs,wglm->mask,w->z);
+	    }
+	  }
+	  if(DiagCluster) {
+	    sprintf(tmpstr,"./%s-zsm1.%s",wglm->glm->Cname[n],format);
+	    printf("Saving z into %s\n",tmpstr);
+	    MRIwrite(w->z,tmpstr);
+	    // Exits below
+	  }
+	  // Slightly tortured way to get the right p-values because
+	  //   RFstat2P() computes one-sided, but I handle sidedness
+	  //   during thresholding.
+	  // First, use zabs to get a two-sided pval bet 0 and 0.5
+	  w->zabs = MRIabs(w->z,w->zabs);
+	  wglm->p[n] = RFstat2P(w->zabs,w->rfs,wglm->mask,0,wglm->p[n]);
+	  // Next, mult pvals by 2 to get two-sided bet 0 and 1
+	  MRIscalarMul(wglm->p[n],wglm->p[n],2);
+	  // sig = -log10(p)
+	  w->sig = MRIlog10(wglm->p[n],NULL,w->sig,1);
+	  // If test is not ABS then apply the sign
+	  if(csd->threshsign != 0) MRIsetSign(w->sig,w->z,0);
+
+	  sigmax = MRIframeMax(w->sig,0,wglm->mask,csd->threshsign,
+			       &cmax,&rmax,&smax);
+	  Fmax = MRIgetVoxVal(w->z,cmax,rmax,smax,0);
+	  if(csd->threshsign == 0) Fmax = fabs(Fmax);
+	}
+	if(wglm->mask) MRImask(w->sig,wglm->mask,w->sig,0.0,0.0);
+
+	if(surf) {
+	  // surface clustering -------------
+	  // The surface holds the values being clustered, so one at a time
+	  if(debug || Gdiag_no > 0) printf("Clustering on surface %lf\n",
+					   mytimer.seconds());
+#ifdef HAVE_OPENMP
+	  #pragma omp critical(glmfit_sim_surf)
+#endif
+	  {
+	    MRIScopyMRI(surf, w->sig, 0, "val");
+	    SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
+						  0,&nClusters,NULL,w->fwhmmap);
+	    csize = sclustMaxClusterArea(SurfClustList, nClusters);
+	  }
+	  free(SurfClustList);
+	}
+	else {
+	  // volume clustering -------------
+	  if (debug) printf("Clustering on volume\n");
+	  VolClustList = clustGetClusters(w->sig, 0, threshadj,-1,csd->threshsign,0,
+					  wglm->mask, &nClusters, NULL);
+	  csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
+	  if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
+	  clustFreeClusterList(&VolClustList,nClusters);
+	}
+	if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
+			 wglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
+
+	csd->nClusters[nthsim] = nClusters;
+	csd->MaxClusterSize[nthsim] = csize;
+	csd->MaxSig[nthsim] = sigmax;
+	csd->MaxStat[nthsim] = Fmax;
+
+	if(DiagCluster) {
+	  SimWriteCSDs(nthsim+1);
+	  sprintf(tmpstr,"./%s-sig.%s",wglm->glm->Cname[n],format);
+	  printf("Saving sig into %s and exiting ... \n",tmpstr);
+	  MRIwrite(w->sig,tmpstr);
+	  exit(1);
+	}
+      } // contrasts
+    } // sign list
+  } // thresh list
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimCSDFileName() - name of the CSD file for the given contrast,
+  threshold and sign.
+  --------------------------------------------------------------------*/
+static char *SimCSDFileName(CSD *csd, int n, char *fname)
+{
+  const char *signstr=NULL;
+  if(nThreshList > 1 || nSignList > 1){
+    if(round(csd->threshsign) ==  0) signstr = "abs";
+    if(round(csd->threshsign) == +1) signstr = "pos";
+    if(round(csd->threshsign) == -1) signstr = "neg";
+    sprintf(fname,"%s.th%02d.%s.j001-%s.csd",simbase,
+	    (int)round(csd->thresh*10),signstr,mriglm->glm->Cname[n]);
+  }
+  else
+    sprintf(fname,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
+  return(fname);
+}
+
+/*--------------------------------------------------------------------
+  SimWriteCSDs() - writes the CSD file for each threshold, sign and
+  contrast with the first nreps iterations.
+  --------------------------------------------------------------------*/
+static int SimWriteCSDs(int nreps)
+{
+  int nthThresh, nthSign, n;
+  char fname[2000];
+  FILE *fp;
+  CSD *csd;
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	csd = csdList[nthThresh][nthSign][n];
+	SimCSDFileName(csd,n,fname);
+	if(debug) printf("csd %s \n",fname);
+	fflush(stdout);
+	fp = fopen(fname,"w");
+	if (fp == NULL) {
+	  printf("ERROR: opening %s\n",fname);
+	  exit(1);
+	}
+	fprintf(fp,"# ClusterSimulationData 2\n");
+	fprintf(fp,"# mri_glmfit simulation sim\n");
+	fprintf(fp,"# hostname %s\n",uts.nodename);
+	fprintf(fp,"# machine  %s\n",uts.machine);
+	fprintf(fp,"# runtime_min %g\n",mytimer.minutes());
+	fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
+	if (mriglm->mask) fprintf(fp,"# masking 1\n");
+	else             fprintf(fp,"# masking 0\n");
+	fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
+	fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
+	fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
+	csd->nreps = nreps;
+	CSDprint(fp, csd);
+	fclose(fp);
+	if(debug) CSDprint(stdout, csd);
+      }
+    }
+  }
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimResumeCSDs() - loads the iterations already saved in the CSD
+  files of an interrupted simulation. The base seed is taken from the
+  files so that the remaining iterations get the same streams they
+  would have had. Returns the number of iterations to skip (0 if any
+  of the files does not exist yet).
+  --------------------------------------------------------------------*/
+static int SimResumeCSDs(void)
+{
+  int nthThresh, nthSign, n, nthrep, nstart;
+  long seed = -1;
+  char fname[2000];
+  CSD *csd, *prev;
+
+  nstart = nsim;
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	csd = csdList[nthThresh][nthSign][n];
+	SimCSDFileName(csd,n,fname);
+	if(!fio_FileExistsReadable(fname)) {
+	  printf("INFO: %s does not exist, starting simulation from the beginning\n",fname);
+	  return(0);
+	}
+	prev = CSDread(fname);
+	if(prev == NULL) exit(1);
+	if(strcmp(prev->simtype,csd->simtype) || fabs(prev->thresh-csd->thresh) > 1e-4 ||
+	   prev->threshsign != csd->threshsign || prev->nreps > nsim ||
+	   (seed >= 0 && prev->seed != seed)){
+	  printf("ERROR: %s does not match this simulation, cannot resume\n",fname);
+	  exit(1);
+	}
+	seed = prev->seed;
+	for(nthrep = 0; nthrep < prev->nreps; nthrep++){
+	  csd->nClusters[nthrep]      = prev->nClusters[nthrep];
+	  csd->MaxClusterSize[nthrep] = prev->MaxClusterSize[nthrep];
+	  csd->MaxSig[nthrep]         = prev->MaxSig[nthrep];
+	  csd->MaxStat[nthrep]        = prev->MaxStat[nthrep];
+	}
+	if(prev->nreps < nstart) nstart = prev->nreps;
+	CSDfreeData(prev);
+	free(prev);
+      }
+    }
+  }
+
+  SynthSeed = seed;
+  csd = ::csd;
+  csd->seed = seed;
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++)
+    for(nthSign = 0; nthSign < nSignList; nthSign++)
+      for (n=0; n < mriglm->glm->ncontrasts; n++) csdList[nthThresh][nthSign][n]->seed = seed;
+  printf("Resuming simulation with seed %ld, %d of %d trials done\n",seed,nstart,nsim);
+  return(nstart);
+}
 
 /*--------------------------------------------------------------------*/
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag) {
@@ -23,3 +23,23 @@ done
 for f in F.mgh gamma.mgh sig.mgh; do
     compare_vol ${actual}/age/${f} ${expected}/age/${f} --thresh 0.008
 done
+
+# permutation simulation with the non-stationary correction: the CSDs must
+# not depend on how many trials are run at a time
+FSTEST_NO_DATA_RESET=1 && init_testdata
+for nthreads in 1 4; do
+    test_command mri_glmfit \
+        --seed 1234 \
+        --y lh.gender_age.thickness.10.mgh \
+        --fsgd gender_age.txt doss \
+        --no-cortex \
+        --glmdir lh.gender_age.sim.glmdir \
+        --surf average lh \
+        --C age.mat \
+        --sim perm 20 2 perm.threads${nthreads} \
+        --perm-nonstatcor \
+        --sim-threads ${nthreads}
+done
+if [ "$FSTEST_REGENERATE" != true ]; then
+    eval_cmd diff perm.threads1-age.csd perm.threads4-age.csd -I runtime_min
+fi
@@ -29,6 +29,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <vector>
 
 #include "fio.h"
 #include "const.h"
@@ -43,6 +44,7 @@
 #include "tags.h"
 #include "gca.h"
 #include "MC.h"
+#include "romp_support.h"
 
 #define MAXFACES    3000000
 #define MAXVERTICES 1500000
@@ -116,6 +118,7 @@ tesselation_parms;
 
 
 static int downsample = 0 ;
+static int serial = 0 ;
 
 /*initialization of tesselation_parms*/
 /*note that not all the fields are allocated*/
@@ -790,6 +793,255 @@ void generateMCtesselation(tesselation_parms * parms) {
   fprintf(stderr,"done\n");
 }
 
+/* triangles of the cube configuration ref, as edge numbers, -1 terminated */
+static const int *mcTriangles(int connectivity, int ref) {
+  switch (connectivity) {
+  case 1:
+    return MC6p[ref];
+  case 2:
+    return MC18[ref];
+  case 3:
+    return MC6[ref];
+  default:
+    return MC26[ref];
+  }
+}
+
+/* the four corners of the cube face in slice k, as in tab1/tab2 above */
+static int mcCorners(MRI *mri, int i, int j, int k) {
+  int ref=0;
+  if (k<0 || k>=mri->depth)
+    return 0;
+  if (MRIvox(mri,i,j,k))
+    ref+=1;
+  if (((i+1)<mri->width) && MRIvox(mri,i+1,j,k))
+    ref+=2;
+  if (((j+1)<mri->height) && MRIvox(mri,i,j+1,k))
+    ref+=4;
+  if (((j+1)<mri->height) && ((i+1)<mri->width) && MRIvox(mri,i+1,j+1,k))
+    ref+=8;
+  return ref;
+}
+
+/* vertex on an edge of the bottom plane of a slab, owned by the slab below */
+#define MC_SEAM(key)    (-2-(key))
+#define MC_IS_SEAM(v)   ((v)<-1)
+#define MC_SEAM_KEY(v)  (-2-(v))
+
+typedef struct mc_slab_ {
+  int k0,k1;                /* slices k0 <= k < k1 */
+  std::vector<float> vertex;  /* imnr, i, j of each vertex, in creation order */
+  std::vector<int> face;      /* 3 slab vertex numbers (or MC_SEAM) per face */
+  std::vector<int> vtop;      /* vertices on the edges of plane k1, as vk2 */
+}
+mc_slab;
+
+/*
+  Runs the cube loop of generateMCtesselation() over the slices of one
+  slab, with the vertices numbered from 0 within the slab. Vertices on
+  the edges of the bottom plane are created by the slab below, so faces
+  that use them get MC_SEAM(key), key being the index into that slab's
+  vtop table.
+*/
+static void mcSlab(tesselation_parms *parms, MRI *mri, mc_slab *slab, int first) {
+  int i,j,k,p,nf,ref,ind,width,imgsize;
+  int vt[12],vind[12],f_c[12];
+  const int *tri;
+  std::vector<int> tab1,tab2,vk1,vk2,vj1,vj2;
+
+  width=mri->width;
+  imgsize=mri->width*mri->height;
+
+  f_c[0]=0;
+  f_c[1]=1;
+  f_c[2]=2*width;
+  f_c[3]=3;
+  f_c[8]=0;
+  f_c[9]=1;
+  f_c[10]=2*width;
+  f_c[11]=3;
+  f_c[4]=0;
+  f_c[5]=1;
+  f_c[6]=0;
+  f_c[7]=1;
+
+  // corners of the cubes in the bottom slice, carried up as in the serial
+  // loop, which starts from a zeroed table
+  tab1.assign(imgsize,0);
+  tab2.assign(imgsize,0);
+  if (!first)
+    for (j=parms->ymin;j<parms->ymax;j++)
+      for (i=parms->xmin;i<parms->xmax;i++)
+        tab1[i+width*j]=mcCorners(mri,i,j,slab->k0);
+
+  // the serial code starts from zeroed tables
+  vk1.assign(2*imgsize,first ? 0 : -1);
+  vk2.assign(2*imgsize,first ? 0 : -1);
+  vj1.assign(width,first ? 0 : -1);
+  vj2.assign(width,first ? 0 : -1);
+
+  for (k=slab->k0;k<slab->k1;k++) {
+    for (j=parms->ymin;j<parms->ymax;j++) {
+      for (i=parms->xmin;i<parms->xmax;i++) {
+        ind=i+width*j;
+        tab2[ind]=mcCorners(mri,i,j,k+1);
+        ref=16*tab2[ind]+tab1[ind];
+        tri=mcTriangles(parms->connectivity,ref);
+        nf=0;
+        while (tri[3*nf]>=0) nf++;
+        if (nf==0) continue;
+
+        memset(vt,0,12*sizeof(int));
+        memset(vind,0,12*sizeof(int));
+        for (p=0;p<3*nf;p++) vt[tri[p]]++;
+
+        for (p=0;p<4;p++)
+          if (vt[p])
+            vind[p]=(k==slab->k0 && !first) ? MC_SEAM(2*ind+f_c[p]) : vk1[2*ind+f_c[p]];
+        for (p=4;p<6;p++)
+          if (vt[p])
+            vind[p]=vj1[i+f_c[p]];
+        if (vt[6])
+          vind[6]=vj2[i];
+        if (vt[7]) {
+          vind[7]=slab->vertex.size()/3;
+          slab->vertex.push_back(k+0.5);
+          slab->vertex.push_back(i+1);
+          slab->vertex.push_back(j+1);
+          vj2[i+1]=vind[7];
+        }
+        if (vt[8])
+          vind[8]=vk2[2*ind+f_c[8]];
+        if (vt[9])
+          vind[9]=vk2[2*ind+f_c[9]];
+        if (vt[10]) {
+          vind[10]=slab->vertex.size()/3;
+          slab->vertex.push_back(k+1);
+          slab->vertex.push_back(i+0.5);
+          slab->vertex.push_back(j+1);
+          vk2[2*ind+f_c[10]]=vind[10];
+        }
+        if (vt[11]) {
+          vind[11]=slab->vertex.size()/3;
+          slab->vertex.push_back(k+1);
+          slab->vertex.push_back(i+1);
+          slab->vertex.push_back(j+0.5);
+          vk2[2*ind+f_c[11]]=vind[11];
+        }
+        for (p=0;p<3*nf;p++)
+          slab->face.push_back(vind[tri[p]]);
+      }
+      vj1.swap(vj2);
+      std::fill(vj2.begin(),vj2.end(),-1);
+    }
+    tab1.swap(tab2);
+    vk1.swap(vk2);
+    std::fill(vk2.begin(),vk2.end(),-1);
+  }
+  slab->vtop.swap(vk1);
+}
+
+/*
+  Same tessellation as generateMCtesselation(), computed in parallel over
+  slabs of slices. Each slab numbers the vertices it creates in the order
+  of the serial loop, so concatenating the slabs in order and welding the
+  seams (the faces of a slab that use vertices on its bottom plane) gives
+  the same vertex and face lists as the serial code for any number of
+  threads.
+*/
+void generateMCtesselationParallel(tesselation_parms * parms) {
+  int n,nslabs,nslices,nvertices,nfaces;
+  MRI *mri;
+
+  fprintf(stderr,"\npreprocessing...");
+  mri=preprocessingStep(parms);
+  allocateTesselation(parms);
+  fprintf(stderr,"done\n");
+
+  nslices=MAX(parms->zmax-parms->zmin,1);
+  nslabs=MIN(nslices,2*omp_get_max_threads());
+  std::vector<mc_slab> slabs(nslabs);
+  for (n=0;n<nslabs;n++) {
+    slabs[n].k0=parms->zmin+(int)((long)nslices*n/nslabs);
+    slabs[n].k1=parms->zmin+(int)((long)nslices*(n+1)/nslabs);
+  }
+  slabs[nslabs-1].k1=parms->zmax;
+
+  fprintf(stderr,"starting generation of surface (%d slabs)...",nslabs);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+#endif
+  for (n=0;n<nslabs;n++) {
+    ROMP_PFLB_begin
+    mcSlab(parms,mri,&slabs[n],n==0);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  std::vector<int> vbase(nslabs+1,0),fbase(nslabs+1,0);
+  for (n=0;n<nslabs;n++) {
+    vbase[n+1]=vbase[n]+slabs[n].vertex.size()/3;
+    fbase[n+1]=fbase[n]+slabs[n].face.size()/3;
+  }
+  nvertices=vbase[nslabs];
+  nfaces=fbase[nslabs];
+  if (nvertices >= parms->maxvertices) {
+    free(parms->vertex);
+    parms->maxvertices=nvertices+1;
+    parms->vertex=(quad_vertex_type*)lcalloc(parms->maxvertices,sizeof(quad_vertex_type));
+  }
+  if (nfaces >= parms->maxfaces) {
+    free(parms->face);
+    parms->maxfaces=nfaces+1;
+    parms->face=(quad_face_type*)lcalloc(parms->maxfaces,sizeof(quad_face_type));
+  }
+  if (!parms->vertex || !parms->face)
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d vertices and %d faces",
+              Progname,nvertices,nfaces) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+#endif
+  for (n=0;n<nslabs;n++) {
+    ROMP_PFLB_begin
+    mc_slab *slab=&slabs[n];
+    int m,p,v;
+    for (m=0;m<(int)slab->vertex.size()/3;m++) {
+      quad_vertex_type *vertex=&parms->vertex[vbase[n]+m];
+      vertex->imnr=slab->vertex[3*m];
+      vertex->i=slab->vertex[3*m+1];
+      vertex->j=slab->vertex[3*m+2];
+      vertex->num=0;
+    }
+    for (m=0;m<(int)slab->face.size()/3;m++) {
+      quad_face_type *face=&parms->face[fbase[n]+m];
+      for (p=0;p<3;p++) {
+        v=slab->face[3*m+p];
+        if (MC_IS_SEAM(v)) {
+          v=slabs[n-1].vtop[MC_SEAM_KEY(v)];
+          if (v<0)
+            ErrorExit(ERROR_BADPARM, "%s: unmatched vertex at slice %d",Progname,slab->k0);
+          v+=vbase[n-1];
+        }
+        else
+          v+=vbase[n];
+        face->v[p]=v;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  parms->vertex_index=nvertices;
+  parms->face_index=nfaces;
+
+  MRIfree(&mri);
+  fprintf(stderr,"\nconstructing final surface...");
+  saveTesselation2(parms);
+  fprintf(stderr,"done\n");
+}
+
 int main(int argc, char *argv[]) {
   tesselation_parms *parms;
   MRIS **mris_table, *mris,*mris_corrected;
@@ -799,18 +1051,31 @@ int main(int argc, char *argv[]) {
 
   Progname=argv[0];
 
-  if (argc > 1 && (stricmp(argv[1], "-d") == 0)) {
-    downsample = atoi(argv[2]) ;
-    argc -= 2;
-    argv += 2 ;
-    printf("downsampling input volume %d times\n", downsample) ;
+  while (argc > 1) {
+    if (stricmp(argv[1], "-d") == 0 && argc > 2) {
+      downsample = atoi(argv[2]) ;
+      argc -= 2;
+      argv += 2 ;
+      printf("downsampling input volume %d times\n", downsample) ;
+    }
+    else if (stricmp(argv[1], "-serial") == 0) {
+      serial = 1 ;
+      argc--;
+      argv++ ;
+      printf("tessellating on a single thread\n") ;
+    }
+    else
+      break;
   }
 
   if (argc < 4) {
-    fprintf(stderr,"\n\nUSAGE: mri_mc input_volume "
+    fprintf(stderr,"\n\nUSAGE: mri_mc [-d N] [-serial] input_volume "
             "label_value output_surface [connectivity]");
     fprintf(stderr,
-            "\noption connectivity: 1=6+,2=18,3=6,4=26 (default=1)\n\n");
+            "\noption connectivity: 1=6+,2=18,3=6,4=26 (default=1)");
+    fprintf(stderr,
+            "\noption -serial: use the original single-threaded loop "
+            "(same output)\n\n");
     exit(-1);
   }
 
@@ -869,7 +1134,10 @@ int main(int argc, char *argv[]) {
 
   initTesselationParms(parms);
 
-  generateMCtesselation(parms);
+  if (serial)
+    generateMCtesselation(parms);
+  else
+    generateMCtesselationParallel(parms);
 
   free(parms->label_values);
   mris=parms->mris_table[0];
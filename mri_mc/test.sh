@@ -1,5 +1,19 @@
 #!/usr/bin/env bash
 source "$(dirname $0)/../test.sh"
 
+mri_binarize=$(find_path $FSTEST_CWD mri_binarize/mri_binarize)
+mris_diff=$(find_path $FSTEST_CWD mris_diff/mris_diff)
+
 test_command mri_pretess -w mri/wm.mgz wm mri/norm.mgz wm_new.mgz
 compare_vol wm_new.mgz wm_ref.mgz
+
+# the slab-parallel tessellation must match the serial loop for any number of slabs
+if [ "$FSTEST_REGENERATE" != true ]; then
+    FSTEST_NO_DATA_RESET=1 && init_testdata
+    test_command $mri_binarize --i mri/wm.mgz --min 5 --o wm.bin.mgz
+    test_command mri_mc -serial wm.bin.mgz 1 lh.mc.serial
+    for nthreads in 1 4; do
+        test_command OMP_NUM_THREADS=${nthreads} mri_mc wm.bin.mgz 1 lh.mc.threads${nthreads}
+        eval_cmd $mris_diff lh.mc.threads${nthreads} lh.mc.serial --debug
+    done
+fi
@@ -46,6 +46,7 @@
   --fwhm fwhm : smooth input by fwhm mm
   --abs       : compute abs of mov
   --subsamp nsub : only sample every nsub vertices
+  --threads nthreads : number of threads for computing the cost
 
   --preopt-file file : save preopt results in file
   --preopt-dim dim : 0-5 (def 2) (0=TrLR,1=TrSI,2=TrAP,3=RotLR,4=RotSI,5=RotAP)
@@ -152,6 +153,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/utsname.h>
+#include <vector>
 
 #include "macros.h"
 #include "error.h"
@@ -177,6 +179,7 @@
 #include "annotation.h"
 #include "transform.h"
 #include "label.h"
+#include "romp_support.h"
 
 #ifdef X
 #undef X
@@ -186,6 +189,8 @@ int MRISbbrSurfs(char *subject);
 
 double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
 		     double *p, int dof, double *costs);
+int GetSurfCostsBatch(MRI *mov, MATRIX *R0, int nparams, double *params,
+		      int dof, double *costs);
 int MinPowell(MRI *mov, MRI *notused, MATRIX *R, double *params,
 	      int dof, double ftol, double linmintol, int nmaxiters,
 	      char *costfile, double *costs, int *niters);
@@ -684,6 +689,9 @@ int main(int argc, char **argv) {
     for(tx = PreOptMinTrans; tx <= PreOptMaxTrans; tx += PreOptDeltaTrans){
       for(ty = PreOptMinTrans; ty <= PreOptMaxTrans; ty += PreOptDeltaTrans){
         for(tz = PreOptMinTrans; tz <= PreOptMaxTrans; tz += PreOptDeltaTrans){
+          // Score all the rotations at this translation in one batch
+          std::vector<double> plist, blist;
+          int k, nbatch;
           for(ax = PreOptMin; ax <= PreOptMax; ax += PreOptDelta){
             for(ay = PreOptMin; ay <= PreOptMax; ay += PreOptDelta){
               for(az = PreOptMin; az <= PreOptMax; az += PreOptDelta){
@@ -693,34 +701,43 @@ int main(int argc, char **argv) {
                 p[3] = ax;
                 p[4] = ay;
                 p[5] = az;
-                GetSurfCosts(mov, NULL, R0, R, p, dof, costs);
-                if(costs[7] < mincost) {
-                  mincost = costs[7];
-                  for(n=0; n < 6; n++) pmin[n] = p[n];
-                  secCostTime = mytimer.seconds() ;
-                  printf("%6d %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf    %8.4lf %8.4lf %4.1f\n",
-                         nth,tx,ty,tz,ax,ay,az,costs[7],mincost,secCostTime/60);
-                  fprintf(fp,"%6d %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf    %8.4lf %8.4lf %4.1f\n",
-                          nth,tx,ty,tz,ax,ay,az,costs[7],mincost,secCostTime/60);
-                  fflush(stdout); fflush(fp);
-                  
-                } else {
-                  if(nth == 0 || nth%1000 == 0 || debug){
-                    secCostTime = mytimer.seconds() ;
-                    printf("%6d %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf    %8.4lf %8.4lf %4.1f\n",
-                           nth,tx,ty,tz,ax,ay,az,costs[7],mincost,secCostTime/60);
-                    fprintf(fp,"%6d %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf    %8.4lf %8.4lf %4.1f\n",
-                            nth,tx,ty,tz,ax,ay,az,costs[7],mincost,secCostTime/60);
-                    fflush(stdout); fflush(fp);
-                  }
-                }
-                if(PreOptFile) 
-                  fprintf(fpPreOpt,"%8.8lf %8.8lf %8.8lf %8.8lf %8.8lf %8.8lf    %8.8lf\n",
-                          tx,ty,tz,ax,ay,az,costs[7]);
-                nth ++;
+                plist.insert(plist.end(), p, p+12);
               }
             }
           }
+          nbatch = plist.size()/12;
+          blist.resize(nbatch*8);
+          GetSurfCostsBatch(mov, R0, nbatch, plist.data(), dof, blist.data());
+          for(k=0; k < nbatch; k++){
+            ax = plist[k*12+3];
+            ay = plist[k*12+4];
+            az = plist[k*12+5];
+            for(n=0; n < 8; n++) costs[n] = blist[k*8+n];
+            if(costs[7] < mincost) {
+              mincost = costs[7];
+              for(n=0; n < 6; n++) pmin[n] = plist[k*12+n];
+              secCostTime = mytimer.seconds() ;
+              printf("%6d %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf    %8.4lf %8.4lf %4.1f\n",
+                     nth,tx,ty,tz,ax,ay,az,costs[7],mincost,secCostTime/60);
+              fprintf(fp,"%6d %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf    %8.4lf %8.4lf %4.1f\n",
+                      nth,tx,ty,tz,ax,ay,az,costs[7],mincost,secCostTime/60);
+              fflush(stdout); fflush(fp);
+
+            } else {
+              if(nth == 0 || nth%1000 == 0 || debug){
+                secCostTime = mytimer.seconds() ;
+                printf("%6d %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf    %8.4lf %8.4lf %4.1f\n",
+                       nth,tx,ty,tz,ax,ay,az,costs[7],mincost,secCostTime/60);
+                fprintf(fp,"%6d %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf %8.4lf    %8.4lf %8.4lf %4.1f\n",
+                        nth,tx,ty,tz,ax,ay,az,costs[7],mincost,secCostTime/60);
+                fflush(stdout); fflush(fp);
+              }
+            }
+            if(PreOptFile)
+              fprintf(fpPreOpt,"%8.8lf %8.8lf %8.8lf %8.8lf %8.8lf %8.8lf    %8.8lf\n",
+                      tx,ty,tz,ax,ay,az,costs[7]);
+            nth ++;
+          }
         }
       }
     }
@@ -1225,6 +1242,15 @@ static int parse_commandline(int argc, char **argv) {
       sscanf(pargv[0],"%d",&nsubsampbrute);
       nargsused = 1;
     } 
+    else if(!strcasecmp(option, "--threads") || !strcasecmp(option, "--nthreads") ){
+      if(nargc < 1) argnerr(option,1);
+      int nthreads;
+      sscanf(pargv[0],"%d",&nthreads);
+      #ifdef HAVE_OPENMP
+      omp_set_num_threads(nthreads);
+      #endif
+      nargsused = 1;
+    } 
     else if (istringnmatch(option, "--nmax",0)) {
       if (nargc < 1) argnerr(option,1);
       sscanf(pargv[0],"%d",&nMaxItersPowell);
@@ -2083,32 +2109,95 @@ double VertexCost(double vctx, double vwm, double slope,
   return(c);
 }
 
-/*-------------------------------------------------------*/
-double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
-		     double *p, int dof, double *costs)
+/*-------------------------------------------------------
+  BBR cost evaluation. The wm and ctx surfaces are projected along the
+  normal once in MRISbbrSurfs(), so between evaluations only the
+  registration changes. The vertices that can contribute to the cost
+  (not ripped, on the subsampling grid, inside the cortex label, mask
+  and label) are gathered once into flat coordinate arrays, which are
+  then mapped into the mov and sampled a block of BBR_BLOCK_SIZE
+  vertices at a time. Each block accumulates its own sums, and the
+  blocks are added in order, so the costs do not depend on the number
+  of threads.
+  --------------------------------------------------------*/
+#define BBR_BLOCK_SIZE 1024
+
+typedef struct
+{
+  MRIS *wm, *ctx;        // surfaces the arrays were taken from
+  int nsubsamp;
+  std::vector<int> vno;  // vertex number of each point
+  std::vector<float> wx, wy, wz, cx, cy, cz;
+  std::vector<float> targcon; // empty if there is no target contrast
+} BBR_SURF;
+
+typedef struct
+{
+  int nhits;
+  double wm, wm2, ctx, ctx2, d, d2, c, c2;
+} BBR_SUMS;
+
+static BBR_SURF bbrlh, bbrrh;
+
+static void BBRsurfInit(BBR_SURF *bs, MRIS *wm, MRIS *ctx, MRI *CortexLabel,
+			MRI *segmask, MRI *label, MRI *TargCon)
+{
+  int n;
+
+  if(bs->wm == wm && bs->ctx == ctx && bs->nsubsamp == nsubsamp) return;
+
+  bs->wm = wm;
+  bs->ctx = ctx;
+  bs->nsubsamp = nsubsamp;
+  bs->vno.clear();
+  bs->wx.clear(); bs->wy.clear(); bs->wz.clear();
+  bs->cx.clear(); bs->cy.clear(); bs->cz.clear();
+  bs->targcon.clear();
+  for(n = 0; n < wm->nvertices; n += nsubsamp){
+    if(wm->vertices[n].ripflag != 0) continue;
+    if(CortexLabel && MRIgetVoxVal(CortexLabel,n,0,0,0) < 0.5) continue;
+    if(UseMask && MRIgetVoxVal(segmask,n,0,0,0) < 0.5) continue;
+    if(UseLabel && MRIgetVoxVal(label,n,0,0,0) < 0.5) continue;
+    bs->vno.push_back(n);
+    bs->wx.push_back(wm->vertices[n].x);
+    bs->wy.push_back(wm->vertices[n].y);
+    bs->wz.push_back(wm->vertices[n].z);
+    bs->cx.push_back(ctx->vertices[n].x);
+    bs->cy.push_back(ctx->vertices[n].y);
+    bs->cz.push_back(ctx->vertices[n].z);
+    if(TargCon) bs->targcon.push_back(MRIgetVoxVal(TargCon,n,0,0,0));
+  }
+}
+
+static int BBRnblocks(const BBR_SURF *bs)
+{
+  return((bs->vno.size() + BBR_BLOCK_SIZE - 1)/BBR_BLOCK_SIZE);
+}
+
+/*
+  BBRcanSample() - whether the points can be sampled here rather than
+  through MRIvol2surfVSM(). The voxel shift map, the spline and sinc
+  interpolation, and the per-vertex cost/contrast output still go
+  through MRIvol2surfVSM().
+*/
+static int BBRcanSample(void)
 {
-  static MRI *vlhwm=NULL, *vlhctx=NULL, *vrhwm=NULL, *vrhctx=NULL;
-  extern MRI *lhcost, *rhcost;
-  extern MRI *lhcon, *rhcon;
   extern char *lhcostfile, *rhcostfile;
   extern char *lhconfile, *rhconfile;
-  extern int UseMask, UseLH, UseRH;
-  extern MRI *lhsegmask, *rhsegmask;
-  extern MRI *lhCortexLabel, *rhCortexLabel;
-  extern MRIS *lhwm, *rhwm, *lhctx, *rhctx;
-  extern int PenaltySign;
-  extern double PenaltySlope;
-  extern int nsubsamp;
-  extern int interpcode;
-  double angles[3],d,dsum,dsum2,dstd,dmean,vwm,vctx,c,csum,csum2,cstd,cmean,val;
-  MATRIX *Mrot=NULL, *Mtrans=NULL, *Mscale=NULL, *Mshear=NULL;
-  int nhits,n;
-  //FILE *fp;
+  if(vsm) return(0);
+  if(interpcode != SAMPLE_TRILINEAR && interpcode != SAMPLE_NEAREST) return(0);
+  if(lhcostfile || lhcost0file || lhconfile) return(0);
+  if(rhcostfile || rhcost0file || rhconfile) return(0);
+  return(1);
+}
 
-  if(R==NULL){
-    printf("ERROR: GetSurfCosts(): R cannot be NULL\n");
-    return(NULL);
-  }
+/*
+  BBRparams2R() - R = Mshear*Mscale*Mtrans*Mrot*R0
+*/
+static MATRIX *BBRparams2R(MATRIX *R0, double *p, int dof, MATRIX *R)
+{
+  double angles[3];
+  MATRIX *Mrot=NULL, *Mtrans=NULL, *Mscale=NULL, *Mshear=NULL;
 
   Mtrans = MatrixIdentity(4,NULL);
   if(dof > 0){
@@ -2138,7 +2227,6 @@ double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
     Mshear->rptr[2][3] = p[11];
   }
 
-  // R = Mshear*Mscale*Mtrans*Mrot*R0
   R = MatrixMultiply(Mrot,R0,R);
   R = MatrixMultiply(Mtrans,R,R);
   R = MatrixMultiply(Mscale,R,R);
@@ -2148,113 +2236,224 @@ double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
   MatrixFree(&Mscale);
   MatrixFree(&Mshear);
 
-  //printf("Trans: %g %g %g\n",p[0],p[1],p[2]);
-  //printf("Rot:   %g %g %g\n",p[3],p[4],p[5]);
-  //printf("Scale: %g %g %g\n",p[6],p[7],p[8]);
+  return(R);
+}
 
-  if(UseLH){
-    vlhwm  = MRIvol2surfVSM(mov,R,lhwm,  vsm, interpcode, NULL, 0, 0, nsubsamp, vlhwm, pedir);
-    vlhctx = MRIvol2surfVSM(mov,R,lhctx, vsm, interpcode, NULL, 0, 0, nsubsamp, vlhctx, pedir);
-    if(lhcost == NULL) lhcost = MRIclone(vlhctx,NULL);
-    if(lhcon == NULL)  lhcon  = MRIclone(vlhctx,NULL);
+/*
+  BBRras2vox() - surface RAS to mov voxel for registration R, the
+  same matrix MRIvol2surfVSM() uses.
+*/
+static void BBRras2vox(MRI *mov, MATRIX *R, AffineMatrix *A)
+{
+  MATRIX *vox2ras, *ras2vox;
+  vox2ras = MRIxfmCRS2XYZtkreg(mov);
+  ras2vox = MatrixInverse(vox2ras, NULL);
+  MatrixMultiply(ras2vox, R, ras2vox);
+  SetAffineMatrix(A, ras2vox);
+  MatrixFree(&vox2ras);
+  MatrixFree(&ras2vox);
+}
+
+/*
+  BBRsamplePoints() - samples mov at npoints surface points. Each
+  coordinate is computed with the operations of AffineMV() in the same
+  order, and points whose nearest voxel is outside the volume are 0,
+  so the values are those MRIvol2surfVSM() gives.
+*/
+static void BBRsamplePoints(MRI *mov, const AffineMatrix *A, const float *x,
+			    const float *y, const float *z, int npoints, float *val)
+{
+  const float *m = A->mat;
+  float fcol[BBR_BLOCK_SIZE], frow[BBR_BLOCK_SIZE], fslc[BBR_BLOCK_SIZE];
+  int n, icol, irow, islc;
+
+  for(n = 0; n < npoints; n++){
+    fcol[n] = m[0]*x[n] + m[4]*y[n] + m[8]*z[n]  + m[12];
+    frow[n] = m[1]*x[n] + m[5]*y[n] + m[9]*z[n]  + m[13];
+    fslc[n] = m[2]*x[n] + m[6]*y[n] + m[10]*z[n] + m[14];
   }
-  if(UseRH){
-    vrhwm  = MRIvol2surfVSM(mov,R,rhwm,  vsm, interpcode, NULL, 0, 0, nsubsamp, vrhwm, pedir);
-    vrhctx = MRIvol2surfVSM(mov,R,rhctx, vsm, interpcode, NULL, 0, 0, nsubsamp, vrhctx, pedir);
-    if(rhcost == NULL) rhcost = MRIclone(vrhctx,NULL);
-    if(rhcon == NULL)  rhcon  = MRIclone(vrhctx,NULL);
+
+  for(n = 0; n < npoints; n++){
+    val[n] = 0;
+    icol = nint(fcol[n]);
+    irow = nint(frow[n]);
+    islc = nint(fslc[n]);
+    if(irow < 0 || irow >= mov->height || icol < 0 || icol >= mov->width || islc < 0 || islc >= mov->depth)
+      continue;
+    if(interpcode == SAMPLE_TRILINEAR)
+      MRIsampleSeqVolume(mov, fcol[n], frow[n], fslc[n], &val[n], 0, 0);
+    else
+      val[n] = MRIgetVoxVal(mov, icol, irow, islc, 0);
   }
+}
 
-  for(n = 0; n < 8; n++) costs[n] = 0;
+/*
+  BBRblockSums() - accumulates the cost of the nthblock-th block of
+  points. If vwmvol is non-NULL the values are taken from the
+  MRIvol2surfVSM() output instead of being sampled, and the cost and
+  contrast are stored in costvol and convol if they are non-NULL.
+*/
+static void BBRblockSums(const BBR_SURF *bs, int nthblock, MRI *mov, const AffineMatrix *A,
+			 MRI *vwmvol, MRI *vctxvol, MRI *costvol, MRI *convol, BBR_SUMS *s)
+{
+  float vwm[BBR_BLOCK_SIZE], vctx[BBR_BLOCK_SIZE];
+  double c, d, val;
+  int n, n0, npoints;
 
-  dsum = 0.0;
-  dsum2 = 0.0;
-  csum = 0.0;
-  csum2 = 0.0;
-  nhits = 0;
+  n0 = nthblock*BBR_BLOCK_SIZE;
+  npoints = MIN(BBR_BLOCK_SIZE, (int)bs->vno.size() - n0);
 
-  //fp = fopen("tmp.dat","w");
-  if(UseLH){
-    for(n = 0; n < lhwm->nvertices; n += nsubsamp){
-      if (lhwm->vertices[n].ripflag != 0) continue ;
-      if(lhcostfile || lhcost0file) MRIsetVoxVal(lhcost,n,0,0,0,0.0);
-      if(lhconfile)  MRIsetVoxVal(lhcon,n,0,0,0,0.0);
-      if(lhCortexLabel && MRIgetVoxVal(lhCortexLabel,n,0,0,0) < 0.5) continue;
-      if(UseMask && MRIgetVoxVal(lhsegmask,n,0,0,0) < 0.5) continue;
-      if(UseLabel && MRIgetVoxVal(lhlabel,n,0,0,0) < 0.5) continue;
-      vwm = MRIgetVoxVal(vlhwm,n,0,0,0);
-      if(vwm == 0.0 && ExcludeZeroVoxels) continue;
-      vctx = MRIgetVoxVal(vlhctx,n,0,0,0);
-      if(vctx == 0.0 && ExcludeZeroVoxels) continue;
-      nhits++;
-      costs[1] += vwm;
-      costs[2] += (vwm*vwm);
-      costs[4] += vctx;
-      costs[5] += (vctx*vctx);
-      c = VertexCost(vctx, vwm, PenaltySlope, PenaltyCenter, PenaltySign, &d);
-      if(TargConLH){
-	val = MRIgetVoxVal(TargConLH,n,0,0,0);
-	c = (d-val)*(d-val);
-      }
-      dsum += d;
-      dsum2 += (d*d);
-      csum += c;
-      csum2 += (c*c);
-      if(lhcostfile || lhcost0file) MRIsetVoxVal(lhcost,n,0,0,0,c);
-      if(lhconfile)  MRIsetVoxVal(lhcon,n,0,0,0,d);
-      //fprintf(fp,"%6d %lf %lf %lf %lf %lf %lf %lf\n",nhits,vwm,vctx,d,dsum,a,c,csum);
+  if(vwmvol){
+    for(n = 0; n < npoints; n++){
+      vwm[n]  = MRIgetVoxVal(vwmvol,  bs->vno[n0+n],0,0,0);
+      vctx[n] = MRIgetVoxVal(vctxvol, bs->vno[n0+n],0,0,0);
     }
   }
-  if(UseRH){
-    for(n = 0; n < rhwm->nvertices; n += nsubsamp){
-      if (rhwm->vertices[n].ripflag != 0)
-        continue ;
-      if(rhcostfile || rhcost0file) MRIsetVoxVal(rhcost,n,0,0,0,0.0);
-      if(rhconfile)  MRIsetVoxVal(rhcon,n,0,0,0,0.0);
-      if(rhCortexLabel && MRIgetVoxVal(rhCortexLabel,n,0,0,0) < 0.5) continue;
-      if(UseMask && MRIgetVoxVal(rhsegmask,n,0,0,0) < 0.5) continue;
-      if(UseLabel && MRIgetVoxVal(rhlabel,n,0,0,0) < 0.5) continue;
-      vwm = MRIgetVoxVal(vrhwm,n,0,0,0);
-      if(vwm == 0.0 && ExcludeZeroVoxels) continue;
-      vctx = MRIgetVoxVal(vrhctx,n,0,0,0);
-      if(vctx == 0.0 && ExcludeZeroVoxels) continue;
-      nhits++;
-      costs[1] += vwm;
-      costs[2] += (vwm*vwm);
-      costs[4] += vctx;
-      costs[5] += (vctx*vctx);
-      c = VertexCost(vctx, vwm, PenaltySlope, PenaltyCenter, PenaltySign, &d);
-      if(TargConRH){
-	val = MRIgetVoxVal(TargConRH,n,0,0,0);
-	c = (d-val)*(d-val);
-      }
-      dsum += d;
-      dsum2 += (d*d);
-      csum += c;
-      csum2 += (c*c);
-      if(rhcostfile || rhcost0file) MRIsetVoxVal(rhcost,n,0,0,0,c);
-      if(rhconfile)  MRIsetVoxVal(rhcon,n,0,0,0,d);
-      //fprintf(fp,"%6d %lf %lf %lf %lf %lf %lf %lf\n",nhits,vwm,vctx,d,dsum,a,c,csum);
-    }
-    //fclose(fp);
+  else {
+    BBRsamplePoints(mov, A, &bs->wx[n0], &bs->wy[n0], &bs->wz[n0], npoints, vwm);
+    BBRsamplePoints(mov, A, &bs->cx[n0], &bs->cy[n0], &bs->cz[n0], npoints, vctx);
+  }
+
+  memset(s, 0, sizeof(BBR_SUMS));
+  for(n = 0; n < npoints; n++){
+    if(vwm[n] == 0.0 && ExcludeZeroVoxels) continue;
+    if(vctx[n] == 0.0 && ExcludeZeroVoxels) continue;
+    s->nhits++;
+    s->wm  += vwm[n];
+    s->wm2 += ((double)vwm[n]*vwm[n]);
+    s->ctx  += vctx[n];
+    s->ctx2 += ((double)vctx[n]*vctx[n]);
+    c = VertexCost(vctx[n], vwm[n], PenaltySlope, PenaltyCenter, PenaltySign, &d);
+    if(!bs->targcon.empty()){
+      val = bs->targcon[n0+n];
+      c = (d-val)*(d-val);
+    }
+    s->d  += d;
+    s->d2 += (d*d);
+    s->c  += c;
+    s->c2 += (c*c);
+    if(costvol) MRIsetVoxVal(costvol,bs->vno[n0+n],0,0,0,c);
+    if(convol)  MRIsetVoxVal(convol, bs->vno[n0+n],0,0,0,d);
   }
+}
+
+/*
+  BBRsums2costs() - adds the block sums in order and fills costs[8]
+*/
+static void BBRsums2costs(const BBR_SUMS *s, int nblocks, double *costs)
+{
+  double dsum=0,dsum2=0,csum=0,csum2=0;
+  int nhits=0, n;
 
-  dmean = dsum/nhits;
-  dstd  = sum2stddev(dsum,dsum2,nhits);
-  //printf("dsum=%g, dsum2=%g, dstd=%g\n",dsum,dsum2,dstd);
-  cmean = csum/nhits;
-  cstd  = sum2stddev(csum,csum2,nhits);
-  //printf("csum=%g, csum2=%g, cstd=%g\n",csum,csum2,cstd);
+  for(n = 0; n < 8; n++) costs[n] = 0;
+  for(n = 0; n < nblocks; n++){
+    nhits += s[n].nhits;
+    costs[1] += s[n].wm;
+    costs[2] += s[n].wm2;
+    costs[4] += s[n].ctx;
+    costs[5] += s[n].ctx2;
+    dsum  += s[n].d;
+    dsum2 += s[n].d2;
+    csum  += s[n].c;
+    csum2 += s[n].c2;
+  }
 
   costs[0] = nhits;
   costs[2] = sum2stddev(costs[1],costs[2],nhits); // wm std
   costs[1] = costs[1]/nhits; // wm mean
-  costs[3] = dstd; // std in percent contrast
+  costs[3] = sum2stddev(dsum,dsum2,nhits); // std in percent contrast
   costs[5] = sum2stddev(costs[4],costs[5],nhits); // ctx std
   costs[4] = costs[4]/nhits; // ctx mean
-  costs[6] = dmean; // percent contrast
-  costs[7] = cmean;
-  if(nhits == 0) costs[7] = 10.0; 
+  costs[6] = dsum/nhits; // percent contrast
+  costs[7] = csum/nhits;
+  if(nhits == 0) costs[7] = 10.0;
+}
+
+static void BBRsurfsInit(void)
+{
+  extern MRI *lhsegmask, *rhsegmask;
+  extern MRI *lhCortexLabel, *rhCortexLabel;
+  extern MRIS *lhwm, *rhwm, *lhctx, *rhctx;
+  if(UseLH) BBRsurfInit(&bbrlh, lhwm, lhctx, lhCortexLabel, lhsegmask, lhlabel, TargConLH);
+  if(UseRH) BBRsurfInit(&bbrrh, rhwm, rhctx, rhCortexLabel, rhsegmask, rhlabel, TargConRH);
+}
+
+/*-------------------------------------------------------*/
+double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
+		     double *p, int dof, double *costs)
+{
+  static MRI *vlhwm=NULL, *vlhctx=NULL, *vrhwm=NULL, *vrhctx=NULL;
+  extern MRI *lhcost, *rhcost;
+  extern MRI *lhcon, *rhcon;
+  extern char *lhcostfile, *rhcostfile;
+  extern char *lhconfile, *rhconfile;
+  extern int UseLH, UseRH;
+  extern MRIS *lhwm, *rhwm, *lhctx, *rhctx;
+  AffineMatrix A;
+  int nlhblocks=0, nrhblocks=0, nblocks, n, fromvol;
+  std::vector<BBR_SUMS> sums;
+
+  if(R==NULL){
+    printf("ERROR: GetSurfCosts(): R cannot be NULL\n");
+    return(NULL);
+  }
+
+  R = BBRparams2R(R0, p, dof, R);
+
+  //printf("Trans: %g %g %g\n",p[0],p[1],p[2]);
+  //printf("Rot:   %g %g %g\n",p[3],p[4],p[5]);
+  //printf("Scale: %g %g %g\n",p[6],p[7],p[8]);
+
+  BBRsurfsInit();
+  if(UseLH) nlhblocks = BBRnblocks(&bbrlh);
+  if(UseRH) nrhblocks = BBRnblocks(&bbrrh);
+  nblocks = nlhblocks + nrhblocks;
+  sums.resize(nblocks);
+
+  fromvol = !BBRcanSample();
+  if(fromvol){
+    if(UseLH){
+      vlhwm  = MRIvol2surfVSM(mov,R,lhwm,  vsm, interpcode, NULL, 0, 0, nsubsamp, vlhwm, pedir);
+      vlhctx = MRIvol2surfVSM(mov,R,lhctx, vsm, interpcode, NULL, 0, 0, nsubsamp, vlhctx, pedir);
+      if(lhcost == NULL) lhcost = MRIclone(vlhctx,NULL);
+      if(lhcon == NULL)  lhcon  = MRIclone(vlhctx,NULL);
+      for(n = 0; n < lhwm->nvertices; n += nsubsamp){
+	if (lhwm->vertices[n].ripflag != 0) continue ;
+	if(lhcostfile || lhcost0file) MRIsetVoxVal(lhcost,n,0,0,0,0.0);
+	if(lhconfile)  MRIsetVoxVal(lhcon,n,0,0,0,0.0);
+      }
+    }
+    if(UseRH){
+      vrhwm  = MRIvol2surfVSM(mov,R,rhwm,  vsm, interpcode, NULL, 0, 0, nsubsamp, vrhwm, pedir);
+      vrhctx = MRIvol2surfVSM(mov,R,rhctx, vsm, interpcode, NULL, 0, 0, nsubsamp, vrhctx, pedir);
+      if(rhcost == NULL) rhcost = MRIclone(vrhctx,NULL);
+      if(rhcon == NULL)  rhcon  = MRIclone(vrhctx,NULL);
+      for(n = 0; n < rhwm->nvertices; n += nsubsamp){
+	if (rhwm->vertices[n].ripflag != 0) continue ;
+	if(rhcostfile || rhcost0file) MRIsetVoxVal(rhcost,n,0,0,0,0.0);
+	if(rhconfile)  MRIsetVoxVal(rhcon,n,0,0,0,0.0);
+      }
+    }
+  }
+  else BBRras2vox(mov, R, &A);
+
+  ROMP_PF_begin
+  #ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+  #endif
+  for(n = 0; n < nblocks; n++){
+    ROMP_PFLB_begin
+    if(n < nlhblocks)
+      BBRblockSums(&bbrlh, n, mov, &A, fromvol ? vlhwm : NULL, vlhctx,
+		   (lhcostfile || lhcost0file) ? lhcost : NULL, lhconfile ? lhcon : NULL, &sums[n]);
+    else
+      BBRblockSums(&bbrrh, n-nlhblocks, mov, &A, fromvol ? vrhwm : NULL, vrhctx,
+		   (rhcostfile || rhcost0file) ? rhcost : NULL, rhconfile ? rhcon : NULL, &sums[n]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  BBRsums2costs(sums.data(), nblocks, costs);
 
   if(UseLH){
     //MRIfree(&vlhwm);
@@ -2293,6 +2492,63 @@ double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
   return(costs);
 }
 
+/*-------------------------------------------------------
+  GetSurfCostsBatch() - costs of nparams registrations, for the brute
+  force search. params is nparams x 12 (the p of GetSurfCosts() for
+  each registration), costs is nparams x 8. The registrations are
+  scored in parallel, each one with the same blocks and in the same
+  order as GetSurfCosts(), so the costs are identical to those of
+  calling it for each registration.
+  --------------------------------------------------------*/
+int GetSurfCostsBatch(MRI *mov, MATRIX *R0, int nparams, double *params,
+		      int dof, double *costs)
+{
+  std::vector<AffineMatrix> A(nparams);
+  MATRIX *R;
+  int nlhblocks=0, nrhblocks=0, nblocks, k;
+
+  R = MatrixAlloc(4,4,MATRIX_REAL);
+  if(!BBRcanSample()){
+    for(k = 0; k < nparams; k++)
+      GetSurfCosts(mov, NULL, R0, R, &params[k*12], dof, &costs[k*8]);
+    MatrixFree(&R);
+    return(0);
+  }
+
+  // the matrix routines are not used inside the parallel loop
+  for(k = 0; k < nparams; k++){
+    R = BBRparams2R(R0, &params[k*12], dof, R);
+    BBRras2vox(mov, R, &A[k]);
+  }
+  MatrixFree(&R);
+
+  BBRsurfsInit();
+  if(UseLH) nlhblocks = BBRnblocks(&bbrlh);
+  if(UseRH) nrhblocks = BBRnblocks(&bbrrh);
+  nblocks = nlhblocks + nrhblocks;
+
+  ROMP_PF_begin
+  #ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+  #endif
+  for(k = 0; k < nparams; k++){
+    ROMP_PFLB_begin
+    std::vector<BBR_SUMS> sums(nblocks);
+    int n;
+    for(n = 0; n < nblocks; n++){
+      if(n < nlhblocks)
+	BBRblockSums(&bbrlh, n, mov, &A[k], NULL, NULL, NULL, NULL, &sums[n]);
+      else
+	BBRblockSums(&bbrrh, n-nlhblocks, mov, &A[k], NULL, NULL, NULL, NULL, &sums[n]);
+    }
+    BBRsums2costs(sums.data(), nblocks, &costs[k*8]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return(0);
+}
+
 /*---------------------------------------------------------*/
 int MinPowell(MRI *mov, MRI *notused, MATRIX *R, double *params,
 	      int dof, double ftol, double linmintol, int nmaxiters,
@@ -91,7 +91,7 @@ static void dump_options(FILE *fp);
 static int  singledash(char *flag);
 
 
-int MRIsegCount(MRI *seg, int id, int frame);
+int MRIsegCount(MRI *seg, const std::vector<MRI_BRICK> &bricks, int id, int frame);
 STATSUMENTRY *LoadStatSumFile(char *fname, int *nsegid);
 int DumpStatSumTable(STATSUMENTRY *StatSumTable, int nsegid);
 int CountEdits(char *subject, char *outfile);
@@ -818,6 +818,9 @@ int main(int argc, char **argv)
   fflush(stdout);
 
   DoContinue=0;nx=0;skip=0;n0=0;vol=0;nhits=0;c=0;min=0.0;max=0.0;range=0.0;mean=0.0;std=0.0;snr=0.0;
+  // most of a segmentation is 0, so each count only has to visit the bricks with labels
+  std::vector<MRI_BRICK> SegBricks;
+  if (!mris && seg) SegBricks = MRInonzeroBricks(seg, 0);
 
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
@@ -861,13 +864,13 @@ int main(int argc, char **argv)
       {
         if (pvvol == NULL)
         {
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = MRIsegCount(seg, SegBricks, StatSumTable[n].id, 0);
           vol = nhits*voxelvolume;
         }
         else
         {
           vol = MRIvoxelsInLabelWithPartialVolumeEffects(seg, pvvol, StatSumTable[n].id, NULL, NULL);
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = MRIsegCount(seg, SegBricks, StatSumTable[n].id, 0);
 //          nhits = nint(vol/voxelvolume);
         }
       }  // if (!mris)
@@ -2253,26 +2256,39 @@ static int singledash(char *flag)
 
 /* ----------------------------------------------------------
    MRIsegCount() - returns the number of times the given
-   segmentation id appears in the volume.
+   segmentation id appears in the volume. bricks must be
+   MRInonzeroBricks(seg, frame); every voxel outside of
+   them is 0.
    --------------------------------------------------------- */
-int MRIsegCount(MRI *seg, int id, int frame)
+int MRIsegCount(MRI *seg, const std::vector<MRI_BRICK> &bricks, int id, int frame)
 {
   int nhits, v, c,r,s;
+  size_t b, nbrickvox;
   nhits = 0;
-  for (c=0; c < seg->width; c++)
+  nbrickvox = 0;
+  for (b=0; b < bricks.size(); b++)
   {
-    for (r=0; r < seg->height; r++)
+    const MRI_BRICK &brick = bricks[b];
+    nbrickvox += (size_t)(brick.x1-brick.x0)*(brick.y1-brick.y0)*(brick.z1-brick.z0);
+    for (s=brick.z0; s < brick.z1; s++)
     {
-      for (s=0; s < seg->depth; s++)
+      for (r=brick.y0; r < brick.y1; r++)
       {
-        v = (int) MRIgetVoxVal(seg,c,r,s,frame);
-        if (v == id)
+        for (c=brick.x0; c < brick.x1; c++)
         {
-          nhits ++;
+          v = (int) MRIgetVoxVal(seg,c,r,s,frame);
+          if (v == id)
+          {
+            nhits ++;
+          }
         }
       }
     }
   }
+  if (id == 0)
+  {
+    nhits += (size_t)seg->width*seg->height*seg->depth - nbrickvox;
+  }
   return(nhits);
 }
 /*------------------------------------------------------------*/
@@ -425,6 +425,7 @@ int  reshape3d=0;
 const char *mapmethod = "nnfr";
 
 int UseHash = 1;
+char *RegOpFile = NULL;
 int framesave = 0;
 float IcoRadius = 100.0;
 int nthstep, nnbrs, nthnbr, nbrvtx, frame;
@@ -1034,7 +1035,14 @@ int main(int argc, char **argv)
       MRIS *SurfRegList[2];
       SurfRegList[0] = SrcSurfReg;
       SurfRegList[1] = TrgSurfReg;
-      TrgVals = MRISapplyReg(SrcVals, SurfRegList, 2, ReverseMapFlag,jac,UseHash);
+      if(RegOpFile){
+        MRIS_REG_OPERATOR *RegOp = MRISreadOrBuildRegOperator(RegOpFile, SurfRegList, 2, ReverseMapFlag,jac,UseHash);
+        if(RegOp == NULL) exit(1);
+        TrgVals = MRISapplyRegOperator(RegOp, SrcVals, NULL);
+        MRISfreeRegOperator(&RegOp);
+      }
+      else
+        TrgVals = MRISapplyReg(SrcVals, SurfRegList, 2, ReverseMapFlag,jac,UseHash);
     }
 
   } else {
@@ -1317,6 +1325,12 @@ static int parse_commandline(int argc, char **argv)
       }
       sscanf(pargv[0],"%d",&SynthSeed);
       nargsused = 1;
+    } else if (!strcmp(option, "--reg-op")) {
+      if (nargc < 1) {
+        argnerr(option,1);
+      }
+      RegOpFile = pargv[0];
+      nargsused = 1;
     } else if (!strcmp(option, "--sd")) {
       if (nargc < 1) {
         argnerr(option,1);
@@ -1859,6 +1873,7 @@ static void print_usage(void)
   printf("   --trghemi    hemisphere : (lh or rh) for target\n");
   printf("   --dual-hemi  : assume source ?h.?h.surfreg file name\n");
   printf("   --jac  : turn on jacobian correction, needed when applying to area or volume \n");
+  printf("   --reg-op opfile : reuse the source-to-target mapping saved in opfile (created if needed)\n");
   printf("   --surfreg    source and targ surface registration (sphere.reg)  \n");
   printf("   --srcsurfreg source surface registration (sphere.reg)  \n");
   printf("   --trgsurfreg target surface registration (sphere.reg)  \n");
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/time.h>
@@ -138,7 +139,8 @@ BasinCell;
 
 typedef struct Bound
 {
-  unsigned char x,y,z,val;
+  int x,y,z;
+  unsigned char val;
   struct Bound *next;
 }
 Bound;
@@ -318,13 +320,16 @@ typedef struct
 
   Bound *Bound1,*Bound2;
 
+  // Basin[k][j] points into one width*height*depth array of cells
   Cell *** Basin;
 
-  Coord** Table[256];
+  // non-zero voxels inside the 2 voxel border as 32-bit linear indices,
+  // bucketed by grey value: those of value k are Sorted[bucket[k]..bucket[k+1])
+  unsigned int *Sorted;
+  unsigned long bucket[257];
 
   unsigned char intbasin[256];
   unsigned long tabdim[256];
-  unsigned long sqrdim[256];
   unsigned long count[256];
 
   Coord* T1Table;
@@ -377,7 +382,6 @@ BasinCell* CreateBasinCell(int val, unsigned long size,
 int Decision(STRIP_PARMS *parms,  MRI_variables *MRI_var);
 void FindMainWmComponent(MRI_variables *MRI_var);
 int CharSorting(MRI_variables *MRI_var);
-int sqroot(int r);
 int Analyze(STRIP_PARMS *parms,MRI_variables *MRI_var);
 Cell* FindBasin(Cell *cell);
 int Lookat(int,int,int,unsigned char,int*,Cell**,int*,Cell* adtab[27],
@@ -385,12 +389,12 @@ int Lookat(int,int,int,unsigned char,int*,Cell**,int*,Cell* adtab[27],
 int Test(Coord crd,STRIP_PARMS *parms,MRI_variables *MRI_var);
 Cell* TypeVoxel(Cell *cell);
 int PostAnalyze(STRIP_PARMS *parms,MRI_variables *MRI_var);
-int Merge(unsigned char i,unsigned char j,unsigned char k,
+int Merge(int i,int j,int k,
           int val,int *n,MRI_variables *MRI_var);
 int AddVoxel(MRI_variables *MRI_var);
-int AroundCell(unsigned char i,unsigned char j,unsigned char k,
+int AroundCell(int i,int j,int k,
                MRI_variables *MRI_var);
-int MergeRoutine(unsigned char,unsigned char,unsigned char,int,int*,
+int MergeRoutine(int,int,int,int,int*,
                  MRI_variables *MRI_var);
 int FreeMem(MRI_variables *MRI_var);
 int Save(MRI_variables *MRI_var);
@@ -2032,34 +2036,36 @@ void FindMainWmComponent(MRI_variables *MRI_var)
 void Allocation(MRI_variables *MRI_var)
 {
   int k,j;
+  Cell **rows,*cells;
+
+  if ((double)MRI_var->width*MRI_var->height*MRI_var->depth > (double)UINT_MAX)
+  {
+    Error("volume too large for 32-bit voxel indices\n");
+  }
 
+  // one block of cells, addressed through per-slice row pointers
   MRI_var->Basin=(Cell ***)malloc(MRI_var->depth*sizeof(Cell **));
-  if (!MRI_var->Basin)
+  rows=(Cell **)malloc((size_t)MRI_var->depth*MRI_var->height*sizeof(Cell*));
+  cells=(Cell *)calloc((size_t)MRI_var->depth*MRI_var->height*MRI_var->width,
+                       sizeof(Cell));
+  if (!MRI_var->Basin || !rows || !cells)
   {
-    Error("first allocation  failed\n");
+    Error("basin allocation failed\n");
   }
 
   for (k=0; k<MRI_var->depth; k++)
   {
-    MRI_var->Basin[k]=(Cell **)malloc(MRI_var->height*sizeof(Cell*));
-    if (!MRI_var->Basin[k])
-    {
-      Error("second allocation  failed\n");
-    }
+    MRI_var->Basin[k]=rows+(size_t)k*MRI_var->height;
     for (j=0; j<MRI_var->height; j++)
     {
-      MRI_var->Basin[k][j]=(Cell*)calloc(MRI_var->width,sizeof(Cell));
-      if (!MRI_var->Basin[k][j])
-      {
-        Error("third alloc failed\n");
-      }
+      MRI_var->Basin[k][j]=cells+((size_t)k*MRI_var->height+j)*MRI_var->width;
     }
   }
+  MRI_var->Sorted=NULL;
 
   for (k=0; k<256; k++)
   {
     MRI_var->tabdim[k]=0;
-    MRI_var->sqrdim[k]=0;
     MRI_var->count[k]=0;
     MRI_var->intbasin[k]=k;
     MRI_var->gmnumber[k]=0;
@@ -3334,7 +3340,6 @@ int Decision(STRIP_PARMS *parms,  MRI_variables *MRI_var)
     for (k=0; k<256; k++)
     {
       MRI_var->tabdim[k]=0;
-      MRI_var->sqrdim[k]=0;
       MRI_var->count[k]=0;
       MRI_var->intbasin[k]=k;
       MRI_var->gmnumber[k]=0;
@@ -3353,78 +3358,77 @@ int Decision(STRIP_PARMS *parms,  MRI_variables *MRI_var)
   ------------------------------------------------------*/
 int CharSorting(MRI_variables *MRI_var)
 {
-  int i,j,k,u,v;
-  int l;
-  ldiv_t ld;
-  BUFTYPE *pb;
-  unsigned char val;
+  const int width=MRI_var->width,height=MRI_var->height,depth=MRI_var->depth;
+  const int nslabs=MAX(depth-4,1);
+  int k,val;
+  unsigned long n;
 
-  /*allocating an 256 table of Coord** in order to process the Sorting*/
+  /* counting sort into one array of linear indices. Each slice is
+     counted and then scattered independently, the per slice offsets
+     keeping the voxels of a grey value in the same (k,j,i) order as a
+     serial scan, which is the order Analyze visits them in */
+  std::vector<unsigned long> slabcount((size_t)nslabs*256,0);
 
-  for (k=1; k<MRI_var->Imax+1; k++)
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for
+#endif
+  for (k=2; k<depth-2; k++)
   {
-    l=sqroot(MRI_var->tabdim[k]); // sqrt of the population at grey=k
-    MRI_var->sqrdim[k]=l;
-    MRI_var->Table[k]=(Coord**)malloc(l*sizeof(Coord*));
-    // each Table is a 2d array of Coord
-    if (!MRI_var->Table[k])
-    {
-      Error("Allocation first Table Echec");
-    }
-    // array is l x l
-    for (u=0; u<l; u++)
+    unsigned long *c=&slabcount[(size_t)(k-2)*256];
+    for (int j=2; j<height-2; j++)
     {
-      MRI_var->Table[k][u]=(Coord*)calloc(l,sizeof(Coord));
-      if (!MRI_var->Table[k][u])
+      const BUFTYPE *pb=&MRIvox(MRI_var->mri_src,2,j,k);
+      for (int i=2; i<width-2; i++)
       {
-        Error("Allocation second Table Echec");
+        c[*pb++]++;
       }
     }
   }
 
-  /*Sorting itself*/
-  // each Table[k] (k=grey value) is a 2D array.  each element of 2D array has
-  // the coordinate of a voxel.
-  // filling 2d array with quot and rem of count
-  // why 2d array?  Maybe this programmer thought that the length of column is
-  // too big to fit in the linear array.  Unnecessary
-  for (k=2; k<MRI_var->depth-2; k++)
-    for (j=2; j<MRI_var->height-2; j++)
+  // exclusive prefix over grey values, then over slices within a value.
+  // 0 intensity voxels are never flooded and are left out
+  n=0;
+  MRI_var->bucket[0]=0;
+  MRI_var->count[0]=0;
+  for (val=1; val<256; val++)
+  {
+    MRI_var->bucket[val]=n;
+    for (k=0; k<nslabs; k++)
     {
-      pb=&MRIvox(MRI_var->mri_src,0,j,k);
-      pb+=2;
-      for (i=2; i<MRI_var->width-2; i++)
-      {
-        val=*pb++;
-        if (val)
-        {
-          l=MRI_var->count[val]++;
-          // count[] is a histogram of non-zero grey values
-          ld=ldiv(l,MRI_var->sqrdim[val]);
-          u=ld.quot;
-          v=ld.rem;
-          MRI_var->Table[val][u][v][0]=i;
-          MRI_var->Table[val][u][v][1]=j;
-          MRI_var->Table[val][u][v][2]=k;
-        }
-      }
+      const unsigned long m=slabcount[(size_t)k*256+val];
+      slabcount[(size_t)k*256+val]=n;
+      n+=m;
     }
-  return 0;
-}
+    MRI_var->count[val]=n-MRI_var->bucket[val];
+  }
+  MRI_var->bucket[256]=n;
 
-/*sqrt routine*/
-int sqroot(int r)
-{
-  int i;
-  i=(int)sqrt(r);
-  if (i*i<r)
+  MRI_var->Sorted=(unsigned int*)malloc(MAX(n,1)*sizeof(unsigned int));
+  if (!MRI_var->Sorted)
   {
-    return (i+1);
+    Error("Allocation of the sorted voxels failed");
   }
-  else
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for
+#endif
+  for (k=2; k<depth-2; k++)
   {
-    return i;
+    unsigned long *c=&slabcount[(size_t)(k-2)*256];
+    for (int j=2; j<height-2; j++)
+    {
+      const BUFTYPE *pb=&MRIvox(MRI_var->mri_src,2,j,k);
+      const unsigned int row=((unsigned int)k*height+j)*width;
+      for (int i=2; i<width-2; i++, pb++)
+      {
+        if (*pb)
+        {
+          MRI_var->Sorted[c[*pb]++]=row+i;
+        }
+      }
+    }
   }
+  return 0;
 }
 
 /*******************************ANALYZE****************************/
@@ -3433,39 +3437,27 @@ int sqroot(int r)
 int Analyze(STRIP_PARMS *parms,MRI_variables *MRI_var)
 {
   int pos;
-  int u,v,n,d;
-  int l;
-  ldiv_t ld;
+  int n;
+  unsigned long l;
+  unsigned int idx;
+  Coord crd;
+  const unsigned int width=MRI_var->width,height=MRI_var->height;
   double vol_elt;
 
   MRI_var->basinnumber=0;
   MRI_var->basinsize=0;
 
-  n=MRI_var->sqrdim[MRI_var->Imax]; // the sqrt of the population at Imax
-  for (u=0; u<n; u++)
-  {
-    free(MRI_var->Table[MRI_var->Imax][u]);
-  }
-  free(MRI_var->Table[MRI_var->Imax]);
-
+  // flood from the brightest value down; the voxels at Imax are the seeds
   for (pos=MRI_var->Imax-1; pos>0; pos--)
   {
-    l=0;
-    d=MRI_var->tabdim[pos];  // the population at pos
-    n=MRI_var->sqrdim[pos];  // the sqrt of the d
-    while (l<d)
-    {
-      ld=ldiv(l,n);
-      u=ld.quot;
-      v=ld.rem;
-      Test(MRI_var->Table[pos][u][v],parms,MRI_var);
-      l++;
-    }
-    for (u=0; u<n; u++)
+    for (l=MRI_var->bucket[pos]; l<MRI_var->bucket[pos+1]; l++)
     {
-      free(MRI_var->Table[pos][u]);
+      idx=MRI_var->Sorted[l];
+      crd[0]=idx%width;
+      crd[1]=(idx/width)%height;
+      crd[2]=idx/(width*height);
+      Test(crd,parms,MRI_var);
     }
-    free(MRI_var->Table[pos]);
 
     if (Gdiag & DIAG_SHOW)
     {
@@ -3475,6 +3467,9 @@ int Analyze(STRIP_PARMS *parms,MRI_variables *MRI_var)
     }
   }
 
+  free(MRI_var->Sorted);
+  MRI_var->Sorted=NULL;
+
   MRI_var->main_basin_size+=((BasinCell*)MRI_var->Basin
                              [MRI_var->k_global_min]
                              [MRI_var->j_global_min]
@@ -3736,7 +3731,7 @@ Cell* TypeVoxel(Cell *cell)
 
 
 /*Looks if the voxel is a border from the segmented brain*/
-int AroundCell( unsigned char i,unsigned char j,unsigned char k,
+int AroundCell( int i,int j,int k,
                 MRI_variables *MRI_var )
 {
   int val=0,n=0;
@@ -3783,7 +3778,7 @@ int AroundCell( unsigned char i,unsigned char j,unsigned char k,
 
 
 /*Merge voxels which intensity is near the intensity of border voxels*/
-int MergeRoutine( unsigned char i,unsigned char j,unsigned char k,
+int MergeRoutine( int i,int j,int k,
                   int val,int *n,MRI_variables *MRI_var )
 {
   int cond=15*val;
@@ -3816,7 +3811,7 @@ int MergeRoutine( unsigned char i,unsigned char j,unsigned char k,
 }
 
 
-int Merge( unsigned char i,unsigned char j,unsigned char k,
+int Merge( int i,int j,int k,
            int val,int *n,MRI_variables *MRI_var )
 {
 
@@ -4481,16 +4476,8 @@ int PostAnalyze(STRIP_PARMS *parms,MRI_variables *MRI_var)
 /*free the allocated Basin (in the routine Allocation)*/
 int FreeMem(MRI_variables *MRI_var)
 {
-  int k,j;
-
-  for (k=0; k<MRI_var->depth; k++)
-  {
-    for (j=0; j<MRI_var->height; j++)
-    {
-      free(MRI_var->Basin[k][j]);
-    }
-    free(MRI_var->Basin[k]);
-  }
+  free(MRI_var->Basin[0][0]);
+  free(MRI_var->Basin[0]);
   free(MRI_var->Basin);
   return 0;
 }
@@ -92,6 +92,7 @@ int LabelKeepStat=1;
 int ReverseMapFlag = 1;
 int DoJac = 0;
 int UseHash = 1;
+char *RegOpFile = NULL;
 int nsurfs = 0;
 int npatches = 0;
 int DoSynthRand = 0;
@@ -242,11 +243,25 @@ int main(int argc, char *argv[]) {
   else LabelSurf = SurfReg[nsurfs-1];
 
   // Apply registration to source
-  TrgVal = MRISapplyReg(SrcVal, SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash);
-  if(TrgVal == NULL) exit(1);
-  if(SrcLabelStat) {
-    TrgLabelStat = MRISapplyReg(SrcLabelStat, SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash);
-    if(TrgLabelStat == NULL) exit(1);
+  if(RegOpFile){
+    // the mapping is the same for the values and the label stats
+    MRIS_REG_OPERATOR *RegOp = MRISreadOrBuildRegOperator(RegOpFile, SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash);
+    if(RegOp == NULL) exit(1);
+    TrgVal = MRISapplyRegOperator(RegOp, SrcVal, NULL);
+    if(TrgVal == NULL) exit(1);
+    if(SrcLabelStat) {
+      TrgLabelStat = MRISapplyRegOperator(RegOp, SrcLabelStat, NULL);
+      if(TrgLabelStat == NULL) exit(1);
+    }
+    MRISfreeRegOperator(&RegOp);
+  }
+  else {
+    TrgVal = MRISapplyReg(SrcVal, SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash);
+    if(TrgVal == NULL) exit(1);
+    if(SrcLabelStat) {
+      TrgLabelStat = MRISapplyReg(SrcLabelStat, SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash);
+      if(TrgLabelStat == NULL) exit(1);
+    }
   }
 
   // Save output
@@ -404,6 +419,11 @@ static int parse_commandline(int argc, char **argv) {
       nLabelFiles++;
       nargsused = 1;
     } 
+    else if (!strcasecmp(option, "--reg-op")){
+      if(nargc < 1) CMDargNErr(option,1);
+      RegOpFile = pargv[0];
+      nargsused = 1;
+    }
     else if (!strcasecmp(option, "--label-surf")){
       if(nargc < 1) CMDargNErr(option,1);
       LabelSurfFile = pargv[0];
@@ -651,6 +671,7 @@ static void print_usage(void) {
   printf("   --streg srcreg2 trgreg2 : more source and target reg files ...\n");
   printf("\n");
   printf("   --jac : use jacobian correction\n");
+  printf("   --reg-op opfile : reuse the mapping saved in opfile (created if it does not exist)\n");
   printf("   --no-rev : do not do reverse mapping  (put after --src-label to enforce)\n");
   printf("   --rev : perform reverse mapping (this is done by default)\n");
   printf("   --randn : replace input with WGN\n");
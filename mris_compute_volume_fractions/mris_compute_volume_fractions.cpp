@@ -34,6 +34,7 @@
 #include "diag.h"
 #include "mrisurf.h"
 #include "mris_compVolFrac.h"
+#include "romp_support.h"
 
 static int  parse_commandline(int argc, char **argv);
 static void check_options(void);
@@ -130,6 +131,14 @@ static int parse_commandline(int argc, char **argv) {
       Accuracy = atof(pargv[0]); 
       nargsused = 1; 
     }
+    else if (!strcasecmp(option, "--threads")){
+      if (nargc < 1) CMDargNErr(option,1);
+      int nthreads = atoi(pargv[0]);
+      #ifdef HAVE_OPENMP
+      omp_set_num_threads(nthreads);
+      #endif
+      nargsused = 1;
+    }
     else if (!strcasecmp(option, "--out")){
       if (nargc < 1) CMDargNErr(option,1);
       OutFile = pargv[0];
@@ -167,7 +176,9 @@ static void print_usage(void) {
   printf("\n");
   printf("   --vol volume_file : volume \n");
   printf("   --surf surface_file: surface\n");
-  printf("   --acc accuracy: required accuracy\n");
+  printf("   --acc accuracy: use the octree approximation with this max error\n");
+  printf("                   per voxel instead of the exact fractions\n");
+  printf("   --threads nthreads: number of threads\n");
   printf("   --out out_file: output volume file for the fractions\n");
   printf("\n");
   printf("   --debug     turn on debugging\n");
@@ -206,7 +217,7 @@ static void print_version(void) {
 */
 /* ------ Doxygen markup ends on the line above  (this line not needed for Doxygen) -- */
 static void check_options(void) {
-  if(VolFile == NULL || SurfFile == NULL || Accuracy < 0 || OutFile == NULL)
+  if(VolFile == NULL || SurfFile == NULL || OutFile == NULL)
     {
       print_usage(); 
       exit(1);
@@ -52,6 +52,7 @@ static double resolution = .25 ;
 static int conform = 0 ;
 static int use_template = 0 ;
 static int sample_factor = 1 ;
+static int use_parity = 0 ;
 
 static char *vol_fname ;
 
@@ -116,7 +117,10 @@ main(int argc, char *argv[]) {
     MRIfree(&mri_tmp);
   }
 
-  mri_interior = MRISfillInterior(mris, resolution, mri_template) ;
+  if (use_parity)
+    mri_interior = MRISfillInteriorParity(mris, resolution, mri_template) ;
+  else
+    mri_interior = MRISfillInterior(mris, resolution, mri_template) ;
 
   if (conform)
   {
@@ -177,6 +181,10 @@ get_option(int argc, char *argv[]) {
     vol_fname = argv[2];
     nargs = 1 ;
     break;
+  case 'P':
+    use_parity = 1 ;
+    printf("filling voxels whose centres are inside the surface by ray parity\n") ;
+    break ;
   case 'S':
     sample_factor = atoi(argv[2]) ;
     nargs = 1;
@@ -217,6 +225,7 @@ print_help(void)
   printf("\t-r <resolution>: set the resolution of the output volume"
          " (default = %2.3f mm/voxel)\n", resolution) ;
   printf("\t-c               'conform' the volume before writing\n") ;
+  printf("\t-p               fill by ray parity (exact for closed surfaces)\n") ;
   exit(1) ;
 }
 
@@ -7,9 +7,10 @@
 
 /*
   Build a surfa Overlay, Slice, or Volume object (whichever is appropriate given the dimensionality)
-  from an MRI instance. All data is copied between python and cxx, so any allocated MRI pointers
-  will need to be freed, even after convert to python. However, if `release` is `true`, this function
-  will free the MRI after converting.
+  from an MRI instance. Unless `release` is `true`, the image data is copied between python and cxx,
+  so any allocated MRI pointers will need to be freed, even after convert to python. If `release` is
+  `true`, this function will free the MRI after converting, and the chunk it owns is handed to numpy
+  instead of being copied.
 */
 py::object MRItoSurfaArray(MRI* mri, bool release)
 {
@@ -43,9 +44,17 @@ py::object MRItoSurfaArray(MRI* mri, bool release)
   if (mri->nframes > 1) shape.push_back(mri->nframes);
   std::vector<ssize_t> strides = fstrides(shape, mri->bytes_per_vox);
 
-  // wrap a numpy array around the chunked MRI data, then copy
-  py::capsule capsule(mri->chunk);
-  py::array buffer = py::array(dtype, shape, strides, mri->chunk, capsule).attr("copy")();
+  // wrap a numpy array around the chunked MRI data - if the MRI is being released and owns its
+  // chunk, numpy takes over the buffer and frees it, otherwise the data is copied
+  py::array buffer;
+  if (release && mri->owndata) {
+    py::capsule capsule(mri->chunk, [](void *d) { free(d); });
+    buffer = py::array(dtype, shape, strides, mri->chunk, capsule);
+    mri->owndata = false;
+  } else {
+    py::capsule capsule(mri->chunk);
+    buffer = py::array(dtype, shape, strides, mri->chunk, capsule).attr("copy")();
+  }
 
   // extract base dimensions (ignore frames) to determine whether the MRI
   // represents an overlay, image, or volume
@@ -104,9 +113,11 @@ py::object MRItoSurfaArray(MRI* mri, bool release)
 
 /*
   Convert a surfa FramedArray to an MRI structure of appropriate dimensionality. The returned
-  MRI pointer will need to be freed manually once it's done with.
+  MRI pointer will need to be freed manually once it's done with. If `keepalive` is provided, the
+  MRI wraps the (fortran-ordered, type-converted) array data without copying it, and `keepalive`
+  holds the array that owns that data, so it must outlive the MRI. Read-only arrays are always copied.
 */
-MRI* MRIfromSurfaArray(py::object arr)
+MRI* MRIfromSurfaArray(py::object arr, py::object *keepalive)
 {
   // type checking
   py::object arrclass = py::module::import("surfa").attr("core").attr("FramedArray");
@@ -147,9 +158,15 @@ MRI* MRIfromSurfaArray(py::object arr)
   }
   MRI *mri = new MRI(expanded, dtype, false);
 
-  // copy buffer data into MRI chunk
-  mri->chunk = malloc(mri->bytes_total);
-  memcpy(mri->chunk, mri_buffer.mutable_data(), mri->bytes_total);
+  // point the MRI chunk at the buffer data, or copy it if the MRI has to own its data
+  if (keepalive && mri_buffer.writeable()) {
+    mri->chunk = mri_buffer.mutable_data();
+    mri->owndata = false;
+    *keepalive = mri_buffer;
+  } else {
+    mri->chunk = malloc(mri->bytes_total);
+    memcpy(mri->chunk, mri_buffer.data(), mri->bytes_total);
+  }
   mri->ischunked = true;
   mri->initSlices();
   mri->initIndices();
@@ -228,7 +245,8 @@ py::object readMRI(const std::string& filename)
 */
 void writeMRI(py::object arr, const std::string& filename)
 {
-  MRI* mri = MRIfromSurfaArray(arr);
+  py::object buffer;
+  MRI* mri = MRIfromSurfaArray(arr, &buffer);
   if (stringEndsWith(filename, ".annot")) {
     writeAnnotationFromSeg(mri, filename);
   } else {
@@ -141,7 +141,8 @@ int countIntersections(py::object surf)
 py::object smoothOverlay(py::object surf, py::object overlay, int steps)
 {
   MRIS *mris = MRISfromSurfaMesh(surf);
-  MRI *mri_overlay = MRIfromSurfaArray(overlay);
+  py::object buffer;
+  MRI *mri_overlay = MRIfromSurfaArray(overlay, &buffer);
   MRI *mri_smoothed = MRISsmoothMRIFast(mris, mri_overlay, steps, nullptr, nullptr);
   MRISfree(&mris);
   MRIfree(&mri_overlay);
@@ -325,6 +325,55 @@ int fwriteDouble(double d, FILE *fp)
   return (fwrite(&d, sizeof(double), 1, fp));
 }
 
+/*------ bulk arrays ------------*/
+/* Whole arrays of big-endian 4 byte values, read or written with one
+  fread/fwrite (through a bounded staging buffer when writing) instead of
+  one call per element. The swap is a plain loop over 32 bit words, which
+  the compiler vectorises. Each returns the number of elements transferred.
+*/
+#define FIO_CHUNK 16384
+
+static void fioSwap4(unsigned int *w, size_t n)
+{
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  for (size_t i = 0; i < n; i++) {
+    const unsigned int x = w[i];
+    w[i] = (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+  }
+#endif
+}
+
+static size_t fioRead4Array(void *v, size_t n, FILE *fp)
+{
+  const size_t nread = fread(v, 4, n, fp);
+  fioSwap4((unsigned int *)v, nread);
+  return (nread);
+}
+
+static size_t fioWrite4Array(const void *v, size_t n, FILE *fp)
+{
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  unsigned int buf[FIO_CHUNK];
+  size_t nwritten = 0;
+  for (size_t i = 0; i < n; i += FIO_CHUNK) {
+    const size_t m = (n - i < FIO_CHUNK) ? n - i : FIO_CHUNK;
+    memcpy(buf, (const char *)v + 4 * i, 4 * m);
+    fioSwap4(buf, m);
+    const size_t w = fwrite(buf, 4, m, fp);
+    nwritten += w;
+    if (w != m) break;
+  }
+  return (nwritten);
+#else
+  return (fwrite(v, 4, n, fp));
+#endif
+}
+
+size_t freadFloatArray(float *v, size_t n, FILE *fp) { return (fioRead4Array(v, n, fp)); }
+size_t freadIntArray(int *v, size_t n, FILE *fp) { return (fioRead4Array(v, n, fp)); }
+size_t fwriteFloatArray(const float *v, size_t n, FILE *fp) { return (fioWrite4Array(v, n, fp)); }
+size_t fwriteIntArray(const int *v, size_t n, FILE *fp) { return (fioWrite4Array(v, n, fp)); }
+
 /*------ znzlib support ------------*/
 /* Note: an mgz file has a variable number of fields that get written at the
   end of the file. The reader keeps reading until it gets an EOF at which
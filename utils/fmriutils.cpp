@@ -1282,7 +1282,6 @@ int MRIglmLoadVox(MRIGLM *mriglm, int c, int r, int s, int LoadBeta, GLMMAT *glm
 {
   int f, n, nthreg, nthf, nf;
   double v;
-  static int nfprev = -1;
   if(glm == NULL) glm = mriglm->glm;
 
   nf = mriglm->y->nframes;
@@ -1293,9 +1292,8 @@ int MRIglmLoadVox(MRIGLM *mriglm, int c, int r, int s, int LoadBeta, GLMMAT *glm
       if (MRIgetVoxVal(mriglm->FrameMask, c, r, s, f - 1) > 0.5) nf++;
     if (nf == 0) printf("MRIglmLoadVox(): %d,%d,%d nf=0\n", c, r, s);
     // Free matrices if needed
-    if (glm->X != NULL && nfprev != nf) MatrixFree(&(glm->X));
-    if (glm->y != NULL && nfprev != nf) MatrixFree(&(glm->y));
-    nfprev = nf;
+    if (glm->X != NULL && glm->X->rows != nf) MatrixFree(&(glm->X));
+    if (glm->y != NULL && glm->y->rows != nf) MatrixFree(&(glm->y));
   }
 
   // Alloc matrices if needed
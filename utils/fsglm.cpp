@@ -494,6 +494,13 @@ int GLMfit(GLMMAT *glm)
   return (0);
 }
 
+static RFS *GLMzRFS(void)
+{
+  RFS *rfs = RFspecInit(0, NULL);
+  rfs->name = strcpyalloc("z");
+  return (rfs);
+}
+
 /*------------------------------------------------------------------------
   GLMtest() - tests all the contrasts for the given GLM. Must have already
   run GLMcMatrices(), GLMxMatrices(), and GLMfit(). See also GLMtestFFX().
@@ -502,13 +509,9 @@ int GLMtest(GLMMAT *glm)
 {
   int n;
   double dtmp;
-  static MATRIX *F = NULL, *mtmp = NULL;
-  static RFS *rfs = NULL;
-
-  if (rfs == NULL) {
-    rfs = RFspecInit(0, NULL);
-    rfs->name = strcpyalloc("z");
-  }
+  MATRIX *F = NULL, *mtmp = NULL;
+  // Only read once made, so GLMs on different threads can share it
+  static RFS *rfs = GLMzRFS();
 
   if (glm->ill_cond_flag) {
     // If it's ill cond, just return F=0
@@ -590,6 +593,7 @@ int GLMtest(GLMMAT *glm)
     }
     if (glm->ypmfflag[n]) glm->ypmf[n] = MatrixMultiplyD(glm->Mpmf[n], glm->beta, glm->ypmf[n]);
   }
+  if (F) MatrixFree(&F);
   return (0);
 }
 
@@ -601,7 +605,7 @@ int GLMtestFFx(GLMMAT *glm)
 {
   double val;
   int n, r, c;
-  static MATRIX *F = NULL, *mtmp = NULL;
+  MATRIX *F = NULL, *mtmp = NULL;
   MATRIX *Xs = NULL, *Xst = NULL, *CiXtXXs = NULL, *CiXtXXst = NULL;
 
   if (glm->ill_cond_flag) {
@@ -650,6 +654,7 @@ int GLMtestFFx(GLMMAT *glm)
   MatrixFree(&Xst);
   MatrixFree(&CiXtXXs);
   MatrixFree(&CiXtXXst);
+  if (F) MatrixFree(&F);
 
   return (0);
 }
@@ -6036,6 +6036,50 @@ static int GCAupdateNodeGibbsPriors(GCA *gca, MRI *mri, int xn, int yn, int zn,
 }
 
 
+/*
+  Gibbs relabelling worklist. The posterior of a label at a voxel only depends
+  on the voxel's intensities and the labels of its GIBBS_NEIGHBORS neighbors, so
+  once a voxel has been relabelled, relabelling it again can not change it until
+  one of those labels (or the prior factor) changes. mri_stale marks the voxels
+  for which that happened; the relabelling loops skip the others, exactly as if
+  they had been visited and left unchanged.
+*/
+static MRI *gcaGibbsStaleAlloc(MRI *mri)
+{
+  MRI *mri_stale = MRIalloc(mri->width, mri->height, mri->depth, MRI_UCHAR);
+  if (!mri_stale) ErrorExit(ERROR_NOMEMORY, "gcaGibbsStaleAlloc: could not allocate stale voxel volume");
+  MRIsetValues(mri_stale, 1);
+  return (mri_stale);
+}
+
+// the label at (x,y,z) changed - mark it and every voxel that has it as a neighbor
+static void gcaGibbsMarkStale(MRI *mri_stale, int x, int y, int z)
+{
+  int i, xn, yn, zn;
+
+  MRIvox(mri_stale, x, y, z) = 1;
+  for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+    xn = x + xnbr_offset[i];
+    yn = y + ynbr_offset[i];
+    zn = z + znbr_offset[i];
+    if (xn < 0 || yn < 0 || zn < 0 || xn >= mri_stale->width || yn >= mri_stale->height || zn >= mri_stale->depth)
+      continue;
+    MRIvox(mri_stale, xn, yn, zn) = 1;
+  }
+}
+
+// mark the voxels whose labels differ between mri_before and mri_after
+static void gcaGibbsMarkChangedStale(MRI *mri_stale, MRI *mri_before, MRI *mri_after)
+{
+  int x, y, z;
+
+  for (z = 0; z < mri_stale->depth; z++)
+    for (y = 0; y < mri_stale->height; y++)
+      for (x = 0; x < mri_stale->width; x++)
+        if (nint(MRIgetVoxVal(mri_before, x, y, z, 0)) != nint(MRIgetVoxVal(mri_after, x, y, z, 0)))
+          gcaGibbsMarkStale(mri_stale, x, y, z);
+}
+
 MRI *GCAanneal(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform, int max_iter, double prior_factor)
 {
   int x, y, z, width, height, depth, label, iter, xn, yn, zn, n, nchanged, index, nindices, old_label;
@@ -6043,7 +6087,7 @@ MRI *GCAanneal(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform, in
   short *x_indices, *y_indices, *z_indices;
   GCA_NODE *gcan;
   double ll, lcma = 0.0, old_posterior, new_posterior, min_posterior;
-  MRI *mri_changed, *mri_probs;
+  MRI *mri_changed, *mri_probs, *mri_stale;
 
   printf("performing simulated annealing...\n");
 
@@ -6069,6 +6113,7 @@ MRI *GCAanneal(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform, in
   }
 
   mri_changed = MRIclone(mri_dst, NULL);
+  mri_stale = gcaGibbsStaleAlloc(mri_dst);
 
   /* go through each voxel in the input volume and find the canonical
      voxel (and hence the classifier) to which it maps. Then update the
@@ -6117,6 +6162,13 @@ MRI *GCAanneal(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform, in
       if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
         gcan = &gca->nodes[xn][yn][zn];
 
+        // nothing the posterior depends on changed since the last visit
+        if (MRIvox(mri_stale, x, y, z) == 0) {
+          MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
+          continue;
+        }
+        MRIvox(mri_stale, x, y, z) = 0;
+
         label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
         min_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
 
@@ -6139,6 +6191,7 @@ MRI *GCAanneal(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform, in
           MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
         }
         MRIsetVoxVal(mri_dst, x, y, z, 0, label);
+        if (label != old_label) gcaGibbsMarkStale(mri_stale, x, y, z);
       }
     }  // index loop
     if (nchanged > 10000) {
@@ -6159,6 +6212,7 @@ MRI *GCAanneal(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform, in
   free(y_indices);
   free(z_indices);
   MRIfree(&mri_changed);
+  MRIfree(&mri_stale);
 
   return (mri_dst);
 }
@@ -6181,7 +6235,7 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
   int x, y, z, width, height, depth, iter, nchanged, min_changed, index, nindices, fixed;
   short *x_indices, *y_indices, *z_indices;
   double prior_factor, old_posterior, lcma = 0.0;
-  MRI *mri_changed, *mri_probs /*, *mri_zero */;
+  MRI *mri_changed, *mri_probs /*, *mri_zero */, *mri_stale, *mri_before_update = NULL;
 
   prior_factor = min_prior_factor;
   // fixed is the label fixed volume, e.g. wm
@@ -6210,6 +6264,7 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
   }
 
   mri_changed = MRIclone(mri_dst, NULL);
+  mri_stale = gcaGibbsStaleAlloc(mri_dst);
 
   /* go through each voxel in the input volume and find the canonical
      voxel (and hence the classifier) to which it maps. Then update the
@@ -6327,6 +6382,14 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       // only one label associated, don't do anything
       if (gcap->nlabels == 1) continue;
 
+      // nothing the posterior depends on changed since the last visit, so
+      // the label would stay (unless the posteriors are being written out)
+      if (!mri_probs && MRIvox(mri_stale, x, y, z) == 0) {
+        MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
+        continue;
+      }
+      MRIvox(mri_stale, x, y, z) = 0;
+
       // save the current label
       label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
       // calculate neighborhood likelihood
@@ -6400,6 +6463,7 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       }
       // assign new label
       MRIsetVoxVal(mri_dst, x, y, z, 0, label);
+      if (label != old_label) gcaGibbsMarkStale(mri_stale, x, y, z);
       if (mri_probs) {
         MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior);
       }
@@ -6511,7 +6575,9 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
     MRIdilate(mri_changed, mri_changed);
     // if unpdate_func is present, use it
     if (update_func) {
+      mri_before_update = MRIcopy(mri_dst, mri_before_update);
       (*update_func)(mri_dst);
+      gcaGibbsMarkChangedStale(mri_stale, mri_before_update, mri_dst);
     }
 
 #define MIN_CHANGED 5000
@@ -6538,6 +6604,7 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       }
       else {
         prior_factor *= 2;
+        MRIsetValues(mri_stale, 1);  // every posterior changes
         if (prior_factor < max_prior_factor) fprintf(stdout, "setting PRIOR_FACTOR to %2.4f\n", prior_factor);
       }
       if (gca_write_iterations > 0) {
@@ -6565,6 +6632,8 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
   free(y_indices);
   free(z_indices);
   MRIfree(&mri_changed);
+  MRIfree(&mri_stale);
+  if (mri_before_update) MRIfree(&mri_before_update);
 
   return (mri_dst);
 }
@@ -3,22 +3,23 @@
 //
 
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <algorithm>  
 #include <iomanip>
 #include <iostream>
-#include <map>
 #include <stack>
 #include <vector>
+#ifdef _POSIX_MAPPED_FILES
+#include <sys/mman.h>
+#endif
 
 #include "geodesics.h"
 
 #include "macros.h"
 #include "mrisurf.h"
 #include "timer.h"
-
-#ifdef _OPENMP
 #include "romp_support.h"
-#endif
 
 // Vertex
 struct Vertex
@@ -42,302 +43,726 @@ struct Triangle
   float angle[3];
   int vert[3];
   int neighbor[3];
-  bool inChain;
 };
 
-static int getIndex(int *arr, int vid);
+// per-thread scratch space for the per-source solvers. Everything that the
+// serial code used to share between sources (the inChain flags, the
+// nearest-vertex flags and the pathmap) lives here so the sources can be
+// processed concurrently.
+struct GeodesicsScratch
+{
+  std::vector< char > inchain;    // per face
+  std::vector< char > isnearest;  // per vertex
+  std::vector< float > rowdist;   // per vertex, < 0 if no path yet
+  std::vector< int > chain;
+  std::vector< int > nearest;
+  std::stack< StackItem > stack;
+
+  GeodesicsScratch(int nfaces, int nvertices) : inchain(nfaces, 0), isnearest(nvertices, 0), rowdist(nvertices, -1) {}
+};
+
+typedef std::pair< int, float > GeodesicsEntry;
+
+static int getIndex(const int *arr, int vid);
 static float distanceBetween(int v1, int v2, MRIS *surf);
 static int findNeighbor(int faceidx, int v1, int v2, MRIS *surf);
 static Vertex extendedPoint(Vertex A, Vertex B, float dA, float dB, float dAB);
-static std::pair< int, int > makeKey(int a, int b);
 static void progressBar(float progress);
+static void geodesicsLOS(MRIS *surf,
+                         const std::vector< Triangle > &triangles,
+                         int vertexID,
+                         float maxdist,
+                         GeodesicsScratch &scratch,
+                         std::vector< int > &nearestverts,
+                         std::vector< GeodesicsEntry > &los);
+static GeodesicsCSR *geodesicsCSRalloc(int nvertices, long nnbrs);
+
+static bool entryLess(const GeodesicsEntry &a, const GeodesicsEntry &b)
+{
+  return (a.first < b.first) || (a.first == b.first && a.second < b.second);
+}
 
-Geodesics *computeGeodesics(MRIS *surf, float maxdist)
+// distance to vno in a row held as a sorted step 1 part and a sorted part
+// added by step 2, or -1 if vno is in neither
+static float geodesicsPairDist(const GeodesicsEntry *row, int n, const std::vector< GeodesicsEntry > &added, int vno)
+{
+  const GeodesicsEntry *e = std::lower_bound(row, row + n, GeodesicsEntry(vno, -1.0f), entryLess);
+  if (e != row + n && e->first == vno) return (e->second);
+  std::vector< GeodesicsEntry >::const_iterator a =
+      std::lower_bound(added.begin(), added.end(), GeodesicsEntry(vno, -1.0f), entryLess);
+  if (a != added.end() && a->first == vno) return (a->second);
+  return (-1);
+}
+
+static void geodesicsPairAdd(std::vector< GeodesicsEntry > &added, int vno, float dist)
+{
+  GeodesicsEntry entry(vno, dist);
+  added.insert(std::lower_bound(added.begin(), added.end(), entry, entryLess), entry);
+}
+
+/*!
+  \fn GeodesicsCSR *computeGeodesicsCSR(MRIS *surf, float maxdist)
+  \brief Computes the geodesic neighbourhood (all vertices within maxdist)
+  of every vertex. The line-of-sight unfolding (step 1) is run in parallel
+  over source vertices with thread-local scratch. The shortest path
+  completion (step 2) runs over the sources in order, as in the original
+  serial code, because each source can use the paths completed by the
+  sources before it. Rows are sorted by neighbour vertex number.
+*/
+GeodesicsCSR *computeGeodesicsCSR(MRIS *surf, float maxdist)
 {
   int msec;
   Timer mytimer;
-  printf("computeGeodesics(): maxdist = %g, nvertices = %d\n", maxdist, surf->nvertices);
+  const int nvertices = surf->nvertices;
+  printf("computeGeodesicsCSR(): maxdist = %g, nvertices = %d, threads = %d\n", maxdist, nvertices,
+         omp_get_max_threads());
   fflush(stdout);
 
   // pre-compute and set-up required values to build triangle chain:
-  FACE *face;
-  Triangle *triangle;
   std::vector< Triangle > triangles(surf->nfaces);
-  int idx1, idx2;
-  for (int nf = 0; nf < surf->nfaces; nf++) {
-    face = &surf->faces[nf];
-    triangle = &triangles[nf];
+  int nf;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (nf = 0; nf < surf->nfaces; nf++) {
+    ROMP_PFLB_begin
+    FACE *face = &surf->faces[nf];
+    Triangle *triangle = &triangles[nf];
     for (int ns = 0; ns < 3; ns++) {
-      idx1 = (ns + 1) % 3;
-      idx2 = (ns + 2) % 3;
+      int idx1 = (ns + 1) % 3;
+      int idx2 = (ns + 2) % 3;
       triangle->length[ns] = distanceBetween(face->v[idx1], face->v[idx2], surf);
       triangle->neighbor[ns] = findNeighbor(nf, face->v[idx1], face->v[idx2], surf);
       triangle->vert[ns] = face->v[ns];
       triangle->angle[ns] = face->angle[ns];
     }
-    triangle->inChain = false;
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
   msec = mytimer.milliseconds();
   printf("precompute t = %g min\n", msec / (1000.0 * 60));
   fflush(stdout);
 
-  std::cout << "computing geodesics within distance of " << maxdist << " mm\n";
-  fflush(stdout);
-  std::vector< std::vector< int > > nearestverts(surf->nvertices);
-  int idxlookup[] = {0, 2, 1, 0};  // fast lookup table to find remaining index
-                                   // can be removed... there's an easier way
-  std::map< std::pair< int, int >, float > pathmap;
-  // private vars:
-  std::vector< int > chain;
-  std::stack< StackItem > stack;
-  std::vector< bool > isnearest(surf->nvertices);
-  std::map< std::pair< int, int >, float >::iterator edge;
-  StackItem stackitem;
-  Vertex A, B, C, D;
-  int iA, iB, iC, iD;
-  int current_idx;
-  float min_angle, max_angle, current_angle, distance;
+  const int nthreads = omp_get_max_threads();
+  std::vector< GeodesicsScratch * > scratch(nthreads);
+  for (int t = 0; t < nthreads; t++) scratch[t] = new GeodesicsScratch(surf->nfaces, nvertices);
 
   // ------ STEP 1 ------
-  // compute each geodesic using the LOS algorithm. each geodesics is added
-  // to the pathmap, but this will not account for every path.
-  for (int vertexID = 0; vertexID < surf->nvertices; vertexID++) {
-    VERTEX_TOPOLOGY const * const basevertex = &surf->vertices_topology[vertexID];
-    // begin chain with each face that neighbors the current base vertex:
-    for (int i = 0; i < basevertex->num; i++) {
-      // clear triangle chain and surrounding vertices index:
-      for (unsigned int c = 0; c < chain.size(); c++) triangles[chain[c]].inChain = false;
-      chain.clear();
-      for (unsigned int c = 0; c < isnearest.size(); c++) isnearest[c] = false;
-      // set up initial triangle in plane:
-      current_idx = basevertex->f[i];
-      triangle = &triangles[current_idx];
-      // formally add to chain:
-      chain.push_back(current_idx);
-      triangle->inChain = true;
-      // get vertex indices in relation to their
-      // placement in the face's vertex array:
-      iC = getIndex(triangle->vert, vertexID);
-      iA = (iC + 1) % 3;
-      iB = (iC + 2) % 3;
-      // compute min and max fov angles:
-      min_angle = 0.0;
-      max_angle = triangle->angle[iC];
-      // compute vertex A along x axis:
-      A.x = triangle->length[iB];
-      A.y = 0.0;
-      A.id = triangle->vert[iA];
-      // compute vertex B in positive y (no need for this to be pre-computed):
-      B.x = triangle->length[iA] * cos(max_angle);
-      B.y = triangle->length[iA] * sin(max_angle);
-      B.id = triangle->vert[iB];
-      // reset vertex C (base vertex which represents the origin):
-      C.x = 0.0;
-      C.y = 0.0;
-      C.id = triangle->vert[iC];
-      // formally consider the distance from C to A as a geodesic:
-      nearestverts[vertexID].push_back(A.id);
-      isnearest[A.id] = true;
-      edge = pathmap.find(makeKey(vertexID, A.id));
-      if (edge != pathmap.end())
-        edge->second = triangle->length[iB];
-      else
-        pathmap.insert(make_pair(makeKey(vertexID, A.id), triangle->length[iB]));
-      // formally consider the distance from C to B as a geodesic:
-      nearestverts[vertexID].push_back(B.id);
-      isnearest[B.id] = true;
-      edge = pathmap.find(makeKey(vertexID, B.id));
-      if (edge != pathmap.end())
-        edge->second = triangle->length[iA];
-      else
-        pathmap.insert(make_pair(makeKey(vertexID, B.id), triangle->length[iA]));
-      // chain initialiaztion complete. get next triangle
-      // and begin building chain:
-      current_idx = triangle->neighbor[iC];
-      // ------ build triangle chain ------
-      while (true) {
-        // check if the current triangle is valid or if it
-        // already exists in the chain:
-        if ((current_idx < 0) || (triangles[current_idx].inChain)) {
-          // move on to next base triangle if the stack is empty:
-          if (stack.empty()) break;
-          // if not, just revert to the last stack item:
-          else {
-            stackitem = stack.top();
-            A = stackitem.a;
-            B = stackitem.b;
-            C = stackitem.c;
-            min_angle = stackitem.mina;
-            max_angle = stackitem.maxa;
-            current_idx = stackitem.idx;
-            triangle = &triangles[current_idx];
-            // trim the chain back to the current triangle:
-            while ((chain.back() != current_idx) && (chain.size() > 0)) {
-              triangles[chain.back()].inChain = false;
-              chain.pop_back();
-            }
-            stack.pop();
-          }
-        }
-        // triangle is valid, so add it to the chain:
-        else {
-          triangle = &triangles[current_idx];
-          chain.push_back(current_idx);
-          triangle->inChain = true;
-          // find appropriate vertex indices for new triangle:
-          iA = getIndex(triangle->vert, A.id);  // this can be optimized
-          iB = getIndex(triangle->vert, B.id);
-          iD = idxlookup[iA + iB];
-          // calculate the planar position of the extended vertex D:
-          D = extendedPoint(A, B, triangle->length[iB], triangle->length[iA], triangle->length[iD]);
-          D.id = triangle->vert[iD];
-          // calculate the angle that the vector D makes with x-axis:
-          current_angle = atan2(D.y, D.x);
-          // now calculate the distance to the origin:
-          distance = sqrt(D.x * D.x + D.y * D.y);
-          if (distance > maxdist) {
-            current_idx = -1;  // this forces the next triangle invalid
-            continue;
-          }
-          // potentially use the geodesics matrix here...
-          if (!isnearest[D.id]) {
-            nearestverts[vertexID].push_back(D.id);
-            isnearest[D.id] = true;
-          }
-          // check if angle is visible within the fov:
-          if ((current_angle < min_angle)) {
-            C = A;
-            A = D;
-          }
-          else if ((current_angle > max_angle)) {
-            C = B;
-            B = D;
-          }
-          else if (((current_angle <= max_angle) && (current_angle >= min_angle))) {
-            // add geodesic to path map if shorter than the previous distance:
-            edge = pathmap.find(makeKey(vertexID, D.id));
-            if (edge != pathmap.end()) {
-              if ((distance < edge->second) || (edge->second < 0.0)) edge->second = distance;
-            }
-            else {
-              pathmap.insert(make_pair(makeKey(vertexID, D.id), distance));
-            }
-            // push triangle to the stack:
-            stackitem.a = A;
-            stackitem.b = D;
-            stackitem.c = B;
-            stackitem.idx = current_idx;
-            stackitem.mina = min_angle;
-            stackitem.maxa = current_angle;
-            stack.push(stackitem);
-            C = A;
-            A = D;
-            min_angle = current_angle;
-          }
-          // this is used to find bugs within the surface (so far I've only
-          // seen problems in the fsaverage surface)
-          else {
-            // std::cout << "nan\n";
-            // fflush(stdout);
-            current_idx = -1;
-            continue;
-          }
-        }
-        // get the next triangle and repeat:
-        iC = getIndex(triangle->vert, C.id);
-        current_idx = triangle->neighbor[iC];
-      }
-    }
-    if (vertexID % 1000 == 0) progressBar((float)vertexID / surf->nvertices);
+  // line-of-sight geodesics from every source; los[k] holds the unique
+  // neighbours of k with their shortest LOS distance
+  std::vector< std::vector< int > > nearestverts(nvertices);
+  std::vector< std::vector< GeodesicsEntry > > los(nvertices);
+  int vertexID, ndone = 0;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 64)
+#endif
+  for (vertexID = 0; vertexID < nvertices; vertexID++) {
+    ROMP_PFLB_begin
+    geodesicsLOS(surf, triangles, vertexID, maxdist, *scratch[omp_get_thread_num()], nearestverts[vertexID],
+                 los[vertexID]);
+#ifdef HAVE_OPENMP
+    #pragma omp atomic
+#endif
+    ndone++;
+    if (omp_get_thread_num() == 0 && vertexID % 1000 == 0) progressBar((float)ndone / nvertices);
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
   progressBar(1.0);
   std::cout << std::endl;
   msec = mytimer.milliseconds();
   printf("step 1 t = %g min\n", msec / (1000.0 * 60));
   fflush(stdout);
 
+  // symmetrize: the distance between a and b is the shorter of the paths
+  // found from a and from b (this is what the shared pathmap used to hold)
+  std::vector< long > symoffset(nvertices + 1, 0);
+  for (int k = 0; k < nvertices; k++) {
+    symoffset[k + 1] += los[k].size();
+    for (unsigned int n = 0; n < los[k].size(); n++) symoffset[los[k][n].first + 1]++;
+  }
+  for (int k = 0; k < nvertices; k++) symoffset[k + 1] += symoffset[k];
+  std::vector< GeodesicsEntry > sym(symoffset[nvertices]);
+  {
+    std::vector< long > fill(symoffset.begin(), symoffset.end() - 1);
+    for (int k = 0; k < nvertices; k++) {
+      for (unsigned int n = 0; n < los[k].size(); n++) {
+        sym[fill[k]++] = los[k][n];
+        sym[fill[los[k][n].first]++] = GeodesicsEntry(k, los[k][n].second);
+      }
+      std::vector< GeodesicsEntry >().swap(los[k]);
+    }
+  }
+  std::vector< int > symnum(nvertices);
+  int k;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 256)
+#endif
+  for (k = 0; k < nvertices; k++) {
+    ROMP_PFLB_begin
+    // sort and keep the shortest distance of each neighbour
+    GeodesicsEntry *row = &sym[symoffset[k]];
+    int n = symoffset[k + 1] - symoffset[k], nunique = 0;
+    std::sort(row, row + n, entryLess);
+    for (int i = 0; i < n; i++)
+      if (nunique == 0 || row[nunique - 1].first != row[i].first) row[nunique++] = row[i];
+    symnum[k] = nunique;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
   std::cout << "computing shortest paths and non-geodesics\n";
   fflush(stdout);
-  Geodesics *geo = (Geodesics *)calloc(surf->nvertices, sizeof(Geodesics));
-  // ------ STEP 2 ------
-  // compute the shortest paths between each vertex (within given limit)
-  int vi, vj;
-  for (int k = 0; k < surf->nvertices; k++) {
-    // set up nearest vertices reference:
-    for (unsigned int d = 0; d < nearestverts[k].size(); d++) {
-      isnearest[nearestverts[k][d]] == true;
-    }
-    for (unsigned int i = 0; i < nearestverts[k].size(); i++) {
-      vi = nearestverts[k][i];
-      edge = pathmap.find(makeKey(k, vi));
-      if ((vi == k) || (edge != pathmap.end())) continue;
 
-      for (unsigned int j = 0; j < nearestverts[k].size(); j++) {
-        vj = nearestverts[k][j];
+  // ------ STEP 2 ------
+  // complete the paths between each vertex and the vertices near it that
+  // have no line of sight, using paths through a third nearby vertex. The
+  // distance between two vertices is shared by both of them: a path
+  // completed for source k is added to the rows of k and of the other end
+  // (in added[]) and is seen by every later source.
+  std::vector< std::vector< GeodesicsEntry > > rows(nvertices), added(nvertices);
+  GeodesicsScratch &s = *scratch[0];
+  std::vector< int > &nearest = s.nearest;
+  std::vector< int > completed;
+  for (k = 0; k < nvertices; k++) {
+    const GeodesicsEntry *symrow = &sym[symoffset[k]];
+
+    nearest = nearestverts[k];
+    for (unsigned int d = 0; d < nearest.size(); d++) s.isnearest[nearest[d]] = 1;
+    for (int n = 0; n < symnum[k]; n++) s.rowdist[symrow[n].first] = symrow[n].second;
+    for (unsigned int n = 0; n < added[k].size(); n++) s.rowdist[added[k][n].first] = added[k][n].second;
+
+    completed.clear();
+    for (unsigned int i = 0; i < nearest.size(); i++) {
+      int vi = nearest[i];
+      if ((vi == k) || (s.rowdist[vi] >= 0)) continue;
+
+      for (unsigned int j = 0; j < nearest.size(); j++) {
+        int vj = nearest[j];
         if ((vi == vj) || (vj == k)) continue;
-        // retrieve distance from k to i:
-        edge = pathmap.find(makeKey(k, vj));
-        if (edge == pathmap.end()) continue;
-        distance = edge->second;
-        // retrieve distance from j to k:
-        edge = pathmap.find(makeKey(vj, vi));
-        if (edge == pathmap.end()) continue;
-        distance += edge->second;
-        // retrieve distance from i to j:
-        edge = pathmap.find(makeKey(k, vi));
-        if ((edge == pathmap.end()) && (distance < maxdist))
-          pathmap.insert(make_pair(makeKey(k, vi), distance));
-        else if (distance < edge->second)
-          edge->second = distance;
+        // distance from k to j:
+        float dkj = s.rowdist[vj];
+        if (dkj < 0) continue;
+        // distance from j to i:
+        float dji = geodesicsPairDist(&sym[symoffset[vj]], symnum[vj], added[vj], vi);
+        if (dji < 0) continue;
+        float distance = dkj + dji;
+        if (distance < maxdist && (s.rowdist[vi] < 0 || distance < s.rowdist[vi])) s.rowdist[vi] = distance;
       }
       // search for vertices that are within distance limits
       // but weren't discovered by the triangle chain
-      edge = pathmap.find(makeKey(k, vi));
-      if (edge != pathmap.end()) {
-        for (int side = 0; side < surf->vertices_topology[vi].vnum; side++) {
-          if (!isnearest[surf->vertices_topology[vi].v[side]]) {
-            distance = edge->second + 0.5;
-            if (distance < maxdist) {
-              isnearest[surf->vertices_topology[vi].v[side]] = true;
-              nearestverts[k].push_back(surf->vertices_topology[vi].v[side]);
-            }
+      if (s.rowdist[vi] >= 0) {
+        completed.push_back(vi);
+        VERTEX_TOPOLOGY const *const vt = &surf->vertices_topology[vi];
+        for (int side = 0; side < vt->vnum; side++) {
+          int vn = vt->v[side];
+          if (!s.isnearest[vn] && s.rowdist[vi] + 0.5 < maxdist) {
+            s.isnearest[vn] = 1;
+            nearest.push_back(vn);
           }
         }
       }
     }
-    geo[k].vnum = 0;
-    // geo[k].v = (int*) calloc(nearestverts[k].size(), sizeof(int));
-    // geo[k].dist = (float*) calloc(nearestverts[k].size(), sizeof(float));
-    for (unsigned int d = 0; d < nearestverts[k].size(); d++) {
-      edge = pathmap.find(makeKey(k, nearestverts[k][d]));
-      if (edge != pathmap.end()) {
-        geo[k].v[geo[k].vnum] = nearestverts[k][d];
-        geo[k].dist[geo[k].vnum] = edge->second;
-        geo[k].vnum += 1;
-        if (geo[k].vnum > MAX_GEODESICS) {
-          std::cerr << "error: too many neighbors, try a smaller max distance\n";
-          fflush(stdout);
-          exit(1);
-        }
-      }
-      isnearest[nearestverts[k][d]] == false;
+
+    std::vector< GeodesicsEntry > &row = rows[k];
+    for (unsigned int d = 0; d < nearest.size(); d++)
+      if (nearest[d] != k && s.rowdist[nearest[d]] >= 0) row.push_back(GeodesicsEntry(nearest[d], s.rowdist[nearest[d]]));
+    std::sort(row.begin(), row.end(), entryLess);
+
+    // share the completed paths with the other ends
+    for (unsigned int c = 0; c < completed.size(); c++) {
+      int vi = completed[c];
+      geodesicsPairAdd(added[k], vi, s.rowdist[vi]);
+      geodesicsPairAdd(added[vi], k, s.rowdist[vi]);
     }
 
-    if (k % 100 == 0) {
-      progressBar((float)k / surf->nvertices);
+    // reset the scratch space touched by this source
+    for (unsigned int d = 0; d < nearest.size(); d++) {
+      s.isnearest[nearest[d]] = 0;
+      s.rowdist[nearest[d]] = -1;
     }
+    for (int n = 0; n < symnum[k]; n++) s.rowdist[symrow[n].first] = -1;
+    for (unsigned int n = 0; n < added[k].size(); n++) s.rowdist[added[k][n].first] = -1;
+    std::vector< int >().swap(nearestverts[k]);
+
+    if (k % 100 == 0) progressBar((float)k / nvertices);
   }
   progressBar(1.0);
   std::cout << std::endl;
 
+  for (int t = 0; t < nthreads; t++) delete scratch[t];
+
+  // pack into the CSR structure
+  long nnbrs = 0;
+  for (k = 0; k < nvertices; k++) nnbrs += rows[k].size();
+  GeodesicsCSR *geo = geodesicsCSRalloc(nvertices, nnbrs);
+  geo->offset[0] = 0;
+  for (k = 0; k < nvertices; k++) geo->offset[k + 1] = geo->offset[k] + rows[k].size();
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (k = 0; k < nvertices; k++) {
+    ROMP_PFLB_begin
+    long off = geo->offset[k];
+    for (unsigned int n = 0; n < rows[k].size(); n++) {
+      geo->v[off + n] = rows[k][n].first;
+      geo->dist[off + n] = rows[k][n].second;
+    }
+    std::vector< GeodesicsEntry >().swap(rows[k]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
   msec = mytimer.milliseconds();
-  printf("t = %g min\n", msec / (1000.0 * 60));
+  printf("computeGeodesicsCSR(): %ld neighbours, t = %g min\n", nnbrs, msec / (1000.0 * 60));
   fflush(stdout);
 
   return geo;
 }
 
+/*!
+  \fn static void geodesicsLOS()
+  \brief Step 1 of computeGeodesicsCSR for one source vertex: unfold the
+  triangle chains around vertexID into the plane and record the vertices
+  in line of sight (los) and all vertices reached (nearestverts).
+*/
+static void geodesicsLOS(MRIS *surf,
+                         const std::vector< Triangle > &triangles,
+                         int vertexID,
+                         float maxdist,
+                         GeodesicsScratch &scratch,
+                         std::vector< int > &nearestverts,
+                         std::vector< GeodesicsEntry > &los)
+{
+  int idxlookup[] = {0, 2, 1, 0};  // fast lookup table to find remaining index
+                                   // can be removed... there's an easier way
+  std::vector< char > &inchain = scratch.inchain;
+  std::vector< char > &isnearest = scratch.isnearest;
+  std::vector< float > &pathdist = scratch.rowdist;
+  std::vector< int > &chain = scratch.chain;
+  std::stack< StackItem > &stack = scratch.stack;
+  const Triangle *triangle;
+  StackItem stackitem;
+  Vertex A, B, C, D;
+  int iA, iB, iC, iD;
+  int current_idx;
+  float min_angle, max_angle, current_angle, distance;
+
+  VERTEX_TOPOLOGY const *const basevertex = &surf->vertices_topology[vertexID];
+  // begin chain with each face that neighbors the current base vertex:
+  for (int i = 0; i < basevertex->num; i++) {
+    // clear triangle chain:
+    for (unsigned int c = 0; c < chain.size(); c++) inchain[chain[c]] = 0;
+    chain.clear();
+    // set up initial triangle in plane:
+    current_idx = basevertex->f[i];
+    triangle = &triangles[current_idx];
+    // formally add to chain:
+    chain.push_back(current_idx);
+    inchain[current_idx] = 1;
+    // get vertex indices in relation to their
+    // placement in the face's vertex array:
+    iC = getIndex(triangle->vert, vertexID);
+    iA = (iC + 1) % 3;
+    iB = (iC + 2) % 3;
+    // compute min and max fov angles:
+    min_angle = 0.0;
+    max_angle = triangle->angle[iC];
+    // compute vertex A along x axis:
+    A.x = triangle->length[iB];
+    A.y = 0.0;
+    A.id = triangle->vert[iA];
+    // compute vertex B in positive y (no need for this to be pre-computed):
+    B.x = triangle->length[iA] * cos(max_angle);
+    B.y = triangle->length[iA] * sin(max_angle);
+    B.id = triangle->vert[iB];
+    // reset vertex C (base vertex which represents the origin):
+    C.x = 0.0;
+    C.y = 0.0;
+    C.id = triangle->vert[iC];
+    // formally consider the distances from C to A and C to B as geodesics
+    // (edge lengths are exact, so they replace any other path):
+    if (!isnearest[A.id]) {
+      nearestverts.push_back(A.id);
+      isnearest[A.id] = 1;
+    }
+    pathdist[A.id] = triangle->length[iB];
+    if (!isnearest[B.id]) {
+      nearestverts.push_back(B.id);
+      isnearest[B.id] = 1;
+    }
+    pathdist[B.id] = triangle->length[iA];
+    // chain initialiaztion complete. get next triangle
+    // and begin building chain:
+    current_idx = triangle->neighbor[iC];
+    // ------ build triangle chain ------
+    while (true) {
+      // check if the current triangle is valid or if it
+      // already exists in the chain:
+      if ((current_idx < 0) || (inchain[current_idx])) {
+        // move on to next base triangle if the stack is empty:
+        if (stack.empty()) break;
+        // if not, just revert to the last stack item:
+        else {
+          stackitem = stack.top();
+          A = stackitem.a;
+          B = stackitem.b;
+          C = stackitem.c;
+          min_angle = stackitem.mina;
+          max_angle = stackitem.maxa;
+          current_idx = stackitem.idx;
+          triangle = &triangles[current_idx];
+          // trim the chain back to the current triangle:
+          while ((chain.size() > 0) && (chain.back() != current_idx)) {
+            inchain[chain.back()] = 0;
+            chain.pop_back();
+          }
+          stack.pop();
+        }
+      }
+      // triangle is valid, so add it to the chain:
+      else {
+        triangle = &triangles[current_idx];
+        chain.push_back(current_idx);
+        inchain[current_idx] = 1;
+        // find appropriate vertex indices for new triangle:
+        iA = getIndex(triangle->vert, A.id);  // this can be optimized
+        iB = getIndex(triangle->vert, B.id);
+        iD = idxlookup[iA + iB];
+        // calculate the planar position of the extended vertex D:
+        D = extendedPoint(A, B, triangle->length[iB], triangle->length[iA], triangle->length[iD]);
+        D.id = triangle->vert[iD];
+        // calculate the angle that the vector D makes with x-axis:
+        current_angle = atan2(D.y, D.x);
+        // now calculate the distance to the origin:
+        distance = sqrt(D.x * D.x + D.y * D.y);
+        if (distance > maxdist) {
+          current_idx = -1;  // this forces the next triangle invalid
+          continue;
+        }
+        if (!isnearest[D.id]) {
+          nearestverts.push_back(D.id);
+          isnearest[D.id] = 1;
+        }
+        // check if angle is visible within the fov:
+        if ((current_angle < min_angle)) {
+          C = A;
+          A = D;
+        }
+        else if ((current_angle > max_angle)) {
+          C = B;
+          B = D;
+        }
+        else if (((current_angle <= max_angle) && (current_angle >= min_angle))) {
+          // keep the geodesic if shorter than the previous distance:
+          if (pathdist[D.id] < 0.0 || distance < pathdist[D.id]) pathdist[D.id] = distance;
+          // push triangle to the stack:
+          stackitem.a = A;
+          stackitem.b = D;
+          stackitem.c = B;
+          stackitem.idx = current_idx;
+          stackitem.mina = min_angle;
+          stackitem.maxa = current_angle;
+          stack.push(stackitem);
+          C = A;
+          A = D;
+          min_angle = current_angle;
+        }
+        // this is used to find bugs within the surface (so far I've only
+        // seen problems in the fsaverage surface)
+        else {
+          current_idx = -1;
+          continue;
+        }
+      }
+      // get the next triangle and repeat:
+      iC = getIndex(triangle->vert, C.id);
+      current_idx = triangle->neighbor[iC];
+    }
+  }
+
+  for (unsigned int c = 0; c < chain.size(); c++) inchain[chain[c]] = 0;
+  chain.clear();
+
+  // collect the line-of-sight distances and reset the scratch flags
+  for (unsigned int d = 0; d < nearestverts.size(); d++) {
+    int vno = nearestverts[d];
+    if (vno != vertexID && pathdist[vno] >= 0) los.push_back(GeodesicsEntry(vno, pathdist[vno]));
+    pathdist[vno] = -1;
+    isnearest[vno] = 0;
+  }
+}
+
+/*!
+  \fn Geodesics *computeGeodesics(MRIS *surf, float maxdist)
+  \brief Legacy interface to computeGeodesicsCSR() returning the fixed size
+  per-vertex neighbour lists.
+*/
+Geodesics *computeGeodesics(MRIS *surf, float maxdist)
+{
+  GeodesicsCSR *csr = computeGeodesicsCSR(surf, maxdist);
+  Geodesics *geo = geodesicsCSRtoGeodesics(csr);
+  geodesicsCSRfree(&csr);
+  if (geo == NULL) {
+    std::cerr << "error: too many neighbors, try a smaller max distance\n";
+    exit(1);
+  }
+  return geo;
+}
+
+static GeodesicsCSR *geodesicsCSRalloc(int nvertices, long nnbrs)
+{
+  GeodesicsCSR *geo = (GeodesicsCSR *)calloc(1, sizeof(GeodesicsCSR));
+  geo->nvertices = nvertices;
+  geo->nnbrs = nnbrs;
+  geo->offset = (long *)calloc(nvertices + 1, sizeof(long));
+  geo->v = (int *)calloc(MAX(nnbrs, 1), sizeof(int));
+  geo->dist = (float *)calloc(MAX(nnbrs, 1), sizeof(float));
+  return geo;
+}
+
+void geodesicsCSRfree(GeodesicsCSR **pgeo)
+{
+  GeodesicsCSR *geo = *pgeo;
+  if (geo == NULL) return;
+#ifdef _POSIX_MAPPED_FILES
+  if (geo->mmap_base) {
+    munmap(geo->mmap_base, geo->mmap_len);
+  }
+  else
+#endif
+  {
+    free(geo->offset);
+    free(geo->v);
+    free(geo->dist);
+  }
+  free(geo);
+  *pgeo = NULL;
+}
+
+/*!
+  \fn float geodesicsCSRdist(GeodesicsCSR *geo, int vno1, int vno2)
+  \brief Returns the geodesic distance from vno1 to vno2, or -1 if vno2 is
+  not in the neighbourhood of vno1.
+*/
+float geodesicsCSRdist(GeodesicsCSR *geo, int vno1, int vno2)
+{
+  const int *first = geo->v + geo->offset[vno1], *last = geo->v + geo->offset[vno1 + 1];
+  const int *p = std::lower_bound(first, last, vno2);
+  if (p == last || *p != vno2) return (-1);
+  return (geo->dist[p - geo->v]);
+}
+
+/*!
+  \fn Geodesics *geodesicsCSRtoGeodesics(GeodesicsCSR *csr)
+  \brief Converts to the per-vertex Geodesics array. Returns NULL if a
+  vertex has more than MAX_GEODESICS neighbours.
+*/
+Geodesics *geodesicsCSRtoGeodesics(GeodesicsCSR *csr)
+{
+  for (int vno = 0; vno < csr->nvertices; vno++) {
+    if (csr->offset[vno + 1] - csr->offset[vno] > MAX_GEODESICS) {
+      printf("ERROR: geodesicsCSRtoGeodesics(): vertex %d has %ld neighbors (max %d)\n", vno,
+             csr->offset[vno + 1] - csr->offset[vno], MAX_GEODESICS);
+      return (NULL);
+    }
+  }
+  Geodesics *geo = (Geodesics *)calloc(csr->nvertices, sizeof(Geodesics));
+  for (int vno = 0; vno < csr->nvertices; vno++) {
+    long off = csr->offset[vno];
+    geo[vno].vnum = csr->offset[vno + 1] - off;
+    memcpy(geo[vno].v, &csr->v[off], geo[vno].vnum * sizeof(int));
+    memcpy(geo[vno].dist, &csr->dist[off], geo[vno].vnum * sizeof(float));
+  }
+  return (geo);
+}
+
+/*!
+  \fn GeodesicsCSR *geodesicsCSRfromGeodesics(Geodesics *geo, int nvertices)
+  \brief Packs per-vertex Geodesics (eg, from geodesicsRead()) into CSR
+  form. Rows are uniquified and sorted.
+*/
+GeodesicsCSR *geodesicsCSRfromGeodesics(Geodesics *geo, int nvertices)
+{
+  std::vector< std::vector< GeodesicsEntry > > rows(nvertices);
+  long nnbrs = 0;
+  for (int vno = 0; vno < nvertices; vno++) {
+    std::vector< GeodesicsEntry > &row = rows[vno];
+    for (int n = 0; n < geo[vno].vnum; n++) row.push_back(GeodesicsEntry(geo[vno].v[n], geo[vno].dist[n]));
+    std::sort(row.begin(), row.end(), entryLess);
+    int nunique = 0;
+    for (unsigned int i = 0; i < row.size(); i++)
+      if (nunique == 0 || row[nunique - 1].first != row[i].first) row[nunique++] = row[i];
+    row.resize(nunique);
+    nnbrs += nunique;
+  }
+  GeodesicsCSR *csr = geodesicsCSRalloc(nvertices, nnbrs);
+  for (int vno = 0; vno < nvertices; vno++) {
+    long off = csr->offset[vno];
+    csr->offset[vno + 1] = off + rows[vno].size();
+    for (unsigned int n = 0; n < rows[vno].size(); n++) {
+      csr->v[off + n] = rows[vno][n].first;
+      csr->dist[off + n] = rows[vno][n].second;
+    }
+  }
+  return (csr);
+}
+
+/*
+  CSR file layout, all in native byte order so it can be mapped directly:
+    char  magic[32]       "FreeSurferGeodesics-CSR"
+    int   endian          -1
+    int   nvertices
+    long  nnbrs           (8 bytes)
+    char  pad[16]         header is 64 bytes
+    long  offset[nvertices+1]
+    int   v[nnbrs]
+    float dist[nnbrs]
+*/
+#define GEODESICS_CSR_MAGIC "FreeSurferGeodesics-CSR"
+#define GEODESICS_CSR_HEADER 64
+
+// the offsets must run from 0 to nnbrs without decreasing before anything
+// indexes with them. The neighbours are only checked if checkv is set, as
+// that touches every page of a mapped file.
+static int geodesicsCSRcheck(GeodesicsCSR *geo, const char *fname, int checkv)
+{
+  if (geo->offset[0] != 0 || geo->offset[geo->nvertices] != geo->nnbrs) {
+    printf("ERROR: %s has inconsistent offsets\n", fname);
+    return (0);
+  }
+  for (int vno = 0; vno < geo->nvertices; vno++) {
+    if (geo->offset[vno + 1] < geo->offset[vno]) {
+      printf("ERROR: %s has inconsistent offsets at vertex %d\n", fname, vno);
+      return (0);
+    }
+  }
+  for (long n = 0; checkv && n < geo->nnbrs; n++) {
+    if (geo->v[n] < 0 || geo->v[n] >= geo->nvertices) {
+      printf("ERROR: %s has neighbour %d out of range\n", fname, geo->v[n]);
+      return (0);
+    }
+  }
+  return (1);
+}
+
+int geodesicsCSRwrite(GeodesicsCSR *geo, const char *fname)
+{
+  char header[GEODESICS_CSR_HEADER];
+  int endian = -1;
+  long nnbrs = geo->nnbrs;
+
+  memset(header, 0, sizeof(header));
+  strcpy(header, GEODESICS_CSR_MAGIC);
+  memcpy(&header[32], &endian, sizeof(int));
+  memcpy(&header[36], &geo->nvertices, sizeof(int));
+  memcpy(&header[40], &nnbrs, sizeof(long));
+
+  FILE *fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    printf("ERROR: geodesicsCSRwrite(): could not open %s\n", fname);
+    return (1);
+  }
+  if (fwrite(header, 1, sizeof(header), fp) != sizeof(header) ||
+      fwrite(geo->offset, sizeof(long), geo->nvertices + 1, fp) != (size_t)geo->nvertices + 1 ||
+      fwrite(geo->v, sizeof(int), nnbrs, fp) != (size_t)nnbrs ||
+      fwrite(geo->dist, sizeof(float), nnbrs, fp) != (size_t)nnbrs) {
+    printf("ERROR: geodesicsCSRwrite(): failed writing %s\n", fname);
+    fclose(fp);
+    return (1);
+  }
+  fclose(fp);
+  return (0);
+}
+
+/*!
+  \fn GeodesicsCSR *geodesicsCSRread(const char *fname, int use_mmap)
+  \brief Reads a file written by geodesicsCSRwrite(). If use_mmap is set
+  the arrays point into a read-only mapping of the file, so only the
+  neighbourhoods that are actually used get paged in.
+*/
+GeodesicsCSR *geodesicsCSRread(const char *fname, int use_mmap)
+{
+  char header[GEODESICS_CSR_HEADER];
+  int endian, nvertices;
+  long nnbrs;
+
+  FILE *fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    printf("ERROR: geodesicsCSRread(): could not open %s\n", fname);
+    return (NULL);
+  }
+  if (fread(header, 1, sizeof(header), fp) != sizeof(header) || strcmp(header, GEODESICS_CSR_MAGIC)) {
+    printf("ERROR: %s not a CSR geodesics file\n", fname);
+    fclose(fp);
+    return (NULL);
+  }
+  memcpy(&endian, &header[32], sizeof(int));
+  memcpy(&nvertices, &header[36], sizeof(int));
+  memcpy(&nnbrs, &header[40], sizeof(long));
+  if (endian != -1) {
+    printf("ERROR: %s wrong endian\n", fname);
+    fclose(fp);
+    return (NULL);
+  }
+  printf("    geodesicsCSRread(): %s nvertices = %d, nnbrs = %ld\n", fname, nvertices, nnbrs);
+
+  // the header must describe exactly the file that is there, or the arrays
+  // would run past its end (a SIGBUS when mapped)
+  struct stat st;
+  if (fstat(fileno(fp), &st) != 0 || nvertices < 0 || nnbrs < 0 ||
+      nnbrs > (long)(st.st_size / (sizeof(int) + sizeof(float)))) {
+    printf("ERROR: %s has a bad header or could not be stat'ed\n", fname);
+    fclose(fp);
+    return (NULL);
+  }
+  size_t const offset_bytes = (nvertices + 1) * sizeof(long);
+  size_t const len = GEODESICS_CSR_HEADER + offset_bytes + nnbrs * (sizeof(int) + sizeof(float));
+  if ((size_t)st.st_size != len) {
+    printf("ERROR: %s is %ld bytes, expected %ld for nvertices = %d, nnbrs = %ld\n", fname, (long)st.st_size,
+           (long)len, nvertices, nnbrs);
+    fclose(fp);
+    return (NULL);
+  }
+
+#ifdef _POSIX_MAPPED_FILES
+  if (use_mmap) {
+    void *base = mmap(0, len, PROT_READ, MAP_SHARED, fileno(fp), 0);
+    if (base != MAP_FAILED) {
+      fclose(fp);
+      GeodesicsCSR *geo = (GeodesicsCSR *)calloc(1, sizeof(GeodesicsCSR));
+      char *p = (char *)base + GEODESICS_CSR_HEADER;
+      geo->nvertices = nvertices;
+      geo->nnbrs = nnbrs;
+      geo->offset = (long *)p;
+      geo->v = (int *)(p + offset_bytes);
+      geo->dist = (float *)(p + offset_bytes + nnbrs * sizeof(int));
+      geo->mmap_base = base;
+      geo->mmap_len = len;
+      if (!geodesicsCSRcheck(geo, fname, 0)) geodesicsCSRfree(&geo);
+      return (geo);
+    }
+    printf("WARNING: geodesicsCSRread(): could not mmap %s, reading instead\n", fname);
+  }
+#endif
+
+  GeodesicsCSR *geo = geodesicsCSRalloc(nvertices, nnbrs);
+  if (fread(geo->offset, sizeof(long), nvertices + 1, fp) != (size_t)nvertices + 1 ||
+      fread(geo->v, sizeof(int), nnbrs, fp) != (size_t)nnbrs ||
+      fread(geo->dist, sizeof(float), nnbrs, fp) != (size_t)nnbrs) {
+    printf("ERROR: %s failed fread\n", fname);
+    geodesicsCSRfree(&geo);
+  }
+  fclose(fp);
+  if (geo && !geodesicsCSRcheck(geo, fname, 1)) geodesicsCSRfree(&geo);
+  return (geo);
+}
+
 void geodesicsWrite(Geodesics *geo, int nvertices, char *fname)
 {
   int vtxno;
@@ -459,7 +884,7 @@ int geodesicsUniquify(Geodesics *geod)
   return (nunique);
 }
 
-static int getIndex(int *arr, int vid)
+static int getIndex(const int *arr, int vid)
 {
   int idx = std::distance(arr, std::find(arr, arr + 3, vid));
   // this can be removed:
@@ -505,14 +930,6 @@ static Vertex extendedPoint(Vertex A, Vertex B, float dA, float dB, float dAB)
   return D;
 }
 
-static std::pair< int, int > makeKey(int a, int b)
-{
-  if (a < b)
-    return std::pair< int, int >(a, b);
-  else
-    return std::pair< int, int >(b, a);
-}
-
 static void progressBar(float progress)
 {
   if (!isatty(fileno(stdout))) return;
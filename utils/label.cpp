@@ -24,6 +24,8 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unordered_map>
+#include <vector>
 
 #include "mri.h"
 #include "mrisurf.h"
@@ -47,21 +49,40 @@ static int labelGetSurfaceRasCoords(LABEL *area, LABEL_VERTEX *lv, float *px, fl
 static int update_vertex_indices(LABEL *area);
 ;
 static LABEL_VERTEX *labelFindVertexNumber(LABEL *area, int vno);
+static void labelVertexIndexChanged(LABEL *area, int n);
+static void labelLoadSubject(LABEL *area, const char *subject_name);
+static int labelReadBinaryFrom(LABEL *area, FILE *fp);
 static Transform *labelLoadTransform(const char *subject_name, const char *sdir, General_transform *transform);
 #define MAX_VERTICES 500000
+
+static const char LABEL_BINARY_MAGIC[] = "\xff" "LBL";  // not a valid first byte of an ascii label
+#define LABEL_BINARY_VERSION 1
 /*-----------------------------------------------------
 ------------------------------------------------------*/
 LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
 {
   LABEL *area;
-  char line[STRLEN], subjects_dir[STRLEN], *cp, *str;
-  int vno, nlines;
+  char line[STRLEN], *cp, *str;
+  int vno, nlines, c;
   float x, y, z, stat;
 
   area = (LABEL *)calloc(1, sizeof(LABEL));
   if (!area) {
     ErrorExit(ERROR_NOMEMORY, "%s: could not allocate LABEL struct.", Progname);
   }
+
+  // an ascii label starts with a comment line, a binary one with LABEL_BINARY_MAGIC
+  c = fgetc(fp);
+  if (c == (unsigned char)LABEL_BINARY_MAGIC[0]) {
+    if (labelReadBinaryFrom(area, fp) != NO_ERROR) {
+      LabelFree(&area);
+      return (NULL);
+    }
+    labelLoadSubject(area, subject_name);
+    return (area);
+  }
+  if (c != EOF) ungetc(c, fp);
+
   cp = fgets(line, STRLEN, fp);  // read comment line
   if (cp == NULL) return (NULL);
   str = strstr(cp, "vox2ras=");
@@ -102,6 +123,14 @@ LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
   }
 
   if (!nlines) ErrorReturn(NULL, (ERROR_BADFILE, "%s: no data in label file", Progname));
+  labelLoadSubject(area, subject_name);
+  return (area);
+}
+
+static void labelLoadSubject(LABEL *area, const char *subject_name)
+{
+  char subjects_dir[STRLEN], *cp;
+
   if (subject_name) {
     cp = getenv("SUBJECTS_DIR");
     if (!cp)
@@ -114,7 +143,58 @@ LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
     area->linear_transform = labelLoadTransform(subject_name, subjects_dir, &area->transform);
     area->inverse_linear_transform = get_inverse_linear_transform_ptr(&area->transform);
   }
-  return (area);
+}
+
+/*-----------------------------------------------------
+  Binary labels: LABEL_BINARY_MAGIC, then (big-endian) the
+  version, the coords, the length and text of the space, the
+  number of points, and one array each of vno, x, y, z and
+  stat. Read with LabelRead/LabelReadFrom like an ascii label.
+------------------------------------------------------*/
+static int labelReadBinaryFrom(LABEL *area, FILE *fp)
+{
+  char magic[3];
+  int version, len, n;
+  size_t npoints;
+  std::vector<int> vno;
+  std::vector<float> x, y, z, stat;
+
+  // the first byte of the magic has already been consumed
+  if (fread(magic, 1, 3, fp) != 3 || memcmp(magic, LABEL_BINARY_MAGIC + 1, 3))
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "%s: not a binary label file", Progname));
+  if (!freadIntEx(&version, fp) || version != LABEL_BINARY_VERSION)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "%s: unsupported binary label version %d", Progname, version));
+  if (!freadIntEx(&area->coords, fp) || !freadIntEx(&len, fp) || len < 0 || len >= (int)sizeof(area->space) ||
+      fread(area->space, 1, len, fp) != (size_t)len)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "%s: could not read binary label header", Progname));
+  area->space[len] = 0;
+  if (!freadIntEx(&area->n_points, fp) || area->n_points <= 0)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "%s: no data in label file", Progname));
+
+  npoints = area->n_points;
+  area->max_points = area->n_points;
+  area->lv = (LABEL_VERTEX *)calloc(npoints, sizeof(LABEL_VERTEX));
+  if (!area->lv)
+    ErrorExit(ERROR_NOMEMORY, "%s: LabelReadFrom could not allocate %d-sized vector", Progname, sizeof(LV) * npoints);
+
+  vno.resize(npoints);
+  x.resize(npoints);
+  y.resize(npoints);
+  z.resize(npoints);
+  stat.resize(npoints);
+  if (freadIntArray(vno.data(), npoints, fp) != npoints || freadFloatArray(x.data(), npoints, fp) != npoints ||
+      freadFloatArray(y.data(), npoints, fp) != npoints || freadFloatArray(z.data(), npoints, fp) != npoints ||
+      freadFloatArray(stat.data(), npoints, fp) != npoints)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "%s: binary label file is truncated", Progname));
+
+  for (n = 0; n < area->n_points; n++) {
+    area->lv[n].vno = vno[n];
+    area->lv[n].x = x[n];
+    area->lv[n].y = y[n];
+    area->lv[n].z = z[n];
+    area->lv[n].stat = stat[n];
+  }
+  return (NO_ERROR);
 }
 
 LABEL *LabelRead(const char *subject_name, const char *label_name)
@@ -124,8 +204,11 @@ LABEL *LabelRead(const char *subject_name, const char *label_name)
   char label_name0[STRLEN];
   FILE *fp;
   std::string fname;
+  const char *ext = ".label";
 
   sprintf(label_name0, "%s", label_name);  // keep a copy
+  cp = strrchr(label_name0, '.');
+  if (cp && stricmp(cp, ".blabel") == 0) ext = ".blabel";
 
   if (subject_name && !strchr(label_name, '/')) {
     // subject name passed and label name does not have /
@@ -138,7 +221,7 @@ LABEL *LabelRead(const char *subject_name, const char *label_name)
                 Progname);
     strcpy(subjects_dir, cp);
     strcpy(lname, label_name);
-    cp = strstr(lname, ".label");
+    cp = strstr(lname, ext);
     if (cp) *cp = 0;
 
     cp = strrchr(lname, '/');
@@ -149,7 +232,7 @@ LABEL *LabelRead(const char *subject_name, const char *label_name)
     }
 
     fname = std::string(subjects_dir) + "/" + std::string(subject_name)
-      + "/label/" + std::string(label_name) + ".label";
+      + "/label/" + std::string(label_name) + ext;
   }
   else {
     fname = label_name;
@@ -160,9 +243,9 @@ LABEL *LabelRead(const char *subject_name, const char *label_name)
       strcpy(subjects_dir, cp);
     }
     strcpy(lname, label_name);
-    cp = strstr(lname, ".label");
+    cp = strstr(lname, ext);
     if (cp == NULL) {
-      fname = std::string(lname) + ".label";
+      fname = std::string(lname) + ext;
     } else {
       fname = label_name;
     }
@@ -219,6 +302,7 @@ int LabelFree(LABEL **parea)
   area = *parea;
   *parea = NULL;
   if (area->vertex_label_ind) free(area->vertex_label_ind);
+  LabelInvalidateVertexIndex(area);
 
   free(area->lv);
   free(area);
@@ -240,6 +324,7 @@ int LabelToCanonical(LABEL *area, MRI_SURFACE *mris)
     vno = area->lv[n].vno;
     v = &mris->vertices[vno];
     area->lv[n].vno = -1; /* not associated with a vertex anymore */
+    labelVertexIndexChanged(area, n);
     area->lv[n].x = v->cx;
     area->lv[n].y = v->cy;
     area->lv[n].z = v->cz;
@@ -263,6 +348,7 @@ int LabelToCurrent(LABEL *area, MRI_SURFACE *mris)
     vno = area->lv[n].vno;
     v = &mris->vertices[vno];
     area->lv[n].vno = -1; /* not associated with a vertex anymore */
+    labelVertexIndexChanged(area, n);
     area->lv[n].x = v->x;
     area->lv[n].y = v->y;
     area->lv[n].z = v->z;
@@ -323,6 +409,7 @@ int LabelFromCanonical(LABEL *area, MRI_SURFACE *mris)
                 Progname,
                 sizeof(LV) * nvertices);
   }
+  LabelInvalidateVertexIndex(area);
   area->n_points = nvertices;
   for (n = 0; n < nvertices; n++) {
     lv = &area->lv[n];
@@ -523,6 +610,7 @@ int LabelToFlat(LABEL *area, MRI_SURFACE *mris)
         DiagBreak();
       }
       area->lv[n].vno = vno;
+      labelVertexIndexChanged(area, n);
       area->lv[n].x = v->x;
       area->lv[n].y = v->y;
       area->lv[n].z = v->z;
@@ -570,18 +658,52 @@ int LabelWriteInto(LABEL *area, FILE *fp)
     }
   return (NO_ERROR);
 }
+int LabelWriteBinaryInto(LABEL *area, FILE *fp)
+{
+  int n, num, len;
+  std::vector<int> vno;
+  std::vector<float> x, y, z, stat;
+
+  for (n = 0; n < area->n_points; n++)
+    if (!area->lv[n].deleted) {
+      vno.push_back(area->lv[n].vno);
+      x.push_back(area->lv[n].x);
+      y.push_back(area->lv[n].y);
+      z.push_back(area->lv[n].z);
+      stat.push_back(area->lv[n].stat);
+    }
+  num = vno.size();
+  len = strlen(area->space);
+
+  if (fwrite(LABEL_BINARY_MAGIC, 1, 4, fp) != 4 || fwriteInt(LABEL_BINARY_VERSION, fp) != 1 ||
+      fwriteInt(area->coords, fp) != 1 || fwriteInt(len, fp) != 1 || fwrite(area->space, 1, len, fp) != (size_t)len ||
+      fwriteInt(num, fp) != 1) {
+    printf("ERROR: writing to label file 1\n");
+    return (1);
+  }
+  if (fwriteIntArray(vno.data(), num, fp) != (size_t)num || fwriteFloatArray(x.data(), num, fp) != (size_t)num ||
+      fwriteFloatArray(y.data(), num, fp) != (size_t)num || fwriteFloatArray(z.data(), num, fp) != (size_t)num ||
+      fwriteFloatArray(stat.data(), num, fp) != (size_t)num) {
+    printf("ERROR: writing to label file 2\n");
+    return (1);
+  }
+  return (NO_ERROR);
+}
 /*-----------------------------------------------------
         Parameters:
 
         Returns value:
 
         Description
+          A label_name ending in .blabel is written in the
+          binary format, anything else as an ascii .label
 ------------------------------------------------------*/
 int LabelWrite(LABEL *area, const char *label_name)
 {
   char *cp, subjects_dir[STRLEN], lname[STRLEN];
   FILE *fp;
-  int ret;
+  int ret, binary = 0;
+  const char *ext = ".label";
   std::string fname;
 
   strcpy(lname, label_name);
@@ -589,6 +711,11 @@ int LabelWrite(LABEL *area, const char *label_name)
   if (cp && stricmp(cp, ".label") == 0) {
     *cp = 0;
   }
+  else if (cp && stricmp(cp, ".blabel") == 0) {
+    *cp = 0;
+    binary = 1;
+    ext = ".blabel";
+  }
   label_name = lname;
   cp = strrchr(lname, '/');
   if ((cp == NULL) && strlen(area->subject_name) > 0) {
@@ -600,22 +727,27 @@ int LabelWrite(LABEL *area, const char *label_name)
                 Progname);
     strcpy(subjects_dir, cp);
     fname = std::string(subjects_dir) + '/' + std::string(area->subject_name) +
-      "/label/" + std::string(label_name) + ".label";
+      "/label/" + std::string(label_name) + ext;
   }
   else {
     cp = strrchr(lname, '.');
-    if (cp && stricmp(cp, ".label") == 0) {
+    if (cp && stricmp(cp, ext) == 0) {
       fname = label_name;
     }
     else {
-      fname = std::string(label_name) + ".label";
+      fname = std::string(label_name) + ext;
     }
   }
 
-  fp = fopen(fname.c_str(), "w");
+  fp = fopen(fname.c_str(), binary ? "wb" : "w");
   if (!fp) ErrorReturn(ERROR_NOFILE, (ERROR_NO_FILE, "%s: could not open label file %s", Progname, fname.c_str()));
 
-  ret = LabelWriteInto(area, fp);
+  if (binary) {
+    ret = LabelWriteBinaryInto(area, fp);
+  }
+  else {
+    ret = LabelWriteInto(area, fp);
+  }
   fclose(fp);
   return (ret);
 }
@@ -867,6 +999,7 @@ int LabelCurvFill(LABEL *area, int *vertex_list, int nvertices, int max_vertices
     v->marked = 1;
     LV* const lv = &area->lv[n];
     lv->vno = vertex_list[n];
+    labelVertexIndexChanged(area, n);
     lv->x = v->x;
     lv->y = v->y;
     lv->z = v->z;
@@ -1067,6 +1200,7 @@ int LabelFillAll(LABEL *area, int *vertex_list, int nvertices, int max_vertices,
     v->marked = 1;
     lv = &area->lv[n];
     lv->vno = vertex_list[n];
+    labelVertexIndexChanged(area, n);
     lv->x = v->x;
     lv->y = v->y;
     lv->z = v->z;
@@ -1266,8 +1400,14 @@ LABEL *LabelCopy(LABEL *asrc, LABEL *adst)
   strcpy(adst->subject_name, asrc->subject_name);
 
   memmove(adst->lv, asrc->lv, asrc->n_points * sizeof(LABEL_VERTEX));
+  LabelInvalidateVertexIndex(adst);
   return (adst);
 }
+static unsigned long long labelCellKey(long long cx, long long cy, long long cz)
+{
+  return (((unsigned long long)cx * 73856093ULL) ^ ((unsigned long long)cy * 19349663ULL) ^
+          ((unsigned long long)cz * 83492791ULL));
+}
 /*-----------------------------------------------------
   int LabelRemoveDuplicates(LABEL *area)
   Sets the 'deleted' flag of a label point if it is
@@ -1275,29 +1415,48 @@ LABEL *LabelCopy(LABEL *asrc, LABEL *adst)
   ------------------------------------------------------*/
 int LabelRemoveDuplicates(LABEL *area)
 {
-  int n1, n2, deleted = 0;
+  int n2, deleted = 0, dx, dy, dz;
   LV *lv1, *lv2;
-
-  // loop thru each label point
-  for (n1 = 0; n1 < area->n_points; n1++) {
-    lv1 = &area->lv[n1];
-    if (lv1->deleted) {
-      continue;
-    }
-    // loop thru the remaining looking for duplicates
-    for (n2 = n1 + 1; n2 < area->n_points; n2++) {
-      lv2 = &area->lv[n2];
-      if (lv1->vno >= 0 && lv2->vno >= 0 && lv1->vno == lv2->vno) {
+  long long cx, cy, cz;
+  std::vector<char> seen;
+  std::unordered_multimap<unsigned long long, int> cells;
+
+  // A point is a duplicate of an earlier one that survived if they have the
+  // same vertex number, or if neither is a vertex and they are within
+  // FLT_EPSILON in each coordinate. Vertices are checked in a table indexed
+  // by vno, coordinates in a hash of FLT_EPSILON-sized cells (a match can
+  // only be in the cell of the point or one of the 26 around it).
+  for (n2 = 0; n2 < area->n_points; n2++) {
+    lv2 = &area->lv[n2];
+    if (lv2->vno >= 0) {
+      if (lv2->vno >= (int)seen.size()) seen.resize(lv2->vno + 1, 0);
+      if (seen[lv2->vno]) {
         deleted++;
         lv2->deleted = 1;
       }
-      else if (lv1->vno < 0 && lv2->vno < 0) {
-        if (FEQUAL(lv1->x, lv2->x) && FEQUAL(lv1->y, lv2->y) && FEQUAL(lv1->z, lv2->z)) {
-          deleted++;
-          lv2->deleted = 1;
-        }
+      else if (!lv2->deleted) {
+        seen[lv2->vno] = 1;
       }
+      continue;
     }
+
+    cx = (long long)floor(lv2->x / FLT_EPSILON);
+    cy = (long long)floor(lv2->y / FLT_EPSILON);
+    cz = (long long)floor(lv2->z / FLT_EPSILON);
+    for (dx = -1; dx <= 1 && !lv2->deleted; dx++)
+      for (dy = -1; dy <= 1 && !lv2->deleted; dy++)
+        for (dz = -1; dz <= 1 && !lv2->deleted; dz++) {
+          auto range = cells.equal_range(labelCellKey(cx + dx, cy + dy, cz + dz));
+          for (auto it = range.first; it != range.second; ++it) {
+            lv1 = &area->lv[it->second];
+            if (FEQUAL(lv1->x, lv2->x) && FEQUAL(lv1->y, lv2->y) && FEQUAL(lv1->z, lv2->z)) {
+              deleted++;
+              lv2->deleted = 1;
+              break;
+            }
+          }
+        }
+    if (!lv2->deleted) cells.insert(std::make_pair(labelCellKey(cx, cy, cz), n2));
   }
 
   if (Gdiag & DIAG_SHOW) fprintf(stderr, "%d duplicate vertices removed from label %s.\n", deleted, area->name);
@@ -1361,6 +1520,7 @@ LABEL *LabelCompact(LABEL *lsrc, LABEL *ldst)
       ldst->lv[n].y = lsrc->lv[i].y;
       ldst->lv[n].z = lsrc->lv[i].z;
       ldst->lv[n].vno = lsrc->lv[i].vno;
+      labelVertexIndexChanged(ldst, n);
       ldst->lv[n].stat = lsrc->lv[i].stat;
       if (lsrc->lv[i].vno >= 0 && lsrc->lv[i].vno < ldst->max_points) ldst->vertex_label_ind[lsrc->lv[i].vno] = n;
       n++;
@@ -1938,6 +2098,7 @@ int LabelFillUnassignedVertices(MRI_SURFACE *mris, LABEL *area, int coords)
       num_not_found++;
     }
     lv->vno = min_vno;
+    labelVertexIndexChanged(area, n);
   }
   LabelRemoveDuplicates(area);
   MHTfree(&mht);
@@ -2002,6 +2163,7 @@ LABEL *LabelSphericalCombine(MRI_SURFACE *mris, LABEL *asrc, MRIS_HASH_TABLE *mh
       DiagBreak();
     }
     lv_dst->vno = vdst - mris_dst->vertices;
+    labelVertexIndexChanged(adst, lv_dst - adst->lv);
     if (lv_dst->vno == 60008) {
       DiagBreak();
     }
@@ -2085,6 +2247,7 @@ LABEL *LabelSphericalCombine(MRI_SURFACE *mris, LABEL *asrc, MRIS_HASH_TABLE *mh
           lv_dst->y = adst->lv[n].y;
           lv_dst->z = adst->lv[n].z;
           lv_dst->vno = vt->v[m];
+          labelVertexIndexChanged(adst, lv_dst - adst->lv);
           lv_dst->stat += vsrc->stat;
           if (lv_dst->vno == Gdiag_no) {
             DiagBreak();
@@ -2310,6 +2473,7 @@ int LabelDilate(LABEL *area, MRI_SURFACE *mris, int num_times, int coords)
         n = area->n_points++;
         lv = &area->lv[n];
         lv->vno = vno;
+        labelVertexIndexChanged(area, n);
         MRISgetCoords(v, coords, &lv->x, &lv->y, &lv->z);
         if (area->vertex_label_ind) area->vertex_label_ind[vno] = n;
         if (area->mris && area->mri_template) {
@@ -2334,18 +2498,100 @@ int LabelDilate(LABEL *area, MRI_SURFACE *mris, int num_times, int coords)
   return (NO_ERROR);
 }
 
-static LABEL_VERTEX *labelFindVertexNumber(LABEL *area, int vno)
+/*-----------------------------------------------------
+  Vertex number -> label point lookup. The table is built the
+  first time a label is searched by vertex number and covers
+  lv[0..n_points) as they were then. Points appended since
+  (n_points grew) are added at the next lookup, and a label
+  that shrank is rebuilt. Anything that gives an existing point
+  a new vertex number, or refills the label from the start,
+  must call labelVertexIndexChanged() or, outside this file,
+  LabelInvalidateVertexIndex(); a miss is not checked against
+  lv[]. LabelRealloc() keeps the points, so it keeps the table.
+  ------------------------------------------------------*/
+struct LABEL_VNO_INDEX
 {
-  int n;
-  LABEL_VERTEX *lv;
+  LABEL *owner;  // a LABEL copied by assignment must not share it
+  int n_points;
+  std::vector<int> first;  // first point with each vno, -1 if none
+};
 
-  for (n = 0; n < area->n_points; n++) {
-    lv = &area->lv[n];
-    if (lv->vno == vno) {
-      return (lv);
+#define LABEL_VNO_INDEX_MAX_VNO 50000000
+
+void LabelInvalidateVertexIndex(LABEL *area)
+{
+  if (area->vno_index && area->vno_index->owner == area) delete area->vno_index;
+  area->vno_index = NULL;
+}
+
+// point n is getting a new vertex number; appended points are past
+// the indexed range and get picked up by the next lookup
+static void labelVertexIndexChanged(LABEL *area, int n)
+{
+  if (area->vno_index && (area->vno_index->owner != area || n < area->vno_index->n_points))
+    LabelInvalidateVertexIndex(area);
+}
+
+static LABEL_VNO_INDEX *labelVertexIndex(LABEL *area)
+{
+  LABEL_VNO_INDEX *index = area->vno_index;
+  int n, vno, n0;
+
+  if (index && (index->owner != area || index->n_points > area->n_points)) {
+    LabelInvalidateVertexIndex(area);
+    index = NULL;
+  }
+  if (index == NULL) {
+    index = new LABEL_VNO_INDEX;
+    index->owner = area;
+    index->n_points = 0;
+    area->vno_index = index;
+  }
+
+  n0 = index->n_points;
+  for (n = n0; n < area->n_points; n++) {
+    vno = area->lv[n].vno;
+    if (vno < 0) continue;
+    if (vno >= LABEL_VNO_INDEX_MAX_VNO) {
+      // not a surface vertex number, fall back to searching
+      LabelInvalidateVertexIndex(area);
+      return (NULL);
     }
+    if (vno >= (int)index->first.size()) index->first.resize(vno + 1, -1);
+    if (index->first[vno] < 0) index->first[vno] = n;
+  }
+  index->n_points = area->n_points;
+  return (index);
+}
+
+// index of the first point in the label with this vertex number, -1 if there is none
+static int labelFindVertexIndex(LABEL *area, int vno)
+{
+  LABEL_VNO_INDEX *index;
+  int n;
+
+  index = vno >= 0 ? labelVertexIndex(area) : NULL;
+  if (index == NULL) {
+    for (n = 0; n < area->n_points; n++)
+      if (area->lv[n].vno == vno) return (n);
+    return (-1);
+  }
+  if (vno >= (int)index->first.size()) return (-1);
+  n = index->first[vno];
+  if (n >= 0 && area->lv[n].vno != vno) {
+    // lv[] was edited in place since the index was built
+    LabelInvalidateVertexIndex(area);
+    return (labelFindVertexIndex(area, vno));
   }
-  return (NULL);
+  return (n);
+}
+
+static LABEL_VERTEX *labelFindVertexNumber(LABEL *area, int vno)
+{
+  int n;
+
+  n = labelFindVertexIndex(area, vno);
+  return (n >= 0 ? &area->lv[n] : NULL);
 }
 
 int LabelSetStat(LABEL *area, float stat)
@@ -2542,12 +2788,7 @@ LABEL *LabelFillHolesWithOrig(LABEL *area_src, MRI_SURFACE *mris)
   ---------------------------------------------------------------*/
 int LabelHasVertex(int vtxno, LABEL *lb)
 {
-  int n;
-  for (n = 0; n < lb->n_points; n++)
-    if (lb->lv[n].vno == vtxno) {
-      return (n);
-    }
-  return (-1);
+  return (labelFindVertexIndex(lb, vtxno));
 }
 /*---------------------------------------------------------------
   LabelRealloc() - reallocates the number of label vertices
@@ -2649,14 +2890,7 @@ LABEL *LabelfromASeg(MRI *aseg, int segcode)
   ---------------------------------------------------------------*/
 int VertexIsInLabel(int vtxno, LABEL *label)
 {
-  int n;
-
-  for (n = 0; n < label->n_points; n++)
-    if (label->lv[n].vno == vtxno) {
-      return (1);
-    }
-
-  return (0);
+  return (labelFindVertexIndex(label, vtxno) >= 0);
 }
 /*---------------------------------------------------------------
   LabelBoundary() - returns a label of all the points in the input
@@ -2839,6 +3073,7 @@ int LabelUnassign(LABEL *area)
 
   for (i = 0; i < area->n_points; i++) {
     area->lv[i].vno = -1;
+    labelVertexIndexChanged(area, i);
   }
   return (NO_ERROR);
 }
@@ -3486,6 +3721,7 @@ LABEL *LabelSampleToSurface(MRI_SURFACE *mris, LABEL *area, MRI *mri_template, i
     }
     if (min_vno == Gdiag_no) DiagBreak();
     lv->vno = min_vno;
+    labelVertexIndexChanged(area_dst, n);
     area_dst->vertex_label_ind[min_vno] = n;
   }
   //  LabelRemoveDuplicates(area) ;
@@ -3534,6 +3770,7 @@ LABEL *LabelSampleToSurface(MRI_SURFACE *mris, LABEL *area, MRI *mri_template, i
           printf("adding vertex %d at index %d to fill label hole\n", vno2, area_dst->n_points);
           lv = &area_dst->lv[area_dst->n_points];
           lv->vno = vno2;
+          labelVertexIndexChanged(area_dst, area_dst->n_points);
           lv->x = xw;
           lv->y = yw;
           lv->z = zw;
@@ -3656,6 +3893,7 @@ int LabelInit(LABEL *area, MRI *mri_template, MRI_SURFACE *mris, int coords)
     min_vno = MHTfindClosestVertexNoXYZ( (MHT *)area->mht, (MRIS *)area->mris, vx,vy,vz, &distance );
 
     lv->vno = min_vno;
+    labelVertexIndexChanged(area, n);
     if (min_vno >= 0 && area->vertex_label_ind[min_vno] < 0)  // found one that isn't in label
     {
       area->vertex_label_ind[min_vno] = n;
@@ -3736,6 +3974,7 @@ int LabelAddVoxel(LABEL *area, int xv, int yv, int zv, int coords, int *vertices
   min_vno = MHTfindClosestVertexNoXYZ( (MHT *)area->mht, (MRIS *)area->mris, vx,vy,vz, &distance );
 
   lv->vno = min_vno;
+  labelVertexIndexChanged(area, n);
   if (min_vno >= 0)
   {
     if (area->vertex_label_ind[min_vno] < 0)  // found one that isn't in label
@@ -3759,6 +3998,7 @@ int LabelAddVoxel(LABEL *area, int xv, int yv, int zv, int coords, int *vertices
       else
       {
         lv->vno = -1;
+        labelVertexIndexChanged(area, lv - area->lv);
         for ( i = 0; i < area->n_points-1; i++)
         {
           LV *lv2 = &area->lv[i];
@@ -3914,6 +4154,7 @@ int LabelAddVertex(LABEL *area, int vno, int coords)
     MRIvoxelToWorld(area->mri_template, xv, yv, zv, &x, &y, &z);
 
   lv->vno = vno;
+  labelVertexIndexChanged(area, n);
   lv->x = x;
   lv->y = y;
   lv->z = z;
@@ -27,6 +27,10 @@ extern const char *Progname;
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <new>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -36,6 +40,7 @@ extern const char *Progname;
 #include "diag.h"
 #include "error.h"
 #include "fastmarching.h"
+#include "mri_edt.h"
 #include "filter.h"
 #include "fnv_hash.h"
 #include "macros.h"
@@ -162,12 +167,391 @@ MRI::MRI(const std::string& filename)
 #endif
 
 
+/*
+  Optional pool of image buffers and their slice pointer tables, enabled by setting
+  FS_MRI_POOL to the number of MB of freed buffers it may hold on to. Programs that
+  create and free many temporary volumes of the same shape then reuse the memory
+  (which is already mapped) instead of going back to calloc and initSlices. A
+  recycled buffer is only cleared if the volume has to start out zeroed. Buffers are
+  keyed on (bytes_total, depth * nframes, height) and usage is printed at exit.
+*/
+struct MRIpoolKey {
+  size_t bytes;
+  int nslices;
+  int height;
+  bool operator<(const MRIpoolKey &k) const
+  {
+    if (bytes != k.bytes) return bytes < k.bytes;
+    if (nslices != k.nslices) return nslices < k.nslices;
+    return height < k.height;
+  }
+};
+
+struct MRIpoolEntry {
+  void *chunk;
+  BUFTYPE ***slices;
+};
+
+struct MRIpool {
+  std::mutex lock;
+  std::map<MRIpoolKey, std::vector<MRIpoolEntry>> free_buffers;
+  size_t limit = 0;   // max bytes held in free_buffers
+  size_t cached = 0;  // bytes held in free_buffers
+  size_t in_use = 0;  // bytes of pooled volumes that are still alive
+  size_t peak = 0;    // max of in_use + cached
+  long requests = 0, hits = 0, recycled = 0;
+};
+
+static MRIpool *mri_pool = nullptr;
+
+static void mriPoolExitHandler(void)
+{
+  MRIpool *pool = mri_pool;
+  fprintf(stderr,
+          "MRI pool: %ld buffers requested, %ld reused (%.1f%%), %ld freed into the pool, "
+          "peak %.1f MB (%.1f MB cached at exit)\n",
+          pool->requests,
+          pool->hits,
+          pool->requests ? 100.0 * pool->hits / pool->requests : 0.0,
+          pool->recycled,
+          pool->peak / (1024.0 * 1024.0),
+          pool->cached / (1024.0 * 1024.0));
+}
+
+static MRIpool *mriPool()
+{
+  static bool inited = [] {
+    const char *cp = getenv("FS_MRI_POOL");
+    if (cp && atol(cp) > 0) {
+      mri_pool = new MRIpool;
+      mri_pool->limit = (size_t)atol(cp) << 20;
+      atexit(mriPoolExitHandler);
+    }
+    return true;
+  }();
+  (void)inited;
+  return mri_pool;
+}
+
+// a buffer of bytes for a volume with this slice table shape, with the slice table if it was recycled
+static void *mriPoolAlloc(MRIpool *pool, const MRIpoolKey &key, bool zero, BUFTYPE ****pslices)
+{
+  void *chunk = nullptr;
+
+  *pslices = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(pool->lock);
+    pool->requests++;
+    auto it = pool->free_buffers.find(key);
+    if (it != pool->free_buffers.end() && !it->second.empty()) {
+      chunk = it->second.back().chunk;
+      *pslices = it->second.back().slices;
+      it->second.pop_back();
+      pool->cached -= key.bytes;
+      pool->hits++;
+    }
+    pool->in_use += key.bytes;
+    pool->peak = std::max(pool->peak, pool->in_use + pool->cached);
+  }
+
+  if (chunk) {
+    if (zero) memset(chunk, 0, key.bytes);
+    return chunk;
+  }
+  chunk = zero ? calloc(key.bytes, 1) : malloc(key.bytes);
+  if (!chunk) {
+    std::lock_guard<std::mutex> guard(pool->lock);
+    pool->in_use -= key.bytes;
+  }
+  return chunk;
+}
+
+// returns false if the caller still has to free the buffer and slice table
+static bool mriPoolRelease(MRIpool *pool, const MRIpoolKey &key, void *chunk, BUFTYPE ***slices, bool keep)
+{
+  std::lock_guard<std::mutex> guard(pool->lock);
+  pool->in_use -= key.bytes;
+  if (!keep || !chunk || !slices || pool->cached + key.bytes > pool->limit) return false;
+  pool->free_buffers[key].push_back({chunk, slices});
+  pool->cached += key.bytes;
+  pool->recycled++;
+  return true;
+}
+
+
+/*
+  Sparse brick storage (MRIallocSparse). Each frame is a table of MRI_BRICK_SIZE^3
+  bricks, stored x fastest within the brick. A null entry is the shared all-zero
+  brick, so a brick only gets memory when a nonzero value is written to it. Bricks
+  are reference counted: MRIcopy of a sparse volume shares them, and the first
+  write to a shared brick replaces it with a private copy. Table entries are
+  atomic so that threads writing different voxels of one volume can allocate or
+  copy the same brick at once; the loser of the race frees its brick.
+*/
+struct alignas(16) MRI_BRICK_DATA {
+  std::atomic<int> refs;  // number of volumes using the brick
+  unsigned char *voxels() { return (unsigned char *)(this + 1); }
+};
+
+struct MRI_BRICK_STORE {
+  int nbx, nby, nbz, nframes;
+  size_t brick_bytes;
+  std::atomic<MRI_BRICK_DATA *> *table;  // (frame, bz, by, bx), x fastest
+};
+
+#define MRI_BRICK_VOXELS (MRI_BRICK_SIZE * MRI_BRICK_SIZE * MRI_BRICK_SIZE)
+static const long mri_zero_brick[MRI_BRICK_VOXELS] = {0};  // big enough for any voxel type
+
+static MRI_BRICK_STORE *mriBrickStoreAlloc(const MRI *mri)
+{
+  MRI_BRICK_STORE *store = new MRI_BRICK_STORE;
+  store->nbx = (mri->width + MRI_BRICK_SIZE - 1) / MRI_BRICK_SIZE;
+  store->nby = (mri->height + MRI_BRICK_SIZE - 1) / MRI_BRICK_SIZE;
+  store->nbz = (mri->depth + MRI_BRICK_SIZE - 1) / MRI_BRICK_SIZE;
+  store->nframes = mri->nframes;
+  store->brick_bytes = MRI_BRICK_VOXELS * mri->bytes_per_vox;
+  size_t n = (size_t)store->nbx * store->nby * store->nbz * store->nframes;
+  store->table = new std::atomic<MRI_BRICK_DATA *>[n];
+  for (size_t b = 0; b < n; b++) store->table[b].store(nullptr);
+  return store;
+}
+
+static size_t mriBrickCount(const MRI_BRICK_STORE *store)
+{
+  return (size_t)store->nbx * store->nby * store->nbz * store->nframes;
+}
+
+static void mriBrickRelease(MRI_BRICK_DATA *brick)
+{
+  if (brick && brick->refs.fetch_sub(1) == 1) free(brick);
+}
+
+static void mriBrickStoreFree(MRI_BRICK_STORE *store)
+{
+  size_t n = mriBrickCount(store);
+  for (size_t b = 0; b < n; b++) mriBrickRelease(store->table[b].load());
+  delete[] store->table;
+  delete store;
+}
+
+// makes dst share all the bricks of src (same shape and type)
+static void mriBrickStoreShare(const MRI_BRICK_STORE *src, MRI_BRICK_STORE *dst)
+{
+  size_t n = mriBrickCount(src);
+  for (size_t b = 0; b < n; b++) {
+    MRI_BRICK_DATA *brick = src->table[b].load();
+    if (brick) brick->refs++;
+    mriBrickRelease(dst->table[b].exchange(brick));
+  }
+}
+
+static inline size_t mriBrickIndex(const MRI_BRICK_STORE *store, int x, int y, int z, int f)
+{
+  return (((size_t)f * store->nbz + z / MRI_BRICK_SIZE) * store->nby + y / MRI_BRICK_SIZE) * store->nbx +
+         x / MRI_BRICK_SIZE;
+}
+
+static inline size_t mriBrickOffset(int x, int y, int z)
+{
+  return ((size_t)(z % MRI_BRICK_SIZE) * MRI_BRICK_SIZE + y % MRI_BRICK_SIZE) * MRI_BRICK_SIZE + x % MRI_BRICK_SIZE;
+}
+
+static inline const unsigned char *mriBrickRead(const MRI_BRICK_STORE *store, size_t b)
+{
+  MRI_BRICK_DATA *brick = store->table[b].load(std::memory_order_acquire);
+  return brick ? brick->voxels() : (const unsigned char *)mri_zero_brick;
+}
+
+// the voxels of brick b for writing: a zero brick is allocated, a shared one copied
+static unsigned char *mriBrickWrite(MRI_BRICK_STORE *store, size_t b)
+{
+  std::atomic<MRI_BRICK_DATA *> &entry = store->table[b];
+
+  for (;;) {
+    MRI_BRICK_DATA *brick = entry.load(std::memory_order_acquire);
+    // A brick with one reference is ours only if it is still in the table: another
+    // thread may have replaced it with its copy and dropped our reference to it.
+    if (brick && brick->refs.load() == 1 && entry.load(std::memory_order_acquire) == brick) return brick->voxels();
+
+    MRI_BRICK_DATA *copy = (MRI_BRICK_DATA *)malloc(sizeof(MRI_BRICK_DATA) + store->brick_bytes);
+    if (!copy) ErrorExit(ERROR_NO_MEMORY, "MRI: could not allocate a %lu byte brick", store->brick_bytes);
+    new (copy) MRI_BRICK_DATA;
+    copy->refs.store(1);
+    if (brick)
+      memcpy(copy->voxels(), brick->voxels(), store->brick_bytes);
+    else
+      memset(copy->voxels(), 0, store->brick_bytes);
+    if (entry.compare_exchange_strong(brick, copy, std::memory_order_acq_rel, std::memory_order_acquire)) {
+      mriBrickRelease(brick);
+      return copy->voxels();
+    }
+    free(copy);  // another thread replaced the brick first, start over from its brick
+  }
+}
+
+static float mriSparseGetVal(const MRI *mri, int c, int r, int s, int f)
+{
+  if (c >= mri->width || r >= mri->height || s >= mri->depth || f < 0 || f >= mri->nframes) return mri->outside_val;
+  const unsigned char *p = mriBrickRead(mri->bricks, mriBrickIndex(mri->bricks, c, r, s, f)) +
+                           mriBrickOffset(c, r, s) * mri->bytes_per_vox;
+  switch (mri->type) {
+  case MRI_UCHAR:
+    return (float)*p;
+  case MRI_SHORT:
+    return (float)*(const short *)p;
+  case MRI_USHRT:
+    return (float)*(const unsigned short *)p;
+  case MRI_INT:
+    return (float)*(const int *)p;
+  case MRI_LONG:
+    return (float)*(const long *)p;
+  case MRI_FLOAT:
+    return *(const float *)p;
+  }
+  return (-10000000000.9);
+}
+
+// voxval is already clipped to the range of the type
+static int mriSparseSetVal(MRI *mri, int c, int r, int s, int f, float voxval)
+{
+  if (c < 0 || r < 0 || s < 0 || c >= mri->width || r >= mri->height || s >= mri->depth || f < 0 || f >= mri->nframes)
+    return (1);
+  size_t b = mriBrickIndex(mri->bricks, c, r, s, f);
+  bool isfloat = (mri->type == MRI_FLOAT);
+  if ((isfloat ? voxval : nint(voxval)) == 0 && !mri->bricks->table[b].load(std::memory_order_acquire))
+    return (0);  // already 0
+
+  unsigned char *p = mriBrickWrite(mri->bricks, b) + mriBrickOffset(c, r, s) * mri->bytes_per_vox;
+  switch (mri->type) {
+  case MRI_UCHAR:
+    *p = nint(voxval);
+    break;
+  case MRI_SHORT:
+    *(short *)p = nint(voxval);
+    break;
+  case MRI_USHRT:
+    *(unsigned short *)p = nint(voxval);
+    break;
+  case MRI_INT:
+    *(int *)p = nint(voxval);
+    break;
+  case MRI_LONG:
+    *(long *)p = nint(voxval);
+    break;
+  case MRI_FLOAT:
+    *(float *)p = voxval;
+    break;
+  default:
+    return (1);
+  }
+  return (0);
+}
+
+/*!
+  \fn MRI *MRIallocSparse(int width, int height, int depth, int type, int nframes)
+  \brief Allocates a volume stored as MRI_BRICK_SIZE^3 bricks (see mri.h). All
+  voxels are 0 and no brick uses memory until a nonzero value is written to it.
+  Types are MRI_UCHAR, MRI_SHORT, MRI_USHRT, MRI_INT, MRI_LONG and MRI_FLOAT.
+*/
+MRI *MRIallocSparse(int width, int height, int depth, int type, int nframes)
+{
+  if (type != MRI_UCHAR && type != MRI_SHORT && type != MRI_USHRT && type != MRI_INT && type != MRI_LONG &&
+      type != MRI_FLOAT)
+    ErrorReturn(NULL, (ERROR_UNSUPPORTED, "MRIallocSparse: unsupported type %d", type));
+
+  MRI *mri = new MRI({width, height, depth, nframes}, type, false);
+  mri->ras_good_flag = 1;
+  mri->ischunked = 0;
+  mri->bricks = mriBrickStoreAlloc(mri);
+  mri->initIndices();
+  return (mri);
+}
+
+/*!
+  \fn void MRIsparseGetRow(const MRI *mri, int y, int z, int frame, void *row)
+  \brief Copies row (y, z) of the frame of a sparse volume into row, which holds
+  width voxels of the volume type.
+*/
+void MRIsparseGetRow(const MRI *mri, int y, int z, int frame, void *row)
+{
+  size_t const bpv = mri->bytes_per_vox;
+  for (int x0 = 0; x0 < mri->width; x0 += MRI_BRICK_SIZE) {
+    int n = MIN(MRI_BRICK_SIZE, mri->width - x0);
+    const unsigned char *voxels = mriBrickRead(mri->bricks, mriBrickIndex(mri->bricks, x0, y, z, frame));
+    memcpy((unsigned char *)row + x0 * bpv, voxels + mriBrickOffset(x0, y, z) * bpv, n * bpv);
+  }
+}
+
+/*!
+  \fn void MRIsparseSetRow(MRI *mri, int y, int z, int frame, const void *row)
+  \brief Sets row (y, z) of the frame of a sparse volume from row, which holds
+  width voxels of the volume type. Parts of the row that are 0 and fall in a zero
+  brick do not allocate it.
+*/
+void MRIsparseSetRow(MRI *mri, int y, int z, int frame, const void *row)
+{
+  size_t const bpv = mri->bytes_per_vox;
+  for (int x0 = 0; x0 < mri->width; x0 += MRI_BRICK_SIZE) {
+    int n = MIN(MRI_BRICK_SIZE, mri->width - x0);
+    const unsigned char *src = (const unsigned char *)row + x0 * bpv;
+    size_t b = mriBrickIndex(mri->bricks, x0, y, z, frame);
+    if (!mri->bricks->table[b].load(std::memory_order_acquire) && MRIbufferIsZero(src, n * bpv)) continue;
+    memcpy(mriBrickWrite(mri->bricks, b) + mriBrickOffset(x0, y, z) * bpv, src, n * bpv);
+  }
+}
+
+/*!
+  \fn size_t MRIsparseBytes(const MRI *mri)
+  \brief Bytes of voxel memory used by the bricks of a sparse volume (bricks shared
+  with other volumes included), or bytes_total for a dense volume.
+*/
+size_t MRIsparseBytes(const MRI *mri)
+{
+  if (!mri->bricks) return mri->bytes_total;
+  size_t nbricks = 0, n = mriBrickCount(mri->bricks);
+  for (size_t b = 0; b < n; b++)
+    if (mri->bricks->table[b].load()) nbricks++;
+  return nbricks * mri->bricks->brick_bytes;
+}
+
+// copies the voxels of src into dst (same shape) when either one is sparse
+static void mriSparseCopyVoxels(const MRI *src, MRI *dst)
+{
+  if (src->bricks && dst->bricks && src->type == dst->type && src->nframes == dst->nframes) {
+    mriBrickStoreShare(src->bricks, dst->bricks);
+    return;
+  }
+
+  std::vector<unsigned char> row(src->width * src->bytes_per_vox);
+  for (int f = 0; f < src->nframes; f++) {
+    for (int z = 0; z < src->depth; z++) {
+      for (int y = 0; y < src->height; y++) {
+        if (src->type == dst->type) {
+          const void *srcrow = row.data();
+          if (src->bricks)
+            MRIsparseGetRow(src, y, z, f, row.data());
+          else
+            srcrow = src->slices[z + f * src->depth][y];
+          if (dst->bricks)
+            MRIsparseSetRow(dst, y, z, f, srcrow);
+          else
+            memmove(dst->slices[z + f * dst->depth][y], srcrow, row.size());
+          continue;
+        }
+        for (int x = 0; x < src->width; x++) MRIsetVoxVal(dst, x, y, z, f, MRIgetVoxVal(src, x, y, z, f));
+      }
+    }
+  }
+}
+
+
 /**
   Constructs an MRI with a given shape and data type. If the `alloc` parameter (defaults
   to true) is false, the underlying image buffer is not allocated and only the header is
-  initialized.
+  initialized. If `zero` is false, the caller is going to overwrite every voxel and the
+  buffer is not cleared.
 */
-MRI::MRI(Shape volshape, int dtype, bool alloc) : shape(volshape), type(dtype)
+MRI::MRI(Shape volshape, int dtype, bool alloc, bool zero) : shape(volshape), type(dtype)
 {
   // set geometry
   width = shape.width;
@@ -223,7 +607,18 @@ MRI::MRI(Shape volshape, int dtype, bool alloc) : shape(volshape), type(dtype)
   ras_good_flag = 1;
 
   // attempt to chunk - if that fails, try allocating non-contiguous slices
-  chunk = calloc(bytes_total, 1);
+  MRIpool *pool = mriPool();
+  if (pool) {
+    chunk = mriPoolAlloc(pool, {bytes_total, depth * nframes, height}, zero, &slices);
+    if (chunk) {
+      pool_bytes = bytes_total;
+      pool_nslices = depth * nframes;
+      pool_height = height;
+    }
+  }
+  else {
+    chunk = zero ? calloc(bytes_total, 1) : malloc(bytes_total);
+  }
   ischunked = bool(chunk);
 
   // initialize slices and indices
@@ -248,18 +643,21 @@ void MRI::initGCAMorphLabel()
 /**
   Allocates array of slice pointers - this is done regardless of chunking so that we
   can still support 3D-indexing and not produce any weird issues. This function should
-  only be called once for a single volume.
+  only be called once for a single volume. A slice table recycled from the MRI pool is
+  already allocated and only has its row pointers reset.
 */
 void MRI::initSlices()
 {
   int nslices = depth * nframes;
-  slices = (BUFTYPE ***)calloc(nslices, sizeof(BUFTYPE **));
-  if (!slices) fs::fatal() << "could not allocate memory for " << nslices << " slices";
+  if (!slices) {
+    slices = (BUFTYPE ***)calloc(nslices, sizeof(BUFTYPE **));
+    if (!slices) fs::fatal() << "could not allocate memory for " << nslices << " slices";
+  }
 
   void *ptr = chunk;
   for (int slice = 0; slice < nslices; slice++) {
     // allocate an array of row pointers
-    slices[slice] = (BUFTYPE **)calloc(height, sizeof(BUFTYPE *));
+    if (!slices[slice]) slices[slice] = (BUFTYPE **)calloc(height, sizeof(BUFTYPE *));
     if (!slices[slice]) fs::fatal() << "could not allocate memory for slice " << slice + 1 << " out of " << nslices;
 
     if (ischunked) {
@@ -351,7 +749,9 @@ void MRI::initIndices()
 */
 MRI::~MRI()
 {
-  if (!ischunked) {
+  if (bricks) {
+    mriBrickStoreFree(bricks);
+  } else if (!ischunked) {
     if (slices) {
       for (int slice = 0; slice < depth * nframes; slice++) {
         if (slices[slice]) {
@@ -361,10 +761,13 @@ MRI::~MRI()
       }
       free(slices);
     }
+  } else if (pool_bytes && mriPoolRelease(mri_pool, {pool_bytes, pool_nslices, pool_height}, chunk, slices, owndata)) {
+    // chunk and slice table are reused by the next volume of this shape
   } else {
     if (owndata) free(chunk);
     if (slices) {
-      for (int slice = 0; slice < depth * nframes; slice++)
+      int nslices = pool_bytes ? pool_nslices : depth * nframes;
+      for (int slice = 0; slice < nslices; slice++)
         if (slices[slice]) free(slices[slice]);
     }
     free(slices);
@@ -420,6 +823,15 @@ FnvHash MRI::hash() {
       }
     }
   }
+  else if (bricks) {
+    std::vector<unsigned char> row(MRIsizeof(type) * width);
+    for (int slice = 0; slice < depth; slice++) {
+      for (int r = 0; r < height; r++) {
+        MRIsparseGetRow(this, r, slice, 0, row.data());
+        mrihash.add(row.data(), row.size());
+      }
+    }
+  }
   return mrihash;
 }
 
@@ -1446,6 +1858,82 @@ size_t MRIsizeof(int mritype)
   return (-1);  // should never get here
 }
 
+/*!
+  \fn bool MRIbufferIsZero(const void *buf, size_t nbytes)
+  \brief Returns true if every byte of the buffer is 0 (so -0.0 is not zero).
+*/
+bool MRIbufferIsZero(const void *buf, size_t nbytes)
+{
+  const unsigned char *p = (const unsigned char *)buf;
+  size_t n = 0;
+  unsigned long long word;
+
+  for (; n + sizeof(word) <= nbytes; n += sizeof(word)) {
+    memcpy(&word, p + n, sizeof(word));
+    if (word) return false;
+  }
+  for (; n < nbytes; n++)
+    if (p[n]) return false;
+  return true;
+}
+
+/*!
+  \fn std::vector<MRI_BRICK> MRInonzeroBricks(const MRI *mri, int frame)
+  \brief Lists the MRI_BRICK_SIZE^3 bricks of the frame that have at least one
+  nonzero voxel, in x fastest order. Reading the empty part of a sparse volume
+  does not make its pages resident.
+*/
+std::vector<MRI_BRICK> MRInonzeroBricks(const MRI *mri, int frame)
+{
+  int const nbx = (mri->width + MRI_BRICK_SIZE - 1) / MRI_BRICK_SIZE;
+  int const nby = (mri->height + MRI_BRICK_SIZE - 1) / MRI_BRICK_SIZE;
+  int const nbz = (mri->depth + MRI_BRICK_SIZE - 1) / MRI_BRICK_SIZE;
+  size_t const bpv = mri->bytes_per_vox;
+  std::vector<char> nonzero((size_t)nbx * nby * nbz, 0);
+  std::vector<MRI_BRICK> bricks;
+  int bz;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (bz = 0; bz < nbz; bz++) {
+    ROMP_PFLB_begin
+    int const z0 = bz * MRI_BRICK_SIZE, z1 = MIN(z0 + MRI_BRICK_SIZE, mri->depth);
+    for (int by = 0; by < nby; by++) {
+      int const y0 = by * MRI_BRICK_SIZE, y1 = MIN(y0 + MRI_BRICK_SIZE, mri->height);
+      for (int bx = 0; bx < nbx; bx++) {
+        int const x0 = bx * MRI_BRICK_SIZE, x1 = MIN(x0 + MRI_BRICK_SIZE, mri->width);
+        char *flag = &nonzero[((size_t)bz * nby + by) * nbx + bx];
+        if (mri->bricks) {
+          // the voxels past the edge of the volume are never written and stay 0
+          size_t b = mriBrickIndex(mri->bricks, x0, y0, z0, frame);
+          *flag = mri->bricks->table[b].load() && !MRIbufferIsZero(mriBrickRead(mri->bricks, b), mri->bricks->brick_bytes);
+          continue;
+        }
+        for (int z = z0; z < z1 && !*flag; z++)
+          for (int y = y0; y < y1 && !*flag; y++)
+            if (!MRIbufferIsZero(mri->slices[z + frame * mri->depth][y] + x0 * bpv, (x1 - x0) * bpv)) *flag = 1;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (size_t b = 0; b < nonzero.size(); b++) {
+    if (!nonzero[b]) continue;
+    MRI_BRICK brick;
+    brick.x0 = (b % nbx) * MRI_BRICK_SIZE;
+    brick.y0 = ((b / nbx) % nby) * MRI_BRICK_SIZE;
+    brick.z0 = (b / ((size_t)nbx * nby)) * MRI_BRICK_SIZE;
+    brick.x1 = MIN(brick.x0 + MRI_BRICK_SIZE, mri->width);
+    brick.y1 = MIN(brick.y0 + MRI_BRICK_SIZE, mri->height);
+    brick.z1 = MIN(brick.z0 + MRI_BRICK_SIZE, mri->depth);
+    bricks.push_back(brick);
+  }
+  return (bricks);
+}
+
 /*--------------------------------------------------------*/
 /*!
  \fn double MRIptr2dbl(void *pmric, int mritype)
@@ -1593,6 +2081,8 @@ float MRIgetVoxVal(const MRI *mri, int c, int r, int s, int f)
   if (r < 0) return mri->outside_val;
   if (s < 0) return mri->outside_val;
 
+  if (mri->bricks) return mriSparseGetVal(mri, c, r, s, f);
+
   if (mri->ischunked) {
     switch (mri->type) {
     case MRI_RGB:
@@ -1648,6 +2138,8 @@ float MRIgetVoxVal2(const MRI *mri, int c, int r, int s, int f)
   if (r < 0) return mri->outside_val;
   if (s < 0) return mri->outside_val;
 
+  if (mri->bricks) return mriSparseGetVal(mri, c, r, s, f);
+
   switch (mri->type) {
   case MRI_RGB:
   case MRI_UCHAR:
@@ -1709,6 +2201,8 @@ int MRIsetVoxVal(MRI *mri, int c, int r, int s, int f, float voxval)
     break;
   }
 
+  if (mri->bricks) return mriSparseSetVal(mri, c, r, s, f, voxval);
+
   if (mri->ischunked) {
     switch (mri->type) {
     case MRI_RGB:
@@ -1786,6 +2280,8 @@ int MRIsetVoxVal2(MRI *mri, int c, int r, int s, int f, float voxval)
     break;
   }
 
+  if (mri->bricks) return mriSparseSetVal(mri, c, r, s, f, voxval);
+
   switch (mri->type) {
   case MRI_RGB:
   case MRI_UCHAR:
@@ -4926,8 +5422,11 @@ MRI *MRIbinarizeNoThreshold(MRI *mri_src, MRI *mri_dst)
   ------------------------------------------------------*/
 MRI *MRIbinarize(MRI *mri_src, MRI *mri_dst, float threshold, float low_val, float hi_val)
 {
-  int width, height, depth, f, z;
+  int width, height, depth, f, z, b, sparse;
 
+  // a new destination starts out 0, so if 0 maps to low_val == 0 only the
+  // bricks of the source with a nonzero voxel have to be visited
+  sparse = (mri_dst == NULL && low_val == 0 && threshold > 0);
   if (!mri_dst) mri_dst = MRIclone(mri_src, NULL);
 
   width = mri_src->width;
@@ -4935,6 +5434,25 @@ MRI *MRIbinarize(MRI *mri_src, MRI *mri_dst, float threshold, float low_val, flo
   depth = mri_src->depth;
 
   for (f = 0; f < mri_src->nframes; f++) {
+    if (sparse) {
+      std::vector<MRI_BRICK> bricks = MRInonzeroBricks(mri_src, f);
+      ROMP_PF_begin
+      #ifdef HAVE_OPENMP
+      #pragma omp parallel for if_ROMP(experimental)
+      #endif
+      for (b = 0; b < (int)bricks.size(); b++) {
+        ROMP_PFLB_begin
+        const MRI_BRICK *brick = &bricks[b];
+        for (int z = brick->z0; z < brick->z1; z++)
+          for (int y = brick->y0; y < brick->y1; y++)
+            for (int x = brick->x0; x < brick->x1; x++)
+              if (!(MRIgetVoxVal(mri_src, x, y, z, f) < threshold)) MRIsetVoxVal(mri_dst, x, y, z, f, hi_val);
+        ROMP_PFLB_end
+      }
+      ROMP_PF_end
+      continue;
+    }
+
     ROMP_PF_begin
     #ifdef HAVE_OPENMP
     #pragma omp parallel for if_ROMP(experimental)
@@ -5658,8 +6176,12 @@ MRI *MRIdivide(MRI *mri1, MRI *mri2, MRI *mri_dst)
   ------------------------------------------------------*/
 MRI *MRIclone(const MRI *mri_src, MRI *mri_dst)
 {
-  if (!mri_dst)
-    mri_dst = MRIallocSequence(mri_src->width, mri_src->height, mri_src->depth, mri_src->type, mri_src->nframes);
+  if (!mri_dst) {
+    if (mri_src->bricks)  // a clone of a sparse volume is sparse
+      mri_dst = MRIallocSparse(mri_src->width, mri_src->height, mri_src->depth, mri_src->type, mri_src->nframes);
+    else
+      mri_dst = MRIallocSequence(mri_src->width, mri_src->height, mri_src->depth, mri_src->type, mri_src->nframes);
+  }
 
   // Including this in MRIcopyHeader might have unwanted effects. A
   // valid mri->ct indicates to freeview that it's a segmentation, and
@@ -5731,9 +6253,30 @@ MRI *MRIcopy(MRI *mri_src, MRI *mri_dst)
   int rgb=1;
   if(mri_src->type == MRI_RGB) rgb=3;
 
+  if (mri_src->bricks || (mri_dst && mri_dst->bricks)) {
+    // a sparse copy of a sparse volume shares its bricks until one of them is written
+    if (!mri_dst) mri_dst = MRIallocSparse(width, height, depth, mri_src->type, mri_src->nframes);
+    dest_ptype = mri_dst->ptype;
+    MRIcopyHeader(mri_src, mri_dst);
+    mri_dst->ptype = dest_ptype;
+    mriSparseCopyVoxels(mri_src, mri_dst);
+    return (mri_dst);
+  }
+
+  bool skip_zero_rows = false;
   if (!mri_dst) {
-    if (mri_src->slices)
-      mri_dst = MRIallocSequence(width, height, depth, mri_src->type, rgb*mri_src->nframes);
+    if (mri_src->slices) {
+      // These types are copied below a full row at a time. A recycled buffer
+      // from the MRI pool does not need clearing; otherwise the buffer comes
+      // zeroed from calloc and the all-zero rows of the source are skipped, so
+      // the empty parts of a sparse volume never get pages.
+      bool full_rows = (mri_src->type == MRI_UCHAR || mri_src->type == MRI_RGB || mri_src->type == MRI_SHORT ||
+                        mri_src->type == MRI_USHRT || mri_src->type == MRI_FLOAT || mri_src->type == MRI_INT ||
+                        mri_src->type == MRI_LONG);
+      bool zero = !full_rows || !mriPool();
+      mri_dst = new MRI({width, height, depth, rgb*mri_src->nframes}, mri_src->type, true, zero);
+      skip_zero_rows = full_rows && zero;
+    }
     else {
       mri_dst = MRIallocHeader(width, height, depth, mri_src->type, 1);
       mri_dst->nframes = mri_src->nframes;
@@ -5772,6 +6315,7 @@ MRI *MRIcopy(MRI *mri_src, MRI *mri_dst)
     for (frame = 0; frame < rgb*mri_src->nframes; frame++) {
       for (z = 0; z < depth; z++) {
         for (y = 0; y < height; y++) {
+          if (skip_zero_rows && MRIbufferIsZero(mri_src->slices[z + frame * depth][y], bytes)) continue;
           memmove(mri_dst->slices[z + frame * depth][y], mri_src->slices[z + frame * depth][y], bytes);
         }
       }
@@ -12137,10 +12681,11 @@ MRI *MRIresampleFill(MRI *src, MRI *template_vol, int resample_type, float fill_
     MRIfree(&mri_votes);
   }
   else
+    // walk the destination in memory order (column fastest)
     for (nframe = 0; nframe < template_vol->nframes; nframe++) {
-      for (di = 0; di < template_vol->width; di++) {
+      for (dk = 0; dk < template_vol->depth; dk++) {
         for (dj = 0; dj < template_vol->height; dj++) {
-          for (dk = 0; dk < template_vol->depth; dk++) {
+          for (di = 0; di < template_vol->width; di++) {
             if (di == Gx && dj == Gy && dk == Gz) DiagBreak();
             *MATRIX_RELT(dp, 1, 1) = (float)di;
             *MATRIX_RELT(dp, 2, 1) = (float)dj;
@@ -15364,6 +15909,11 @@ char *MRIsliceDirectionName(VOL_GEOM *mri)
 /**
  * This is deprecated.  Please use MRIextractDistanceMap in fastmarching.h
  * instead
+ *
+ * If FS_DTRANS_EXACT is set and there is no mask, this uses the exact
+ * distance transform in mri_edt.cpp, with max_dist in voxels and the result
+ * in mm as before. A mask restricts propagation of the front, so that case
+ * always goes through fast marching.
  **/
 MRI *MRIdistanceTransform(MRI *mri_src, MRI *mri_dist, int label, float max_dist, int mode, MRI *mri_mask)
 {
@@ -15378,6 +15928,13 @@ MRI *MRIdistanceTransform(MRI *mri_src, MRI *mri_dist, int label, float max_dist
   else
     MRIclear(mri_dist);
 
+  if (mri_mask == NULL && MRIuseExactDistanceTransform()) {
+    const float clip = (max_dist > 0) ? max_dist : 2 * MAX(MAX(width, height), depth);
+    mri_dist = MRIexactDistanceTransform(mri_src, mri_dist, label, clip * mri_src->xsize, mode, 1);
+    if (mri_dist) mri_dist->outside_val = max_dist;
+    return mri_dist;
+  }
+
   // these are the modes in fastmarching...
   const int outside = 1;
   // this one isn't used in this function
@@ -18,11 +18,13 @@
  */
 
 #include <float.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <vector>
 
 #include "bfileio.h"
 #include "cma.h"
@@ -768,6 +770,139 @@ MRI *MRIvol2VolLTA::vol2vol(MRI *outvol)
 
 
 
+/*---------------------------------------------------------------
+  Resampling engine used by MRIvol2Vol(). The target is cut into tiles
+  of a run of columns over a small block of rows and slices; each
+  thread walks its tile in memory order, so consecutive target voxels
+  map to nearby source voxels. For every row of a tile the source
+  coordinates are gathered first, then the row is sampled by a routine
+  specialised for the interpolation and source type, then stored with
+  a routine specialised for the target type. The arithmetic is the
+  same as MRIsampleSeqVolume() and MRIsetVoxVal(), so the output does
+  not change.
+  ---------------------------------------------------------------*/
+#define VOL2VOL_TILE_COLS 64
+#define VOL2VOL_TILE_ROWS 8
+#define VOL2VOL_TILE_SLICES 8
+
+#ifndef UCHAR_MIN
+#define UCHAR_MIN 0.0
+#endif
+#ifndef SHORT_MIN
+#define SHORT_MIN -32768.0
+#endif
+#ifndef SHORT_MAX
+#define SHORT_MAX 32767.0
+#endif
+
+// vals holds n values per frame (frame-major); only inside voxels are touched
+template <class T>
+static void vol2volNearestRow(
+    const MRI *src, int n, const int *ics, const int *irs, const int *iss, const char *inside, float *vals)
+{
+  for (int f = 0; f < src->nframes; f++) {
+    const T *p = (const T *)src->chunk + f * src->vox_per_vol;
+    float *v = vals + (size_t)f * n;
+    for (int k = 0; k < n; k++)
+      if (inside[k]) v[k] = (float)p[ics[k] + irs[k] * src->vox_per_row + iss[k] * src->vox_per_slice];
+  }
+}
+
+template <class T>
+static void vol2volTrilinearRow(
+    const MRI *src, int n, const float *fcs, const float *frs, const float *fss, const char *inside, float *vals)
+{
+  const T *p = (const T *)src->chunk;
+  const size_t vpr = src->vox_per_row, vps = src->vox_per_slice, vpv = src->vox_per_vol;
+  const int width = src->width, height = src->height, depth = src->depth;
+
+  for (int k = 0; k < n; k++) {
+    if (!inside[k]) continue;
+    double x = fcs[k], y = frs[k], z = fss[k];
+    if (MRIindexNotInVolume(src, x, y, z) == 1) {
+      for (int f = 0; f < src->nframes; f++) vals[(size_t)f * n + k] = src->outside_val;
+      continue;
+    }
+    if (x >= width) x = width - 1.0;
+    if (y >= height) y = height - 1.0;
+    if (z >= depth) z = depth - 1.0;
+    if (x < 0.0) x = 0.0;
+    if (y < 0.0) y = 0.0;
+    if (z < 0.0) z = 0.0;
+
+    int xm = MAX((int)x, 0);
+    int xp = MIN(width - 1, xm + 1);
+    int ym = MAX((int)y, 0);
+    int yp = MIN(height - 1, ym + 1);
+    int zm = MAX((int)z, 0);
+    int zp = MIN(depth - 1, zm + 1);
+
+    double xmd = x - (float)xm;
+    double ymd = y - (float)ym;
+    double zmd = z - (float)zm;
+    double xpd = (1.0f - xmd);
+    double ypd = (1.0f - ymd);
+    double zpd = (1.0f - zmd);
+
+    const size_t mmm = xm + ym * vpr + zm * vps, mmp = xm + ym * vpr + zp * vps;
+    const size_t mpm = xm + yp * vpr + zm * vps, mpp = xm + yp * vpr + zp * vps;
+    const size_t pmm = xp + ym * vpr + zm * vps, pmp = xp + ym * vpr + zp * vps;
+    const size_t ppm = xp + yp * vpr + zm * vps, ppp = xp + yp * vpr + zp * vps;
+    for (int f = 0; f < src->nframes; f++) {
+      const T *pf = p + f * vpv;
+      vals[(size_t)f * n + k] = xpd * ypd * zpd * (double)pf[mmm] + xpd * ypd * zmd * (double)pf[mmp] +
+                                xpd * ymd * zpd * (double)pf[mpm] + xpd * ymd * zmd * (double)pf[mpp] +
+                                xmd * ypd * zpd * (double)pf[pmm] + xmd * ypd * zmd * (double)pf[pmp] +
+                                xmd * ymd * zpd * (double)pf[ppm] + xmd * ymd * zmd * (double)pf[ppp];
+    }
+  }
+}
+
+// clipping and rounding as in MRIsetVoxVal()
+static inline void vol2volStore(unsigned char *p, float v)
+{
+  if (v < UCHAR_MIN) v = UCHAR_MIN;
+  if (v > UCHAR_MAX) v = UCHAR_MAX;
+  *p = nint(v);
+}
+static inline void vol2volStore(short *p, float v)
+{
+  if (v < SHORT_MIN) v = SHORT_MIN;
+  if (v > SHORT_MAX) v = SHORT_MAX;
+  *p = nint(v);
+}
+static inline void vol2volStore(unsigned short *p, float v)
+{
+  if (v < 0) v = 0;
+  if (v > USHRT_MAX) v = USHRT_MAX;
+  *p = nint(v);
+}
+static inline void vol2volStore(int *p, float v)
+{
+  if (v < INT_MIN) v = INT_MIN;
+  if (v > INT_MAX) v = INT_MAX;
+  *p = nint(v);
+}
+static inline void vol2volStore(long *p, float v)
+{
+  if (v < LONG_MIN) v = LONG_MIN;
+  if (v > LONG_MAX) v = LONG_MAX;
+  *p = nint(v);
+}
+static inline void vol2volStore(float *p, float v) { *p = v; }
+
+template <class T>
+static void vol2volStoreRow(MRI *targ, int c0, int rt, int st, int n, const char *inside, const float *vals)
+{
+  for (int f = 0; f < targ->nframes; f++) {
+    T *p = (T *)targ->chunk + c0 + rt * targ->vox_per_row + st * targ->vox_per_slice + f * targ->vox_per_vol;
+    const float *v = vals + (size_t)f * n;
+    for (int k = 0; k < n; k++)
+      if (inside[k]) vol2volStore(p + k, v[k]);
+  }
+}
+
+
 /*---------------------------------------------------------------
   MRIvol2Vol() - samples the values of one volume into that of
   another. Handles multiple frames. Can do nearest-neighbor,
@@ -784,17 +919,19 @@ MRI *MRIvol2VolLTA::vol2vol(MRI *outvol)
 
   param is a generic parameter. For sinc, param is the hw parameter,
   otherwise, it currently has no meaning.
+
+  Target voxels that do not map into the source are left untouched.
   ---------------------------------------------------------------*/
 int MRIvol2Vol(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, float param)
 {
-  int ct, show_progress_thread;
-  int tid = 0;
-  float *valvects[_MAX_FS_THREADS];
-  int sinchw;
+  int tile, ntiles, ntc, ntr, nts, show_progress_thread;
+  int sinchw, FastSample, FastStore, n;
   MATRIX *V2Rsrc = NULL, *invV2Rsrc = NULL, *V2Rtarg = NULL;
   int FreeMats = 0;
   MRI_BSPLINE *bspline = NULL;
   int (*nintfunc)( double );
+  std::vector<float> ctab[3], rtab[3], stab[3];
+  float offset[3];
 
   /*
     This is a little bit of a hack for the case where there is only
@@ -850,94 +987,157 @@ int MRIvol2Vol(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, float param)
 
   if (InterpCode == SAMPLE_CUBIC_BSPLINE) bspline = MRItoBSpline(src, NULL, 3);
 
+  /* Each term of the vox2vox product, per target column, row and
+     slice. Summing them in the same order as the matrix-vector product
+     gives the same float source coordinates. */
+  for (n = 0; n < 3; n++) {
+    ctab[n].resize(targ->width);
+    rtab[n].resize(targ->height);
+    stab[n].resize(targ->depth);
+    for (int ct = 0; ct < targ->width; ct++) ctab[n][ct] = Vt2s->rptr[n + 1][1] * ct;
+    for (int rt = 0; rt < targ->height; rt++) rtab[n][rt] = Vt2s->rptr[n + 1][2] * rt;
+    for (int st = 0; st < targ->depth; st++) stab[n][st] = Vt2s->rptr[n + 1][3] * st;
+    offset[n] = Vt2s->rptr[n + 1][4];
+  }
+
+  /* Typed row routines need contiguous buffers; anything else (sinc,
+     bspline, RGB or unchunked volumes) goes through the generic
+     per-voxel samplers */
+  FastSample = src->ischunked && src->type != MRI_RGB &&
+               (InterpCode == SAMPLE_NEAREST || InterpCode == SAMPLE_TRILINEAR);
+  FastStore = targ->ischunked && targ->type != MRI_RGB;
+
+  ntc = (targ->width + VOL2VOL_TILE_COLS - 1) / VOL2VOL_TILE_COLS;
+  ntr = (targ->height + VOL2VOL_TILE_ROWS - 1) / VOL2VOL_TILE_ROWS;
+  nts = (targ->depth + VOL2VOL_TILE_SLICES - 1) / VOL2VOL_TILE_SLICES;
+  ntiles = ntc * ntr * nts;
+
 #ifdef HAVE_OPENMP
   if (omp_get_max_threads() == 1)
     show_progress_thread = 0;
   else
     show_progress_thread = omp_get_max_threads() - 1;  // avoid master thread
-
-  for (tid = 0; tid < _MAX_FS_THREADS; tid++) {
-    valvects[tid] = (float *)calloc(sizeof(float), src->nframes);
-  }
 #else
   show_progress_thread = 0;
-  valvects[0] = (float *)calloc(sizeof(float), src->nframes);
 #endif
 
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for if_ROMP(assume_reproducible) shared(show_progress_thread, targ, bspline, src, Vt2s, InterpCode)
+  #pragma omp parallel for if_ROMP(assume_reproducible) shared(show_progress_thread, targ, bspline, src, InterpCode, ctab, rtab, stab, offset)
 #endif
-  for (ct = 0; ct < targ->width; ct++) {
+  for (tile = 0; tile < ntiles; tile++) {
     ROMP_PFLB_begin
-    
-    int rt, st, f;
-    int ics, irs, iss;
-    float fcs, frs, fss, *valvect;
-    double rval;
 
+    int c0, c1, r0, r1, s0, s1, rt, st, k, f, nc, ninside;
+    float fcs[VOL2VOL_TILE_COLS], frs[VOL2VOL_TILE_COLS], fss[VOL2VOL_TILE_COLS];
+    int ics[VOL2VOL_TILE_COLS], irs[VOL2VOL_TILE_COLS], iss[VOL2VOL_TILE_COLS];
+    char inside[VOL2VOL_TILE_COLS];
+    std::vector<float> vals((size_t)VOL2VOL_TILE_COLS * src->nframes), valvect(src->nframes);
+    double rval;
+    int tid = 0;
 #ifdef HAVE_OPENMP
-    int tid = omp_get_thread_num();
-    valvect = valvects[tid];
-#else
-    valvect = valvects[0];
+    tid = omp_get_thread_num();
 #endif
 
-    for (rt = 0; rt < targ->height; rt++) {
-      for (st = 0; st < targ->depth; st++) {
-        /* Column in source corresponding to CRS in Target */
-        fcs = Vt2s->rptr[1][1] * ct + Vt2s->rptr[1][2] * rt + Vt2s->rptr[1][3] * st + Vt2s->rptr[1][4];
-        ics = nintfunc(fcs);
-        if (ics < 0 || ics >= src->width) continue;
-
-        /* Row in source corresponding to CRS in Target */
-        frs = Vt2s->rptr[2][1] * ct + Vt2s->rptr[2][2] * rt + Vt2s->rptr[2][3] * st + Vt2s->rptr[2][4];
-        irs = nintfunc(frs);
-        if (irs < 0 || irs >= src->height) continue;
-
-        /* Slice in source corresponding to CRS in Target */
-        fss = Vt2s->rptr[3][1] * ct + Vt2s->rptr[3][2] * rt + Vt2s->rptr[3][3] * st + Vt2s->rptr[3][4];
-        iss = nintfunc(fss);
-        if (iss < 0 || iss >= src->depth) continue;
-
-        /* Assign output volume values */
-        if (InterpCode == SAMPLE_TRILINEAR)
-          MRIsampleSeqVolume(src, fcs, frs, fss, valvect, 0, src->nframes - 1);
+    c0 = (tile % ntc) * VOL2VOL_TILE_COLS;
+    r0 = ((tile / ntc) % ntr) * VOL2VOL_TILE_ROWS;
+    s0 = (tile / (ntc * ntr)) * VOL2VOL_TILE_SLICES;
+    c1 = MIN(c0 + VOL2VOL_TILE_COLS, targ->width);
+    r1 = MIN(r0 + VOL2VOL_TILE_ROWS, targ->height);
+    s1 = MIN(s0 + VOL2VOL_TILE_SLICES, targ->depth);
+    nc = c1 - c0;
+
+    for (st = s0; st < s1; st++) {
+      for (rt = r0; rt < r1; rt++) {
+        /* CRS in source corresponding to CRS in Target */
+        ninside = 0;
+        for (k = 0; k < nc; k++) {
+          fcs[k] = ctab[0][c0 + k] + rtab[0][rt] + stab[0][st] + offset[0];
+          frs[k] = ctab[1][c0 + k] + rtab[1][rt] + stab[1][st] + offset[1];
+          fss[k] = ctab[2][c0 + k] + rtab[2][rt] + stab[2][st] + offset[2];
+          ics[k] = nintfunc(fcs[k]);
+          irs[k] = nintfunc(frs[k]);
+          iss[k] = nintfunc(fss[k]);
+          inside[k] = (ics[k] >= 0 && ics[k] < src->width && irs[k] >= 0 && irs[k] < src->height && iss[k] >= 0 &&
+                       iss[k] < src->depth);
+          ninside += inside[k];
+        }
+        if (ninside == 0) continue;
+
+        /* Sample the source */
+        if (FastSample) {
+          if (InterpCode == SAMPLE_NEAREST) {
+            switch (src->type) {
+              case MRI_UCHAR: vol2volNearestRow<unsigned char>(src, nc, ics, irs, iss, inside, &vals[0]); break;
+              case MRI_SHORT: vol2volNearestRow<short>(src, nc, ics, irs, iss, inside, &vals[0]); break;
+              case MRI_USHRT: vol2volNearestRow<unsigned short>(src, nc, ics, irs, iss, inside, &vals[0]); break;
+              case MRI_INT: vol2volNearestRow<int>(src, nc, ics, irs, iss, inside, &vals[0]); break;
+              case MRI_LONG: vol2volNearestRow<long>(src, nc, ics, irs, iss, inside, &vals[0]); break;
+              case MRI_FLOAT: vol2volNearestRow<float>(src, nc, ics, irs, iss, inside, &vals[0]); break;
+            }
+          }
+          else {
+            switch (src->type) {
+              case MRI_UCHAR: vol2volTrilinearRow<unsigned char>(src, nc, fcs, frs, fss, inside, &vals[0]); break;
+              case MRI_SHORT: vol2volTrilinearRow<short>(src, nc, fcs, frs, fss, inside, &vals[0]); break;
+              case MRI_USHRT: vol2volTrilinearRow<unsigned short>(src, nc, fcs, frs, fss, inside, &vals[0]); break;
+              case MRI_INT: vol2volTrilinearRow<int>(src, nc, fcs, frs, fss, inside, &vals[0]); break;
+              case MRI_LONG: vol2volTrilinearRow<long>(src, nc, fcs, frs, fss, inside, &vals[0]); break;
+              case MRI_FLOAT: vol2volTrilinearRow<float>(src, nc, fcs, frs, fss, inside, &vals[0]); break;
+            }
+          }
+        }
         else {
-          for (f = 0; f < src->nframes; f++) {
-            switch (InterpCode) {
-              case SAMPLE_NEAREST:
-                valvect[f] = MRIgetVoxVal(src, ics, irs, iss, f);
-                break;
-              case SAMPLE_CUBIC_BSPLINE:
-                MRIsampleBSpline(bspline, fcs, frs, fss, f, &rval);
-                valvect[f] = rval;
-                break;
-              case SAMPLE_SINC: /* no multi-frame */
-                MRIsincSampleVolume(src, fcs, frs, fss, sinchw, &rval);
-                valvect[f] = rval;
-                break;
-              default:
-                printf("ERROR: MRIvol2vol: interpolation method %i unknown\n", InterpCode);
-                exit(1);
+          for (k = 0; k < nc; k++) {
+            if (!inside[k]) continue;
+            if (InterpCode == SAMPLE_TRILINEAR)
+              MRIsampleSeqVolume(src, fcs[k], frs[k], fss[k], &valvect[0], 0, src->nframes - 1);
+            else {
+              for (f = 0; f < src->nframes; f++) {
+                switch (InterpCode) {
+                  case SAMPLE_NEAREST:
+                    valvect[f] = MRIgetVoxVal(src, ics[k], irs[k], iss[k], f);
+                    break;
+                  case SAMPLE_CUBIC_BSPLINE:
+                    MRIsampleBSpline(bspline, fcs[k], frs[k], fss[k], f, &rval);
+                    valvect[f] = rval;
+                    break;
+                  case SAMPLE_SINC: /* no multi-frame */
+                    MRIsincSampleVolume(src, fcs[k], frs[k], fss[k], sinchw, &rval);
+                    valvect[f] = rval;
+                    break;
+                  default:
+                    printf("ERROR: MRIvol2vol: interpolation method %i unknown\n", InterpCode);
+                    exit(1);
+                }
+              }
             }
+            for (f = 0; f < src->nframes; f++) vals[(size_t)f * nc + k] = valvect[f];
           }
         }
 
-        for (f = 0; f < src->nframes; f++) MRIsetVoxVal(targ, ct, rt, st, f, valvect[f]);
-
-      } /* target col */
-    }   /* target row */
-    if (tid == show_progress_thread) exec_progress_callback(ct, targ->width, 0, 1);
+        /* Assign output volume values */
+        if (FastStore) {
+          switch (targ->type) {
+            case MRI_UCHAR: vol2volStoreRow<unsigned char>(targ, c0, rt, st, nc, inside, &vals[0]); break;
+            case MRI_SHORT: vol2volStoreRow<short>(targ, c0, rt, st, nc, inside, &vals[0]); break;
+            case MRI_USHRT: vol2volStoreRow<unsigned short>(targ, c0, rt, st, nc, inside, &vals[0]); break;
+            case MRI_INT: vol2volStoreRow<int>(targ, c0, rt, st, nc, inside, &vals[0]); break;
+            case MRI_LONG: vol2volStoreRow<long>(targ, c0, rt, st, nc, inside, &vals[0]); break;
+            case MRI_FLOAT: vol2volStoreRow<float>(targ, c0, rt, st, nc, inside, &vals[0]); break;
+          }
+        }
+        else {
+          for (f = 0; f < src->nframes; f++)
+            for (k = 0; k < nc; k++)
+              if (inside[k]) MRIsetVoxVal(targ, c0 + k, rt, st, f, vals[(size_t)f * nc + k]);
+        }
+      } /* target row */
+    }   /* target slice */
+    if (tid == show_progress_thread) exec_progress_callback(tile, ntiles, 0, 1);
     ROMP_PFLB_end
-  } /* target slice */
+  } /* target tile */
   ROMP_PF_end
-  
-#ifdef HAVE_OPENMP
-  for (tid = 0; tid < _MAX_FS_THREADS; tid++) free(valvects[tid]);
-#else
-  free(valvects[0]);
-#endif
 
 #ifdef VERBOSE_MODE
   int tSampleTime = tSample.milliseconds();
@@ -0,0 +1,230 @@
+/**
+ * @brief exact separable euclidean distance transform of label volumes
+ *
+ * An exact alternative to the heap-based fast marching front for full-volume
+ * distance maps, used by MRIdistanceTransform and MRIextractDistanceMap when
+ * FS_DTRANS_EXACT is set.
+ * Each axis is handled by the linear-time lower envelope of parabolas
+ * algorithm of Felzenszwalb and Huttenlocher ("Distance Transforms of
+ * Sampled Functions", Theory of Computing 8, 2012), which gives exact
+ * squared distances for arbitrary (anisotropic) voxel sizes.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "romp_support.h"
+
+#include "mri_edt.h"
+
+int MRIuseExactDistanceTransform(void)
+{
+  static int use_exact = -1;
+  if (use_exact < 0) use_exact = (getenv("FS_DTRANS_EXACT") != NULL);
+  return (use_exact);
+}
+
+/*
+  1D squared distance transform of the sampled function f (n samples, spacing
+  w) into d. v and z are scratch arrays of size n and n+1. Samples with
+  f >= MRI_EDT_INFINITY are not sites, so a line without any finite sample
+  stays at MRI_EDT_INFINITY.
+*/
+static void edt1d(const float *f, float *d, int n, double w, int *v, double *z)
+{
+  const double w2 = w * w;
+  int k = -1;
+
+  for (int q = 0; q < n; q++) {
+    if (f[q] >= MRI_EDT_INFINITY) continue;
+    const double fq = f[q] + w2 * q * q;
+    double s = -HUGE_VAL;
+    while (k >= 0) {
+      const int p = v[k];
+      s = (fq - (f[p] + w2 * p * p)) / (2.0 * w2 * (q - p));
+      if (s > z[k]) break;
+      k--;
+    }
+    k++;
+    v[k] = q;
+    z[k] = (k == 0) ? -HUGE_VAL : s;
+  }
+
+  if (k < 0) {
+    for (int q = 0; q < n; q++) d[q] = MRI_EDT_INFINITY;
+    return;
+  }
+  z[k + 1] = HUGE_VAL;
+
+  for (int q = 0, j = 0; q < n; q++) {
+    while (z[j + 1] < q) j++;
+    const double dq = q - v[j];
+    d[q] = (float)(w2 * dq * dq + f[v[j]]);
+  }
+}
+
+/*
+  Run edt1d over every line of the volume parallel to one axis. nlines lines
+  of length n, the first sample of line l is at base(l) and consecutive
+  samples are stride apart.
+*/
+static void edtAxisPass(float *f, size_t nlines, int n, size_t stride, int line_width, size_t plane, double w)
+{
+  const int nthreads = omp_get_max_threads();
+  std::vector<float> in_buf((size_t)nthreads * n), out_buf((size_t)nthreads * n);
+  std::vector<int> v_buf((size_t)nthreads * n);
+  std::vector<double> z_buf((size_t)nthreads * (n + 1));
+
+  long l;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+  for (l = 0; l < (long)nlines; l++) {
+    ROMP_PFLB_begin
+    const int tid = omp_get_thread_num();
+    float *in = &in_buf[(size_t)tid * n];
+    float *out = &out_buf[(size_t)tid * n];
+
+    // lines are enumerated with the first free axis fastest so that
+    // neighbouring iterations touch neighbouring memory
+    const size_t base = (size_t)(l % line_width) + (size_t)(l / line_width) * plane;
+    float *p = f + base;
+
+    for (int i = 0; i < n; i++) in[i] = p[i * stride];
+    edt1d(in, out, n, w, &v_buf[(size_t)tid * n], &z_buf[(size_t)tid * (n + 1)]);
+    for (int i = 0; i < n; i++) p[i * stride] = out[i];
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+int MRIcomputeSquaredEDT(float *f, int width, int height, int depth, const double spacing[3])
+{
+  const size_t slice = (size_t)width * height;
+
+  // x: lines start at (0,y,z), contiguous
+  edtAxisPass(f, (size_t)height * depth, width, 1, 1, width, spacing[0]);
+  // y: lines start at (x,0,z)
+  if (height > 1) edtAxisPass(f, (size_t)width * depth, height, width, width, slice, spacing[1]);
+  // z: lines start at (x,y,0)
+  if (depth > 1) edtAxisPass(f, slice, depth, slice, width, width, spacing[2]);
+
+  return (NO_ERROR);
+}
+
+MRI *MRIexactDistanceTransform(MRI *mri_src, MRI *mri_dst, int label, float max_dist, int mode, int in_mm)
+{
+  const int width = mri_src->width, height = mri_src->height, depth = mri_src->depth;
+  const size_t nvox = (size_t)width * height * depth;
+  double spacing[3], half;
+
+  if (mri_dst == NULL) {
+    mri_dst = MRIalloc(width, height, depth, MRI_FLOAT);
+    MRIcopyHeader(mri_src, mri_dst);
+  }
+  if (mri_dst->width != width || mri_dst->height != height || mri_dst->depth != depth || mri_dst->type != MRI_FLOAT)
+    ErrorReturn(NULL,
+                (ERROR_BADPARM,
+                 "MRIexactDistanceTransform: dst must be MRI_FLOAT and %dx%dx%d (is type %d, %dx%dx%d)",
+                 width, height, depth, mri_dst->type, mri_dst->width, mri_dst->height, mri_dst->depth));
+
+  if (in_mm) {
+    spacing[0] = mri_src->xsize;
+    spacing[1] = mri_src->ysize;
+    spacing[2] = mri_src->zsize;
+    half = 0.5 * mri_src->xsize;
+  }
+  else {
+    spacing[0] = 1.0;
+    spacing[1] = mri_src->ysize / mri_src->xsize;
+    spacing[2] = mri_src->zsize / mri_src->xsize;
+    half = 0.5;
+  }
+
+  // same default as MRIextractDistanceMap
+  if (max_dist <= 0) {
+    max_dist = 2 * MAX(MAX(width, height), depth);
+    if (in_mm) max_dist *= mri_src->xsize;
+  }
+
+  std::vector<unsigned char> in_label(nvox);
+  int z;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < height; y++) {
+      unsigned char *p = &in_label[((size_t)z * height + y) * width];
+      for (int x = 0; x < width; x++) p[x] = (nint(MRIgetVoxVal(mri_src, x, y, z, 0)) == label);
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  const bool need_out = (mode != DTRANS_MODE_INSIDE);
+  const bool need_in = (mode != DTRANS_MODE_OUTSIDE);
+
+  // distance of the exterior to the label, and of the interior to the exterior
+  std::vector<float> dout, din;
+  if (need_out) {
+    dout.resize(nvox);
+    for (size_t i = 0; i < nvox; i++) dout[i] = in_label[i] ? 0.0f : MRI_EDT_INFINITY;
+    MRIcomputeSquaredEDT(&dout[0], width, height, depth, spacing);
+  }
+  if (need_in) {
+    din.resize(nvox);
+    for (size_t i = 0; i < nvox; i++) din[i] = in_label[i] ? MRI_EDT_INFINITY : 0.0f;
+    MRIcomputeSquaredEDT(&din[0], width, height, depth, spacing);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < height; y++) {
+      const size_t row = ((size_t)z * height + y) * width;
+      for (int x = 0; x < width; x++) {
+        const size_t i = row + x;
+        double val = 0;
+        if (in_label[i]) {
+          if (need_in) {
+            val = (din[i] >= MRI_EDT_INFINITY) ? max_dist : sqrt(din[i]) - half;
+            if (val > max_dist) val = max_dist;
+            if (mode != DTRANS_MODE_UNSIGNED) val = -val;
+          }
+        }
+        else if (need_out) {
+          val = (dout[i] >= MRI_EDT_INFINITY) ? max_dist : sqrt(dout[i]) - half;
+          if (val > max_dist) val = max_dist;
+        }
+        MRIFvox(mri_dst, x, y, z) = val;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (mri_dst);
+}
@@ -21,6 +21,7 @@
  */
 
 #include "fastmarching.h"
+#include "mri_edt.h"
 
 MRI *MRIextractDistanceMap(MRI *mri_src, MRI *mri_dst, int label, float max_distance, int mode, MRI *mri_mask)
 {
@@ -77,6 +78,27 @@ MRI *MRIextractDistanceMap(MRI *mri_src, MRI *mri_dst, int label, float max_dist
               mri_dst->type);
   }
   else {
+    // opt-in, as it changes the output; the exact transform can't honor a
+    // mask, which blocks the front
+    if (mri_mask == NULL && MRIuseExactDistanceTransform()) {
+      int dtrans_mode;
+      switch (mode) {
+        case 1:
+          dtrans_mode = DTRANS_MODE_OUTSIDE;
+          break;
+        case 2:
+          dtrans_mode = DTRANS_MODE_INSIDE;
+          break;
+        case 4:
+          dtrans_mode = DTRANS_MODE_UNSIGNED;
+          break;
+        default:
+          dtrans_mode = DTRANS_MODE_SIGNED;
+          break;
+      }
+      return MRIexactDistanceTransform(mri_src, mri_dst, label, max_distance, dtrans_mode, 0);
+    }
+
     // set values to zero
     for (int z = 0; z < mri_dst->depth; z++)
       for (int y = 0; y < mri_dst->height; y++)
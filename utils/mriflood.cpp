@@ -20,6 +20,8 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <vector>
 #include "cma.h"
 #include "diag.h"
 #include "fsenv.h"
@@ -28,6 +30,7 @@
 #include "mrisurf.h"
 #include "mrisurf_metricProperties.h"
 #include "region.h"
+#include "romp_support.h"
 #include "timer.h"
 
 #define IMGSIZE 256
@@ -1482,52 +1485,68 @@ MRI *MRISmakeBoundingVolume(MRIS *mris, double resolution)
 }
 
 
+/*!
+  \brief Allocates the output of MRISfillInterior() when the caller does
+  not supply one: a float volume of the given resolution covering the
+  bounding box of the surface.
+*/
+static MRI *MRISfillInteriorAlloc(MRI_SURFACE *mris, double resolution)
+{
+  int width, height, depth;
+  MATRIX *m_vox2ras;
+  MRI *mri_dst;
+
+  // not sure this will work
+  // ATH: it doesn't when the surface source geometry differs
+  // from resolution or when geometry is not LIA. In the future,
+  // this whole section should be replaced by MRISmakeBoundingVolume(),
+  // which just needs to be tested more first
+  width = ceil((mris->xhi - mris->xlo) / resolution);
+  height = ceil((mris->yhi - mris->ylo) / resolution);
+  depth = ceil((mris->zhi - mris->zlo) / resolution);
+  mri_dst = MRIalloc(width, height, depth, MRI_FLOAT);
+  MRIsetResolution(mri_dst, resolution, resolution, resolution);
+  m_vox2ras = MatrixIdentity(4, NULL);
+  *MATRIX_RELT(m_vox2ras, 1, 1) = resolution;
+  *MATRIX_RELT(m_vox2ras, 2, 2) = resolution;
+  *MATRIX_RELT(m_vox2ras, 3, 3) = resolution;
+  *MATRIX_RELT(m_vox2ras, 1, 4) = mris->xlo + mris->vg.c_r;
+  *MATRIX_RELT(m_vox2ras, 2, 4) = mris->ylo + mris->vg.c_a;
+  *MATRIX_RELT(m_vox2ras, 3, 4) = mris->zlo + mris->vg.c_s;
+  MRIsetVoxelToRasXform(mri_dst, m_vox2ras);
+  MatrixFree(&m_vox2ras);
+  return (mri_dst);
+}
+
+
 /*!
 \fn MRI *MRISfillInterior(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
 \brief Fills in the interior of a surface by creating a "watertight"
 shell and filling everything outside of the shell. This is much faster
 but slightly less accurate than a ray-tracing algorithm.  See also
-MRISfillInteriorOld() and MRISfillInteriorRibbonTest().
+MRISfillInteriorOld(), MRISfillInteriorParity() and
+MRISfillInteriorRibbonTest().
 \param mris - input surface
 \param resolution - only used if mri_dst is NULL
 \param mri_dst - output
 */
 MRI *MRISfillInterior(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
 {
-  int col, row, slc, fno, numu, numv, u, v, nhits, width, height, depth;
+  int col, row, slc, fno, numu, numv, u, v, nhits;
   double x0, y0, z0, x1, y1, z1, x2, y2, z2, d0, d1, d2, dmax;
   double px0, py0, pz0, px1, py1, pz1, px, py, pz;
   double fcol, frow, fslc, dcol, drow, dslc, val, val2;
   double vx, vy, vz, vlen, ux, uy, uz, cosa;
   VERTEX *v_0, *v_1, *v_2;
   FACE *f;
-  MATRIX *crs, *xyz = NULL, *vox2sras = NULL, *m_vox2ras;
+  MATRIX *crs, *xyz = NULL, *vox2sras = NULL;
   MRI *mri_cosa, *mri_vlen, *mri_shell, *shellbb, *outsidebb;
   MRI_REGION *region;
   Timer start;
 
   MRIScomputeMetricProperties(mris);
 
-  if (!mri_dst) {
-    // not sure this will work
-    // ATH: it doesn't when the surface source geometry differs
-    // from resolution or when geometry is not LIA. In the future,
-    // this whole section should be replaced by MRISmakeBoundingVolume(),
-    // which just needs to be tested more first
-    width = ceil((mris->xhi - mris->xlo) / resolution);
-    height = ceil((mris->yhi - mris->ylo) / resolution);
-    depth = ceil((mris->zhi - mris->zlo) / resolution);
-    mri_dst = MRIalloc(width, height, depth, MRI_FLOAT);
-    MRIsetResolution(mri_dst, resolution, resolution, resolution);
-    m_vox2ras = MatrixIdentity(4, NULL);
-    *MATRIX_RELT(m_vox2ras, 1, 1) = resolution;
-    *MATRIX_RELT(m_vox2ras, 2, 2) = resolution;
-    *MATRIX_RELT(m_vox2ras, 3, 3) = resolution;
-    *MATRIX_RELT(m_vox2ras, 1, 4) = mris->xlo + mris->vg.c_r;
-    *MATRIX_RELT(m_vox2ras, 2, 4) = mris->ylo + mris->vg.c_a;
-    *MATRIX_RELT(m_vox2ras, 3, 4) = mris->zlo + mris->vg.c_s;
-    MRIsetVoxelToRasXform(mri_dst, m_vox2ras);
-  }
+  if (!mri_dst) mri_dst = MRISfillInteriorAlloc(mris, resolution);
   MRIclear(mri_dst);
 
   dcol = mri_dst->xsize;
@@ -1719,13 +1738,180 @@ MRI *MRISfillInterior(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
   return (mri_dst);
 }
 
+/*
+  Side of the point (r,s) relative to the edge va->vb of a face projected
+  along the column axis, with va, vb in (col,row,slice) voxel coords. The
+  callers always pass the lower-numbered vertex as va, so the two faces
+  that share an edge see exactly the same value. A point that lies on the
+  edge (e == 0) is treated as if displaced by (eps, eps^2), which puts it
+  strictly on one side; *side gets the resulting sign (0 only when the
+  edge projects to a point).
+*/
+static double fillParityEdge(const double *va, const double *vb, double r, double s, int *side)
+{
+  double dr, ds, e;
+
+  dr = vb[1] - va[1];
+  ds = vb[2] - va[2];
+  e = dr * (s - va[2]) - ds * (r - va[1]);
+  if (e != 0)
+    *side = e > 0 ? 1 : -1;
+  else if (ds != 0)
+    *side = ds < 0 ? 1 : -1;
+  else
+    *side = dr > 0 ? 1 : (dr < 0 ? -1 : 0);
+  return (e);
+}
+
+/*
+  If the column through (r,s) crosses the face with vertex numbers vno[3],
+  sets *col to the column coordinate of the crossing and returns 1.
+*/
+static int fillParityCrossing(const double *vox, const int *vno, double r, double s, double *col)
+{
+  int n, a, b, side[3];
+  double w[3], wsum;
+
+  // w[n] is the edge opposite corner n, i.e. its barycentric weight
+  for (n = 0; n < 3; n++) {
+    a = vno[(n + 1) % 3];
+    b = vno[(n + 2) % 3];
+    if (a < b)
+      w[n] = fillParityEdge(&vox[3 * a], &vox[3 * b], r, s, &side[n]);
+    else {
+      w[n] = -fillParityEdge(&vox[3 * b], &vox[3 * a], r, s, &side[n]);
+      side[n] = -side[n];
+    }
+  }
+  if (side[0] == 0 || side[0] != side[1] || side[0] != side[2]) return (0);
+
+  wsum = w[0] + w[1] + w[2];
+  if (wsum == 0)  // point hits a corner of a sliver, all weights vanish
+    *col = (vox[3 * vno[0]] + vox[3 * vno[1]] + vox[3 * vno[2]]) / 3;
+  else
+    *col = (w[0] * vox[3 * vno[0]] + w[1] * vox[3 * vno[1]] + w[2] * vox[3 * vno[2]]) / wsum;
+  return (1);
+}
+
+/*!
+\fn MRI *MRISfillInteriorParity(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
+\brief Fills in the interior of a closed surface by ray parity. The
+faces are binned by slice, and for each row of voxel centres the
+crossings of the row with the faces are found and sorted; a voxel is
+interior if an odd number of crossings lie before its centre. Hits on
+edges and vertices are resolved consistently between neighbouring faces
+(see fillParityEdge()), so each crossing of a watertight surface is
+counted exactly once and no shell volume or flood fill is needed. Rows
+are independent, so the result is the same for any number of threads.
+Unlike MRISfillInterior(), a voxel is only set when its centre is
+inside the surface; the face orientation does not matter.
+\param mris - input surface
+\param resolution - only used if mri_dst is NULL
+\param mri_dst - output
+*/
+MRI *MRISfillInteriorParity(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
+{
+  int vno, fno, n, k, width, height, depth, nopen;
+  double fcol, frow, fslc, smin, smax;
+  Timer start;
+
+  MRIScomputeMetricProperties(mris);
+  if (!mri_dst) mri_dst = MRISfillInteriorAlloc(mris, resolution);
+  MRIclear(mri_dst);
+  width = mri_dst->width;
+  height = mri_dst->height;
+  depth = mri_dst->depth;
+
+  std::vector<double> vox(3 * mris->nvertices);
+  MRIS_SurfRAS2VoxelMap *map = MRIS_makeRAS2VoxelMap(mri_dst, mris);
+  MRIS_loadRAS2VoxelMap(map, mri_dst, mris);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    MRIS_useRAS2VoxelMap(map, mri_dst, v->x, v->y, v->z, &fcol, &frow, &fslc);
+    vox[3 * vno] = fcol;
+    vox[3 * vno + 1] = frow;
+    vox[3 * vno + 2] = fslc;
+  }
+  MRIS_freeRAS2VoxelMap(&map);
+
+  // bin the faces by the slices whose voxel centres they span, in face order
+  std::vector<int> slcfirst(depth + 1, 0), slcface;
+  for (int pass = 0; pass < 2; pass++) {
+    std::vector<int> slcnext(slcfirst.begin(), slcfirst.end() - 1);
+    for (fno = 0; fno < mris->nfaces; fno++) {
+      FACE *f = &mris->faces[fno];
+      smin = smax = vox[3 * f->v[0] + 2];
+      for (n = 1; n < VERTICES_PER_FACE; n++) {
+        smin = MIN(smin, vox[3 * f->v[n] + 2]);
+        smax = MAX(smax, vox[3 * f->v[n] + 2]);
+      }
+      int klo = MAX(0, (int)ceil(smin)), khi = MIN(depth - 1, (int)floor(smax));
+      for (k = klo; k <= khi; k++) {
+        if (pass == 0)
+          slcfirst[k + 1]++;
+        else
+          slcface[slcnext[k]++] = fno;
+      }
+    }
+    if (pass == 0) {
+      for (k = 0; k < depth; k++) slcfirst[k + 1] += slcfirst[k];
+      slcface.resize(slcfirst[depth]);
+    }
+  }
+
+  nopen = 0;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : nopen)
+#endif
+  for (k = 0; k < depth; k++) {
+    ROMP_PFLB_begin
+    std::vector<std::vector<double> > rows(height);
+    int m, j, c, c0, c1;
+    double rmin, rmax, col;
+    for (m = slcfirst[k]; m < slcfirst[k + 1]; m++) {
+      FACE *f = &mris->faces[slcface[m]];
+      rmin = rmax = vox[3 * f->v[0] + 1];
+      for (c = 1; c < VERTICES_PER_FACE; c++) {
+        rmin = MIN(rmin, vox[3 * f->v[c] + 1]);
+        rmax = MAX(rmax, vox[3 * f->v[c] + 1]);
+      }
+      int jlo = MAX(0, (int)ceil(rmin)), jhi = MIN(height - 1, (int)floor(rmax));
+      for (j = jlo; j <= jhi; j++)
+        if (fillParityCrossing(vox.data(), f->v, j, k, &col)) rows[j].push_back(col);
+    }
+    for (j = 0; j < height; j++) {
+      std::vector<double> &x = rows[j];
+      if (x.empty()) continue;
+      std::sort(x.begin(), x.end());
+      if (x.size() % 2) nopen++;  // surface is not closed along this row
+      // voxel c is interior when x[m] < c <= x[m+1] for even m
+      for (m = 0; m + 1 < (int)x.size(); m += 2) {
+        c0 = MAX(0, (int)floor(x[m]) + 1);
+        c1 = MIN(width - 1, (int)floor(x[m + 1]));
+        for (c = c0; c <= c1; c++) MRIsetVoxVal(mri_dst, c, j, k, 0, 1);
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (nopen > 0)
+    printf("WARNING: MRISfillInteriorParity(): %d rows cross the surface an odd number of times, "
+           "surface may not be closed\n", nopen);
+  if (Gdiag_no > 0) printf("  MRISfillInteriorParity t = %g\n", start.seconds());
+
+  return (mri_dst);
+}
+
 /*!
 \fn int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp)
 \brief Runs a test on MRISfillInterior() by comparing its results to
 the ribbon.mgz file.  The ribbon.mgz file is the gold standard
 generated using a ray tracing algorithm. Typical results are that the
 new MRISfillInterior() will overlap ribbon.mgz to better than 99.5%
-but is on the order of 20 times faster.
+but is on the order of 20 times faster. UseNew = 2 tests
+MRISfillInteriorParity() instead.
 */
 int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp)
 {
@@ -1779,8 +1965,9 @@ int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp)
         return (1);
       }
       MRIclear(mri);
-      if (UseNew) MRISfillInterior(surf, 1, mri);      // resolution = 1
-      if (!UseNew) MRISfillInteriorOld(surf, 1, mri);  // resolution = 1
+      if (UseNew == 2) MRISfillInteriorParity(surf, 1, mri);  // resolution = 1
+      if (UseNew == 1) MRISfillInterior(surf, 1, mri);        // resolution = 1
+      if (!UseNew) MRISfillInteriorOld(surf, 1, mri);         // resolution = 1
 
       nfp = 0;  // false positive - not in ribbon but in interior
       nfn = 0;  // false negative - in ribbon but not in interior
@@ -7641,8 +7641,7 @@ static MRI *ximgRead(const char *fname, int read_volume)
   -----------------------------------------------------------*/
 MRI *MRISreadCurvAsMRI(const char *curvfile, int read_volume)
 {
-  int magno, k, vnum, fnum, vals_per_vertex;
-  float curv;
+  int magno, vnum, fnum, vals_per_vertex;
   FILE *fp;
   MRI *curvmri;
 
@@ -7669,10 +7668,9 @@ MRI *MRISreadCurvAsMRI(const char *curvfile, int read_volume)
 
   curvmri = MRIalloc(vnum, 1, 1, MRI_FLOAT);
   curvmri->version = ((MGZ_INTENT_SHAPE & 0xff ) << 8) | MGH_VERSION;
-  for (k = 0; k < vnum; k++) {
-    curv = freadFloat(fp);
-    MRIsetVoxVal(curvmri, k, 0, 0, 0, curv);
-  }
+  // a vnum x 1 x 1 float volume is a single contiguous row
+  if (freadFloatArray(&MRIFvox(curvmri, 0, 0, 0), vnum, fp) != (size_t)vnum)
+    printf("ERROR: MRISreadCurvAsMRI: %s, fread failed\n", curvfile);
   fclose(fp);
 
   return (curvmri);
@@ -10751,7 +10749,7 @@ static void local_buffer_to_image(BUFTYPE *buf, MRI *mri, int slice, int frame)
 // declare function pointer
 // static int (*myclose)(FILE *stream);
 
-MRI *mghRead(const char *fname, int read_volume, int frame)
+MRI *mghRead(const char *fname, int read_volume, int frame, bool sparse)
 {
   MRI *mri;
   znzFile fp;
@@ -10901,7 +10899,15 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
       if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "read %d frames\n", nframes);
     }
     buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
-    mri = MRIallocSequence(width, height, depth, type, nframes);
+    if (sparse)
+      mri = MRIallocSparse(width, height, depth, type, nframes);
+    else
+      mri = MRIallocSequence(width, height, depth, type, nframes);
+    if (!mri) {
+      znzclose(fp);
+      free(buf);
+      return (NULL);
+    }
     mri->dof = dof;
 
     mri->version = version;                // version saved in mgz
@@ -10987,9 +10993,23 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
             free(buf);
             ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z));
           }
+          if (mri->bricks) {
+            // only the bricks with a nonzero voxel get memory
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+            if (bpv == 2) byteswapbufshort(buf, bytes);
+            if (bpv == 4) byteswapbuffloat(buf, bytes);
+#endif
+            for (y = 0; y < height; y++) MRIsparseSetRow(mri, y, z, frame - start_frame, buf + (size_t)y * width * bpv);
+            exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
+            continue;
+          }
           switch (type) {
             case MRI_INT:
               for (i = y = 0; y < height; y++) {
+                if (MRIbufferIsZero(buf + (size_t)i * bpv, width * bpv)) {
+                  i += width;  // the new volume is already 0 there
+                  continue;
+                }
                 for (x = 0; x < width; x++, i++) {
                   ival = orderIntBytes(((int *)buf)[i]);
                   MRIIseq_vox(mri, x, y, z, frame - start_frame) = ival;
@@ -10998,6 +11018,10 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
               break;
             case MRI_SHORT:
               for (i = y = 0; y < height; y++) {
+                if (MRIbufferIsZero(buf + (size_t)i * bpv, width * bpv)) {
+                  i += width;  // the new volume is already 0 there
+                  continue;
+                }
                 for (x = 0; x < width; x++, i++) {
                   sval = orderShortBytes(((short *)buf)[i]);
                   MRISseq_vox(mri, x, y, z, frame - start_frame) = sval;
@@ -11006,6 +11030,10 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
               break;
             case MRI_USHRT:
               for (i = y = 0; y < height; y++) {
+                if (MRIbufferIsZero(buf + (size_t)i * bpv, width * bpv)) {
+                  i += width;  // the new volume is already 0 there
+                  continue;
+                }
                 for (x = 0; x < width; x++, i++) {
                   unsigned short usval = orderUShortBytes(((unsigned short *)buf)[i]);
                   MRIUSseq_vox(mri, x, y, z, frame - start_frame) = usval;
@@ -11015,6 +11043,10 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
             case MRI_TENSOR:
             case MRI_FLOAT:
               for (i = y = 0; y < height; y++) {
+                if (MRIbufferIsZero(buf + (size_t)i * bpv, width * bpv)) {
+                  i += width;  // the new volume is already 0 there
+                  continue;
+                }
                 for (x = 0; x < width; x++, i++) {
                   fval = orderFloatBytes(((float *)buf)[i]);
                   MRIFseq_vox(mri, x, y, z, frame - start_frame) = fval;
@@ -11022,7 +11054,8 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
               }
               break;
             case MRI_UCHAR:
-              local_buffer_to_image(buf, mri, z, frame - start_frame);
+              for (i = y = 0; y < height; y++, i += width)
+                if (!MRIbufferIsZero(buf + i, width)) memmove(&MRIseq_vox(mri, 0, y, z, frame - start_frame), buf + i, width);
               break;
             default:
               errno = 0;
@@ -11283,6 +11316,31 @@ int mghWrite(MRI *mri, const char *fname, int frame)
     }
 #endif
   }
+  else if (mri->bricks)
+  {
+    if (mri->type == MRI_LONG) {
+      errno = 0;
+      ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mghWrite: unsupported type %d", mri->type));
+    }
+    int bytes_per_row = width * mri->bytes_per_vox;
+    std::vector<BUFTYPE> row(bytes_per_row);
+    for (frame = start_frame; frame <= end_frame; frame++) {
+      for (z = 0; z < depth; z++) {
+        for (y = 0; y < height; y++) {
+          MRIsparseGetRow(mri, y, z, frame, row.data());
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+          if (mri->bytes_per_vox == 2) byteswapbufshort(row.data(), bytes_per_row);
+          if (mri->bytes_per_vox == 4) byteswapbuffloat(row.data(), bytes_per_row);
+#endif
+          if ((int)znzwrite(row.data(), sizeof(BUFTYPE), bytes_per_row, fp) != bytes_per_row) {
+            errno = 0;
+            ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write %d bytes to %s", bytes_per_row, fname));
+          }
+        }
+        exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
+      }
+    }
+  }
   else
   {
     for (frame = start_frame; frame <= end_frame; frame++) {
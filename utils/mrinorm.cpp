@@ -29,6 +29,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "box.h"
 #include "ctrpoints.h"
 #include "diag.h"
@@ -42,6 +45,7 @@
 #include "numerics.h"
 #include "proto.h"
 #include "region.h"
+#include "romp_support.h"
 #include "talairachex.h"
 
 /*-----------------------------------------------------
@@ -2116,6 +2120,15 @@ MRI *MRIbuildVoronoiDiagram(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst)
 
   Description
   ------------------------------------------------------*/
+// FS_SOAP_BUBBLE_MULTIGRID makes MRIsoapBubble solve float volumes to convergence with
+// MRIsoapBubbleMultigrid instead of running niter relaxation steps
+int MRIsoapBubbleUseMultigrid(void)
+{
+  static int use_mg = -1;
+  if (use_mg < 0) use_mg = (getenv("FS_SOAP_BUBBLE_MULTIGRID") != NULL);
+  return (use_mg);
+}
+
 MRI *MRIsoapBubble(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst, int niter, float min_change)
 {
   int width, height, depth, frames, x, y, z, f, xk, yk, zk, xi, yi, zi, i, *pxi, *pyi, *pzi, mean;
@@ -2124,6 +2137,9 @@ MRI *MRIsoapBubble(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst, int niter, float m
 
   if (niter == 0)
     return(MRIcopy(mri_src, mri_dst)) ;
+  if (mri_src->type == MRI_FLOAT && MRIsoapBubbleUseMultigrid()) {
+    return (MRIsoapBubbleMultigrid(mri_src, mri_ctrl, mri_dst, min_change));
+  }
   if (mri_src->type == MRI_FLOAT) {
     return (mriSoapBubbleFloat(mri_src, mri_ctrl, mri_dst, niter, min_change));
   }
@@ -2190,6 +2206,414 @@ MRI *MRIsoapBubble(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst, int niter, float m
   return (mri_dst);
 }
 
+/*-----------------------------------------------------
+  Multigrid solver for the soap bubble problem.
+
+  The soap bubble iteration converges to the field that equals the mean of
+  its 27 voxel neighbourhood (indices clamped at the border) everywhere
+  except at the control points, where it keeps its input value. Writing
+  (A u)(v) = sum of u over the neighbourhood of v - 27 u(v), that is A u = 0
+  with Dirichlet conditions at the control points.
+
+  Instead of relaxing it a voxel step per iteration, it is solved here by
+  conjugate gradients preconditioned with a multigrid V-cycle over a
+  hierarchy of grids, each half the size of the previous one. The V-cycle
+  alone converges poorly when the control points are sparse (a coarse voxel
+  has to be held fixed if any of its children is), the Krylov iteration
+  around it does not care.
+  ------------------------------------------------------*/
+typedef struct
+{
+  int width, height, depth;
+  std::vector<float> u, f, r;
+  std::vector<unsigned char> fixed;
+} SOAP_MG_LEVEL;
+
+#define SOAP_MG_MIN_SIZE 4          // coarsest grid is at most this size along some axis
+#define SOAP_MG_SWEEPS 2            // smoothing sweeps before and after the coarse correction
+#define SOAP_MG_COARSE_SWEEPS 20    // symmetric sweep pairs on the coarsest grid
+#define SOAP_MG_MAX_ITERATIONS 200
+
+/*
+  Sum of u over the neighbourhood of (x,y,z) leaving out the voxel itself.
+  nself is the number of neighbourhood entries that are the voxel itself
+  (1 inside the volume, more where the indices are clamped).
+*/
+static inline double soapNeighborSum(const SOAP_MG_LEVEL *l, const float *u, int x, int y, int z, int *nself)
+{
+  const int w = l->width, h = l->height, d = l->depth;
+  const size_t slice = (size_t)w * h;
+  double sum = 0;
+
+  if (x > 0 && y > 0 && z > 0 && x < w - 1 && y < h - 1 && z < d - 1) {
+    const float *p = u + (size_t)z * slice + (size_t)y * w + x;
+    for (int zk = -1; zk <= 1; zk++)
+      for (int yk = -1; yk <= 1; yk++) {
+        const float *q = p + zk * (long)slice + yk * (long)w;
+        sum += q[-1] + q[0] + q[1];
+      }
+    *nself = 1;
+    return (sum - *p);
+  }
+
+  int n = 0;
+  for (int zk = -1; zk <= 1; zk++) {
+    const int zi = MAX(0, MIN(d - 1, z + zk));
+    for (int yk = -1; yk <= 1; yk++) {
+      const int yi = MAX(0, MIN(h - 1, y + yk));
+      for (int xk = -1; xk <= 1; xk++) {
+        const int xi = MAX(0, MIN(w - 1, x + xk));
+        if (xi == x && yi == y && zi == z)
+          n++;
+        else
+          sum += u[(size_t)zi * slice + (size_t)yi * w + xi];
+      }
+    }
+  }
+  *nself = n;
+  return (sum);
+}
+
+/*
+  Gauss-Seidel sweeps on A u = f. With the 27 voxel stencil a voxel depends
+  on all its neighbours, so the voxels are split into 8 colours by the
+  parity of x, y and z; voxels of one colour are independent and are updated
+  in parallel over slices. backward reverses the colour order, so that a
+  forward sweep followed by a backward one is symmetric.
+*/
+static void soapSmooth(SOAP_MG_LEVEL *l, int nsweeps, int backward)
+{
+  float *u = &l->u[0];
+  const float *f = &l->f[0];
+  const unsigned char *fixed = &l->fixed[0];
+
+  for (int sweep = 0; sweep < nsweeps; sweep++) {
+    for (int c = 0; c < 8; c++) {
+      const int colour = backward ? 7 - c : c;
+      const int cx = colour & 1, cy = (colour >> 1) & 1, cz = (colour >> 2) & 1;
+      int z;
+      ROMP_PF_begin
+#ifdef HAVE_OPENMP
+      #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+      for (z = cz; z < l->depth; z += 2) {
+        ROMP_PFLB_begin
+        for (int y = cy; y < l->height; y += 2) {
+          for (int x = cx; x < l->width; x += 2) {
+            const size_t i = ((size_t)z * l->height + y) * l->width + x;
+            if (fixed[i]) continue;
+            int nself;
+            const double sum = soapNeighborSum(l, u, x, y, z, &nself);
+            u[i] = (float)((sum - f[i]) / (27 - nself));
+          }
+        }
+        ROMP_PFLB_end
+      }
+      ROMP_PF_end
+    }
+  }
+}
+
+// Au = A u at the free voxels, 0 at the fixed ones
+static void soapApply(const SOAP_MG_LEVEL *l, const float *u, float *Au)
+{
+  int z;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (z = 0; z < l->depth; z++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < l->height; y++) {
+      for (int x = 0; x < l->width; x++) {
+        const size_t i = ((size_t)z * l->height + y) * l->width + x;
+        if (l->fixed[i]) {
+          Au[i] = 0;
+          continue;
+        }
+        int nself;
+        const double sum = soapNeighborSum(l, u, x, y, z, &nself);
+        Au[i] = (float)(sum - (27 - nself) * (double)u[i]);
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*
+  Trilinear interpolation from a grid of n coarse voxels to fine voxel i
+  along one axis: fine voxel centres sit at (i - 0.5) / 2 in coarse voxel
+  coordinates. The weight of coarse voxel i0 is 1-t, of i1 it is t.
+*/
+static inline void soapInterpWeights(int i, int n, int *i0, int *i1, double *t)
+{
+  const double c = MAX(0.0, MIN(n - 1.0, 0.5 * i - 0.25));
+  *i0 = (int)c;
+  *i1 = MIN(*i0 + 1, n - 1);
+  *t = c - *i0;
+}
+
+// weight of coarse voxel ic in the interpolation to fine voxel i
+static inline double soapInterpWeight(int i, int n, int ic)
+{
+  int i0, i1;
+  double t;
+  soapInterpWeights(i, n, &i0, &i1, &t);
+  return ((i0 == ic ? 1 - t : 0) + (i1 == ic ? t : 0));
+}
+
+/*
+  Right hand side of the coarse correction equation: the transpose of the
+  interpolation applied to the residual (which keeps the V-cycle symmetric),
+  times 1/2 = 4/8: each coarse voxel collects about 8 fine ones, and A
+  scales with the square of the voxel size. The correction is held at zero
+  at coarse voxels that contain a control point.
+*/
+static void soapRestrict(const SOAP_MG_LEVEL *fine, SOAP_MG_LEVEL *coarse)
+{
+  int z;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (z = 0; z < coarse->depth; z++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < coarse->height; y++) {
+      for (int x = 0; x < coarse->width; x++) {
+        const size_t i = ((size_t)z * coarse->height + y) * coarse->width + x;
+        coarse->u[i] = 0;
+        if (coarse->fixed[i]) {
+          coarse->f[i] = 0;
+          continue;
+        }
+        double sum = 0;
+        for (int zk = MAX(0, 2 * z - 1); zk <= MIN(fine->depth - 1, 2 * z + 2); zk++) {
+          const double wz = soapInterpWeight(zk, coarse->depth, z);
+          if (wz == 0) continue;
+          for (int yk = MAX(0, 2 * y - 1); yk <= MIN(fine->height - 1, 2 * y + 2); yk++) {
+            const double wy = soapInterpWeight(yk, coarse->height, y);
+            if (wy == 0) continue;
+            for (int xk = MAX(0, 2 * x - 1); xk <= MIN(fine->width - 1, 2 * x + 2); xk++) {
+              const double wx = soapInterpWeight(xk, coarse->width, x);
+              if (wx == 0) continue;
+              sum += wx * wy * wz * fine->r[((size_t)zk * fine->height + yk) * fine->width + xk];
+            }
+          }
+        }
+        coarse->f[i] = (float)(0.5 * sum);
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+// trilinear interpolation of the coarse correction, added to the free fine voxels
+static void soapProlongAndCorrect(const SOAP_MG_LEVEL *coarse, SOAP_MG_LEVEL *fine)
+{
+  const int cw = coarse->width, ch = coarse->height, cd = coarse->depth;
+  const float *e = &coarse->u[0];
+  int z;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (z = 0; z < fine->depth; z++) {
+    ROMP_PFLB_begin
+    int z0, z1, y0, y1, x0, x1;
+    double fz, fy, fx;
+    soapInterpWeights(z, cd, &z0, &z1, &fz);
+    for (int y = 0; y < fine->height; y++) {
+      soapInterpWeights(y, ch, &y0, &y1, &fy);
+      for (int x = 0; x < fine->width; x++) {
+        const size_t i = ((size_t)z * fine->height + y) * fine->width + x;
+        if (fine->fixed[i]) continue;
+        soapInterpWeights(x, cw, &x0, &x1, &fx);
+#define SOAP_E(xx, yy, zz) e[((size_t)(zz) * ch + (yy)) * cw + (xx)]
+        const double e00 = SOAP_E(x0, y0, z0) * (1 - fx) + SOAP_E(x1, y0, z0) * fx;
+        const double e10 = SOAP_E(x0, y1, z0) * (1 - fx) + SOAP_E(x1, y1, z0) * fx;
+        const double e01 = SOAP_E(x0, y0, z1) * (1 - fx) + SOAP_E(x1, y0, z1) * fx;
+        const double e11 = SOAP_E(x0, y1, z1) * (1 - fx) + SOAP_E(x1, y1, z1) * fx;
+#undef SOAP_E
+        fine->u[i] += (float)(((e00 * (1 - fy) + e10 * fy) * (1 - fz)) + ((e01 * (1 - fy) + e11 * fy) * fz));
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+// one V-cycle on A u = f at level k, starting from u = 0
+static void soapVcycle(std::vector<SOAP_MG_LEVEL> &levels, int k)
+{
+  SOAP_MG_LEVEL *l = &levels[k];
+  if (k == (int)levels.size() - 1) {
+    for (int i = 0; i < SOAP_MG_COARSE_SWEEPS; i++) {
+      soapSmooth(l, 1, 0);
+      soapSmooth(l, 1, 1);
+    }
+    return;
+  }
+  soapSmooth(l, SOAP_MG_SWEEPS, 0);
+  soapApply(l, &l->u[0], &l->r[0]);
+  for (size_t i = 0; i < l->r.size(); i++) l->r[i] = l->f[i] - l->r[i];
+  soapRestrict(l, &levels[k + 1]);
+  soapVcycle(levels, k + 1);
+  soapProlongAndCorrect(&levels[k + 1], l);
+  soapSmooth(l, SOAP_MG_SWEEPS, 1);
+}
+
+// dot product summed slice by slice, so the result does not depend on the number of threads
+static double soapDot(const SOAP_MG_LEVEL *l, const float *a, const float *b)
+{
+  const size_t slice = (size_t)l->width * l->height;
+  std::vector<double> partial(l->depth);
+  int z;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (z = 0; z < l->depth; z++) {
+    ROMP_PFLB_begin
+    double sum = 0;
+    for (size_t i = z * slice; i < (z + 1) * slice; i++) sum += (double)a[i] * b[i];
+    partial[z] = sum;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  double sum = 0;
+  for (z = 0; z < l->depth; z++) sum += partial[z];
+  return (sum);
+}
+
+/*
+  Solves A u = 0 for the free voxels of u, given its values at the fixed
+  ones. Stops when an iteration changes no voxel by more than tol.
+*/
+static int soapSolve(std::vector<SOAP_MG_LEVEL> &levels, float *u, float tol)
+{
+  SOAP_MG_LEVEL *l = &levels[0];
+  const size_t n = l->u.size();
+  std::vector<float> r(n), p(n), q(n);
+
+  // preconditioned conjugate gradients. A and the V-cycle are both negative
+  // definite on the free voxels, which gives the same iterates as for -A
+  soapApply(l, u, &r[0]);
+  for (size_t i = 0; i < n; i++) r[i] = -r[i];
+  l->f = r;
+  std::fill(l->u.begin(), l->u.end(), 0.0f);
+  soapVcycle(levels, 0);
+  p = l->u;
+  double rz = soapDot(l, &r[0], &l->u[0]);
+
+  int iter;
+  for (iter = 0; iter < SOAP_MG_MAX_ITERATIONS && rz != 0; iter++) {
+    soapApply(l, &p[0], &q[0]);
+    const double alpha = rz / soapDot(l, &p[0], &q[0]);
+    float max_change = 0;
+    for (size_t i = 0; i < n; i++) {
+      const float du = (float)(alpha * p[i]);
+      u[i] += du;
+      r[i] -= (float)(alpha * q[i]);
+      if (fabs(du) > max_change) max_change = fabs(du);
+    }
+    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) printf("soap bubble iteration %d: max change %f\n", iter, max_change);
+    if (max_change < tol) break;
+
+    l->f = r;
+    std::fill(l->u.begin(), l->u.end(), 0.0f);
+    soapVcycle(levels, 0);
+    const double rz_new = soapDot(l, &r[0], &l->u[0]);
+    const double beta = rz_new / rz;
+    rz = rz_new;
+    for (size_t i = 0; i < n; i++) p[i] = l->u[i] + (float)(beta * p[i]);
+  }
+  return (iter);
+}
+
+/*-----------------------------------------------------
+  Parameters:
+    tol - stop when an iteration changes no voxel by more than this.
+          If <= 0, 1e-3 of the intensity range of mri_src is used.
+
+  Returns value:
+
+  Description
+    Same result as running MRIsoapBubble to convergence: every voxel
+    that is not CONTROL_MARKED in mri_ctrl is replaced by the average of
+    its neighbours, the marked voxels keep their values.
+  ------------------------------------------------------*/
+MRI *MRIsoapBubbleMultigrid(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst, float tol)
+{
+  if (mri_ctrl->width != mri_src->width || mri_ctrl->height != mri_src->height || mri_ctrl->depth != mri_src->depth)
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIsoapBubbleMultigrid: ctrl and src dimensions differ"));
+
+  if (mri_dst != mri_src) mri_dst = MRIcopy(mri_src, mri_dst);
+
+  if (tol <= 0) {
+    float min_val, max_val;
+    MRIvalRange(mri_src, &min_val, &max_val);
+    tol = 1e-3 * (max_val - min_val);
+    if (tol <= 0) return (mri_dst);
+  }
+
+  // grid hierarchy, with the control points of each coarse voxel's children
+  std::vector<SOAP_MG_LEVEL> levels(1);
+  levels[0].width = mri_src->width;
+  levels[0].height = mri_src->height;
+  levels[0].depth = mri_src->depth;
+  const size_t nvox = (size_t)mri_src->width * mri_src->height * mri_src->depth;
+  levels[0].fixed.resize(nvox);
+  size_t nfixed = 0;
+  for (int z = 0; z < mri_src->depth; z++)
+    for (int y = 0; y < mri_src->height; y++)
+      for (int x = 0; x < mri_src->width; x++) {
+        const int ctrl = (MRIgetVoxVal(mri_ctrl, x, y, z, 0) == CONTROL_MARKED);
+        levels[0].fixed[((size_t)z * mri_src->height + y) * mri_src->width + x] = ctrl;
+        nfixed += ctrl;
+      }
+  if (nfixed == 0 || nfixed == nvox) return (mri_dst);
+
+  while (MIN(MIN(levels.back().width, levels.back().height), levels.back().depth) > SOAP_MG_MIN_SIZE) {
+    SOAP_MG_LEVEL coarse;
+    const SOAP_MG_LEVEL &fine = levels.back();
+    coarse.width = (fine.width + 1) / 2;
+    coarse.height = (fine.height + 1) / 2;
+    coarse.depth = (fine.depth + 1) / 2;
+    coarse.fixed.assign((size_t)coarse.width * coarse.height * coarse.depth, 0);
+    for (int z = 0; z < fine.depth; z++)
+      for (int y = 0; y < fine.height; y++)
+        for (int x = 0; x < fine.width; x++)
+          if (fine.fixed[((size_t)z * fine.height + y) * fine.width + x])
+            coarse.fixed[((size_t)(z / 2) * coarse.height + y / 2) * coarse.width + x / 2] = 1;
+    levels.push_back(coarse);
+  }
+  for (size_t k = 0; k < levels.size(); k++) {
+    const size_t n = (size_t)levels[k].width * levels[k].height * levels[k].depth;
+    levels[k].u.resize(n);
+    levels[k].f.assign(n, 0);
+    levels[k].r.resize(n);
+  }
+
+  std::vector<float> u(nvox);
+  for (int f = 0; f < mri_dst->nframes; f++) {
+    for (int z = 0; z < mri_src->depth; z++)
+      for (int y = 0; y < mri_src->height; y++)
+        for (int x = 0; x < mri_src->width; x++)
+          u[((size_t)z * mri_src->height + y) * mri_src->width + x] = MRIgetVoxVal(mri_dst, x, y, z, f);
+
+    soapSolve(levels, &u[0], tol);
+
+    for (int z = 0; z < mri_src->depth; z++)
+      for (int y = 0; y < mri_src->height; y++)
+        for (int x = 0; x < mri_src->width; x++)
+          MRIsetVoxVal(mri_dst, x, y, z, f, u[((size_t)z * mri_src->height + y) * mri_src->width + x]);
+  }
+
+  return (mri_dst);
+}
+
 /*-----------------------------------------------------
   Parameters:
 
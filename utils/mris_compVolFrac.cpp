@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <sys/utsname.h>
 #include <unistd.h>
+#include <vector>
 
 #include "cmdargs.h"
 #include "diag.h"
@@ -32,18 +33,232 @@
 #include "mris_compVolFrac.h"
 #include "mrisurf.h"
 #include "mrisurf_metricProperties.h"
+#include "romp_support.h"
 #include "utils.h"
 #include "version.h"
 
+/*
+  Exact fractions. In voxel coordinates, where voxel k of a column spans
+  [k-0.5,k+0.5], the divergence theorem with F = (0,0,zeta-z) gives the
+  volume inside the surface, within the column of voxel (i,j) and below z, as
+
+     G(z) = integral over the surface in the column and below z of (zeta-z) n_z dA
+
+  since n_z vanishes on the walls of the column and F on its cap at z. The
+  fraction of voxel (i,j,k) is then G(k+0.5)-G(k-0.5), which only needs the
+  faces clipped to the column: a face entirely below the voxel adds minus
+  its projected area, and only the faces crossing the voxel are clipped in z.
+  Columns are independent, so each thread takes its own x slabs.
+*/
+#define VF_MAXPTS 12 /* vertices of a face clipped to a column and a height */
+#define VF_EPS 1e-6  /* fractions this close to 0 or 1 are set to it */
+
+typedef struct {
+  double area;  /* signed area of the projection onto the xy plane */
+  double zarea; /* integral of zeta over the projection */
+  double zmin, zmax;
+  int n;
+  double p[VF_MAXPTS][3];
+} vfPoly;
+
+/* keeps the part of the convex polygon where sign*(p[axis]-c) <= 0 */
+static int vfClip(double in[][3], int n, int axis, double c, double sign, double out[][3])
+{
+  int a, k, m = 0;
+  for (a = 0; a < n; a++) {
+    double *p = in[a], *q = in[(a + 1) % n];
+    double dp = sign * (p[axis] - c), dq = sign * (q[axis] - c);
+    if (dp <= 0) {
+      for (k = 0; k < 3; k++) out[m][k] = p[k];
+      m++;
+    }
+    if ((dp < 0 && dq > 0) || (dp > 0 && dq < 0)) {
+      double t = dp / (dp - dq);
+      for (k = 0; k < 3; k++) out[m][k] = p[k] + t * (q[k] - p[k]);
+      out[m][axis] = c;
+      m++;
+    }
+  }
+  return m;
+}
+
+/* projected area and integral of zeta over it, as a fan from the first vertex */
+static void vfMoments(double p[][3], int n, double *area, double *zarea)
+{
+  int a;
+  *area = *zarea = 0;
+  for (a = 1; a + 1 < n; a++) {
+    double s = 0.5 * ((p[a][0] - p[0][0]) * (p[a + 1][1] - p[0][1]) - (p[a + 1][0] - p[0][0]) * (p[a][1] - p[0][1]));
+    *area += s;
+    *zarea += s * (p[0][2] + p[a][2] + p[a + 1][2]) / 3.0;
+  }
+}
+
+/* contribution of the polygon to G(z) */
+static double vfBelow(vfPoly *poly, double z)
+{
+  double p[VF_MAXPTS][3], area, zarea;
+  if (poly->zmax <= z) return poly->zarea - poly->area * z;
+  if (poly->zmin >= z) return 0;
+  vfMoments(p, vfClip(poly->p, poly->n, 2, z, 1, p), &area, &zarea);
+  return zarea - area * z;
+}
+
+/* the columns (i,j) whose cross-section the face's xy bounding box touches */
+static int vfFaceColumns(const std::vector<double> &vx, const FACE *f, int width, int height, int *range)
+{
+  double xmin = 1e10, xmax = -1e10, ymin = 1e10, ymax = -1e10;
+  int a;
+  for (a = 0; a < 3; a++) {
+    xmin = MIN(xmin, vx[3 * f->v[a]]);
+    xmax = MAX(xmax, vx[3 * f->v[a]]);
+    ymin = MIN(ymin, vx[3 * f->v[a] + 1]);
+    ymax = MAX(ymax, vx[3 * f->v[a] + 1]);
+  }
+  range[0] = MAX(0, (int)ceil(xmin - 0.5));
+  range[1] = MIN(width - 1, (int)floor(xmax + 0.5));
+  range[2] = MAX(0, (int)ceil(ymin - 0.5));
+  range[3] = MIN(height - 1, (int)floor(ymax + 0.5));
+  return range[0] <= range[1] && range[2] <= range[3];
+}
+
+MRI *MRIcomputeVolumeFractionFromSurfaceExact(MRI_SURFACE *mris, MRI *mri_src, MRI *mri_fractions)
+{
+  const int width = mri_src->width;
+  const int height = mri_src->height;
+  const int depth = mri_src->depth;
+  int vno, fno, i, j, n, r[4];
+
+  if (mri_fractions == NULL) {
+    mri_fractions = MRIalloc(width, height, depth, MRI_FLOAT);
+    MRIcopyHeader(mri_src, mri_fractions);
+  }
+
+  /* the vertices in voxel coordinates */
+  MATRIX *m = GetSurfaceRASToVoxelMatrix(mri_src);
+  std::vector<double> vx(3 * mris->nvertices);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    for (n = 0; n < 3; n++)
+      vx[3 * vno + n] = *MATRIX_RELT(m, n + 1, 1) * v->x + *MATRIX_RELT(m, n + 1, 2) * v->y +
+                        *MATRIX_RELT(m, n + 1, 3) * v->z + *MATRIX_RELT(m, n + 1, 4);
+  }
+  MatrixFree(&m);
+
+  /* the sign that makes the enclosed volume positive, whichever way the
+     faces and the voxel axes are oriented */
+  double vol = 0;
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    double const *p0 = &vx[3 * mris->faces[fno].v[0]];
+    double const *p1 = &vx[3 * mris->faces[fno].v[1]];
+    double const *p2 = &vx[3 * mris->faces[fno].v[2]];
+    vol += (p0[0] * (p1[1] * p2[2] - p1[2] * p2[1]) + p0[1] * (p1[2] * p2[0] - p1[0] * p2[2]) +
+            p0[2] * (p1[0] * p2[1] - p1[1] * p2[0])) / 6.0;
+  }
+  if (vol == 0) {
+    printf("ERROR: MRIcomputeVolumeFractionFromSurfaceExact(): surface encloses no volume\n");
+    return (NULL);
+  }
+  const double sign = vol > 0 ? 1 : -1;
+
+  /* the faces crossing each column, in face order */
+  printf("binning the faces\n");
+  std::vector<int> colstart(width * height + 1, 0);
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    if (!vfFaceColumns(vx, &mris->faces[fno], width, height, r)) continue;
+    for (j = r[2]; j <= r[3]; j++)
+      for (i = r[0]; i <= r[1]; i++) colstart[j * width + i + 1]++;
+  }
+  for (n = 0; n < width * height; n++) colstart[n + 1] += colstart[n];
+  std::vector<int> colface(colstart[width * height]), colnext(colstart.begin(), colstart.end() - 1);
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    if (!vfFaceColumns(vx, &mris->faces[fno], width, height, r)) continue;
+    for (j = r[2]; j <= r[3]; j++)
+      for (i = r[0]; i <= r[1]; i++) colface[colnext[j * width + i]++] = fno;
+  }
+
+  printf("computing the fractions\n");
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (i = 0; i < width; i++) {
+    ROMP_PFLB_begin
+    std::vector<vfPoly> polys;
+    std::vector<double> exact(depth), full(depth);
+    int j, k, a, c, n;
+    for (j = 0; j < height; j++) {
+      c = j * width + i;
+      polys.clear();
+      for (n = colstart[c]; n < colstart[c + 1]; n++) {
+        FACE const *f = &mris->faces[colface[n]];
+        double p[VF_MAXPTS][3], q[VF_MAXPTS][3];
+        int np = 3;
+        for (a = 0; a < 3; a++)
+          for (k = 0; k < 3; k++) p[a][k] = vx[3 * f->v[a] + k];
+        np = vfClip(p, np, 0, i - 0.5, -1, q);
+        np = vfClip(q, np, 0, i + 0.5, 1, p);
+        np = vfClip(p, np, 1, j - 0.5, -1, q);
+        np = vfClip(q, np, 1, j + 0.5, 1, p);
+        if (np < 3) continue;
+        vfPoly poly;
+        vfMoments(p, np, &poly.area, &poly.zarea);
+        if (poly.area == 0) continue;
+        poly.n = np;
+        poly.zmin = poly.zmax = p[0][2];
+        for (a = 0; a < np; a++) {
+          for (k = 0; k < 3; k++) poly.p[a][k] = p[a][k];
+          poly.zmin = MIN(poly.zmin, p[a][2]);
+          poly.zmax = MAX(poly.zmax, p[a][2]);
+        }
+        polys.push_back(poly);
+      }
+      if (polys.empty()) continue; /* the column is outside the surface */
+
+      /* exact[k] from the faces crossing voxel k, full[k] the change in the
+         contribution of the faces entirely below it */
+      std::fill(exact.begin(), exact.end(), 0.0);
+      std::fill(full.begin(), full.end(), 0.0);
+      int kmin = depth, kmax = -1;
+      for (n = 0; n < (int)polys.size(); n++) {
+        vfPoly *poly = &polys[n];
+        int k0 = (int)floor(poly->zmin - 0.5) + 1, k1 = (int)ceil(poly->zmax + 0.5);
+        for (k = MAX(k0, 0); k < MIN(k1, depth); k++) exact[k] += vfBelow(poly, k + 0.5) - vfBelow(poly, k - 0.5);
+        if (k1 < depth) full[MAX(k1, 0)] -= poly->area;
+        kmin = MIN(kmin, k0);
+        kmax = MAX(kmax, k1 - 1);
+      }
+      double below = 0;
+      for (k = 0; k < depth; k++) {
+        below += full[k];
+        if (k < kmin || k > kmax) continue;
+        double frac = sign * (below + exact[k]);
+        if (frac < VF_EPS)
+          frac = 0;
+        else if (frac > 1 - VF_EPS)
+          frac = 1;
+        MRIsetVoxVal(mri_fractions, i, j, k, 0, frac);
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return mri_fractions;
+}
+
 MRI *MRIcomputeVolumeFractionFromSurface(MRI_SURFACE *mris, double acc, MRI *mri_src, MRI *mri_fractions)
 {
   const int width = mri_src->width;
   const int height = mri_src->height;
   const int depth = mri_src->depth;
-  int x, y, z, vno;
-  double xs, ys, zs, dist;
+  int x;
   MRIS_HASH_TABLE *mht;
 
+  /* acc is the error allowed per voxel by the octree subdivision, which is
+     only used when asked for */
+  if (acc <= 0) return MRIcomputeVolumeFractionFromSurfaceExact(mris, mri_src, mri_fractions);
+
   /* preparing the output */
   printf("preparing the output\n");
   if (mri_fractions == NULL) {
@@ -63,20 +278,31 @@ MRI *MRIcomputeVolumeFractionFromSurface(MRI_SURFACE *mris, double acc, MRI *mri
   /* creating the hash table related to the surface vertices */
   printf("computing the hash table\n");
   mht = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, 10);
-  /* looping over the nonzero elements of the shell */
+  /* looping over the nonzero elements of the shell, one x slab per thread */
   printf("computing the fractions\n");
-  volFraction frac;
-  octTreeVoxel V;
-  double vox[3], vsize[3];
+  double vsize[3];
   vsize[0] = mri_src->xsize;
   vsize[1] = mri_src->ysize;
   vsize[2] = mri_src->zsize;
+  MATRIX *m = surfaceRASFromVoxel_(mri_shell);
+  MHT_maybeParallel_begin();
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
   for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+    int y, z, vno;
+    double xs, ys, zs, dist, vox[3];
+    volFraction frac;
+    octTreeVoxel V;
     for (y = 0; y < height; y++) {
       for (z = 0; z < depth; z++) {
         if (MRIgetVoxVal(mri_shell, x, y, z, 0) > 125.0) {
           /* change of coordinates from image to surface domain */
-          MRIvoxelToSurfaceRAS(mri_shell, x, y, z, &xs, &ys, &zs);
+          xs = *MATRIX_RELT(m, 1, 1) * x + *MATRIX_RELT(m, 1, 2) * y + *MATRIX_RELT(m, 1, 3) * z + *MATRIX_RELT(m, 1, 4);
+          ys = *MATRIX_RELT(m, 2, 1) * x + *MATRIX_RELT(m, 2, 2) * y + *MATRIX_RELT(m, 2, 3) * z + *MATRIX_RELT(m, 2, 4);
+          zs = *MATRIX_RELT(m, 3, 1) * x + *MATRIX_RELT(m, 3, 2) * y + *MATRIX_RELT(m, 3, 3) * z + *MATRIX_RELT(m, 3, 4);
           /* find the closest vertex to the point */
           MHTfindClosestVertexGeneric(mht, xs, ys, zs, 10, 2, &vno, &dist);
           /* creating the oct tree voxel structure */
@@ -92,7 +318,14 @@ MRI *MRIcomputeVolumeFractionFromSurface(MRI_SURFACE *mris, double acc, MRI *mri
           MRIsetVoxVal(mri_fractions, x, y, z, 0, 1.0);
       }
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
+  MHT_maybeParallel_end();
+  MatrixFree(&m);
+  MHTfree(&mht);
+  MRIfree(&mri_shell);
+  MRIfree(&mri_interior);
   return mri_fractions;
 }
 volFraction MRIcomputeVoxelFractions(octTreeVoxel V, int vno, double acc, int current_depth, MRI_SURFACE *mris)
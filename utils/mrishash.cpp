@@ -22,6 +22,8 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <vector>
 
 //----------------------------------------------------
 // Includes that differ for linux vs GW BC compile
@@ -2220,6 +2222,139 @@ int MRIS_HASH_TABLE_IMPL<Surface,Face,Vertex>::findClosestVertexNoXYZ(
   return vno;
 }
 
+/*---------------------------------------------------------------
+  findClosestVerticesBatch
+
+  findClosestVertexNoXYZ() for many points. Its search only ever looks
+  at the 3 x 3 x 3 buckets around the probe's voxel, so the points are
+  sorted by the Morton code of that voxel and, for each run of points
+  in the same voxel, the unripped vertices of those 27 buckets are
+  gathered once. Each point then replays findClosestVertexGeneric() on
+  the gathered lists, visiting the buckets and vertices in the same
+  order and with the same arithmetic, so the results (including ties)
+  match the single-point search; points it finds nothing for go to
+  findClosestVertexNoXYZ() for the brute-force fallback. The sorted
+  points are split into chunks that are processed in parallel.
+  ---------------------------------------------------------------*/
+template <class Surface, class Face, class Vertex>
+void MRIS_HASH_TABLE_IMPL<Surface,Face,Vertex>::findClosestVerticesBatch(
+    int npoints, float const *xyz, int *vno, float *min_dist)
+{
+  const int chunk = 1024;
+  double const mhtres = vres();
+  // findClosestVertexGeneric with in_max_distance_mm = 1000, in_max_mhts = 1
+  double const max_distance_mm = std::min(1000.0, (double)mhtres);
+
+  // Morton code of the probe voxel, interleaving 11 bits per axis
+  std::vector<std::pair<unsigned long long,int> > order(npoints);
+  for (int n = 0; n < npoints; n++) {
+    unsigned long long key = 0;
+    unsigned int ix = (unsigned int)(int)WORLD_TO_VOLUME((double)xyz[3*n]);
+    unsigned int iy = (unsigned int)(int)WORLD_TO_VOLUME((double)xyz[3*n+1]);
+    unsigned int iz = (unsigned int)(int)WORLD_TO_VOLUME((double)xyz[3*n+2]);
+    for (int b = 0; b < 11; b++)
+      key |= ((unsigned long long)((ix >> b) & 1) << (3*b))   |
+             ((unsigned long long)((iy >> b) & 1) << (3*b+1)) |
+             ((unsigned long long)((iz >> b) & 1) << (3*b+2));
+    order[n] = std::make_pair(key, n);
+  }
+  std::sort(order.begin(), order.end());
+
+  MHT_maybeParallel_begin();
+  int const nchunks = (npoints + chunk - 1) / chunk;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+#endif
+  for (int ch = 0; ch < nchunks; ch++) {
+    ROMP_PFLB_begin
+    // vertices of the 27 buckets around (cx,cy,cz), bucket b = 9*(xv+1)+3*(yv+1)+(zv+1)
+    std::vector<int>   cvno;
+    std::vector<float> cx, cy, cz;
+    int cstart[28];
+    int cvox[3];
+    bool cached = false;
+
+    for (int m = ch*chunk; m < std::min(npoints, (ch+1)*chunk); m++) {
+      int const n = order[m].second;
+      double const probex = xyz[3*n], probey = xyz[3*n+1], probez = xyz[3*n+2];
+      double const probex_vol = WORLD_TO_VOLUME(probex);
+      double const probey_vol = WORLD_TO_VOLUME(probey);
+      double const probez_vol = WORLD_TO_VOLUME(probez);
+      int const probex_vox = (int)probex_vol;
+      int const probey_vox = (int)probey_vol;
+      int const probez_vox = (int)probez_vol;
+
+      if (!cached || probex_vox != cvox[0] || probey_vox != cvox[1] || probez_vox != cvox[2]) {
+        cvno.clear(); cx.clear(); cy.clear(); cz.clear();
+        for (int b = 0; b < 27; b++) {
+          cstart[b] = cvno.size();
+          auto bucket = acqBucketAtVoxIx(probex_vox + b/9 - 1, probey_vox + (b/3)%3 - 1, probez_vox + b%3 - 1);
+          if (!bucket) continue;
+          MHB* bin = bucket->bins;
+          for (int vtxix = 0; vtxix < bucket->nused; vtxix++, bin++) {
+            auto AVtx = surface.vertices(bin->fno);
+            if (AVtx.ripflag()) continue;
+            float tryx, tryy, tryz;
+            mhtVertex2xyz(AVtx, which(), &tryx, &tryy, &tryz);
+            cvno.push_back(bin->fno);
+            cx.push_back(tryx);
+            cy.push_back(tryy);
+            cz.push_back(tryz);
+          }
+          relBucket(&bucket);
+        }
+        cstart[27] = cvno.size();
+        cvox[0] = probex_vox;
+        cvox[1] = probey_vox;
+        cvox[2] = probez_vox;
+        cached = true;
+      }
+
+      int const near8offsetx = (probex_vol - (double)probex_vox <= 0.5) ? -1 : 0;
+      int const near8offsety = (probey_vol - (double)probey_vox <= 0.5) ? -1 : 0;
+      int const near8offsetz = (probez_vol - (double)probez_vox <= 0.5) ? -1 : 0;
+      double MinDistSq = 1e6;
+      int MinDistVtxNum = -1;
+      bool near8[27] = {};
+      int b;
+
+      auto searchBucket = [&](int bi) {
+        for (int k = cstart[bi]; k < cstart[bi+1]; k++) {
+          double ADistSq = SQR(cx[k] - probex) + SQR(cy[k] - probey) + SQR(cz[k] - probez);
+          if (ADistSq >= MinDistSq) continue;
+          MinDistSq = ADistSq;
+          MinDistVtxNum = cvno[k];
+        }
+      };
+
+      for (int xvi = 0; xvi <= 1; xvi++)
+        for (int yvi = 0; yvi <= 1; yvi++)
+          for (int zvi = 0; zvi <= 1; zvi++) {
+            b = 9*(xvi + near8offsetx + 1) + 3*(yvi + near8offsety + 1) + (zvi + near8offsetz + 1);
+            searchBucket(b);
+            near8[b] = true;
+          }
+      if (max_distance_mm > 0.5 * mhtres && (MinDistVtxNum < 0 || sqrt(MinDistSq) > 0.5 * mhtres))
+        for (b = 0; b < 27; b++)
+          if (!near8[b]) searchBucket(b);
+
+      if (MinDistVtxNum >= 0 && sqrt(MinDistSq) <= max_distance_mm) {
+        vno[n] = MinDistVtxNum;
+        if (min_dist) min_dist[n] = sqrt(MinDistSq);
+      }
+      else {
+        float dist;
+        vno[n] = findClosestVertexNoXYZ(xyz[3*n], xyz[3*n+1], xyz[3*n+2], &dist);
+        if (min_dist) min_dist[n] = dist;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  MHT_maybeParallel_end();
+}
+
 /*---------------------------------------------------------------
   findVnoOfClosestVertexInTable
   Returns vertex from mris & mht that's closest to provided coordinates.
@@ -2437,6 +2572,13 @@ int MHTfindClosestVertexNoXYZ(MRIS_HASH_TABLE* mht,
 { mht->toMRIS_HASH_TABLE_NoSurface()->checkConstructedWithVertices();
   return mht->findClosestVertexNoXYZ(x,y,z,min_dist); }
 
+
+void MHTfindClosestVerticesBatch(MRIS_HASH_TABLE* mht,
+                                 MRIS* mris,
+                                 int npoints, float const *xyz,
+                                 int *vno, float *min_dist)
+{ mht->toMRIS_HASH_TABLE_NoSurface()->checkConstructedWithVertices();
+  mht->findClosestVerticesBatch(npoints,xyz,vno,min_dist); }
                              
 int MHTfindClosestSetVertexNo(MRIS_HASH_TABLE* mht,
                                 MRIS* mris,
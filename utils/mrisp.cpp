@@ -23,6 +23,7 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <vector>
 
 #include "diag.h"
 #include "error.h"
@@ -1393,6 +1394,27 @@ double MRISPfunctionVal(MRI_SURFACE_PARAMETERIZATION *mrisp, float desired_radiu
     return MRISPfunctionValTraceable(mrisp, desired_radius, x, y, z, fno, false);
 }
 
+/*
+  MRISPfunctionVal() at npoints points at once: vals[i] is the value of frame fno at
+  (x[i], y[i], z[i]). The points are sampled in parallel.
+*/
+void MRISPfunctionVals(MRI_SURFACE_PARAMETERIZATION *mrisp, float desired_radius,
+                       int npoints, const float *x, const float *y, const float *z, int fno, double *vals)
+{
+  int i;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (i = 0; i < npoints; i++) {
+    ROMP_PFLB_begin
+    vals[i] = MRISPfunctionValTraceable(mrisp, desired_radius, x[i], y[i], z[i], fno, false);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
 /*-----------------------------------------------------
         Parameters:
 
@@ -1576,233 +1598,142 @@ MRI_SP *MRISPblur(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno) {
         (do_old ? MRISPblur_old : MRISPblur_new)(mrisp_src, mrisp_dst, sigma, fno);
 }
 
-static MRI_SP *MRISPblur_new(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno) {
-  int fnoLo_init, fnoHi_init;
-  int no_sphere_init;
-  int cart_klen_init;
-  double sigma_sq_inv_init;
-  IMAGE *Ip_src_init;
-  {
-    no_sphere_init = getenv("NO_SPHERE") != NULL;
-    if (no_sphere_init) fprintf(stderr, "disabling spherical geometry\n");
-
-    if (!mrisp_dst) mrisp_dst = MRISPclone(mrisp_src);
-    mrisp_dst->sigma = sigma;
-
-    /* determine the size of the kernel */
-    cart_klen_init = (int)nint(6.0f * sigma) + 1;
-    if (ISEVEN(cart_klen_init)) /* ensure it's odd */
-      cart_klen_init++;
-
-    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
-      fprintf(stderr, "blurring surface, sigma = %2.3f, cartesian klen = %d\n", sigma, cart_klen_init);
-
-    if (FZERO(sigma))
-      sigma_sq_inv_init = BIG;
-    else
-      sigma_sq_inv_init = 1.0f / (sigma * sigma);
-
-    Ip_src_init = mrisp_src->Ip ;
+/*
+  The blur kernel at latitude u is exp(-(uk^2 + sin^2(phi_u) vk^2) / sigma^2), which
+  factors into a kernel across latitudes, w(uk), and a kernel along the ring at u, g_u(vk).
+  So each output ring is a weighted sum of the source rings within khalf(u) of it (with
+  the spherical wrap over the poles), followed by a circular convolution along the ring.
+  This costs O(khalf) per sample instead of O(khalf^2), and the per-latitude kernels are
+  computed once per call. Rings are independent, so they are blurred in parallel.
+*/
+static int mrispBlurKhalf(MRI_SP *mrisp, int u, int cart_klen, int no_sphere, double *psin_sq_u)
+{
+  double const phi = (double)u * PHI_MAX / PHI_DIM(mrisp);
+  double sin_sq_u = sin(phi);
+  int klen;
 
-    if (fno < 0) {
-      fnoLo_init = 0;
-      fnoHi_init =  Ip_src_init->num_frame;
-    } else {
-      fnoLo_init = fno;
-      fnoHi_init = fno + 1;
-    }
+  sin_sq_u *= sin_sq_u;
+  if (!FZERO(sin_sq_u)) {
+    int k = cart_klen * cart_klen;
+    klen = sqrt(k + k / sin_sq_u);
+    if (klen > MAX_LEN * cart_klen) klen = MAX_LEN * cart_klen;
   }
+  else
+    klen = MAX_LEN * cart_klen; /* arbitrary max length */
+  if (no_sphere) sin_sq_u = 1.0f, klen = cart_klen;
+  if (klen >= U_DIM(mrisp)) klen = U_DIM(mrisp) - 1;
+  if (klen >= V_DIM(mrisp)) klen = V_DIM(mrisp) - 1;
 
-  int const          fnoLo        = fnoLo_init;
-  int const          fnoHi        = fnoHi_init;
-  int const          cart_klen    = cart_klen_init;
-  int const          no_sphere    = no_sphere_init;
-  double const       sigma_sq_inv = sigma_sq_inv_init;
-  const IMAGE *const Ip_src       = Ip_src_init;
+  *psin_sq_u = sin_sq_u;
+  return (klen / 2);
+}
 
-  static int  uMax                    = 0;
-  static int  uToKHalfCache_PHI_DIM   = 0;
-  static int  uToKHalfCache_cart_klen = 0;
-  static int* uToKHalfCache           = NULL;
-  
-  static int     kHalfHi              = 0;
-  static double* uukvkToExpResult     = NULL;
-  
-  if (uMax                    != U_DIM  (mrisp_src) 
-  ||  uToKHalfCache_PHI_DIM   != PHI_DIM(mrisp_src)
-  ||  uToKHalfCache_cart_klen != cart_klen
-  ) {
-    uMax                    = U_DIM  (mrisp_src);
-    uToKHalfCache_PHI_DIM   = PHI_DIM(mrisp_src);
-    uToKHalfCache_cart_klen = cart_klen;
-    
-    uToKHalfCache = (int*)realloc(uToKHalfCache, uMax*sizeof(int));
-    
-    int u;
-    for (u = 0; u < U_DIM(mrisp_src); u++) {
-      double const phi      = (double)u * PHI_MAX / PHI_DIM(mrisp_src);
-      double const sin_sq_u = no_sphere ? 1.0 : squared(sin(phi));
+static MRI_SP *mrispBlurRings(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, const int *frames, int nframes)
+{
+  int no_sphere, cart_klen, khalf_max, udim, vdim, u, n;
+  double sigma_sq_inv;
 
-      int klen;
+  no_sphere = getenv("NO_SPHERE") != NULL;
+  if (no_sphere) fprintf(stderr, "disabling spherical geometry\n");
 
-      if (no_sphere) {
-        klen = cart_klen;
+  if (!mrisp_dst) mrisp_dst = MRISPclone(mrisp_src);
+  mrisp_dst->sigma = sigma;
 
-      } else if (!FZERO(sin_sq_u)) {
-        int k = cart_klen * cart_klen;
-        klen = sqrt(k + k / sin_sq_u);
-        if (klen > MAX_LEN * cart_klen) klen = MAX_LEN * cart_klen;
+  /* determine the size of the kernel */
+  cart_klen = (int)nint(6.0f * sigma) + 1;
+  if (ISEVEN(cart_klen)) /* ensure it's odd */
+    cart_klen++;
 
-      } else {
-        klen = MAX_LEN * cart_klen; /* arbitrary max length */          // happens when u is 0
-      }
+  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
+    fprintf(stderr, "blurring surface, sigma = %2.3f, cartesian klen = %d\n", sigma, cart_klen);
 
-      if (klen >= U_DIM(mrisp_src)) klen = U_DIM(mrisp_src) - 1;
-      if (klen >= V_DIM(mrisp_src)) klen = V_DIM(mrisp_src) - 1;
+  if (FZERO(sigma))
+    sigma_sq_inv = BIG;
+  else
+    sigma_sq_inv = 1.0f / (sigma * sigma);
 
-      uToKHalfCache[u] = klen / 2;
-      
-      if (u > 0 && uToKHalfCache[u] > uToKHalfCache[0]) {
-        fprintf(stdout, "%s:%d uMax[0] not max\n", __FILE__, __LINE__);
-        exit(1);
-      }
-    }
-    
-    kHalfHi          = uToKHalfCache[0] + 1;
-    uukvkToExpResult = (double*)realloc(uukvkToExpResult, uMax*kHalfHi*kHalfHi*sizeof(double));
-    
-    for (u = 0; u < U_DIM(mrisp_src); u++) {
-      double* ukvkToExpResult = uukvkToExpResult + u*kHalfHi*kHalfHi;
-
-      double const phi      = (double)u * PHI_MAX / PHI_DIM(mrisp_src);
-      double const sin_sq_u = no_sphere ? 1.0 : squared(sin(phi));
-       
-      int uk,vk;
-      for (uk = 0; uk < kHalfHi; uk++) 
-      for (vk = 0; vk < kHalfHi; vk++) {
-        double const udiff = (double)(uk * uk); /* distance squared in u */
-        double const vdiff = (double)(vk * vk); /* distance squared in v */
-        double neg_exp_input = (udiff + sin_sq_u * vdiff) * sigma_sq_inv;
-        double k             = exp(-neg_exp_input);
-        ukvkToExpResult[uk*kHalfHi + vk] = k;
-      }
+  udim = U_DIM(mrisp_src);
+  vdim = V_DIM(mrisp_src);
+
+  /* per-latitude kernel half-widths and ring kernels, normalized so that
+     the product of the two kernels sums to 1 */
+  std::vector<int> khalf(udim);
+  std::vector<double> sin_sq(udim);
+  khalf_max = 0;
+  for (u = 0; u < udim; u++) {
+    khalf[u] = mrispBlurKhalf(mrisp_src, u, cart_klen, no_sphere, &sin_sq[u]);
+    if (khalf[u] > khalf_max) khalf_max = khalf[u];
+  }
+  std::vector<double> wk(khalf_max + 1), gk((size_t)udim * (khalf_max + 1));
+  for (n = 0; n <= khalf_max; n++) wk[n] = exp(-(double)(n * n) * sigma_sq_inv);
+  for (u = 0; u < udim; u++) {
+    double *g = &gk[(size_t)u * (khalf_max + 1)];
+    double wtotal = wk[0], gtotal = 1.0;
+    for (n = 1; n <= khalf[u]; n++) {
+      wtotal += 2 * wk[n];
+      g[n] = exp(-sin_sq[u] * (double)(n * n) * sigma_sq_inv);
+      gtotal += 2 * g[n];
     }
+    g[0] = 1.0 / (wtotal * gtotal);
+    for (n = 1; n <= khalf[u]; n++) g[n] *= g[0];
   }
-  
-  int u;
+
+  const IMAGE *const Ip_src = mrisp_src->Ip;
+  IMAGE *const Ip_dst = mrisp_dst->Ip;
+  int const nrings = nframes * udim;
+  int ring;
 
   ROMP_PF_begin
-#if HAVE_OPENMP  
-  #pragma omp parallel for if_ROMP(assume_reproducible) collapse(2)
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
 #endif
-  for (fno = fnoLo; fno < fnoHi; fno++) /* for each frame */
-  {
-    for (u = 0; u < U_DIM(mrisp_src); u++) {
-      ROMP_PFLB_begin
-      double const * const ukvkToExpResult = uukvkToExpResult + u*kHalfHi*kHalfHi;
-      
-      if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "\r%3.3d of %d     ", u, U_DIM(mrisp_src) - 1);
-      
-      double const phi      = (double)u * PHI_MAX / PHI_DIM(mrisp_src);
-      double const sin_sq_u = no_sphere ? 1.0 : squared(sin(phi));
-      
-      // khalf is independent of fno and of v.
-      //
-      int khalf_init;
+  for (ring = 0; ring < nrings; ring++) {
+    ROMP_PFLB_begin
+    int const fno = frames[ring / udim];
+    int const u = ring % udim;
+    int const kh = khalf[u];
+    double const *g = &gk[(size_t)u * (khalf_max + 1)];
+    std::vector<double> T(vdim, 0.0);
+    int uk, vk, v;
+
+    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "\r%3.3d of %d     ", u, udim - 1);
+
+    /* weighted sum of the neighboring rings */
+    for (uk = -kh; uk <= kh; uk++) {
+      int voff, u1 = u + uk;
+      if (u1 < 0) /* enforce spherical topology  */
       {
-        int klen;
-
-        if (no_sphere) {
-          klen = cart_klen;
-
-        } else if (!FZERO(sin_sq_u)) {
-          int k = cart_klen * cart_klen;
-          klen = sqrt(k + k / sin_sq_u);
-          if (klen > MAX_LEN * cart_klen) klen = MAX_LEN * cart_klen;
-        
-        } else {
-          klen = MAX_LEN * cart_klen; /* arbitrary max length */
-        }
-
-        if (klen >= U_DIM(mrisp_src)) klen = U_DIM(mrisp_src) - 1;
-        if (klen >= V_DIM(mrisp_src)) klen = V_DIM(mrisp_src) - 1;
-        
-        khalf_init = klen / 2;
+        voff = vdim / 2;
+        u1 = -u1;
       }
-      int const khalf = khalf_init;
-
-      if (khalf != uToKHalfCache[u]) {
-        fprintf(stdout, "%s:%d khalf != uToKHalfCache[u]\n",__FILE__, __LINE__);
-        exit(1);
+      else if (u1 >= udim) {
+        u1 = udim - (u1 - udim + 1);
+        voff = vdim / 2;
       }
-      
-      int v;
-      for (v = 0; v < V_DIM(mrisp_src); v++) {
-        /*      theta = (double)v*THETA_MAX / THETA_DIM(mrisp_src) ;*/
-        // if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
-
-        double total = 0.0, ktotal = 0.0;
-
-        int uk;
-        for (uk = -khalf; uk <= khalf; uk++) {
-          int const absUk = (uk < 0) ? -uk : uk; 
-#ifdef CHECK_TABLE
-          double const udiff = (double)(uk * uk); /* distance squared in u */
-#endif
+      else
+        voff = 0;
 
-          int voff;
+      double const w = wk[uk < 0 ? -uk : uk];
+      for (v = 0; v < vdim; v++) {
+        int v1 = v + voff;
+        if (v1 >= vdim) v1 -= vdim;
+        T[v] += w * *IMAGEFseq_pix(Ip_src, u1, v1, fno);
+      }
+    }
 
-          int u1 = u + uk;
-          if (u1 < 0) /* enforce spherical topology  */
-          {
-            voff = V_DIM(mrisp_src) / 2;
-            u1 = -u1;
-          }
-          else if (u1 >= U_DIM(mrisp_src)) {
-            u1 = U_DIM(mrisp_src) - (u1 - U_DIM(mrisp_src) + 1);
-            voff = V_DIM(mrisp_src) / 2;
-          } else {
-            voff = 0;
-          }
-          
-          int vk;
-          for (vk = -khalf; vk <= khalf; vk++) {
-            int const absVk = (vk < 0) ? -vk : vk; 
-            double kFromTable = ukvkToExpResult[absUk*kHalfHi + absVk];
-
-#ifndef CHECK_TABLE
-            double k = kFromTable;
-#else
-            double vdiff = (double)(vk * vk);
-            
-            double neg_exp_input = (udiff + sin_sq_u * vdiff) * sigma_sq_inv;
-                //
-                // udiff is v invariant
-                // 
-                
-            double k = exp(-neg_exp_input);
-
-            if (k != kFromTable) {
-              fprintf(stdout, "%s:%d k:%f != kFromTable:%f uk:%d vk:%d\n", __FILE__, __LINE__, k, kFromTable, uk, vk);
-              exit(1);
-            }
-#endif
-            
-            int v1 = v + vk + voff;
-            while (v1 < 0) /* enforce spherical topology */
-              v1 += V_DIM(mrisp_src);
-            while (v1 >= V_DIM(mrisp_src)) v1 -= V_DIM(mrisp_src);
-            
-            ktotal += k;
-            total  += k * *IMAGEFseq_pix(Ip_src, u1, v1, fno);
-          }
-        }
-        if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
-        total /= ktotal; /* normalize weights to 1 */
-        *IMAGEFseq_pix(mrisp_dst->Ip, u, v, fno) = total;
+    /* circular convolution along the ring */
+    for (v = 0; v < vdim; v++) {
+      double total = g[0] * T[v];
+      for (vk = 1; vk <= kh; vk++) {
+        int vm = v - vk, vp = v + vk;
+        if (vm < 0) vm += vdim;
+        if (vp >= vdim) vp -= vdim;
+        total += g[vk] * (T[vm] + T[vp]);
       }
-      ROMP_PFLB_end
+      if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
+      *IMAGEFseq_pix(Ip_dst, u, v, fno) = total;
     }
+    ROMP_PFLB_end
   }
   ROMP_PF_end
 
@@ -1811,6 +1742,18 @@ static MRI_SP *MRISPblur_new(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma,
   return (mrisp_dst);
 }
 
+static MRI_SP *MRISPblur_new(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno)
+{
+  std::vector<int> frames;
+
+  if (fno < 0)
+    for (fno = 0; fno < mrisp_src->Ip->num_frame; fno++) frames.push_back(fno);
+  else
+    frames.push_back(fno);
+
+  return (mrispBlurRings(mrisp_src, mrisp_dst, sigma, &frames[0], frames.size()));
+}
+
 static MRI_SP *MRISPblur_old(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno)
 {
   int f0, f1;
@@ -2719,96 +2662,7 @@ MRI_SP *MRIStoParameterizations(MRIS *mris, MRI_SP *mrisp, float scale, int *fra
 
 MRI_SP *MRISPblurFrames(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int *frames, int nframes)
 {
-  int n, u, v, cart_klen, klen, khalf, uk, vk, u1, v1, no_sphere, voff;
-  double k, *total, ktotal, sigma_sq_inv, udiff, vdiff, sin_sq_u, phi;
-  IMAGE *Ip_src, *Ip_dst;
-
-  total = (double *)malloc(nframes * sizeof(double));
-
-  no_sphere = getenv("NO_SPHERE") != NULL;
-  if (no_sphere) fprintf(stderr, "disabling spherical geometry\n");
-
-  if (!mrisp_dst) mrisp_dst = MRISPclone(mrisp_src);
-  mrisp_dst->sigma = sigma;
-
-  /* determine the size of the kernel */
-  cart_klen = (int)nint(6.0f * sigma) + 1;
-  if (ISEVEN(cart_klen)) /* ensure it's odd */
-    cart_klen++;
-
-  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
-    fprintf(stderr, "blurring surface, sigma = %2.3f, cartesian klen = %d\n", sigma, cart_klen);
-
-  if (FZERO(sigma))
-    sigma_sq_inv = BIG;
-  else
-    sigma_sq_inv = 1.0f / (sigma * sigma);
-
-  Ip_src = mrisp_src->Ip;
-  Ip_dst = mrisp_dst->Ip;
-
-  for (u = 0; u < U_DIM(mrisp_src); u++) {
-    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "\r%3.3d of %d     ", u, U_DIM(mrisp_src) - 1);
-    phi = (double)u * PHI_MAX / PHI_DIM(mrisp_src);
-    sin_sq_u = sin(phi);
-    sin_sq_u *= sin_sq_u;
-    if (!FZERO(sin_sq_u)) {
-      k = cart_klen * cart_klen;
-      klen = sqrt(k + k / sin_sq_u);
-      if (klen > MAX_LEN * cart_klen) klen = MAX_LEN * cart_klen;
-    }
-    else
-      klen = MAX_LEN * cart_klen; /* arbitrary max length */
-    if (no_sphere) sin_sq_u = 1.0f, klen = cart_klen;
-    if (klen >= U_DIM(mrisp_src)) klen = U_DIM(mrisp_src) - 1;
-    if (klen >= V_DIM(mrisp_src)) klen = V_DIM(mrisp_src) - 1;
-    khalf = klen / 2;
-    for (v = 0; v < V_DIM(mrisp_src); v++) {
-      /*      theta = (double)v*THETA_MAX / THETA_DIM(mrisp_src) ;*/
-      if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
-
-      memset(total, 0, nframes * sizeof(double));
-      ktotal = 0.0;
-      for (uk = -khalf; uk <= khalf; uk++) {
-        udiff = (double)(uk * uk); /* distance squared in u */
-
-        u1 = u + uk;
-        if (u1 < 0) /* enforce spherical topology  */
-        {
-          voff = V_DIM(mrisp_src) / 2;
-          u1 = -u1;
-        }
-        else if (u1 >= U_DIM(mrisp_src)) {
-          u1 = U_DIM(mrisp_src) - (u1 - U_DIM(mrisp_src) + 1);
-          voff = V_DIM(mrisp_src) / 2;
-        }
-        else
-          voff = 0;
-
-        for (vk = -khalf; vk <= khalf; vk++) {
-          vdiff = (double)(vk * vk);
-          k = exp(-(udiff + sin_sq_u * vdiff) * sigma_sq_inv);
-          v1 = v + vk + voff;
-          while (v1 < 0) /* enforce spherical topology */
-            v1 += V_DIM(mrisp_src);
-          while (v1 >= V_DIM(mrisp_src)) v1 -= V_DIM(mrisp_src);
-          ktotal += k;
-          for (n = 0; n < nframes; n++) total[n] += k * *IMAGEFseq_pix(Ip_src, u1, v1, frames[n]);
-        }
-      }
-      if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
-      for (n = 0; n < nframes; n++) {
-        total[n] /= ktotal; /* normalize weights to 1 */
-        *IMAGEFseq_pix(mrisp_dst->Ip, u, v, frames[n]) = total[n];
-      }
-    }
-  }
-
-  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "done.\n");
-
-  free(total);
-
-  return (mrisp_dst);
+  return (mrispBlurRings(mrisp_src, mrisp_dst, sigma, frames, nframes));
 }
 
 int MRISPsetFrameVal(MRI_SP *mrisp, int frame, float val)
@@ -0,0 +1,423 @@
+#define COMPILING_MRISURF_TOPOLOGY_FRIEND_CHECKED
+#define COMPILING_MRISURF_METRIC_PROPERTIES_FRIEND
+/**
+ * @brief sidecar cache of the surface properties derived by MRISread
+ *
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef _POSIX_MAPPED_FILES
+#include <sys/mman.h>
+#endif
+
+#include <vector>
+
+#include "mrisurf_cache.h"
+
+#include "mrisurf_base.h"
+#include "mrisurf_metricProperties.h"
+#include "mrisurf_topology.h"
+
+#define MRIS_CACHE_MAGIC   "FreeSurferSurfaceCache"
+#define MRIS_CACHE_VERSION 1
+
+#define MRIS_CACHE_TKR_RAS  0x1   // MRISread was asked to convert scanner to tkr coords
+#define MRIS_CACHE_FASTER_MP 0x2  // FS_FASTER_MP was set when the properties were computed
+
+// MRIS scalars restored along with the per-vertex and per-face properties
+enum {
+  CACHE_XLO, CACHE_XHI, CACHE_YLO, CACHE_YHI, CACHE_ZLO, CACHE_ZHI,
+  CACHE_XCTR, CACHE_YCTR, CACHE_ZCTR,
+  CACHE_TOTAL_AREA, CACHE_AVG_VERTEX_AREA, CACHE_AVG_VERTEX_DIST, CACHE_STD_VERTEX_DIST,
+  CACHE_NEG_ORIG_AREA, CACHE_NEG_AREA, CACHE_RADIUS,
+  CACHE_NGLOBALS
+};
+
+typedef struct {
+  char               magic[32];
+  int                version;
+  int                flags;
+  unsigned long long key;
+  int                nvertices;
+  int                nfaces;
+  long long          nnbrs;     // sum of v3num
+  int                status;
+  int                unused;
+  double             globals[CACHE_NGLOBALS];
+} MRIS_CACHE_HEADER;
+
+// Byte offsets of the arrays following the header, each 8 byte aligned
+//
+typedef struct {
+  size_t vfloat;   // area, nx, ny, nz, origarea        [5][nvertices]
+  size_t vchar;    // neg, border                       [2][nvertices]
+  size_t ffloat;   // area, nx, ny, nz, angle[0..2]     [7][nfaces]
+  size_t vint;     // vnum, v2num, v3num                [3][nvertices]
+  size_t nbr;      // v[0..v3num) of each vertex        [nnbrs]
+  size_t dist;     // dist[0..v3num) of each vertex     [nnbrs]
+  size_t total;
+} MRIS_CACHE_LAYOUT;
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static void cacheLayout(MRIS_CACHE_LAYOUT *l, int nvertices, int nfaces, long long nnbrs)
+{
+  l->vfloat = align8(sizeof(MRIS_CACHE_HEADER));
+  l->vchar  = l->vfloat + align8(5 * (size_t)nvertices * sizeof(float));
+  l->ffloat = l->vchar  + align8(2 * (size_t)nvertices);
+  l->vint   = l->ffloat + align8(7 * (size_t)nfaces * sizeof(float));
+  l->nbr    = l->vint   + align8(3 * (size_t)nvertices * sizeof(int));
+  l->dist   = l->nbr    + align8((size_t)nnbrs * sizeof(int));
+  l->total  = l->dist   + align8((size_t)nnbrs * sizeof(float));
+}
+
+static int hashFile(const char *fname, unsigned long long *key)
+{
+  FILE *fp = fopen(fname, "rb");
+  if (!fp) return (0);
+
+  // FNV-1a
+  unsigned long long h = 14695981039346656037ULL;
+  std::vector<unsigned char> buf(1 << 20);
+  size_t n;
+  while ((n = fread(&buf[0], 1, buf.size(), fp)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      h ^= buf[i];
+      h *= 1099511628211ULL;
+    }
+  }
+  fclose(fp);
+
+  *key = h;
+  return (1);
+}
+
+MRIS_SURFACE_CACHE *MRISsurfaceCacheOpen(const char *surf_fname, int dotkrRasConvert)
+{
+  const char *where = getenv("FS_SURF_CACHE");
+  if (!where || !*where) return (NULL);
+
+  // the old MRIScomputeMetricProperties code is there to be run (and
+  // checked against the new one), so never stand in for it
+  if (getenv("FREESURFER_OLD_MRIScomputeMetricProperties") && !getenv("FS_FASTER_MP")) return (NULL);
+
+  unsigned long long key;
+  if (!hashFile(surf_fname, &key)) return (NULL);
+
+  MRIS_SURFACE_CACHE *cache = (MRIS_SURFACE_CACHE *)calloc(1, sizeof(MRIS_SURFACE_CACHE));
+  cache->key = key;
+  cache->flags = (dotkrRasConvert ? MRIS_CACHE_TKR_RAS : 0) | (getenv("FS_FASTER_MP") ? MRIS_CACHE_FASTER_MP : 0);
+
+  struct stat st;
+  if (stat(where, &st) == 0 && S_ISDIR(st.st_mode))
+    snprintf(cache->fname, STRLEN, "%s/%016llx.surfcache", where, key);
+  else
+    snprintf(cache->fname, STRLEN, "%s.surfcache", surf_fname);
+
+  FILE *fp = fopen(cache->fname, "rb");
+  if (!fp) return (cache);
+
+  MRIS_CACHE_HEADER hdr;
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || strncmp(hdr.magic, MRIS_CACHE_MAGIC, sizeof(hdr.magic)) || hdr.version != MRIS_CACHE_VERSION ||
+      hdr.key != cache->key || hdr.flags != cache->flags) {
+    fclose(fp);
+    return (cache);
+  }
+
+  MRIS_CACHE_LAYOUT layout;
+  cacheLayout(&layout, hdr.nvertices, hdr.nfaces, hdr.nnbrs);
+  if (fstat(fileno(fp), &st) != 0 || (size_t)st.st_size != layout.total) {
+    fclose(fp);
+    return (cache);
+  }
+
+#ifdef _POSIX_MAPPED_FILES
+  void *base = mmap(0, layout.total, PROT_READ, MAP_SHARED, fileno(fp), 0);
+  if (base != MAP_FAILED) {
+    cache->base = (char *)base;
+    cache->len = layout.total;
+    cache->mapped = 1;
+  }
+#endif
+  if (!cache->base) {
+    cache->base = (char *)malloc(layout.total);
+    rewind(fp);
+    if (fread(cache->base, 1, layout.total, fp) == layout.total)
+      cache->len = layout.total;
+    else {
+      free(cache->base);
+      cache->base = NULL;
+    }
+  }
+  fclose(fp);
+
+  if (cache->base && (Gdiag & DIAG_SHOW) && DIAG_VERBOSE_ON) printf("using surface cache %s\n", cache->fname);
+
+  return (cache);
+}
+
+void MRISsurfaceCacheFree(MRIS_SURFACE_CACHE **pcache)
+{
+  MRIS_SURFACE_CACHE *cache = *pcache;
+  if (!cache) return;
+  *pcache = NULL;
+
+  if (cache->base) {
+#ifdef _POSIX_MAPPED_FILES
+    if (cache->mapped) munmap(cache->base, cache->len);
+#endif
+    if (!cache->mapped) free(cache->base);
+  }
+  free(cache);
+}
+
+/*
+  The cached values are only usable on a surface with the same vertices,
+  faces and immediate neighbours in the same order, which is what reading
+  the same file produces.
+*/
+static int cacheMatches(MRIS_SURFACE_CACHE *cache, MRIS *mris, MRIS_CACHE_LAYOUT *layout)
+{
+  if (!cache || !cache->base) return (0);
+
+  MRIS_CACHE_HEADER const *hdr = (MRIS_CACHE_HEADER const *)cache->base;
+  if (hdr->nvertices != mris->nvertices || hdr->nfaces != mris->nfaces || hdr->status != (int)mris->status) return (0);
+  if (mris->nsize != 1 || (mris->dist_alloced_flags & 2)) return (0);
+
+  cacheLayout(layout, hdr->nvertices, hdr->nfaces, hdr->nnbrs);
+
+  int const *vnum = (int const *)(cache->base + layout->vint);
+  int const *v3num = vnum + 2 * mris->nvertices;
+  int const *nbr = (int const *)(cache->base + layout->nbr);
+
+  long long offset = 0;
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const *const vt = &mris->vertices_topology[vno];
+    if (mris->vertices[vno].ripflag || vt->vnum != vnum[vno]) return (0);
+    if (memcmp(vt->v, nbr + offset, vt->vnum * sizeof(int))) return (0);
+    offset += v3num[vno];
+  }
+  for (int fno = 0; fno < mris->nfaces; fno++)
+    if (mris->faces[fno].ripflag) return (0);
+
+  return (offset == hdr->nnbrs);
+}
+
+int MRISsurfaceCacheRestoreMetricProperties(MRIS_SURFACE_CACHE *cache, MRIS *mris)
+{
+  MRIS_CACHE_LAYOUT layout;
+  if (!cacheMatches(cache, mris, &layout)) return (0);
+
+  MRIS_CACHE_HEADER const *hdr = (MRIS_CACHE_HEADER const *)cache->base;
+  double const *g = hdr->globals;
+  int const nvertices = mris->nvertices, nfaces = mris->nfaces;
+
+  mris->xlo = g[CACHE_XLO];
+  mris->xhi = g[CACHE_XHI];
+  mris->ylo = g[CACHE_YLO];
+  mris->yhi = g[CACHE_YHI];
+  mris->zlo = g[CACHE_ZLO];
+  mris->zhi = g[CACHE_ZHI];
+  mris->xctr = g[CACHE_XCTR];
+  mris->yctr = g[CACHE_YCTR];
+  mris->zctr = g[CACHE_ZCTR];
+  mris->total_area = g[CACHE_TOTAL_AREA];
+  mris->avg_vertex_area = g[CACHE_AVG_VERTEX_AREA];
+  mrisSetAvgInterVertexDist(mris, g[CACHE_AVG_VERTEX_DIST]);
+  mris->std_vertex_dist = g[CACHE_STD_VERTEX_DIST];
+  mris->neg_orig_area = g[CACHE_NEG_ORIG_AREA];
+  mris->neg_area = g[CACHE_NEG_AREA];
+  mris->radius = g[CACHE_RADIUS];
+
+  float const *vf = (float const *)(cache->base + layout.vfloat);
+  char const *vc = cache->base + layout.vchar;
+  int const *vnum = (int const *)(cache->base + layout.vint);
+  int const *v3num = vnum + 2 * nvertices;
+  float const *dist = (float const *)(cache->base + layout.dist);
+
+  // MRIScomputeMetricProperties leaves the 1-hop distances behind
+  MRISfreeDistsButNotOrig(mris);
+  long long offset = 0;
+  int vno;
+  for (vno = 0; vno < nvertices; vno++) {
+    VERTEX *const v = &mris->vertices[vno];
+    v->area = vf[vno];
+    v->nx = vf[nvertices + vno];
+    v->ny = vf[2 * nvertices + vno];
+    v->nz = vf[3 * nvertices + vno];
+    v->origarea = vf[4 * nvertices + vno];
+    v->neg = vc[vno];
+    v->border = vc[nvertices + vno];
+
+    if (vnum[vno] > 0) {
+      float *d = mrisStealDistStore(mris, vno, vnum[vno]);
+      memcpy(d, dist + offset, vnum[vno] * sizeof(float));
+      mrisSetDist(mris, vno, d, vnum[vno]);
+    }
+    offset += v3num[vno];
+  }
+  mris->dist_nsize = 1;
+
+  float const *ff = (float const *)(cache->base + layout.ffloat);
+  int fno;
+  for (fno = 0; fno < nfaces; fno++) {
+    FACE *const f = &mris->faces[fno];
+    f->area = ff[fno];
+    setFaceNorm(mris, fno, ff[nfaces + fno], ff[2 * nfaces + fno], ff[3 * nfaces + fno]);
+    for (int k = 0; k < ANGLES_PER_TRIANGLE; k++) f->angle[k] = ff[(4 + k) * nfaces + fno];
+  }
+
+  return (1);
+}
+
+int MRISsurfaceCacheRestoreNeighborhoods(MRIS_SURFACE_CACHE *cache, MRIS *mris)
+{
+  MRIS_CACHE_LAYOUT layout;
+  if (!cacheMatches(cache, mris, &layout) || mris->max_nsize != 1) return (0);
+
+  int const nvertices = mris->nvertices;
+  int const *v2num = (int const *)(cache->base + layout.vint) + nvertices;
+  int const *v3num = v2num + nvertices;
+  int const *nbr = (int const *)(cache->base + layout.nbr);
+  float const *dist = (float const *)(cache->base + layout.dist);
+
+  long long offset = 0;
+  int vno;
+  for (vno = 0; vno < nvertices; vno++) {
+    mrisSetVertexNeighborhood(mris, vno, v2num[vno], v3num[vno], nbr + offset);
+    if (v3num[vno] > 0) {
+      float *d = mrisStealDistStore(mris, vno, v3num[vno]);
+      memcpy(d, dist + offset, v3num[vno] * sizeof(float));
+      mrisSetDist(mris, vno, d, v3num[vno]);
+    }
+    offset += v3num[vno];
+  }
+
+  // the state MRISsetNeighborhoodSizeAndDist(mris, 3) and MRISresetNeighborhoodSize(mris, 1) leave
+  mris->max_nsize = 3;
+  mris->dist_nsize = 3;
+  MRISresetNeighborhoodSize(mris, 1);
+
+  return (1);
+}
+
+int MRISsurfaceCacheWrite(MRIS_SURFACE_CACHE *cache, MRIS *mris)
+{
+  if (!cache || cache->base) return (NO_ERROR);
+  if (mris->nsize != 1 || mris->max_nsize != 3 || mris->dist_nsize < 3) return (NO_ERROR);
+
+  int const nvertices = mris->nvertices, nfaces = mris->nfaces;
+
+  MRIS_CACHE_HEADER hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  strcpy(hdr.magic, MRIS_CACHE_MAGIC);
+  hdr.version = MRIS_CACHE_VERSION;
+  hdr.flags = cache->flags;
+  hdr.key = cache->key;
+  hdr.nvertices = nvertices;
+  hdr.nfaces = nfaces;
+  hdr.status = mris->status;
+
+  int vno;
+  for (vno = 0; vno < nvertices; vno++) {
+    VERTEX_TOPOLOGY const *const vt = &mris->vertices_topology[vno];
+    VERTEX const *const v = &mris->vertices[vno];
+    if (v->ripflag || vt->nsizeMax != 3 || (vt->v3num > 0 && !v->dist)) return (NO_ERROR);
+    hdr.nnbrs += vt->v3num;
+  }
+
+  double *g = hdr.globals;
+  g[CACHE_XLO] = mris->xlo;
+  g[CACHE_XHI] = mris->xhi;
+  g[CACHE_YLO] = mris->ylo;
+  g[CACHE_YHI] = mris->yhi;
+  g[CACHE_ZLO] = mris->zlo;
+  g[CACHE_ZHI] = mris->zhi;
+  g[CACHE_XCTR] = mris->xctr;
+  g[CACHE_YCTR] = mris->yctr;
+  g[CACHE_ZCTR] = mris->zctr;
+  g[CACHE_TOTAL_AREA] = mris->total_area;
+  g[CACHE_AVG_VERTEX_AREA] = mris->avg_vertex_area;
+  g[CACHE_AVG_VERTEX_DIST] = mris->avg_vertex_dist;
+  g[CACHE_STD_VERTEX_DIST] = mris->std_vertex_dist;
+  g[CACHE_NEG_ORIG_AREA] = mris->neg_orig_area;
+  g[CACHE_NEG_AREA] = mris->neg_area;
+  g[CACHE_RADIUS] = mris->radius;
+
+  MRIS_CACHE_LAYOUT layout;
+  cacheLayout(&layout, nvertices, nfaces, hdr.nnbrs);
+  std::vector<char> buf(layout.total, 0);
+  memcpy(&buf[0], &hdr, sizeof(hdr));
+
+  float *vf = (float *)&buf[layout.vfloat];
+  char *vc = &buf[layout.vchar];
+  int *vi = (int *)&buf[layout.vint];
+  int *nbr = (int *)&buf[layout.nbr];
+  float *dist = (float *)&buf[layout.dist];
+
+  long long offset = 0;
+  for (vno = 0; vno < nvertices; vno++) {
+    VERTEX_TOPOLOGY const *const vt = &mris->vertices_topology[vno];
+    VERTEX const *const v = &mris->vertices[vno];
+    vf[vno] = v->area;
+    vf[nvertices + vno] = v->nx;
+    vf[2 * nvertices + vno] = v->ny;
+    vf[3 * nvertices + vno] = v->nz;
+    vf[4 * nvertices + vno] = v->origarea;
+    vc[vno] = v->neg;
+    vc[nvertices + vno] = v->border;
+    vi[vno] = vt->vnum;
+    vi[nvertices + vno] = vt->v2num;
+    vi[2 * nvertices + vno] = vt->v3num;
+    if (vt->v3num > 0) {
+      memcpy(nbr + offset, vt->v, vt->v3num * sizeof(int));
+      memcpy(dist + offset, v->dist, vt->v3num * sizeof(float));
+    }
+    offset += vt->v3num;
+  }
+
+  float *ff = (float *)&buf[layout.ffloat];
+  int fno;
+  for (fno = 0; fno < nfaces; fno++) {
+    FACE const *const f = &mris->faces[fno];
+    FaceNormCacheEntry const *const fNorm = getFaceNorm(mris, fno);
+    ff[fno] = f->area;
+    ff[nfaces + fno] = fNorm->nx;
+    ff[2 * nfaces + fno] = fNorm->ny;
+    ff[3 * nfaces + fno] = fNorm->nz;
+    for (int k = 0; k < ANGLES_PER_TRIANGLE; k++) ff[(4 + k) * nfaces + fno] = f->angle[k];
+  }
+
+  // several processes may be reading the same surface, so write to a
+  // private file and rename it into place
+  char tmpname[STRLEN + 32];
+  snprintf(tmpname, sizeof(tmpname), "%s.%d.tmp", cache->fname, (int)getpid());
+  FILE *fp = fopen(tmpname, "wb");
+  if (!fp) {
+    if (Gdiag & DIAG_SHOW) printf("WARNING: could not write surface cache %s\n", tmpname);
+    return (NO_ERROR);
+  }
+  size_t const written = fwrite(&buf[0], 1, layout.total, fp);
+  if (fclose(fp) != 0 || written != layout.total || rename(tmpname, cache->fname) != 0) {
+    if (Gdiag & DIAG_SHOW) printf("WARNING: could not write surface cache %s\n", cache->fname);
+    unlink(tmpname);
+  }
+
+  return (NO_ERROR);
+}
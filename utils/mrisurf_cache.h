@@ -0,0 +1,47 @@
+#pragma once
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include "mrisurf.h"
+
+// Optional sidecar cache of what MRISread derives from a surface file: the
+// metric properties (areas, vertex and face normals, angles, bounding box)
+// and the 3-hop neighbourhoods with their distances. It is enabled by setting
+// FS_SURF_CACHE, either to a directory (caches are named by the hash of the
+// surface file) or to anything else (the cache is <surface>.surfcache).
+//
+// The file is the native-endian, in-memory layout of the arrays, so it is
+// mapped rather than parsed. A cache whose hash, sizes or topology do not
+// match the surface being read is ignored and rewritten.
+//
+typedef struct MRIS_SURFACE_CACHE {
+  char               fname[STRLEN];  // the sidecar
+  unsigned long long key;            // FNV-1a hash of the surface file contents
+  int                flags;          // read options that change the derived values
+  char              *base;           // contents of a valid sidecar, NULL if there was none
+  size_t             len;
+  int                mapped;
+} MRIS_SURFACE_CACHE;
+
+// NULL when FS_SURF_CACHE is not set, the surface can not be read, or
+// FREESURFER_OLD_MRIScomputeMetricProperties asks for the old code path
+MRIS_SURFACE_CACHE *MRISsurfaceCacheOpen(const char *surf_fname, int dotkrRasConvert);
+void MRISsurfaceCacheFree(MRIS_SURFACE_CACHE **pcache);
+
+// Each returns 1 if the values were restored, 0 if they still have to be computed
+int MRISsurfaceCacheRestoreMetricProperties(MRIS_SURFACE_CACHE *cache, MRIS *mris);
+int MRISsurfaceCacheRestoreNeighborhoods(MRIS_SURFACE_CACHE *cache, MRIS *mris);
+
+// Saves the state MRISread leaves the surface in (nsize 1, neighbourhoods and
+// distances out to 3 hops). Does nothing if the cache was already valid.
+int MRISsurfaceCacheWrite(MRIS_SURFACE_CACHE *cache, MRIS *mris);
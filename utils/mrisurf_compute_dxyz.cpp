@@ -2963,8 +2963,8 @@ int mrisComputeCorrelationTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
 {
   double du, dv, up1, um1, vp1, vm1, delta, src, target, mag, max_mag, l_corr;
   VERTEX *v;
-  int vno, fno;
-  float x, y, z, e1x, e1y, e1z, e2x, e2y, e2z, ux, uy, uz, vx, vy, vz, std, coef, vsmooth = 1.0;
+  int vno, fno, i, n, nv;
+  float e1x, e1y, e1z, e2x, e2y, e2z, ux, uy, uz, vx, vy, vz, std, coef, vsmooth = 1.0;
   double d_dist = D_DIST * mris->avg_vertex_dist;
 
   l_corr = parms->l_corr;
@@ -2978,11 +2978,44 @@ int mrisComputeCorrelationTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
     MRISPwrite(parms->mrisp_template, "temp.hipl");
     MRISPwrite(parms->mrisp, "srf.hipl");
   }
-  for (vno = 0; vno < mris->nvertices; vno++) {
+
+  /*
+    Sample the template for all vertices at once: the vertex itself and the
+    four points along the tangent plane axes used for the derivatives, plus
+    the variance at the vertex.
+  */
+  std::vector<int> vnos;
+  for (vno = 0; vno < mris->nvertices; vno++)
+    if (!mris->vertices[vno].ripflag) vnos.push_back(vno);
+  nv = vnos.size();
+
+  std::vector<float> px(5 * nv), py(5 * nv), pz(5 * nv);
+  std::vector<double> vals(5 * nv), vars(nv);
+  for (i = 0; i < nv; i++) {
+    v = &mris->vertices[vnos[i]];
+    ux = v->e1x * d_dist;
+    uy = v->e1y * d_dist;
+    uz = v->e1z * d_dist;
+    vx = v->e2x * d_dist;
+    vy = v->e2y * d_dist;
+    vz = v->e2z * d_dist;
+    float const coords[5][3] = {{v->x, v->y, v->z},
+                                {v->x + ux, v->y + uy, v->z + uz},
+                                {v->x - ux, v->y - uy, v->z - uz},
+                                {v->x + vx, v->y + vy, v->z + vz},
+                                {v->x - vx, v->y - vy, v->z - vz}};
+    for (n = 0; n < 5; n++) {
+      px[n * nv + i] = coords[n][0];
+      py[n * nv + i] = coords[n][1];
+      pz[n * nv + i] = coords[n][2];
+    }
+  }
+  MRISPfunctionVals(parms->mrisp_template, mris->radius, 5 * nv, &px[0], &py[0], &pz[0], fno, &vals[0]);
+  MRISPfunctionVals(parms->mrisp_template, mris->radius, nv, &px[0], &py[0], &pz[0], fno + 1, &vars[0]);
+
+  for (i = 0; i < nv; i++) {
+    vno = vnos[i];
     v = &mris->vertices[vno];
-    if (v->ripflag) {
-      continue;
-    }
 
     e1x = v->e1x;
     e1y = v->e1y;
@@ -2990,16 +3023,9 @@ int mrisComputeCorrelationTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
     e2x = v->e2x;
     e2y = v->e2y;
     e2z = v->e2z;
-    x = v->x;
-    y = v->y;
-    z = v->z;
-#if 0
-    src = MRISPfunctionVal(parms->mrisp, mris, x, y, z, 0) ;
-#else
     src = v->curv;
-#endif
-    target = MRISPfunctionVal(parms->mrisp_template, mris->radius, x, y, z, parms->frame_no);
-    std    = MRISPfunctionVal(parms->mrisp_template, mris->radius, x, y, z, parms->frame_no + 1);
+    target = vals[i];
+    std    = vars[i];
     std = sqrt(std);
     if (FZERO(std)) {
       std = DEFAULT_STD /*FSMALL*/;
@@ -3016,34 +3042,13 @@ int mrisComputeCorrelationTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
     /* now compute gradient of template w.r.t. a change in vertex position */
 
     /*
-      sample the curvature functions along the tangent plane axes and
-      compute the derivates using them.
+      the curvature functions sampled along the tangent plane axes give
+      the derivatives of the target term
     */
-    ux = e1x * d_dist;
-    uy = e1y * d_dist;
-    uz = e1z * d_dist;
-    vx = e2x * d_dist;
-    vy = e2y * d_dist;
-    vz = e2z * d_dist;
-
-#if 0
-    /* compute src term */
-    up1 = MRISPfunctionVal(parms->mrisp, mris, x+ux, y+uy, z+uz, fno) ;
-    um1 = MRISPfunctionVal(parms->mrisp, mris, x-ux, y-uy, z-uz, fno) ;
-    vp1 = MRISPfunctionVal(parms->mrisp, mris, x+vx, y+vy, z+vz, fno) ;
-    vm1 = MRISPfunctionVal(parms->mrisp, mris, x-vx, y-vy, z-vz, fno) ;
-    du = (up1 - um1) / (2 * d_dist) ;
-    dv = (vp1 - vm1) / (2 * d_dist) ;
-    v->dx += coef * (du*e1x + dv*e2x) ;  /* in negative of grad. direction */
-    v->dy += coef * (du*e1y + dv*e2y) ;
-    v->dz += coef * (du*e1z + dv*e2z) ;
-#endif
-
-    /* compute target term */
-    up1 = MRISPfunctionVal(parms->mrisp_template, mris->radius, x + ux, y + uy, z + uz, fno);
-    um1 = MRISPfunctionVal(parms->mrisp_template, mris->radius, x - ux, y - uy, z - uz, fno);
-    vp1 = MRISPfunctionVal(parms->mrisp_template, mris->radius, x + vx, y + vy, z + vz, fno);
-    vm1 = MRISPfunctionVal(parms->mrisp_template, mris->radius, x - vx, y - vy, z - vz, fno);
+    up1 = vals[1 * nv + i];
+    um1 = vals[2 * nv + i];
+    vp1 = vals[3 * nv + i];
+    vm1 = vals[4 * nv + i];
     du = (up1 - um1) / (2 * d_dist);
     dv = (vp1 - vm1) / (2 * d_dist);
     v->dx -= coef * (du * e1x + dv * e2x);
@@ -18,6 +18,7 @@
  *
  */
 #include "mrisurf_io.h"
+#include "mrisurf_cache.h"
 #include "mrisp.h"
 
 #include "mrisurf_base.h"
@@ -325,10 +326,11 @@ int MRISwriteCurvature(MRI_SURFACE *mris, const char *sname, const char *curv_na
     fwriteInt(mris->nvertices, fp);
     fwriteInt(mris->nfaces, fp);
     fwriteInt(1, fp); /* 1 value per vertex */
+    std::vector<float> curv(mris->nvertices);
     for (int k = 0; k < mris->nvertices; k++) {
-      float curv = mris->vertices[k].curv;
-      fwriteFloat(curv, fp);
+      curv[k] = mris->vertices[k].curv;
     }
+    fwriteFloatArray(curv.data(), curv.size(), fp);
     fclose(fp);
   }
   return error;
@@ -1154,10 +1156,15 @@ int MRISreadPatchNoRemove(MRI_SURFACE *mris, const char *pname, bool dotkrRASCon
         mris->vertices[k].ripflag = TRUE;
       }
 
+      // the points are (int, float, float, float) records of 4 byte words,
+      // read and swapped in one go
+      std::vector<int> rec(4 * (size_t)MAX(npts, 0));
+      if (freadIntArray(rec.data(), rec.size(), fp) != rec.size())
+        ErrorPrintf(ERROR_BADFILE, "MRISreadPatchNoRemove(%s): fread failed", fname);
+
       // go through points
       for (j = 0; j < npts; j++) {
-        // read int
-        i = freadInt(fp);
+        i = rec[4 * (size_t)j];
         // if negative, flip it
         if (i < 0) {
           k = -i - 1;  // convert it to zero based number
@@ -1176,12 +1183,10 @@ int MRISreadPatchNoRemove(MRI_SURFACE *mris, const char *pname, bool dotkrRASCon
         }
         // rip flag for this vertex to be false
         mris->vertices[k].ripflag = FALSE;
-        // read 3 positions
-        // convert it to mm, i.e. change the vertex position
-        float x = freadFloat(fp);
-        float y = freadFloat(fp);
-        float z = freadFloat(fp);
-        MRISsetXYZ(mris,k,x,y,z);
+        // 3 positions
+        float xyz[3];
+        memcpy(xyz, &rec[4 * (size_t)j + 1], sizeof(xyz));
+        MRISsetXYZ(mris,k,xyz[0],xyz[1],xyz[2]);
         if (k == Gdiag_no && Gdiag & DIAG_SHOW)
           fprintf(stdout,
                   "vertex %d read @ (%2.2f, %2.2f, %2.2f)\n",
@@ -1287,21 +1292,23 @@ int MRISwritePatch(MRI_SURFACE *mris, const char *fname)
   // write num points
   fwriteInt(-1, fp);  // "version" #
   fwriteInt(npts, fp);
-  // go through all points
+  // go through all points, packing (int, float, float, float) records
+  std::vector<int> rec;
+  rec.reserve(4 * (size_t)npts);
   for (k = 0; k < mris->nvertices; k++)
     if (!mris->vertices[k].ripflag) {
       i = (mris->vertices[k].border) ? (-(k + 1)) : (k + 1);
-      fwriteInt(i, fp);
+      rec.push_back(i);
       x = mris->vertices[k].x;
       y = mris->vertices[k].y;
       z = mris->vertices[k].z;
-      fwriteFloat(x, fp);
-      fwriteFloat(y, fp);
-      fwriteFloat(z, fp);
-      /*
-        printf("k=%d, i=%d\n",k,i);
-      */
+      for (float f : {x, y, z}) {
+        int w;
+        memcpy(&w, &f, sizeof(w));
+        rec.push_back(w);
+      }
     }
+  fwriteIntArray(rec.data(), rec.size(), fp);
   fclose(fp);
   return (NO_ERROR);
 }
@@ -1435,11 +1442,14 @@ static int __mrisreadannot(const char *fannot, MRIS *mris, const COLOR_TABLE *ct
   if (nElem != nVertices)
     ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "# elements (%d) in %s and # vertices (%d) don't match", nElem, fannot, nVertices));
 
-  /* For each one, read in a vno and an int for the annotation value. Check the vno. */
+  /* The (vno, annotation) pairs, read in one go. Check each vno. */
+  std::vector<int> pairs(2 * (size_t)nElem);
+  if (freadIntArray(pairs.data(), pairs.size(), fp) != pairs.size())
+    ErrorPrintf(ERROR_BADFILE, "__mrisreadannot(%s): fread failed", fannot);
   for (int j = 0; j < nElem; j++)
   {
-    int vno = freadInt(fp);
-    int annot = freadInt(fp);
+    int vno = pairs[2 * (size_t)j];
+    int annot = pairs[2 * (size_t)j + 1];
     if (vno == Gdiag_no)
       DiagBreak();
 
@@ -1583,12 +1593,19 @@ int MRISreadAnnotationIntoArray(const char *fname, int in_array_size, int **out_
 
   /* First int is the number of elements. */
   num = freadInt(fp);
+  if (num < 0) {
+    fclose(fp);
+    free(array);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MRISreadAnnotationIntoArray(%s): bad number of elements %d", fname, num));
+  }
 
-  /* For each one, read in a vno and an int for the annotation
-     value. Check the vno. */
+  /* Then num (vno, annotation) pairs, read in one go. Check each vno. */
+  std::vector<int> pairs(2 * (size_t)num);
+  if (freadIntArray(pairs.data(), pairs.size(), fp) != pairs.size())
+    ErrorPrintf(ERROR_BADFILE, "MRISreadAnnotationIntoArray(%s): fread failed", fname);
   for (j = 0; j < num; j++) {
-    vno = freadInt(fp);
-    i = freadInt(fp);
+    vno = pairs[2 * (size_t)j];
+    i = pairs[2 * (size_t)j + 1];
     if (vno == Gdiag_no) {
       DiagBreak();
     }
@@ -1808,15 +1825,16 @@ static int __mriswriteannot(MRIS *mris, const char *outfannot)
     ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "could not write annot file %s", outfannot));
 
   fwriteInt(mris->nvertices, fp);
+  std::vector<int> pairs(2 * (size_t)mris->nvertices);
   for (int vno = 0; vno < mris->nvertices; vno++)
   {
     if (vno == Gdiag_no)
       DiagBreak();
 
-    int i = mris->vertices[vno].annotation;
-    fwriteInt(vno, fp);
-    i = fwriteInt(i, fp);
+    pairs[2 * (size_t)vno] = vno;
+    pairs[2 * (size_t)vno + 1] = mris->vertices[vno].annotation;
   }
+  fwriteIntArray(pairs.data(), pairs.size(), fp);
 
   if (mris->ct) /* also write annotation in */
   {
@@ -3505,10 +3523,17 @@ static int mrisReadGeoFilePositions(MRI_SURFACE *mris, const char *fname)
 
 /*-----------------------------------------------------
   ------------------------------------------------------*/
-static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier);
+static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier, MRIS_SURFACE_CACHE *cache);
 static MRIS* MRISreadOverAlloc_old(const char *fname, double nVFMultiplier);
 
+static MRIS* mrisReadOverAllocWkr(const char *fname, double nVFMultiplier, MRIS_SURFACE_CACHE *cache);
+
 MRIS* MRISreadOverAlloc(const char *fname, double nVFMultiplier)
+{
+  return mrisReadOverAllocWkr(fname, nVFMultiplier, NULL);
+}
+
+static MRIS* mrisReadOverAllocWkr(const char *fname, double nVFMultiplier, MRIS_SURFACE_CACHE *cache)
 {
   bool useOldBehaviour = false;
   if (useOldBehaviour) {
@@ -3524,10 +3549,10 @@ MRIS* MRISreadOverAlloc(const char *fname, double nVFMultiplier)
   return 
     useOldBehaviour 
     ? MRISreadOverAlloc_old(fname, nVFMultiplier)
-    : MRISreadOverAlloc_new(fname, nVFMultiplier);
+    : MRISreadOverAlloc_new(fname, nVFMultiplier, cache);
 }
 
-static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier)
+static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier, MRIS_SURFACE_CACHE *cache)
 {
   int const type = MRISfileNameType(fname);  /* using extension to get type */
   
@@ -3898,15 +3923,20 @@ static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier)
   
   mrisCheckVertexFaceTopology(mris);
 
-  mrisComputeSurfaceDimensions(mris);
-  mrisComputeVertexDistances(mris);
-  MRIScomputeNormals(mris);
+  if (MRISsurfaceCacheRestoreMetricProperties(cache, mris)) {
+    mrisReadTransform(mris, fname);
+  }
+  else {
+    mrisComputeSurfaceDimensions(mris);
+    mrisComputeVertexDistances(mris);
+    MRIScomputeNormals(mris);
 
-  mrisReadTransform(mris, fname);
+    mrisReadTransform(mris, fname);
 
-  mris->radius = MRISaverageRadius(mris);
+    mris->radius = MRISaverageRadius(mris);
 
-  MRIScomputeMetricProperties(mris);
+    MRIScomputeMetricProperties(mris);
+  }
 
   MRISstoreCurrentPositions(mris);
 
@@ -4403,8 +4433,14 @@ MRIS * MRISread(const char *fname, bool dotkrRasConvert)
       type != MRI_MGH_FILE)
     __MRISapplyFSGIIread(surf_to_read, fname, &type);
 
-  MRIS *mris = MRISreadOverAlloc(surf_to_read, 1.0);
-  if (mris == NULL) return (NULL);
+  // optional sidecar with the properties derived below, see mrisurf_cache.h
+  MRIS_SURFACE_CACHE *cache = MRISsurfaceCacheOpen(surf_to_read, dotkrRasConvert);
+
+  MRIS *mris = mrisReadOverAllocWkr(surf_to_read, 1.0, cache);
+  if (mris == NULL) {
+    MRISsurfaceCacheFree(&cache);
+    return (NULL);
+  }
 
   // save xyz coordinates space because mris->useRealRAS is changed after conversion
   mris->orig_xyzspace = mris->useRealRAS;
@@ -4417,14 +4453,19 @@ MRIS * MRISread(const char *fname, bool dotkrRasConvert)
     {
       printf("ERROR: Surface %s doesn't have valid volume geometry!\n", surf_to_read);
       MRISfree(&mris);
+      MRISsurfaceCacheFree(&cache);
       return NULL;
     }
 
     MRISscanner2Tkr(mris);
   }
 
-  MRISsetNeighborhoodSizeAndDist(mris, 3);  // find nbhds out to 3-nbrs
-  MRISresetNeighborhoodSize(mris, 1);       // reset current size to 1-nbrs
+  if (!MRISsurfaceCacheRestoreNeighborhoods(cache, mris)) {
+    MRISsetNeighborhoodSizeAndDist(mris, 3);  // find nbhds out to 3-nbrs
+    MRISresetNeighborhoodSize(mris, 1);       // reset current size to 1-nbrs
+    MRISsurfaceCacheWrite(cache, mris);
+  }
+  MRISsurfaceCacheFree(&cache);
   return (mris);
 }
 
@@ -5734,15 +5775,22 @@ int MRISwriteTriangularSurface(MRI_SURFACE *mris, const char *fname)
   fwriteInt(mris->nvertices, fp);
   fwriteInt(mris->nfaces, fp); /* # of triangles */
 
-  for (int k = 0; k < mris->nvertices; k++) {
-    fwriteFloat(mris->vertices[k].x, fp);
-    fwriteFloat(mris->vertices[k].y, fp);
-    fwriteFloat(mris->vertices[k].z, fp);
-  }
-  for (int k = 0; k < mris->nfaces; k++) {
-    for (int n = 0; n < VERTICES_PER_FACE; n++) {
-      fwriteInt(mris->faces[k].v[n], fp);
+  {
+    std::vector<float> xyz(3 * (size_t)mris->nvertices);
+    for (int k = 0; k < mris->nvertices; k++) {
+      xyz[3 * k + 0] = mris->vertices[k].x;
+      xyz[3 * k + 1] = mris->vertices[k].y;
+      xyz[3 * k + 2] = mris->vertices[k].z;
     }
+    fwriteFloatArray(xyz.data(), xyz.size(), fp);
+
+    std::vector<int> fv(VERTICES_PER_FACE * (size_t)mris->nfaces);
+    for (int k = 0; k < mris->nfaces; k++) {
+      for (int n = 0; n < VERTICES_PER_FACE; n++) {
+        fv[VERTICES_PER_FACE * k + n] = mris->faces[k].v[n];
+      }
+    }
+    fwriteIntArray(fv.data(), fv.size(), fp);
   }
   /* write whether vertex data was using
      the real RAS rather than conformed RAS */
@@ -5809,14 +5857,17 @@ static SMALL_SURFACE *mrisReadTriangleFileVertexPositionsOnly(const char *fname)
     free(mriss);
     ErrorReturn(NULL, (ERROR_NOMEMORY, "MRISreadVerticesOnly: could not allocate surface"));
   }
+  std::vector<float> xyz(3 * (size_t)nvertices);
+  if (freadFloatArray(xyz.data(), xyz.size(), fp) != xyz.size())
+    ErrorPrintf(ERROR_BADFILE, "mrisReadTriangleFileVertexPositionsOnly(%s): fread failed", fname);
   for (vno = 0; vno < nvertices; vno++) {
     v = &mriss->vertices[vno];
     if (vno == Gdiag_no) {
       DiagBreak();
     }
-    v->x = freadFloat(fp);
-    v->y = freadFloat(fp);
-    v->z = freadFloat(fp);
+    v->x = xyz[3 * vno + 0];
+    v->y = xyz[3 * vno + 1];
+    v->z = xyz[3 * vno + 2];
     if (fabs(v->x) > 10000 || !std::isfinite(v->x))
       ErrorExit(ERROR_BADFILE, "%s: vertex %d x coordinate %f!", Progname, vno, v->x);
     if (fabs(v->y) > 10000 || !std::isfinite(v->y))
@@ -5869,11 +5920,11 @@ static int mrisReadTriangleFilePositions(MRI_SURFACE *mris, const char *fname)
     // MRISsetXYZ will invalidate all of these,
     // so make sure they are recomputed before being used again!
 
+  std::vector<float> xyz(3 * (size_t)nvertices);
+  if (freadFloatArray(xyz.data(), xyz.size(), fp) != xyz.size())
+    ErrorPrintf(ERROR_BADFILE, "mrisReadTriangleFilePositions(%s): fread failed", fname);
   for (vno = 0; vno < nvertices; vno++) {
-    float x = freadFloat(fp);
-    float y = freadFloat(fp);
-    float z = freadFloat(fp);
-    MRISsetXYZ(mris, vno, x,y,z);
+    MRISsetXYZ(mris, vno, xyz[3 * vno + 0], xyz[3 * vno + 1], xyz[3 * vno + 2]);
   }
 
   fclose(fp);
@@ -5923,6 +5974,14 @@ static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double nVFMultiplier
   MRIS * mris = MRISoverAlloc(nVFMultiplier * nvertices, nVFMultiplier * nfaces, nvertices, nfaces);
   mris->type = MRIS_TRIANGULAR_SURFACE;
 
+  // the vertex and face blocks are each read in one go
+  std::vector<float> xyz(3 * (size_t)nvertices);
+  if (freadFloatArray(xyz.data(), xyz.size(), fp) != xyz.size())
+    ErrorPrintf(ERROR_BADFILE, "mrisReadTriangleFile(%s): fread of vertices failed", fname);
+  std::vector<int> fv(VERTICES_PER_FACE * (size_t)nfaces);
+  if (freadIntArray(fv.data(), fv.size(), fp) != fv.size())
+    ErrorPrintf(ERROR_BADFILE, "mrisReadTriangleFile(%s): fread of faces failed", fname);
+
   for (vno = 0; vno < nvertices; vno++) {
     if (vno % 100 == 0) exec_progress_callback(vno, nvertices, 0, 1);
     VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
@@ -5931,11 +5990,7 @@ static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double nVFMultiplier
       DiagBreak();
     }
 
-    float x = freadFloat(fp);
-    float y = freadFloat(fp);
-    float z = freadFloat(fp);
-    
-    MRISsetXYZ(mris,vno, x, y, z);
+    MRISsetXYZ(mris,vno, xyz[3 * vno + 0], xyz[3 * vno + 1], xyz[3 * vno + 2]);
 
     vt->num = 0; /* will figure it out */
     if (fabs(v->x) > 10000 || !std::isfinite(v->x))
@@ -5949,7 +6004,7 @@ static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double nVFMultiplier
   for (fno = 0; fno < mris->nfaces; fno++) {
     f = &mris->faces[fno];
     for (n = 0; n < VERTICES_PER_FACE; n++) {
-      f->v[n] = freadInt(fp);
+      f->v[n] = fv[VERTICES_PER_FACE * (size_t)fno + n];
       if (f->v[n] >= mris->nvertices || f->v[n] < 0)
         ErrorExit(ERROR_BADFILE, "f[%d]->v[%d] = %d - out of range!\n", fno, n, f->v[n]);
     }
@@ -6236,10 +6291,13 @@ int MRISreadNewCurvatureFile(MRI_SURFACE *mris, const char *sname)
         (ERROR_NOFILE, "MRISreadNewCurvature(%s): vals/vertex %d unsupported (must be 1) ", fname, vals_per_vertex));
   }
 
+  std::vector<float> vals(vnum);
+  if (freadFloatArray(vals.data(), vnum, fp) != (size_t)vnum)
+    ErrorPrintf(ERROR_BADFILE, "MRISreadNewCurvature(%s): fread failed", fname);
   curvmin = 10000.0f;
   curvmax = -10000.0f; /* for compiler warnings */
   for (k = 0; k < vnum; k++) {
-    curv = freadFloat(fp);
+    curv = vals[k];
     if (k == 0) {
       curvmin = curvmax = curv;
     }
@@ -6302,7 +6360,7 @@ float *MRISreadNewCurvatureVector(MRI_SURFACE *mris, const char *sname)
 
 int MRISreadNewCurvatureIntoArray(const char *sname, int in_array_size, float **out_array)
 {
-  int k, vnum, fnum;
+  int vnum, fnum;
   float *cvec;
   FILE *fp;
   int vals_per_vertex;
@@ -6348,9 +6406,8 @@ int MRISreadNewCurvatureIntoArray(const char *sname, int in_array_size, float **
   if (!cvec) ErrorExit(ERROR_NOMEMORY, "MRISreadNewCurvatureVector(%s): calloc failed", sname);
 
   /* Read in values. */
-  for (k = 0; k < vnum; k++) {
-    cvec[k] = freadFloat(fp);
-  }
+  if (freadFloatArray(cvec, vnum, fp) != (size_t)vnum)
+    ErrorPrintf(ERROR_BADFILE, "MRISreadNewCurvatureIntoArray(%s): fread failed", sname);
   fclose(fp);
 
   /* Return what we read. */
@@ -895,6 +895,29 @@ void mrisVertexReplacingNeighbors(MRIS * const mris, int const vno, int const vn
 }
 
 
+void mrisSetVertexNeighborhood(MRIS * const mris, int const vno, int const v2num, int const v3num, int const * const v)
+{
+  // Installs a 3-hop neighbourhood that was computed earlier by MRISfindNeighborsAtVertex
+  // (see mrisurf_cache.cpp). The caller has checked that v[0..vnum) are the current immediate
+  // neighbours, so only the outer rings are copied.
+  //
+  VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
+
+  cheapAssert(vt->vnum <= v2num && v2num <= v3num);
+
+  resizeVertexV(mris, vno, v3num, mrisVertexVSize(mris, vno));
+
+  int n;
+  for (n = vt->vnum; n < v3num; n++) vt->v[n] = v[n];
+
+  vt->v2num = v2num;
+  vt->v3num = v3num;
+  vt->nsizeMax = 3; vt->nsizeMaxClock = mris->nsizeMaxClock;
+
+  MRIS_setNsizeCur(mris, vno, vt->nsizeCur);
+}
+
+
 void mrisForgetNeighborhoods(MRIS * const mris) {
   int vno;
   for (vno = 0; vno < mris->nvertices; vno++) {
@@ -3091,6 +3091,7 @@ int L2Stest(const char *subject)
     return (1);
   }
   l2s->labels[0]->n_points = 0;  // reset label
+  LabelInvalidateVertexIndex(l2s->labels[0]);
 
   // Add a voxel near a surface vertex.
   // A little circular because tx,ty,tz are computed by L2S
@@ -3127,6 +3128,7 @@ int L2Stest(const char *subject)
     return (1);
   }
   l2s->labels[0]->n_points = 0;  // reset label
+  LabelInvalidateVertexIndex(l2s->labels[0]);
 
   // Add a voxel away from the surface
   c = 0;  // 0 0 0 should be guaranteed to not be near surf
@@ -3164,6 +3166,7 @@ int L2Stest(const char *subject)
     return (1);
   }
   l2s->labels[0]->n_points = 0;  // reset label
+  LabelInvalidateVertexIndex(l2s->labels[0]);
 
   // Import a label
   label = annotation2label(1, surf);  // banks of the stss
@@ -3188,6 +3191,7 @@ int L2Stest(const char *subject)
     return (1);
   }
   l2s->labels[0]->n_points = 0;  // reset label
+  LabelInvalidateVertexIndex(l2s->labels[0]);
 
   L2Sfree(&l2s);
 
@@ -62,6 +62,7 @@
 #include "romp_support.h"
 
 #include "bfileio.h"
+#include "fio.h"
 #include "corio.h"
 #include "diag.h"
 #include "label.h"
@@ -952,18 +953,40 @@ trg1 and src2 are from the same anatomy.
 \param int ReverseMapFlag - perform reverse mapping
 \param int DoJac - perform jacobian correction (conserves sum(SrcVals))
 \param int UseHash - use hash table (no reason not to, much faster).
+This is MRISbuildRegOperator() followed by MRISapplyRegOperator(); build
+the operator once to map several inputs through the same registration.
 */
 MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int ReverseMapFlag, int DoJac, int UseHash)
 {
-  MRI *TrgSurfVals = NULL;
+  /* check dimension consistency */
+  if (SrcSurfVals->width != SurfReg[0]->nvertices) {
+    printf("MRISapplyReg: Vals and Reg dimension mismatch\n");
+    printf("nVals = %d, nReg %d\n", SrcSurfVals->width, SurfReg[0]->nvertices);
+    return (NULL);
+  }
+
+  MRIS_REG_OPERATOR *op = MRISbuildRegOperator(SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash);
+  if (op == NULL) return (NULL);
+  MRI *TrgSurfVals = MRISapplyRegOperator(op, SrcSurfVals, NULL);
+  MRISfreeRegOperator(&op);
+  return (TrgSurfVals);
+}
+
+/*!
+\fn MRIS_REG_OPERATOR *MRISbuildRegOperator(MRI_SURFACE **SurfReg, int nsurfs,
+                  int ReverseMapFlag, int DoJac, int UseHash)
+\brief Does the geometric part of MRISapplyReg() (closest vertex searches in the
+forward and reverse loops, hit counts) and returns the resulting mapping as a
+sparse operator. Arguments as for MRISapplyReg().
+*/
+MRIS_REG_OPERATOR *MRISbuildRegOperator(MRI_SURFACE **SurfReg, int nsurfs, int ReverseMapFlag, int DoJac, int UseHash)
+{
   MRI_SURFACE *SrcSurfReg, *TrgSurfReg;
-  int svtx = 0, tvtx, tvtxN, svtxN = 0, f, n, nrevhits, nSrcLost;
-  int npairs, kS, kT, nhits;
-  // int nunmapped;
+  int svtx = 0, tvtx, tvtxN, svtxN = 0, n, nrevhits, nSrcLost;
+  int npairs, kS, kT;
   VERTEX *v;
   float dmin;
   MHT **Hash = NULL;
-  MRI *SrcHits, *TrgHits;
 
   npairs = nsurfs / 2;
   printf("MRISapplyReg(): nsurfs = %d, revmap=%d, jac=%d,  hash=%d\n", nsurfs, ReverseMapFlag, DoJac, UseHash);
@@ -973,11 +996,6 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
   TrgSurfReg = SurfReg[nsurfs - 1];
 
   /* check dimension consistency */
-  if (SrcSurfVals->width != SrcSurfReg->nvertices) {
-    printf("MRISapplyReg: Vals and Reg dimension mismatch\n");
-    printf("nVals = %d, nReg %d\n", SrcSurfVals->width, SrcSurfReg->nvertices);
-    return (NULL);
-  }
   for (n = 0; n < npairs - 1; n++) {
     kS = 2 * n + 1;
     kT = kS + 1;
@@ -988,20 +1006,10 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
     }
   }
 
-  /* allocate a "volume" to hold the output */
-  TrgSurfVals = MRIallocSequence(TrgSurfReg->nvertices, 1, 1, MRI_FLOAT, SrcSurfVals->nframes);
-  if (TrgSurfVals == NULL) return (NULL);
-  MRIcopyHeader(SrcSurfVals, TrgSurfVals);
-
-  /* number of source vertices mapped to each target vertex */
-  TrgHits = MRIallocSequence(TrgSurfReg->nvertices, 1, 1, MRI_FLOAT, 1);
-  if (TrgHits == NULL) return (NULL);
-  MRIcopyHeader(SrcSurfVals, TrgHits);
-
-  /* number of target vertices mapped to by each source vertex */
-  SrcHits = MRIallocSequence(SrcSurfReg->nvertices, 1, 1, MRI_FLOAT, 1);
-  if (SrcHits == NULL) return (NULL);
-  MRIcopyHeader(SrcSurfVals, SrcHits);
+  /* number of source vertices mapped to each target vertex, and
+     number of target vertices mapped to by each source vertex */
+  std::vector<int> TrgHits(TrgSurfReg->nvertices, 0);
+  std::vector<int> SrcHits(SrcSurfReg->nvertices, 0);
 
   if (UseHash) {
     printf("MRISapplyReg: building hash tables (res=16).\n");
@@ -1030,8 +1038,8 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
         tvtxN = svtx;
       }
       /* update the number of hits and distance */
-      MRIFseq_vox((SrcHits), svtx, 0, 0, 0)++;
-      MRIFseq_vox((TrgHits), tvtx, 0, 0, 0)++;
+      SrcHits[svtx]++;
+      TrgHits[tvtx]++;
     }
   }
 
@@ -1052,9 +1060,12 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
   }
 
   /* Go through the forwad loop (finding closest srcvtx to each trgvtx).
-  This maps each target vertex to a source vertex */
+  This maps each target vertex to a source vertex. With the jacobian
+  correction the value is divided by the number of times the source
+  vertex gets sampled. */
+  std::vector<int> FwdSrc(TrgSurfReg->nvertices, -1);
+  std::vector<int> FwdHits(TrgSurfReg->nvertices, 1);
   printf("MRISapplyReg: Forward Loop (%d)\n", TrgSurfReg->nvertices);
-  // nunmapped = 0;
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
     if(TrgSurfReg->vertices[tvtx].ripflag) continue;
     if (!UseHash) {
@@ -1120,18 +1131,14 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
       fprintf(stvpairfp,"%d %8.4f %8.4f %8.4f\n",tvtx,v->tx, v->ty, v->tz);
     }
 
+    FwdSrc[tvtx] = svtx;
     if (!DoJac) {
       /* update the number of hits */
-      MRIFseq_vox(SrcHits, svtx, 0, 0, 0)++;
-      MRIFseq_vox(TrgHits, tvtx, 0, 0, 0)++;
-      nhits = 1;
+      SrcHits[svtx]++;
+      TrgHits[tvtx]++;
     }
     else
-      nhits = MRIgetVoxVal(SrcHits, svtx, 0, 0, 0);
-
-    /* accumulate mapped values for each frame */
-    for (f = 0; f < SrcSurfVals->nframes; f++)
-      MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += (MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f) / nhits);
+      FwdHits[tvtx] = SrcHits[svtx];
   }
   if(stvpairfp) fclose(stvpairfp);
 
@@ -1139,11 +1146,12 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
   Go through the reverse loop (finding closest trgvtx to each srcvtx
   unmapped by the forward loop). This assures that each source vertex
   is represented in the map */
+  std::vector<int> RevSrc, RevTrg;
   if (ReverseMapFlag) {
     printf("MRISapplyReg: Reverse Loop (%d)\n", SrcSurfReg->nvertices);
     nrevhits = 0;
     for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
-      if (MRIFseq_vox((SrcHits), svtx, 0, 0, 0) != 0) continue;
+      if (SrcHits[svtx] != 0) continue;
       nrevhits++;
 
       // Compute the target vertex that corresponds to this source vertex
@@ -1163,43 +1171,253 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
       }
 
       /* update the number of hits */
-      MRIFseq_vox((SrcHits), svtx, 0, 0, 0)++;
-      MRIFseq_vox((TrgHits), tvtx, 0, 0, 0)++;
-      /* accumulate mapped values for each frame */
-      for (f = 0; f < SrcSurfVals->nframes; f++)
-        MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f);
+      SrcHits[svtx]++;
+      TrgHits[tvtx]++;
+      RevSrc.push_back(svtx);
+      RevTrg.push_back(tvtx);
     }
     printf("  Reverse Loop had %d hits\n", nrevhits);
   }
 
   /*---------------------------------------------------------------
-  Finally, divide the value at each target vertex by the number
-  of source vertices mapping into it */
+  Assemble the rows: the forward entry, then the reverse entries in
+  source vertex order, which is the order MRISapplyReg() used to add
+  them in. Without the jacobian correction each row is then divided
+  by the number of source vertices mapping into it */
+  MRIS_REG_OPERATOR *op = new MRIS_REG_OPERATOR;
+  op->nsrc = SrcSurfReg->nvertices;
+  op->ntrg = TrgSurfReg->nvertices;
+  op->ReverseMapFlag = ReverseMapFlag;
+  op->DoJac = DoJac;
+  op->reghash = MRISregOperatorHash(SurfReg, nsurfs);
+  op->rowptr.assign(op->ntrg + 1, 0);
+  for (tvtx = 0; tvtx < op->ntrg; tvtx++)
+    if (FwdSrc[tvtx] >= 0) op->rowptr[tvtx + 1]++;
+  for (size_t k = 0; k < RevTrg.size(); k++) op->rowptr[RevTrg[k] + 1]++;
+  for (tvtx = 0; tvtx < op->ntrg; tvtx++) op->rowptr[tvtx + 1] += op->rowptr[tvtx];
+  op->col.resize(op->rowptr[op->ntrg]);
+  op->den.resize(op->rowptr[op->ntrg]);
+  std::vector<int> next(op->rowptr.begin(), op->rowptr.end() - 1);
+  for (tvtx = 0; tvtx < op->ntrg; tvtx++) {
+    if (FwdSrc[tvtx] < 0) continue;
+    op->col[next[tvtx]] = FwdSrc[tvtx];
+    op->den[next[tvtx]++] = FwdHits[tvtx];
+  }
+  for (size_t k = 0; k < RevTrg.size(); k++) {
+    op->col[next[RevTrg[k]]] = RevSrc[k];
+    op->den[next[RevTrg[k]]++] = 1;
+  }
+  op->rowden.assign(op->ntrg, 1);
   if (!DoJac) {
     printf("MRISapplyReg: Dividing by number of hits (%d)\n", TrgSurfReg->nvertices);
-    for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-      n = MRIFseq_vox((TrgHits), tvtx, 0, 0, 0);
-      if (n > 1) {
-        for (f = 0; f < SrcSurfVals->nframes; f++) MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) /= n;
-      }
-    }
+    for (tvtx = 0; tvtx < op->ntrg; tvtx++)
+      if (TrgHits[tvtx] > 1) op->rowden[tvtx] = TrgHits[tvtx];
   }
 
   /* Count lost sources */
   nSrcLost = 0;
   for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
-    n = MRIFseq_vox((SrcHits), svtx, 0, 0, 0);
-    if (n == 0) nSrcLost++;
+    if (SrcHits[svtx] == 0) nSrcLost++;
   }
   printf("MRISapplyReg: nSrcLost = %d\n", nSrcLost);
 
-  MRIfree(&SrcHits);
-  MRIfree(&TrgHits);
-  if (UseHash)
+  if (UseHash) {
     for (n = 0; n < nsurfs; n++) MHTfree(&Hash[n]);
+    free(Hash);
+  }
+  return (op);
+}
+
+/*!
+\fn MRI *MRISapplyRegOperator(const MRIS_REG_OPERATOR *op, MRI *SrcSurfVals, MRI *TrgSurfVals)
+\brief Maps every frame of SrcSurfVals to the target surface (the same values
+MRISapplyReg() would give). TrgSurfVals is allocated if NULL.
+*/
+MRI *MRISapplyRegOperator(const MRIS_REG_OPERATOR *op, MRI *SrcSurfVals, MRI *TrgSurfVals)
+{
+  if (SrcSurfVals->width != op->nsrc) {
+    printf("MRISapplyRegOperator: Vals and operator dimension mismatch\n");
+    printf("nVals = %d, nSrc %d\n", SrcSurfVals->width, op->nsrc);
+    return (NULL);
+  }
+  if (TrgSurfVals == NULL) {
+    TrgSurfVals = MRIallocSequence(op->ntrg, 1, 1, MRI_FLOAT, SrcSurfVals->nframes);
+    if (TrgSurfVals == NULL) return (NULL);
+    MRIcopyHeader(SrcSurfVals, TrgSurfVals);
+  }
+  if (TrgSurfVals->width != op->ntrg || TrgSurfVals->type != MRI_FLOAT ||
+      TrgSurfVals->nframes != SrcSurfVals->nframes) {
+    printf("MRISapplyRegOperator: target must be float with %d vertices and %d frames\n", op->ntrg,
+           SrcSurfVals->nframes);
+    return (NULL);
+  }
+
+  // the sums are kept in float and ordered as in MRISapplyReg() so that
+  // the results are the same to the bit
+  for (int f = 0; f < SrcSurfVals->nframes; f++) {
+    int tvtx;
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+    for (tvtx = 0; tvtx < op->ntrg; tvtx++) {
+      ROMP_PFLB_begin
+      float val = 0;
+      for (int k = op->rowptr[tvtx]; k < op->rowptr[tvtx + 1]; k++) {
+        const float src = (SrcSurfVals->type == MRI_FLOAT) ? MRIFseq_vox(SrcSurfVals, op->col[k], 0, 0, f)
+                                                           : MRIgetVoxVal(SrcSurfVals, op->col[k], 0, 0, f);
+        val += src / op->den[k];
+      }
+      if (op->rowden[tvtx] != 1) val /= op->rowden[tvtx];
+      MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) = val;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
   return (TrgSurfVals);
 }
 
+void MRISfreeRegOperator(MRIS_REG_OPERATOR **pop)
+{
+  delete *pop;
+  *pop = NULL;
+}
+
+// "SRO2"; files written before the registration hash was added ("SROP")
+// are not read, so they get rebuilt
+#define MRIS_REG_OPERATOR_MAGIC 0x53524f32
+
+/*!
+\fn unsigned long MRISregOperatorHash(MRI_SURFACE **SurfReg, int nsurfs)
+\brief Hash of everything in SurfReg that MRISbuildRegOperator() depends on:
+the vertex coordinates and ripflags of every surface in the chain. A saved
+operator is only reused if this matches, so a changed registration with the
+same number of vertices is not mapped through a stale operator.
+*/
+unsigned long MRISregOperatorHash(MRI_SURFACE **SurfReg, int nsurfs)
+{
+  FnvHash hash;
+  hash.add(&nsurfs);
+  for (int n = 0; n < nsurfs; n++) {
+    MRI_SURFACE *surf = SurfReg[n];
+    hash.add(&surf->nvertices);
+    for (int vno = 0; vno < surf->nvertices; vno++) {
+      VERTEX *v = &surf->vertices[vno];
+      hash.add(&v->x);
+      hash.add(&v->y);
+      hash.add(&v->z);
+      hash.add(&v->ripflag);
+    }
+  }
+  return (hash.value);
+}
+
+/*!
+\fn int MRISwriteRegOperator(const MRIS_REG_OPERATOR *op, const char *fname)
+\brief Saves the operator (big-endian: magic, nsrc, ntrg, ReverseMapFlag, DoJac,
+nnz, the registration hash as two ints, then the rowptr, col, den and rowden
+arrays) so that it can be reused for the same registration. Returns 0 on success.
+*/
+int MRISwriteRegOperator(const MRIS_REG_OPERATOR *op, const char *fname)
+{
+  FILE *fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    printf("ERROR: MRISwriteRegOperator(): could not open %s\n", fname);
+    return (1);
+  }
+  const size_t nnz = op->col.size();
+  fwriteInt(MRIS_REG_OPERATOR_MAGIC, fp);
+  fwriteInt(op->nsrc, fp);
+  fwriteInt(op->ntrg, fp);
+  fwriteInt(op->ReverseMapFlag, fp);
+  fwriteInt(op->DoJac, fp);
+  fwriteInt((int)nnz, fp);
+  fwriteInt((int)(op->reghash >> 32), fp);
+  fwriteInt((int)(op->reghash & 0xffffffff), fp);
+  size_t n = fwriteIntArray(op->rowptr.data(), op->rowptr.size(), fp);
+  n += fwriteIntArray(op->col.data(), nnz, fp);
+  n += fwriteFloatArray(op->den.data(), nnz, fp);
+  n += fwriteFloatArray(op->rowden.data(), op->rowden.size(), fp);
+  fclose(fp);
+  if (n != 2 * nnz + 2 * (size_t)op->ntrg + 1) {
+    printf("ERROR: MRISwriteRegOperator(): could not write %s\n", fname);
+    return (1);
+  }
+  return (0);
+}
+
+/*!
+\fn MRIS_REG_OPERATOR *MRISreadRegOperator(const char *fname)
+\brief Reads an operator saved by MRISwriteRegOperator(). Returns NULL if the
+file cannot be read or is not an operator.
+*/
+MRIS_REG_OPERATOR *MRISreadRegOperator(const char *fname)
+{
+  FILE *fp = fopen(fname, "rb");
+  if (fp == NULL) return (NULL);
+  int hdr[8];
+  if (freadIntArray(hdr, 8, fp) != 8 || hdr[0] != MRIS_REG_OPERATOR_MAGIC || hdr[1] < 0 || hdr[2] < 0 || hdr[5] < 0) {
+    printf("ERROR: MRISreadRegOperator(): %s is not a surface registration operator\n", fname);
+    fclose(fp);
+    return (NULL);
+  }
+  MRIS_REG_OPERATOR *op = new MRIS_REG_OPERATOR;
+  op->nsrc = hdr[1];
+  op->ntrg = hdr[2];
+  op->ReverseMapFlag = hdr[3];
+  op->DoJac = hdr[4];
+  op->reghash = ((unsigned long)(unsigned int)hdr[6] << 32) | (unsigned int)hdr[7];
+  const size_t nnz = hdr[5];
+  op->rowptr.resize(op->ntrg + 1);
+  op->col.resize(nnz);
+  op->den.resize(nnz);
+  op->rowden.resize(op->ntrg);
+  size_t n = freadIntArray(op->rowptr.data(), op->rowptr.size(), fp);
+  n += freadIntArray(op->col.data(), nnz, fp);
+  n += freadFloatArray(op->den.data(), nnz, fp);
+  n += freadFloatArray(op->rowden.data(), op->rowden.size(), fp);
+  fclose(fp);
+  bool ok = (n == 2 * nnz + 2 * (size_t)op->ntrg + 1) && op->rowptr[0] == 0 && op->rowptr[op->ntrg] == (int)nnz;
+  for (int t = 0; ok && t < op->ntrg; t++)
+    if (op->rowptr[t + 1] < op->rowptr[t]) ok = false;
+  for (size_t k = 0; ok && k < nnz; k++)
+    if (op->col[k] < 0 || op->col[k] >= op->nsrc) ok = false;
+  if (!ok) {
+    printf("ERROR: MRISreadRegOperator(): %s is truncated or corrupt\n", fname);
+    delete op;
+    return (NULL);
+  }
+  return (op);
+}
+
+/*!
+\fn MRIS_REG_OPERATOR *MRISreadOrBuildRegOperator(const char *fname, MRI_SURFACE **SurfReg,
+                  int nsurfs, int ReverseMapFlag, int DoJac, int UseHash)
+\brief Returns the operator saved in fname if it was built from the same
+registration surfaces (see MRISregOperatorHash()) with the same options;
+otherwise builds it and saves it to fname.
+*/
+MRIS_REG_OPERATOR *MRISreadOrBuildRegOperator(
+    const char *fname, MRI_SURFACE **SurfReg, int nsurfs, int ReverseMapFlag, int DoJac, int UseHash)
+{
+  MRIS_REG_OPERATOR *op = NULL;
+  if (fio_FileExistsReadable(fname)) {
+    op = MRISreadRegOperator(fname);
+    if (op && op->nsrc == SurfReg[0]->nvertices && op->ntrg == SurfReg[nsurfs - 1]->nvertices &&
+        op->ReverseMapFlag == ReverseMapFlag && op->DoJac == DoJac &&
+        op->reghash == MRISregOperatorHash(SurfReg, nsurfs)) {
+      printf("MRISapplyReg: using operator %s (%d entries)\n", fname, (int)op->col.size());
+      return (op);
+    }
+    printf("MRISapplyReg: %s does not match this registration or these options, rebuilding\n", fname);
+    if (op) MRISfreeRegOperator(&op);
+  }
+  op = MRISbuildRegOperator(SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash);
+  if (op == NULL) return (NULL);
+  if (MRISwriteRegOperator(op, fname) == 0) printf("MRISapplyReg: saved operator to %s\n", fname);
+  return (op);
+}
+
 /*----------------------------------------------------------------
   MRI *surf2surf_nnfr() - NOTE: use MRISapplyReg instead!
 
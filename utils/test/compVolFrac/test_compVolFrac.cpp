@@ -0,0 +1,141 @@
+//
+// unit test for the partial volume fractions of a surface - located in utils/mris_compVolFrac.cpp
+//
+// The exact fractions of an ellipsoid mesh are compared with a reference
+// that intersects vertical lines with the (convex) mesh: each voxel gets the
+// length of the lines inside it, averaged over 16x16 lines. The fractions
+// must add up to the volume of the mesh, and must not depend on the number
+// of threads.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "mrisurf.h"
+#include "icosahedron.h"
+#include "mris_compVolFrac.h"
+#include "romp_support.h"
+
+const char *Progname = "test_compVolFrac";
+
+#define NVOX 32
+#define NSUB 16
+
+int main(int argc, char *argv[])
+{
+  int errors = 0, vno, fno, i, j, k, a, b, n;
+
+  // an ellipsoid that does not line up with the voxel grid
+  MRIS *mris = ic2562_make_surface(0, 0);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    float r = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    MRISsetXYZ(mris, vno, 9.3 * v->x / r + 0.31, 7.1 * v->y / r - 0.17, 5.7 * v->z / r + 0.43);
+  }
+  MRIScomputeMetricProperties(mris);
+
+  MRI *mri = MRIalloc(NVOX, NVOX, NVOX, MRI_UCHAR);
+
+  // the mesh in voxel coordinates, where voxel (i,j,k) is the unit cube around (i,j,k)
+  MATRIX *m = GetSurfaceRASToVoxelMatrix(mri);
+  std::vector<double> vx(3 * mris->nvertices);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    for (n = 0; n < 3; n++)
+      vx[3 * vno + n] = *MATRIX_RELT(m, n + 1, 1) * v->x + *MATRIX_RELT(m, n + 1, 2) * v->y +
+                        *MATRIX_RELT(m, n + 1, 3) * v->z + *MATRIX_RELT(m, n + 1, 4);
+  }
+  MatrixFree(&m);
+
+  double meshvol = 0;
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    double const *p0 = &vx[3 * mris->faces[fno].v[0]];
+    double const *p1 = &vx[3 * mris->faces[fno].v[1]];
+    double const *p2 = &vx[3 * mris->faces[fno].v[2]];
+    meshvol += (p0[0] * (p1[1] * p2[2] - p1[2] * p2[1]) + p0[1] * (p1[2] * p2[0] - p1[0] * p2[2]) +
+                p0[2] * (p1[0] * p2[1] - p1[1] * p2[0])) / 6.0;
+  }
+  meshvol = fabs(meshvol);
+
+  // the reference: the mesh is convex, so each vertical line enters and leaves it once
+  std::vector<double> ref(NVOX * NVOX * NVOX, 0.0);
+  for (i = 0; i < NVOX; i++)
+    for (j = 0; j < NVOX; j++)
+      for (a = 0; a < NSUB; a++)
+        for (b = 0; b < NSUB; b++) {
+          double x = i - 0.5 + (a + 0.5) / NSUB, y = j - 0.5 + (b + 0.5) / NSUB;
+          double zlo = 1e10, zhi = -1e10;
+          for (fno = 0; fno < mris->nfaces; fno++) {
+            double const *p0 = &vx[3 * mris->faces[fno].v[0]];
+            double const *p1 = &vx[3 * mris->faces[fno].v[1]];
+            double const *p2 = &vx[3 * mris->faces[fno].v[2]];
+            if (x < MIN(p0[0], MIN(p1[0], p2[0])) || x > MAX(p0[0], MAX(p1[0], p2[0])) ||
+                y < MIN(p0[1], MIN(p1[1], p2[1])) || y > MAX(p0[1], MAX(p1[1], p2[1])))
+              continue;
+            // barycentric coordinates of (x,y) in the projected triangle
+            double d = (p1[0] - p0[0]) * (p2[1] - p0[1]) - (p2[0] - p0[0]) * (p1[1] - p0[1]);
+            if (d == 0) continue;
+            double l1 = ((x - p0[0]) * (p2[1] - p0[1]) - (p2[0] - p0[0]) * (y - p0[1])) / d;
+            double l2 = ((p1[0] - p0[0]) * (y - p0[1]) - (x - p0[0]) * (p1[1] - p0[1])) / d;
+            if (l1 < 0 || l2 < 0 || l1 + l2 > 1) continue;
+            double z = p0[2] + l1 * (p1[2] - p0[2]) + l2 * (p2[2] - p0[2]);
+            zlo = MIN(zlo, z);
+            zhi = MAX(zhi, z);
+          }
+          if (zlo >= zhi) continue;
+          for (k = 0; k < NVOX; k++) {
+            double len = MIN(zhi, k + 0.5) - MAX(zlo, k - 0.5);
+            if (len > 0) ref[(k * NVOX + j) * NVOX + i] += len / (NSUB * NSUB);
+          }
+        }
+
+  MRI *frac = MRIcomputeVolumeFractionFromSurface(mris, -1, mri, NULL);
+  double sum = 0, maxerr = 0;
+  for (k = 0; k < NVOX; k++)
+    for (j = 0; j < NVOX; j++)
+      for (i = 0; i < NVOX; i++) {
+        double f = MRIgetVoxVal(frac, i, j, k, 0);
+        sum += f;
+        maxerr = MAX(maxerr, fabs(f - ref[(k * NVOX + j) * NVOX + i]));
+      }
+  printf("mesh volume %g, sum of fractions %g, largest difference from the reference %g\n", meshvol, sum, maxerr);
+  if (fabs(sum - meshvol) > 1e-6 * meshvol) {
+    printf("fractions do not add up to the mesh volume\n");
+    errors++;
+  }
+  if (maxerr > 0.02) {  // the reference samples each voxel with 16x16 lines
+    printf("fractions differ from the reference\n");
+    errors++;
+  }
+
+#ifdef HAVE_OPENMP
+  // one x slab per thread, so the thread count must not matter
+  omp_set_num_threads(1);
+  MRI *frac1 = MRIcomputeVolumeFractionFromSurface(mris, -1, mri, NULL);
+  omp_set_num_threads(4);
+  MRI *frac4 = MRIcomputeVolumeFractionFromSurface(mris, -1, mri, NULL);
+  for (k = 0; k < NVOX; k++)
+    for (j = 0; j < NVOX; j++)
+      for (i = 0; i < NVOX; i++)
+        if (MRIgetVoxVal(frac1, i, j, k, 0) != MRIgetVoxVal(frac4, i, j, k, 0)) {
+          printf("voxel %d %d %d differs between 1 and 4 threads\n", i, j, k);
+          errors++;
+          k = j = i = NVOX;
+        }
+  MRIfree(&frac1);
+  MRIfree(&frac4);
+#endif
+
+  MRIfree(&frac);
+  MRIfree(&mri);
+  MRISfree(&mris);
+
+  if (errors) {
+    printf("FAILED\n");
+    exit(1);
+  }
+  printf("PASSED\n");
+  exit(0);
+}
@@ -0,0 +1,150 @@
+//
+// unit test for MRIexactDistanceTransform - located in utils/mri_edt.cpp
+//
+// On a small volume with anisotropic voxels every mode must give the
+// brute-force distance from each voxel centre to the nearest voxel on the
+// other side of the label boundary, less half a voxel, clipped at
+// max_dist. MRIdistanceTransform must give the same values when
+// FS_DTRANS_EXACT selects the exact transform.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "mri.h"
+#include "mri_edt.h"
+
+const char *Progname = "test_exactDistanceTransform";
+
+#define WIDTH 13
+#define HEIGHT 11
+#define DEPTH 9
+#define LABEL 5
+
+static int errors = 0;
+
+// two blobs and a stray voxel with another label
+static MRI *makeLabels(void)
+{
+  MRI *mri = MRIalloc(WIDTH, HEIGHT, DEPTH, MRI_UCHAR);
+  mri->xsize = 0.8;
+  mri->ysize = 1.1;
+  mri->zsize = 1.7;
+  for (int z = 0; z < DEPTH; z++)
+    for (int y = 0; y < HEIGHT; y++)
+      for (int x = 0; x < WIDTH; x++) {
+        double dx = (x - 4) * 0.8, dy = (y - 5) * 1.1, dz = (z - 4) * 1.7;
+        if (dx * dx + dy * dy + dz * dz < 10) MRIsetVoxVal(mri, x, y, z, 0, LABEL);
+        if (x >= 10 && x <= 11 && y >= 2 && y <= 3 && z == 6) MRIsetVoxVal(mri, x, y, z, 0, LABEL);
+      }
+  MRIsetVoxVal(mri, 12, 10, 0, 0, LABEL + 1);
+  return (mri);
+}
+
+// brute-force value of the transform at (x, y, z) in units of spacing[]
+static double bruteForce(MRI *mri, int x, int y, int z, int mode, double max_dist, const double spacing[3],
+                         double half)
+{
+  int inside = (nint(MRIgetVoxVal(mri, x, y, z, 0)) == LABEL);
+  if (inside && mode == DTRANS_MODE_OUTSIDE) return 0;
+  if (!inside && mode == DTRANS_MODE_INSIDE) return 0;
+
+  double best = HUGE_VAL;
+  for (int k = 0; k < DEPTH; k++)
+    for (int j = 0; j < HEIGHT; j++)
+      for (int i = 0; i < WIDTH; i++) {
+        if ((nint(MRIgetVoxVal(mri, i, j, k, 0)) == LABEL) == inside) continue;
+        double dx = (i - x) * spacing[0], dy = (j - y) * spacing[1], dz = (k - z) * spacing[2];
+        best = MIN(best, dx * dx + dy * dy + dz * dz);
+      }
+  double val = (best == HUGE_VAL) ? max_dist : MIN(sqrt(best) - half, max_dist);
+  if (inside && mode != DTRANS_MODE_UNSIGNED) val = -val;
+  return (val);
+}
+
+static void check(MRI *mri, MRI *dist, int mode, double max_dist, int in_mm, const char *what)
+{
+  double spacing[3], half;
+  if (in_mm) {
+    spacing[0] = mri->xsize;
+    spacing[1] = mri->ysize;
+    spacing[2] = mri->zsize;
+    half = 0.5 * mri->xsize;
+  }
+  else {
+    spacing[0] = 1;
+    spacing[1] = mri->ysize / mri->xsize;
+    spacing[2] = mri->zsize / mri->xsize;
+    half = 0.5;
+  }
+
+  int nbad = 0, nclipped = 0;
+  double maxerr = 0;
+  for (int z = 0; z < DEPTH; z++)
+    for (int y = 0; y < HEIGHT; y++)
+      for (int x = 0; x < WIDTH; x++) {
+        double expected = bruteForce(mri, x, y, z, mode, max_dist, spacing, half);
+        double err = fabs(MRIgetVoxVal(dist, x, y, z, 0) - expected);
+        if (fabs(expected) == max_dist) nclipped++;
+        maxerr = MAX(maxerr, err);
+        if (err > 1e-4) nbad++;
+      }
+  if (nbad) {
+    printf("%s: %d voxels differ from brute force, max error %g\n", what, nbad, maxerr);
+    errors++;
+  }
+  if (max_dist < 5 && !nclipped) {
+    printf("%s: no voxel reached max_dist %g\n", what, max_dist);
+    errors++;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const int modes[4] = {DTRANS_MODE_SIGNED, DTRANS_MODE_UNSIGNED, DTRANS_MODE_OUTSIDE, DTRANS_MODE_INSIDE};
+  const char *names[4] = {"signed", "unsigned", "outside", "inside"};
+  char what[STRLEN];
+
+  setenv("FS_DTRANS_EXACT", "1", 1);
+  MRI *mri = makeLabels();
+
+  for (int m = 0; m < 4; m++) {
+    for (int in_mm = 0; in_mm <= 1; in_mm++) {
+      // no clipping (max_dist defaults to twice the largest dimension) and clipping
+      MRI *dist = MRIexactDistanceTransform(mri, NULL, LABEL, 0, modes[m], in_mm);
+      sprintf(what, "%s, %s", names[m], in_mm ? "mm" : "voxels");
+      check(mri, dist, modes[m], 2 * MAX(MAX(WIDTH, HEIGHT), DEPTH) * (in_mm ? mri->xsize : 1), in_mm, what);
+      MRIexactDistanceTransform(mri, dist, LABEL, 1.5, modes[m], in_mm);
+      sprintf(what, "%s, %s, max_dist 1.5", names[m], in_mm ? "mm" : "voxels");
+      check(mri, dist, modes[m], 1.5, in_mm, what);
+      MRIfree(&dist);
+    }
+  }
+
+  // a label that is not in the volume is max_dist away everywhere
+  MRI *dist = MRIexactDistanceTransform(mri, NULL, LABEL + 2, 3, DTRANS_MODE_SIGNED, 1);
+  for (int z = 0; z < DEPTH; z++)
+    for (int y = 0; y < HEIGHT; y++)
+      for (int x = 0; x < WIDTH; x++)
+        if (MRIgetVoxVal(dist, x, y, z, 0) != 3) {
+          printf("missing label: (%d, %d, %d) is %g, not max_dist\n", x, y, z, MRIgetVoxVal(dist, x, y, z, 0));
+          errors++;
+          x = WIDTH, y = HEIGHT, z = DEPTH;
+        }
+  MRIfree(&dist);
+
+  // MRIdistanceTransform takes max_dist in voxels and returns mm
+  dist = MRIdistanceTransform(mri, NULL, LABEL, 2, DTRANS_MODE_SIGNED, NULL);
+  check(mri, dist, DTRANS_MODE_SIGNED, 2 * mri->xsize, 1, "MRIdistanceTransform");
+  MRIfree(&dist);
+
+  MRIfree(&mri);
+
+  if (errors) {
+    printf("FAILED\n");
+    exit(1);
+  }
+  printf("PASSED\n");
+  exit(0);
+}
@@ -0,0 +1,177 @@
+//
+// unit test for MRISfillInteriorParity - located in utils/mriflood.cpp
+//
+// A subdivided octahedron with every vertex on a voxel row is the worst
+// case for ray parity: the rows go through vertices and along the
+// projections of edges. Each voxel must be filled exactly when its centre
+// is inside, as given by |x|+|y|+|z| < R. A sphere that is not aligned
+// with the grid is checked against its face planes. Neither result may
+// depend on the number of threads.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <map>
+#include <vector>
+
+#include "mrisurf.h"
+#include "icosahedron.h"
+#include "romp_support.h"
+
+const char *Progname = "test_fillInteriorParity";
+
+#define NVOX 32
+
+// moves vertices given in voxel coordinates of mri to surface RAS
+static void voxelToSurfaceRAS(MRIS *mris, MRI *mri, const std::vector<double> &vox)
+{
+  MATRIX *m = surfaceRASFromVoxel_(mri);
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    double const *p = &vox[3 * vno];
+    double xyz[3];
+    for (int n = 0; n < 3; n++)
+      xyz[n] = *MATRIX_RELT(m, n + 1, 1) * p[0] + *MATRIX_RELT(m, n + 1, 2) * p[1] +
+               *MATRIX_RELT(m, n + 1, 3) * p[2] + *MATRIX_RELT(m, n + 1, 4);
+    MRISsetXYZ(mris, vno, xyz[0], xyz[1], xyz[2]);
+  }
+  MatrixFree(&m);
+}
+
+// octahedron |x|+|y|+|z| = n around c, each face cut into n*n triangles
+static MRIS *makeOctahedron(int n, const double *c, std::vector<double> &vox)
+{
+  std::map<std::vector<int>, int> index;
+  std::vector<float> xyz;
+  std::vector<int> faces;
+  vox.clear();
+  for (int oct = 0; oct < 8; oct++) {
+    int s[3] = {oct & 1 ? -1 : 1, oct & 2 ? -1 : 1, oct & 4 ? -1 : 1};
+    std::vector<std::vector<int> > tri;
+    for (int a = 0; a < n; a++)
+      for (int b = 0; a + b < n; b++) {
+        std::vector<int> p0 = {a, b}, p1 = {a + 1, b}, p2 = {a, b + 1}, p3 = {a + 1, b + 1};
+        tri.push_back({p0[0], p0[1], p1[0], p1[1], p2[0], p2[1]});
+        if (a + b < n - 1) tri.push_back({p1[0], p1[1], p3[0], p3[1], p2[0], p2[1]});
+      }
+    for (unsigned t = 0; t < tri.size(); t++) {
+      int vno[3];
+      for (int m = 0; m < 3; m++) {
+        int a = tri[t][2 * m], b = tri[t][2 * m + 1];
+        std::vector<int> p = {s[0] * a, s[1] * b, s[2] * (n - a - b)};
+        if (!index.count(p)) {
+          index[p] = vox.size() / 3;
+          for (int k = 0; k < 3; k++) vox.push_back(c[k] + p[k]);
+        }
+        vno[m] = index[p];
+      }
+      if (s[0] * s[1] * s[2] < 0) std::swap(vno[1], vno[2]);
+      faces.insert(faces.end(), vno, vno + 3);
+    }
+  }
+  xyz.assign(vox.begin(), vox.end());
+  return MRISfromVerticesAndFaces(xyz.data(), vox.size() / 3, faces.data(), faces.size() / 3);
+}
+
+static int compare(MRI *fill, const std::vector<char> &inside, const char *what)
+{
+  int nwrong = 0, ninside = 0;
+  for (int k = 0; k < NVOX; k++)
+    for (int j = 0; j < NVOX; j++)
+      for (int i = 0; i < NVOX; i++) {
+        int in = inside[(k * NVOX + j) * NVOX + i];
+        ninside += in;
+        if ((MRIgetVoxVal(fill, i, j, k, 0) != 0) != in) nwrong++;
+      }
+  printf("%s: %d voxels inside, %d filled wrongly\n", what, ninside, nwrong);
+  return nwrong > 0;
+}
+
+static int sameFill(MRIS *mris, MRI *mri, const char *what)
+{
+  int differ = 0;
+#ifdef HAVE_OPENMP
+  omp_set_num_threads(1);
+  MRI *fill1 = MRISfillInteriorParity(mris, 0, MRIclone(mri, NULL));
+  omp_set_num_threads(4);
+  MRI *fill4 = MRISfillInteriorParity(mris, 0, MRIclone(mri, NULL));
+  for (int k = 0; k < NVOX && !differ; k++)
+    for (int j = 0; j < NVOX && !differ; j++)
+      for (int i = 0; i < NVOX && !differ; i++)
+        if (MRIgetVoxVal(fill1, i, j, k, 0) != MRIgetVoxVal(fill4, i, j, k, 0)) differ = 1;
+  if (differ) printf("%s: fill differs between 1 and 4 threads\n", what);
+  MRIfree(&fill1);
+  MRIfree(&fill4);
+#endif
+  return differ;
+}
+
+int main(int argc, char *argv[])
+{
+  int errors = 0, i, j, k, fno;
+  std::vector<double> vox;
+  std::vector<char> inside(NVOX * NVOX * NVOX);
+  MRI *mri = MRIalloc(NVOX, NVOX, NVOX, MRI_UCHAR);
+
+  // the centre is half a voxel off in x, so no voxel centre is on the surface
+  const int R = 11;
+  const double c[3] = {15.5, 16, 15};
+  MRIS *oct = makeOctahedron(R, c, vox);
+  voxelToSurfaceRAS(oct, mri, vox);
+  for (k = 0; k < NVOX; k++)
+    for (j = 0; j < NVOX; j++)
+      for (i = 0; i < NVOX; i++)
+        inside[(k * NVOX + j) * NVOX + i] = fabs(i - c[0]) + fabs(j - c[1]) + fabs(k - c[2]) < R;
+  MRI *fill = MRISfillInteriorParity(oct, 0, MRIclone(mri, NULL));
+  errors += compare(fill, inside, "octahedron");
+  errors += sameFill(oct, mri, "octahedron");
+  MRIfree(&fill);
+  MRISfree(&oct);
+
+  // a sphere off the grid: a centre is inside when it is behind every face
+  MRIS *sphere = ic2562_make_surface(0, 0);
+  const double cs[3] = {15.37, 16.21, 15.83};
+  vox.resize(3 * sphere->nvertices);
+  for (int vno = 0; vno < sphere->nvertices; vno++) {
+    VERTEX const *v = &sphere->vertices[vno];
+    double r = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    vox[3 * vno] = cs[0] + 12.3 * v->x / r;
+    vox[3 * vno + 1] = cs[1] + 12.3 * v->y / r;
+    vox[3 * vno + 2] = cs[2] + 12.3 * v->z / r;
+  }
+  voxelToSurfaceRAS(sphere, mri, vox);
+  std::fill(inside.begin(), inside.end(), 1);
+  for (fno = 0; fno < sphere->nfaces; fno++) {
+    double const *p0 = &vox[3 * sphere->faces[fno].v[0]];
+    double const *p1 = &vox[3 * sphere->faces[fno].v[1]];
+    double const *p2 = &vox[3 * sphere->faces[fno].v[2]];
+    double a[3], b[3], nrm[3];
+    for (int n = 0; n < 3; n++) {
+      a[n] = p1[n] - p0[n];
+      b[n] = p2[n] - p0[n];
+    }
+    nrm[0] = a[1] * b[2] - a[2] * b[1];
+    nrm[1] = a[2] * b[0] - a[0] * b[2];
+    nrm[2] = a[0] * b[1] - a[1] * b[0];
+    double out = nrm[0] * (p0[0] - cs[0]) + nrm[1] * (p0[1] - cs[1]) + nrm[2] * (p0[2] - cs[2]);
+    for (k = 0; k < NVOX; k++)
+      for (j = 0; j < NVOX; j++)
+        for (i = 0; i < NVOX; i++) {
+          double d = nrm[0] * (i - p0[0]) + nrm[1] * (j - p0[1]) + nrm[2] * (k - p0[2]);
+          if (d * out >= 0) inside[(k * NVOX + j) * NVOX + i] = 0;
+        }
+  }
+  fill = MRISfillInteriorParity(sphere, 0, MRIclone(mri, NULL));
+  errors += compare(fill, inside, "sphere");
+  errors += sameFill(sphere, mri, "sphere");
+  MRIfree(&fill);
+  MRISfree(&sphere);
+  MRIfree(&mri);
+
+  if (errors) {
+    printf("FAILED\n");
+    exit(1);
+  }
+  printf("PASSED\n");
+  exit(0);
+}
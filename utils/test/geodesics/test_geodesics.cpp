@@ -0,0 +1,381 @@
+//
+// unit test for computeGeodesicsCSR and the CSR geodesics files - located in utils/geodesics.cpp
+//
+// The neighbourhoods are compared against the original serial algorithm
+// (kept below as referenceGeodesics, with its isnearest flags assigned
+// rather than compared), on a bumpy icosahedral surface.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <stack>
+#include <vector>
+
+#include "mrisurf.h"
+#include "icosahedron.h"
+#include "geodesics.h"
+#include "romp_support.h"
+
+const char *Progname = "test_geodesics";
+
+typedef std::vector< std::pair< int, float > > Row;
+
+struct RefVertex
+{
+  float x, y;
+  int id;
+};
+
+struct RefStackItem
+{
+  RefVertex a, b, c;
+  int idx;
+  float mina, maxa;
+};
+
+struct RefTriangle
+{
+  float length[3];
+  float angle[3];
+  int vert[3];
+  int neighbor[3];
+  bool inChain;
+};
+
+static int getIndex(int *arr, int vid)
+{
+  return std::distance(arr, std::find(arr, arr + 3, vid));
+}
+
+static float distanceBetween(int v1, int v2, MRIS *surf)
+{
+  VERTEX_TOPOLOGY const *const vt = &surf->vertices_topology[v1];
+  int const *ns = vt->v;
+  return surf->vertices[v1].dist[std::distance(ns, std::find(ns, ns + vt->vnum, v2))];
+}
+
+static int findNeighbor(int faceidx, int v1, int v2, MRIS *surf)
+{
+  VERTEX_TOPOLOGY const *const vt = &surf->vertices_topology[v1];
+  for (int nf = 0; nf < vt->num; nf++) {
+    int f = vt->f[nf];
+    if (f == faceidx) continue;
+    for (int nv = 0; nv < 3; nv++)
+      if (surf->faces[f].v[nv] == v2) return f;
+  }
+  return -1;
+}
+
+static RefVertex extendedPoint(RefVertex A, RefVertex B, float dA, float dB, float dAB)
+{
+  RefVertex D;
+  float a = (dA * dA - dB * dB + dAB * dAB) / (2 * dAB);
+  float h = sqrt(dA * dA - a * a);
+  float px = A.x + a * (B.x - A.x) / dAB;
+  float py = A.y + a * (B.y - A.y) / dAB;
+  D.x = px + h * (B.y - A.y) / dAB;
+  D.y = py - h * (B.x - A.x) / dAB;
+  return D;
+}
+
+static std::pair< int, int > makeKey(int a, int b)
+{
+  return a < b ? std::pair< int, int >(a, b) : std::pair< int, int >(b, a);
+}
+
+// the original computeGeodesics, returning the uniquified rows
+static std::vector< Row > referenceGeodesics(MRIS *surf, float maxdist)
+{
+  std::vector< RefTriangle > triangles(surf->nfaces);
+  for (int nf = 0; nf < surf->nfaces; nf++) {
+    FACE *face = &surf->faces[nf];
+    RefTriangle *triangle = &triangles[nf];
+    for (int ns = 0; ns < 3; ns++) {
+      int idx1 = (ns + 1) % 3, idx2 = (ns + 2) % 3;
+      triangle->length[ns] = distanceBetween(face->v[idx1], face->v[idx2], surf);
+      triangle->neighbor[ns] = findNeighbor(nf, face->v[idx1], face->v[idx2], surf);
+      triangle->vert[ns] = face->v[ns];
+      triangle->angle[ns] = face->angle[ns];
+    }
+    triangle->inChain = false;
+  }
+
+  std::vector< std::vector< int > > nearestverts(surf->nvertices);
+  int idxlookup[] = {0, 2, 1, 0};
+  std::map< std::pair< int, int >, float > pathmap;
+  std::map< std::pair< int, int >, float >::iterator edge;
+  std::vector< int > chain;
+  std::stack< RefStackItem > stack;
+  std::vector< bool > isnearest(surf->nvertices);
+  RefStackItem stackitem;
+  RefVertex A, B, C, D;
+  RefTriangle *triangle;
+  int iA, iB, iC, iD, current_idx;
+  float min_angle, max_angle, current_angle, distance;
+
+  // step 1: line of sight
+  for (int vertexID = 0; vertexID < surf->nvertices; vertexID++) {
+    VERTEX_TOPOLOGY const *const basevertex = &surf->vertices_topology[vertexID];
+    for (int i = 0; i < basevertex->num; i++) {
+      for (unsigned int c = 0; c < chain.size(); c++) triangles[chain[c]].inChain = false;
+      chain.clear();
+      for (unsigned int c = 0; c < isnearest.size(); c++) isnearest[c] = false;
+      current_idx = basevertex->f[i];
+      triangle = &triangles[current_idx];
+      chain.push_back(current_idx);
+      triangle->inChain = true;
+      iC = getIndex(triangle->vert, vertexID);
+      iA = (iC + 1) % 3;
+      iB = (iC + 2) % 3;
+      min_angle = 0.0;
+      max_angle = triangle->angle[iC];
+      A.x = triangle->length[iB];
+      A.y = 0.0;
+      A.id = triangle->vert[iA];
+      B.x = triangle->length[iA] * cos(max_angle);
+      B.y = triangle->length[iA] * sin(max_angle);
+      B.id = triangle->vert[iB];
+      C.x = 0.0;
+      C.y = 0.0;
+      C.id = triangle->vert[iC];
+      nearestverts[vertexID].push_back(A.id);
+      isnearest[A.id] = true;
+      pathmap[makeKey(vertexID, A.id)] = triangle->length[iB];
+      nearestverts[vertexID].push_back(B.id);
+      isnearest[B.id] = true;
+      pathmap[makeKey(vertexID, B.id)] = triangle->length[iA];
+      current_idx = triangle->neighbor[iC];
+      while (true) {
+        if ((current_idx < 0) || (triangles[current_idx].inChain)) {
+          if (stack.empty()) break;
+          stackitem = stack.top();
+          A = stackitem.a;
+          B = stackitem.b;
+          C = stackitem.c;
+          min_angle = stackitem.mina;
+          max_angle = stackitem.maxa;
+          current_idx = stackitem.idx;
+          triangle = &triangles[current_idx];
+          while ((chain.size() > 0) && (chain.back() != current_idx)) {
+            triangles[chain.back()].inChain = false;
+            chain.pop_back();
+          }
+          stack.pop();
+        }
+        else {
+          triangle = &triangles[current_idx];
+          chain.push_back(current_idx);
+          triangle->inChain = true;
+          iA = getIndex(triangle->vert, A.id);
+          iB = getIndex(triangle->vert, B.id);
+          iD = idxlookup[iA + iB];
+          D = extendedPoint(A, B, triangle->length[iB], triangle->length[iA], triangle->length[iD]);
+          D.id = triangle->vert[iD];
+          current_angle = atan2(D.y, D.x);
+          distance = sqrt(D.x * D.x + D.y * D.y);
+          if (distance > maxdist) {
+            current_idx = -1;
+            continue;
+          }
+          if (!isnearest[D.id]) {
+            nearestverts[vertexID].push_back(D.id);
+            isnearest[D.id] = true;
+          }
+          if (current_angle < min_angle) {
+            C = A;
+            A = D;
+          }
+          else if (current_angle > max_angle) {
+            C = B;
+            B = D;
+          }
+          else if ((current_angle <= max_angle) && (current_angle >= min_angle)) {
+            edge = pathmap.find(makeKey(vertexID, D.id));
+            if (edge != pathmap.end()) {
+              if ((distance < edge->second) || (edge->second < 0.0)) edge->second = distance;
+            }
+            else
+              pathmap[makeKey(vertexID, D.id)] = distance;
+            stackitem.a = A;
+            stackitem.b = D;
+            stackitem.c = B;
+            stackitem.idx = current_idx;
+            stackitem.mina = min_angle;
+            stackitem.maxa = current_angle;
+            stack.push(stackitem);
+            C = A;
+            A = D;
+            min_angle = current_angle;
+          }
+          else {
+            current_idx = -1;
+            continue;
+          }
+        }
+        iC = getIndex(triangle->vert, C.id);
+        current_idx = triangle->neighbor[iC];
+      }
+    }
+  }
+
+  // step 2: paths through a third vertex, shared through the pathmap
+  std::vector< Row > rows(surf->nvertices);
+  for (unsigned int c = 0; c < isnearest.size(); c++) isnearest[c] = false;
+  for (int k = 0; k < surf->nvertices; k++) {
+    for (unsigned int d = 0; d < nearestverts[k].size(); d++) isnearest[nearestverts[k][d]] = true;
+    for (unsigned int i = 0; i < nearestverts[k].size(); i++) {
+      int vi = nearestverts[k][i];
+      if ((vi == k) || (pathmap.find(makeKey(k, vi)) != pathmap.end())) continue;
+      for (unsigned int j = 0; j < nearestverts[k].size(); j++) {
+        int vj = nearestverts[k][j];
+        if ((vi == vj) || (vj == k)) continue;
+        edge = pathmap.find(makeKey(k, vj));
+        if (edge == pathmap.end()) continue;
+        distance = edge->second;
+        edge = pathmap.find(makeKey(vj, vi));
+        if (edge == pathmap.end()) continue;
+        distance += edge->second;
+        edge = pathmap.find(makeKey(k, vi));
+        if (edge == pathmap.end()) {
+          if (distance < maxdist) pathmap[makeKey(k, vi)] = distance;
+        }
+        else if (distance < edge->second)
+          edge->second = distance;
+      }
+      edge = pathmap.find(makeKey(k, vi));
+      if (edge != pathmap.end()) {
+        for (int side = 0; side < surf->vertices_topology[vi].vnum; side++) {
+          int vn = surf->vertices_topology[vi].v[side];
+          if (!isnearest[vn] && edge->second + 0.5 < maxdist) {
+            isnearest[vn] = true;
+            nearestverts[k].push_back(vn);
+          }
+        }
+      }
+    }
+    for (unsigned int d = 0; d < nearestverts[k].size(); d++) {
+      int vno = nearestverts[k][d];
+      edge = pathmap.find(makeKey(k, vno));
+      if (vno != k && edge != pathmap.end()) rows[k].push_back(std::make_pair(vno, edge->second));
+      isnearest[vno] = false;
+    }
+    std::sort(rows[k].begin(), rows[k].end());
+    rows[k].erase(std::unique(rows[k].begin(), rows[k].end()), rows[k].end());
+  }
+  return rows;
+}
+
+static bool sameCSR(GeodesicsCSR *a, GeodesicsCSR *b)
+{
+  if (a->nvertices != b->nvertices || a->nnbrs != b->nnbrs) return false;
+  for (int vno = 0; vno <= a->nvertices; vno++)
+    if (a->offset[vno] != b->offset[vno]) return false;
+  for (long n = 0; n < a->nnbrs; n++)
+    if (a->v[n] != b->v[n] || a->dist[n] != b->dist[n]) return false;
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  const float maxdist = 12;
+  int vno, errors = 0;
+
+  // a sphere of radius 50 with bumps, so the surface has saddles and
+  // vertices without line of sight to each other
+  MRIS *surf = ic2562_make_surface(0, 0);
+  for (vno = 0; vno < surf->nvertices; vno++) {
+    VERTEX *v = &surf->vertices[vno];
+    float r = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    float bump = 1 + 0.08 * sin(5 * v->x / r) * cos(4 * v->y / r) * sin(3 * v->z / r + 1);
+    MRISsetXYZ(surf, vno, 50 * bump * v->x / r, 50 * bump * v->y / r, 50 * bump * v->z / r);
+  }
+  MRIScomputeMetricProperties(surf);
+  MRIScomputeTriangleProperties(surf);  // the face angles the LOS step unfolds with
+
+  std::vector< Row > ref = referenceGeodesics(surf, maxdist);
+  GeodesicsCSR *geo = computeGeodesicsCSR(surf, maxdist);
+
+  // same neighbourhoods as the original code, and the same distances up to
+  // the float rounding of taking the shorter of the two line-of-sight paths
+  for (vno = 0; vno < surf->nvertices; vno++) {
+    long off = geo->offset[vno], n = geo->offset[vno + 1] - off;
+    if (n != (long)ref[vno].size()) {
+      printf("vertex %d: %ld neighbours, expected %d\n", vno, n, (int)ref[vno].size());
+      errors++;
+      continue;
+    }
+    for (long i = 0; i < n; i++) {
+      if (geo->v[off + i] != ref[vno][i].first || fabs(geo->dist[off + i] - ref[vno][i].second) > 1e-4) {
+        printf("vertex %d: neighbour %d at %g, expected %d at %g\n", vno, geo->v[off + i], geo->dist[off + i],
+               ref[vno][i].first, ref[vno][i].second);
+        errors++;
+        break;
+      }
+    }
+  }
+  printf("%ld neighbours, %d vertices differ from the original algorithm\n", geo->nnbrs, errors);
+
+  // the result must not depend on the number of threads
+  int nthreads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  GeodesicsCSR *geo1 = computeGeodesicsCSR(surf, maxdist);
+  omp_set_num_threads(nthreads);
+  if (!sameCSR(geo, geo1)) {
+    printf("result differs between 1 and %d threads\n", nthreads);
+    errors++;
+  }
+  geodesicsCSRfree(&geo1);
+
+  // write and read back, read and mapped
+  const char *fname = "test_geodesics.csr";
+  if (geodesicsCSRwrite(geo, fname)) errors++;
+  for (int use_mmap = 0; use_mmap < 2; use_mmap++) {
+    GeodesicsCSR *rd = geodesicsCSRread(fname, use_mmap);
+    if (rd == NULL || !sameCSR(geo, rd)) {
+      printf("read back (mmap %d) differs\n", use_mmap);
+      errors++;
+    }
+    geodesicsCSRfree(&rd);
+  }
+
+  // a truncated file and a file whose header does not match its size
+  // must be rejected rather than mapped
+  FILE *fp = fopen(fname, "r+b");
+  long nnbrs = geo->nnbrs + 1000;
+  fseek(fp, 40, SEEK_SET);
+  fwrite(&nnbrs, sizeof(long), 1, fp);
+  fclose(fp);
+  for (int use_mmap = 0; use_mmap < 2; use_mmap++) {
+    GeodesicsCSR *rd = geodesicsCSRread(fname, use_mmap);
+    if (rd != NULL) {
+      printf("bad header accepted (mmap %d)\n", use_mmap);
+      errors++;
+      geodesicsCSRfree(&rd);
+    }
+  }
+  geodesicsCSRwrite(geo, fname);
+  if (truncate(fname, 64 + (geo->nvertices + 1) * sizeof(long) + 10) != 0) errors++;
+  for (int use_mmap = 0; use_mmap < 2; use_mmap++) {
+    GeodesicsCSR *rd = geodesicsCSRread(fname, use_mmap);
+    if (rd != NULL) {
+      printf("truncated file accepted (mmap %d)\n", use_mmap);
+      errors++;
+      geodesicsCSRfree(&rd);
+    }
+  }
+  remove(fname);
+
+  geodesicsCSRfree(&geo);
+  MRISfree(&surf);
+
+  if (errors) {
+    printf("FAILED\n");
+    exit(1);
+  }
+  printf("PASSED\n");
+  exit(0);
+}
@@ -0,0 +1,118 @@
+//
+// unit test for the label vertex number lookup - located in utils/label.cpp
+//
+// LabelHasVertex goes through a vno -> point table that is kept between
+// calls. Points renumbered in place, a label refilled from the start and
+// points appended after a LabelRealloc must all be seen by the next lookup.
+// A label written as .blabel must read back exactly, without its deleted
+// points, and with a working lookup.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "label.h"
+
+const char *Progname = "test_labelVertexIndex";
+
+static int errors = 0;
+
+static void expect(LABEL *area, int vno, int n, const char *what)
+{
+  int found = LabelHasVertex(vno, area);
+  if (found != n) {
+    printf("%s: vertex %d found at %d, expected %d\n", what, vno, found, n);
+    errors++;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  LABEL *area = LabelAlloc(10, NULL, "test");
+  int n;
+
+  for (n = 0; n < 10; n++) area->lv[n].vno = 100 + 2 * n;
+  area->n_points = 10;
+  expect(area, 104, 2, "initial");
+  expect(area, 105, -1, "initial");
+
+  // renumbered in place
+  LabelUnassign(area);
+  expect(area, 104, -1, "after LabelUnassign");
+
+  // reset and refilled with other vertex numbers
+  area->n_points = 0;
+  LabelInvalidateVertexIndex(area);
+  for (n = 0; n < 10; n++) area->lv[n].vno = 101 + 2 * n;
+  area->n_points = 10;
+  expect(area, 104, -1, "after refill");
+  expect(area, 105, 2, "after refill");
+
+  // grown past max_points and appended to
+  LabelRealloc(area, 20);
+  for (n = 10; n < 20; n++) area->lv[n].vno = 500 + n;
+  area->n_points = 20;
+  expect(area, 105, 2, "after LabelRealloc");
+  expect(area, 515, 15, "after LabelRealloc");
+  expect(area, 600, -1, "after LabelRealloc");
+
+  LabelFree(&area);
+
+  // binary label round trip
+  const char *fname = "test_labelVertexIndex.blabel";
+  area = LabelAlloc(777, NULL, "test");
+  for (n = 0; n < 777; n++) {
+    area->lv[n].vno = 7 * n + 3;
+    area->lv[n].x = 0.1f * n - 12.345f;
+    area->lv[n].y = -1e-3f * n * n;
+    area->lv[n].z = 1.0f / (n + 1);
+    area->lv[n].stat = n % 13 ? 3.14159f * n : -0.0f;
+  }
+  area->n_points = 777;
+  area->lv[5].deleted = 1;
+  area->coords = LABEL_COORDS_SCANNER_RAS;
+  strcpy(area->space, "scanner");
+  remove(fname);
+  if (LabelWrite(area, fname)) {
+    printf("could not write %s\n", fname);
+    errors++;
+  }
+  LABEL *loaded = LabelRead(NULL, fname);
+  if (!loaded) {
+    printf("could not read %s\n", fname);
+    errors++;
+  }
+  else {
+    int nbad = 0, m = 0;
+    for (n = 0; n < 777; n++) {
+      if (area->lv[n].deleted) continue;
+      LV *a = &area->lv[n], *b = &loaded->lv[m++];
+      if (memcmp(&a->x, &b->x, sizeof(float)) || memcmp(&a->y, &b->y, sizeof(float)) ||
+          memcmp(&a->z, &b->z, sizeof(float)) || memcmp(&a->stat, &b->stat, sizeof(float)) || a->vno != b->vno)
+        nbad++;
+    }
+    if (loaded->n_points != 776 || nbad) {
+      printf("binary label read back %d points, %d differ\n", loaded->n_points, nbad);
+      errors++;
+    }
+    if (loaded->coords != LABEL_COORDS_SCANNER_RAS || strcmp(loaded->space, "scanner")) {
+      printf("binary label read back coords %d in space '%s'\n", loaded->coords, loaded->space);
+      errors++;
+    }
+    expect(loaded, 3, 0, "after LabelRead");
+    expect(loaded, 7 * 5 + 3, -1, "after LabelRead");
+    expect(loaded, 7 * 776 + 3, 775, "after LabelRead");
+    expect(loaded, 4, -1, "after LabelRead");
+    LabelFree(&loaded);
+  }
+  remove(fname);
+  LabelFree(&area);
+
+  if (errors) {
+    printf("FAILED\n");
+    exit(1);
+  }
+  printf("PASSED\n");
+  exit(0);
+}
@@ -3,3 +3,6 @@ source "$(dirname $0)/../../../test.sh"
 
 test_command test_soapbubble src.mgz ctrl.mgz dst.mgz
 compare_vol dst.mgz ref.mgz
+
+# multigrid solver against the single grid relaxation run to convergence
+test_command test_soapbubble --multigrid
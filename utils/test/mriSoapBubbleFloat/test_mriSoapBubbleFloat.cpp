@@ -4,6 +4,7 @@
 
 #include <string>
 #include <iostream>
+#include <math.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -21,12 +22,71 @@ extern "C"
 #endif
 
 
+// Solves a synthetic volume with MRIsoapBubbleMultigrid and with the
+// single grid relaxation run to convergence, and checks they agree.
+static int testMultigrid()
+{
+  const int width = 20, height = 18, depth = 16;
+  MRI *mri_src = MRIalloc(width, height, depth, MRI_FLOAT);
+  MRI *mri_ctrl = MRIalloc(width, height, depth, MRI_UCHAR);
+
+  // about 8% of the voxels are control points with smooth-ish values
+  unsigned int seed = 12345;
+  int nctrl = 0;
+  for (int z = 0; z < depth; z++)
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+      {
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 12 != 0) continue;
+        MRIsetVoxVal(mri_ctrl, x, y, z, 0, CONTROL_MARKED);
+        MRIsetVoxVal(mri_src, x, y, z, 0, 100 + 40 * sin(0.3 * x) * cos(0.2 * y) + 0.5 * z + (seed >> 20) % 7);
+        nctrl++;
+      }
+
+  MRI *mri_single = MRIsoapBubble(mri_src, mri_ctrl, NULL, 20000, 1e-6);
+  MRI *mri_multi = MRIsoapBubbleMultigrid(mri_src, mri_ctrl, NULL, 1e-6);
+
+  double max_diff = 0;
+  for (int z = 0; z < depth; z++)
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+      {
+        double diff = fabs(MRIgetVoxVal(mri_single, x, y, z, 0) - MRIgetVoxVal(mri_multi, x, y, z, 0));
+        if (diff > max_diff) max_diff = diff;
+        if (MRIgetVoxVal(mri_ctrl, x, y, z, 0) == CONTROL_MARKED &&
+            MRIgetVoxVal(mri_multi, x, y, z, 0) != MRIgetVoxVal(mri_src, x, y, z, 0))
+        {
+          std::cerr << "ERROR: control point " << x << " " << y << " " << z << " changed by the multigrid solver\n";
+          return 1;
+        }
+      }
+  std::cout << nctrl << " control points, max difference single/multigrid " << max_diff << std::endl;
+
+  MRIfree(&mri_src);
+  MRIfree(&mri_ctrl);
+  MRIfree(&mri_single);
+  MRIfree(&mri_multi);
+
+  if (max_diff > 1e-2)
+  {
+    std::cerr << "ERROR: multigrid and single grid soap bubble differ\n";
+    return 1;
+  }
+  return 0;
+}
+
+
 int main(int argc, char *argv[])
 {
+  if (argc == 2 && std::string(argv[1]) == "--multigrid")
+    exit(testMultigrid());
+
   // check arg count:
   if (argc != 4)
   {
     std::cerr << "ERROR: 3 arguments are required: mri_src mri_ctrl mri_dst\n";
+    std::cerr << "       or --multigrid to check MRIsoapBubbleMultigrid\n";
     exit(1);
   }
 
@@ -0,0 +1,83 @@
+/*--------------------------------------------
+  mrishash_test_300_batch.cpp
+
+  MHTfindClosestVerticesBatch must give every point the same vertex and
+  distance as MHTfindClosestVertexNoXYZ, at any hash resolution and for
+  any number of threads. The surface is a wavy sphere with coordinates
+  snapped to 1/8 mm, so there are many ties, and some ripped vertices.
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "mrisurf.h"
+#include "mrishash.h"
+#include "icosahedron.h"
+#include "romp_support.h"
+
+const char *Progname = "mrishash_batch_test";
+
+int main(int argc, char *argv[])
+{
+  int errors = 0, vno, n;
+
+  MRIS *mris = ic2562_make_surface(0, 0);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    double r = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    double u = v->z / r, t = atan2(v->y, v->x);
+    double rr = 70 + 8 * sin(5 * t) * cos(7 * u);
+    MRISsetXYZ(mris, vno, round(rr * v->x / r * 8) / 8, round(rr * v->y / r * 8) / 8, round(rr * v->z / r * 8) / 8);
+    v->ripflag = (vno % 50 == 0);
+  }
+
+  // a 2 mm grid around the surface, every other slice shifted by 1 mm
+  std::vector<float> xyz;
+  for (int k = -90; k < 90; k += 2)
+    for (int j = -90; j < 90; j += 2)
+      for (int i = -90; i < 90; i += 2) {
+        double r = sqrt((double)i * i + j * j + k * k);
+        if (r < 50 || r > 90) continue;
+        xyz.push_back(i + (k % 4 ? 1 : 0));
+        xyz.push_back(j);
+        xyz.push_back(k);
+      }
+  int npoints = xyz.size() / 3;
+
+  float const resolutions[3] = {2, 4, 16};
+  for (int res = 0; res < 3; res++) {
+    MRIS_HASH_TABLE *mht = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, resolutions[res]);
+
+    std::vector<int> vno1(npoints);
+    std::vector<float> dist1(npoints);
+    for (n = 0; n < npoints; n++)
+      vno1[n] = MHTfindClosestVertexNoXYZ(mht, mris, xyz[3 * n], xyz[3 * n + 1], xyz[3 * n + 2], &dist1[n]);
+
+    int const threads[2] = {1, 4};
+    for (int t = 0; t < 2; t++) {
+#ifdef HAVE_OPENMP
+      omp_set_num_threads(threads[t]);
+#endif
+      std::vector<int> vno2(npoints);
+      std::vector<float> dist2(npoints);
+      MHTfindClosestVerticesBatch(mht, mris, npoints, xyz.data(), vno2.data(), dist2.data());
+      int nbad = 0;
+      for (n = 0; n < npoints; n++)
+        if (vno1[n] != vno2[n] || dist1[n] != dist2[n]) nbad++;
+      printf("resolution %g, %d threads: %d of %d points differ\n", resolutions[res], threads[t], nbad, npoints);
+      if (nbad) errors++;
+    }
+    MHTfree(&mht);
+  }
+
+  MRISfree(&mris);
+
+  if (errors) {
+    printf("FAILED\n");
+    exit(1);
+  }
+  printf("PASSED\n");
+  exit(0);
+}
@@ -0,0 +1,101 @@
+//
+// unit test for the saved surface registration operators - located in utils/resample.cpp
+//
+// MRISreadOrBuildRegOperator must reuse a saved operator only for the
+// registration it was built from: moving the source sphere (same number
+// of vertices, same options) has to rebuild it.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "mrisurf.h"
+#include "icosahedron.h"
+#include "resample.h"
+
+const char *Progname = "test_regOperator";
+
+static void makeSphere(MRIS *surf, float radius, float angle)
+{
+  for (int vno = 0; vno < surf->nvertices; vno++) {
+    VERTEX *v = &surf->vertices[vno];
+    float r = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    float x = v->x / r, y = v->y / r, z = v->z / r;
+    MRISsetXYZ(surf, vno, radius * (x * cos(angle) - y * sin(angle)), radius * (x * sin(angle) + y * cos(angle)),
+               radius * z);
+  }
+  MRIScomputeMetricProperties(surf);
+}
+
+static bool sameOperator(const MRIS_REG_OPERATOR *a, const MRIS_REG_OPERATOR *b)
+{
+  return a->nsrc == b->nsrc && a->ntrg == b->ntrg && a->rowptr == b->rowptr && a->col == b->col &&
+         a->den == b->den && a->rowden == b->rowden;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *fname = "test_regOperator.srop";
+  int errors = 0;
+
+  MRIS *SurfReg[2];
+  SurfReg[0] = ic2562_make_surface(0, 0);
+  SurfReg[1] = ic642_make_surface(0, 0);
+  makeSphere(SurfReg[0], 100, 0);
+  makeSphere(SurfReg[1], 100, 0);
+  remove(fname);
+
+  // first call builds and saves, the second reads it back
+  MRIS_REG_OPERATOR *built = MRISreadOrBuildRegOperator(fname, SurfReg, 2, 1, 0, 1);
+  MRIS_REG_OPERATOR *reused = MRISreadOrBuildRegOperator(fname, SurfReg, 2, 1, 0, 1);
+  if (!built || !reused || !sameOperator(built, reused)) {
+    printf("saved operator does not match the one built\n");
+    errors++;
+  }
+  unsigned long hash0 = MRISregOperatorHash(SurfReg, 2);
+  MRIS_REG_OPERATOR *saved = MRISreadRegOperator(fname);
+  if (!saved || saved->reghash != hash0) {
+    printf("saved operator does not carry the registration hash\n");
+    errors++;
+  }
+  MRISfreeRegOperator(&saved);
+
+  // a different registration of the same surfaces must not reuse it
+  makeSphere(SurfReg[0], 100, 0.05);
+  if (MRISregOperatorHash(SurfReg, 2) == hash0) {
+    printf("moving the source sphere did not change the hash\n");
+    errors++;
+  }
+  MRIS_REG_OPERATOR *expected = MRISbuildRegOperator(SurfReg, 2, 1, 0, 1);
+  MRIS_REG_OPERATOR *rebuilt = MRISreadOrBuildRegOperator(fname, SurfReg, 2, 1, 0, 1);
+  if (sameOperator(expected, built)) {
+    printf("moving the source sphere did not change the operator\n");
+    errors++;
+  }
+  if (!rebuilt || !sameOperator(rebuilt, expected)) {
+    printf("stale operator reused after the registration changed\n");
+    errors++;
+  }
+  saved = MRISreadRegOperator(fname);
+  if (!saved || saved->reghash != MRISregOperatorHash(SurfReg, 2) || !sameOperator(saved, expected)) {
+    printf("rebuilt operator was not saved\n");
+    errors++;
+  }
+  MRISfreeRegOperator(&saved);
+  remove(fname);
+
+  MRISfreeRegOperator(&built);
+  MRISfreeRegOperator(&reused);
+  MRISfreeRegOperator(&expected);
+  MRISfreeRegOperator(&rebuilt);
+  MRISfree(&SurfReg[0]);
+  MRISfree(&SurfReg[1]);
+
+  if (errors) {
+    printf("FAILED\n");
+    exit(1);
+  }
+  printf("PASSED\n");
+  exit(0);
+}
@@ -0,0 +1,208 @@
+//
+// unit test for the sparse brick storage of MRI volumes - located in utils/mri.cpp
+//
+// A sparse volume must hold the same voxels as a dense volume written the
+// same way, through the accessors, MRIcopy, MRIbinarize, MRInonzeroBricks
+// and an mgz round trip. Bricks only get memory when they hold a nonzero
+// voxel, and a copy shares them until one of the volumes writes to them.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "mri.h"
+#include "romp_support.h"
+
+const char *Progname = "test_sparseMRI";
+
+#define WIDTH 70
+#define HEIGHT 45
+#define DEPTH 38
+#define NFRAMES 2
+
+static int errors = 0;
+
+// a few labels in a corner and a thin plate, negative values included
+static float label(int x, int y, int z, int f)
+{
+  if (x < 20 && y < 12 && z < 9) return (x + y + z) % 5 * (f ? -1 : 1);
+  if (z == 30 && x > 40 && y > 3) return 7 + f;
+  return 0;
+}
+
+static void fill(MRI *mri)
+{
+  for (int f = 0; f < NFRAMES; f++)
+    for (int z = 0; z < DEPTH; z++)
+      for (int y = 0; y < HEIGHT; y++)
+        for (int x = 0; x < WIDTH; x++) MRIsetVoxVal(mri, x, y, z, f, label(x, y, z, f));
+}
+
+static void compare(MRI *mri, MRI *ref, const char *what)
+{
+  int ndiff = 0;
+  for (int f = 0; f < ref->nframes; f++)
+    for (int z = 0; z < DEPTH; z++)
+      for (int y = 0; y < HEIGHT; y++)
+        for (int x = 0; x < WIDTH; x++)
+          if (MRIgetVoxVal(mri, x, y, z, f) != MRIgetVoxVal(ref, x, y, z, f)) ndiff++;
+  if (ndiff) {
+    printf("%s: %d voxels differ\n", what, ndiff);
+    errors++;
+  }
+}
+
+static size_t nbricks(size_t nbytes, const MRI *mri)
+{
+  return nbytes / (MRI_BRICK_SIZE * MRI_BRICK_SIZE * MRI_BRICK_SIZE * mri->bytes_per_vox);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *fname = "test_sparseMRI.mgz";
+
+  MRI *dense = MRIallocSequence(WIDTH, HEIGHT, DEPTH, MRI_SHORT, NFRAMES);
+  MRI *sparse = MRIallocSparse(WIDTH, HEIGHT, DEPTH, MRI_SHORT, NFRAMES);
+  if (MRIsparseBytes(sparse) != 0) {
+    printf("new sparse volume uses memory\n");
+    errors++;
+  }
+  fill(dense);
+  fill(sparse);
+  compare(sparse, dense, "sparse volume");
+  if (sparse->hash().value != dense->hash().value) {
+    printf("sparse and dense hashes differ\n");
+    errors++;
+  }
+
+  // the corner is 2x1x1 bricks per frame, the plate 3x3x1 in each frame
+  size_t used = nbricks(MRIsparseBytes(sparse), sparse);
+  if (used != 2 * (2 + 9)) {
+    printf("sparse volume uses %zu bricks, expected %d\n", used, 2 * (2 + 9));
+    errors++;
+  }
+
+  for (int f = 0; f < NFRAMES; f++) {
+    std::vector<MRI_BRICK> b0 = MRInonzeroBricks(dense, f), b1 = MRInonzeroBricks(sparse, f);
+    bool same = (b0.size() == b1.size());
+    for (size_t n = 0; same && n < b0.size(); n++)
+      same = (b0[n].x0 == b1[n].x0 && b0[n].y0 == b1[n].y0 && b0[n].z0 == b1[n].z0 && b0[n].x1 == b1[n].x1 &&
+              b0[n].y1 == b1[n].y1 && b0[n].z1 == b1[n].z1);
+    if (!same) {
+      printf("frame %d: sparse volume lists %zu nonzero bricks, dense %zu\n", f, b1.size(), b0.size());
+      errors++;
+    }
+  }
+
+  // a copy shares the bricks until it is written
+  MRI *copy = MRIcopy(sparse, NULL);
+  if (!copy->bricks) {
+    printf("copy of a sparse volume is not sparse\n");
+    errors++;
+  }
+  compare(copy, dense, "copy");
+  MRIsetVoxVal(copy, 1, 1, 1, 0, 100);
+  MRIsetVoxVal(copy, 60, 40, 2, 1, 100);
+  if (MRIgetVoxVal(sparse, 1, 1, 1, 0) != label(1, 1, 1, 0) || MRIgetVoxVal(sparse, 60, 40, 2, 1) != 0) {
+    printf("writing to a copy changed the original\n");
+    errors++;
+  }
+  if (MRIgetVoxVal(copy, 1, 1, 1, 0) != 100 || MRIgetVoxVal(copy, 60, 40, 2, 1) != 100) {
+    printf("writing to a copy was lost\n");
+    errors++;
+  }
+  MRIfree(&copy);
+  compare(sparse, dense, "sparse volume after freeing its copy");
+
+  // conversions both ways
+  MRI *fromdense = MRIcopy(dense, MRIallocSparse(WIDTH, HEIGHT, DEPTH, MRI_SHORT, NFRAMES));
+  compare(fromdense, dense, "dense to sparse");
+  if (MRIsparseBytes(fromdense) != MRIsparseBytes(sparse)) {
+    printf("dense to sparse allocated %zu bytes, expected %zu\n", MRIsparseBytes(fromdense), MRIsparseBytes(sparse));
+    errors++;
+  }
+  MRIfree(&fromdense);
+  MRI *todense = MRIcopy(sparse, MRIallocSequence(WIDTH, HEIGHT, DEPTH, MRI_SHORT, NFRAMES));
+  compare(todense, dense, "sparse to dense");
+  MRIfree(&todense);
+  MRI *tofloat = MRIcopy(sparse, MRIallocSparse(WIDTH, HEIGHT, DEPTH, MRI_FLOAT, NFRAMES));
+  compare(tofloat, dense, "sparse short to sparse float");
+  MRIfree(&tofloat);
+
+  // binarize, on the nonzero bricks only and on every voxel
+  for (int low = 0; low <= 1; low++) {
+    MRI *b0 = MRIbinarize(dense, NULL, 2, low, 9);
+    MRI *b1 = MRIbinarize(sparse, NULL, 2, low, 9);
+    if (!b1->bricks) {
+      printf("binarized sparse volume is not sparse\n");
+      errors++;
+    }
+    compare(b1, b0, low ? "binarize with low_val 1" : "binarize");
+    MRIfree(&b0);
+    MRIfree(&b1);
+  }
+
+  // mgz round trip, into dense and sparse volumes
+  if (mghWrite(sparse, fname)) {
+    printf("could not write %s\n", fname);
+    errors++;
+  }
+  else {
+    MRI *read = mghRead(fname);
+    MRI *readsparse = mghRead(fname, TRUE, -1, true);
+    compare(read, dense, "mghRead of a sparse volume");
+    if (!readsparse || !readsparse->bricks) {
+      printf("mghRead did not return a sparse volume\n");
+      errors++;
+    }
+    else {
+      compare(readsparse, dense, "sparse mghRead");
+      if (MRIsparseBytes(readsparse) != MRIsparseBytes(sparse)) {
+        printf("sparse mghRead allocated %zu bytes, expected %zu\n", MRIsparseBytes(readsparse),
+               MRIsparseBytes(sparse));
+        errors++;
+      }
+    }
+    MRIfree(&read);
+    if (readsparse) MRIfree(&readsparse);
+  }
+  remove(fname);
+
+  // threads writing different voxels of the same bricks of a copy, which
+  // start out shared with the source volume or zero: every write has to
+  // land in the copy and none in the source
+  for (int round = 0; round < 20; round++) {
+    MRI *parallel = MRIcopy(sparse, NULL);
+    int z;
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
+#endif
+    for (z = 0; z < DEPTH; z++) {
+      ROMP_PFLB_begin
+      for (int f = 0; f < NFRAMES; f++)
+        for (int y = 0; y < HEIGHT; y++)
+          for (int x = 0; x < WIDTH; x++) MRIsetVoxVal(parallel, x, y, z, f, MRIgetVoxVal(parallel, x, y, z, f) + 100);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    MRIaddScalar(dense, dense, 100);
+    compare(parallel, dense, "parallel writes to a copy");
+    MRIaddScalar(dense, dense, -100);
+    compare(sparse, dense, "source of a copy written in parallel");
+    MRIfree(&parallel);
+    if (errors) break;
+  }
+
+  MRIfree(&sparse);
+  MRIfree(&dense);
+
+  if (errors) {
+    printf("FAILED\n");
+    exit(1);
+  }
+  printf("PASSED\n");
+  exit(0);
+}
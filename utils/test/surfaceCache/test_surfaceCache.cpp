@@ -0,0 +1,229 @@
+//
+// unit test for the MRISread sidecar cache - located in utils/mrisurf_cache.cpp
+//
+// A surface read through FS_SURF_CACHE must have the same metric
+// properties, neighbourhoods and distances as one read without it, both
+// when the cache is written and when it is restored. A sidecar left
+// behind by another version of the surface, under its own name or under
+// the name of the new surface's hash, must be rejected.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "mrisurf.h"
+#include "icosahedron.h"
+#include "mrisurf_metricProperties.h"
+#include "../../mrisurf_cache.h"
+
+const char *Progname = "test_surfaceCache";
+
+static int errors = 0;
+
+static void writeSurface(const char *fname, double wave)
+{
+  MRIS *mris = ic642_make_surface(0, 0);
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    double r = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    double s = 50 * (1 + wave * sin(3 * v->x / r) * cos(2 * v->z / r)) / r;
+    MRISsetXYZ(mris, vno, s * v->x, 0.8 * s * v->y, 1.2 * s * v->z);
+  }
+  MRISwrite(mris, fname);
+  MRISfree(&mris);
+}
+
+static MRIS *readSurface(const char *fname, const char *cache)
+{
+  if (cache)
+    setenv("FS_SURF_CACHE", cache, 1);
+  else
+    unsetenv("FS_SURF_CACHE");
+  MRIS *mris = MRISread(fname);
+  unsetenv("FS_SURF_CACHE");
+  if (!mris) {
+    printf("could not read %s\n", fname);
+    exit(1);
+  }
+  return (mris);
+}
+
+// 1 if the sidecar for fname is there and valid
+static int cacheIsValid(const char *fname, const char *where)
+{
+  setenv("FS_SURF_CACHE", where, 1);
+  MRIS_SURFACE_CACHE *cache = MRISsurfaceCacheOpen(fname, 1);
+  unsetenv("FS_SURF_CACHE");
+  int valid = (cache && cache->base);
+  MRISsurfaceCacheFree(&cache);
+  return (valid);
+}
+
+// with nbhds 0 only the metric properties and the 1-hop distances are compared
+static void compare(MRIS *a, MRIS *b, const char *what, int nbhds = 1)
+{
+  int nbad = 0;
+  const double ga[] = {a->xlo, a->xhi, a->ylo, a->yhi, a->zlo, a->zhi, a->xctr, a->yctr, a->zctr, a->total_area,
+                       a->avg_vertex_area, a->avg_vertex_dist, a->std_vertex_dist, a->neg_area, a->radius};
+  const double gb[] = {b->xlo, b->xhi, b->ylo, b->yhi, b->zlo, b->zhi, b->xctr, b->yctr, b->zctr, b->total_area,
+                       b->avg_vertex_area, b->avg_vertex_dist, b->std_vertex_dist, b->neg_area, b->radius};
+  for (size_t n = 0; n < sizeof(ga) / sizeof(ga[0]); n++)
+    if (ga[n] != gb[n]) nbad++;
+  if (nbhds && (a->nsize != b->nsize || a->max_nsize != b->max_nsize || a->dist_nsize != b->dist_nsize)) nbad++;
+
+  for (int vno = 0; vno < a->nvertices; vno++) {
+    VERTEX_TOPOLOGY const *ta = &a->vertices_topology[vno], *tb = &b->vertices_topology[vno];
+    VERTEX const *va = &a->vertices[vno], *vb = &b->vertices[vno];
+    if (va->area != vb->area || va->origarea != vb->origarea || va->nx != vb->nx || va->ny != vb->ny ||
+        va->nz != vb->nz || va->neg != vb->neg || va->border != vb->border || ta->vnum != tb->vnum ||
+        ta->v2num != tb->v2num || ta->v3num != tb->v3num || ta->vtotal != tb->vtotal) {
+      nbad++;
+      continue;
+    }
+    for (int n = 0; n < (nbhds ? ta->v3num : ta->vnum); n++)
+      if (ta->v[n] != tb->v[n] || va->dist[n] != vb->dist[n]) nbad++;
+  }
+
+  for (int fno = 0; fno < a->nfaces; fno++) {
+    FACE const *fa = &a->faces[fno], *fb = &b->faces[fno];
+    FaceNormCacheEntry const *na = getFaceNorm(a, fno), *nb = getFaceNorm(b, fno);
+    if (fa->area != fb->area || na->nx != nb->nx || na->ny != nb->ny || na->nz != nb->nz) nbad++;
+    for (int k = 0; k < ANGLES_PER_TRIANGLE; k++)
+      if (fa->angle[k] != fb->angle[k]) nbad++;
+  }
+
+  if (nbad) {
+    printf("%s: %d values differ\n", what, nbad);
+    errors++;
+  }
+}
+
+static void clearMetricProperties(MRIS *mris)
+{
+  mris->xlo = mris->xhi = mris->ylo = mris->yhi = mris->zlo = mris->zhi = 0;
+  mris->xctr = mris->yctr = mris->zctr = 0;
+  mris->total_area = mris->avg_vertex_area = mris->std_vertex_dist = mris->neg_area = mris->radius = 0;
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    v->area = v->origarea = v->nx = v->ny = v->nz = 0;
+  }
+  for (int fno = 0; fno < mris->nfaces; fno++) {
+    FACE *f = &mris->faces[fno];
+    f->area = 0;
+    setFaceNorm(mris, fno, 0, 0, 0);
+    for (int k = 0; k < ANGLES_PER_TRIANGLE; k++) f->angle[k] = 0;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const char *fname = "test_surfaceCache.surf";
+  char sidecar[STRLEN], cachedir[STRLEN], cmd[3 * STRLEN];
+  sprintf(sidecar, "%s.surfcache", fname);
+  sprintf(cachedir, "test_surfaceCache.d");
+  sprintf(cmd, "rm -rf %s && mkdir %s", cachedir, cachedir);
+  if (system(cmd)) exit(1);
+  remove(sidecar);
+
+  writeSurface(fname, 0.1);
+  MRIS *plain = readSurface(fname, NULL);
+
+  // the first read writes the sidecar, the second restores from it
+  MRIS *written = readSurface(fname, "1");
+  compare(written, plain, "read that writes the cache");
+  if (!cacheIsValid(fname, "1")) {
+    printf("no valid cache after the first read\n");
+    errors++;
+  }
+  MRIS *restored = readSurface(fname, "1");
+  compare(restored, plain, "read from the cache");
+  MRISfree(&written);
+  MRISfree(&restored);
+
+  // the values really come from the sidecar
+  MRIS *cleared = readSurface(fname, NULL);
+  clearMetricProperties(cleared);
+  setenv("FS_SURF_CACHE", "1", 1);
+  MRIS_SURFACE_CACHE *cache = MRISsurfaceCacheOpen(fname, 1);
+  unsetenv("FS_SURF_CACHE");
+  if (!MRISsurfaceCacheRestoreMetricProperties(cache, cleared)) {
+    printf("the metric properties were not restored from the cache\n");
+    errors++;
+  }
+  MRISsurfaceCacheFree(&cache);
+  compare(cleared, plain, "metric properties restored from the cache", 0);
+  MRISfree(&cleared);
+
+  // the same in a cache directory
+  MRIS *indir = readSurface(fname, cachedir);
+  MRISfree(&indir);
+  if (!cacheIsValid(fname, cachedir)) {
+    printf("no valid cache in %s\n", cachedir);
+    errors++;
+  }
+  indir = readSurface(fname, cachedir);
+  compare(indir, plain, "read from the cache directory");
+  MRISfree(&indir);
+
+  // keep the sidecar of the old surface under the new surface's name
+  setenv("FS_SURF_CACHE", cachedir, 1);
+  cache = MRISsurfaceCacheOpen(fname, 1);
+  unsetenv("FS_SURF_CACHE");
+  char oldcache[STRLEN];
+  strcpy(oldcache, cache->fname);
+  MRISsurfaceCacheFree(&cache);
+
+  // same topology, other vertex positions: the old sidecar must be rejected
+  writeSurface(fname, 0.2);
+  MRIS *changed = readSurface(fname, NULL);
+  double darea = fabs(changed->total_area - plain->total_area);
+  if (darea < 1) {
+    printf("changing the surface only changed its area by %g\n", darea);
+    errors++;
+  }
+  if (cacheIsValid(fname, "1")) {
+    printf("the sidecar of the old surface is valid for the new one\n");
+    errors++;
+  }
+  MRIS *stale = readSurface(fname, "1");
+  compare(stale, changed, "read with the sidecar of the old surface");
+  MRISfree(&stale);
+  if (!cacheIsValid(fname, "1")) {
+    printf("the sidecar of the old surface was not replaced\n");
+    errors++;
+  }
+  stale = readSurface(fname, "1");
+  compare(stale, changed, "read from the replaced sidecar");
+  MRISfree(&stale);
+
+  setenv("FS_SURF_CACHE", cachedir, 1);
+  cache = MRISsurfaceCacheOpen(fname, 1);
+  unsetenv("FS_SURF_CACHE");
+  sprintf(cmd, "cp %s %s", oldcache, cache->fname);
+  MRISsurfaceCacheFree(&cache);
+  if (system(cmd)) exit(1);
+  if (cacheIsValid(fname, cachedir)) {
+    printf("a sidecar with another hash is valid\n");
+    errors++;
+  }
+  stale = readSurface(fname, cachedir);
+  compare(stale, changed, "read with a sidecar of another hash");
+  MRISfree(&stale);
+
+  MRISfree(&changed);
+  MRISfree(&plain);
+  remove(fname);
+  remove(sidecar);
+  sprintf(cmd, "rm -rf %s", cachedir);
+  if (system(cmd)) exit(1);
+
+  if (errors) {
+    printf("FAILED\n");
+    exit(1);
+  }
+  printf("PASSED\n");
+  exit(0);
+}
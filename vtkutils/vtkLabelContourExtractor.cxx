@@ -0,0 +1,263 @@
+/**
+ * @brief Builds 3D contours of many labels of a segmentation volume
+ *
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include "vtkLabelContourExtractor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include "vtkCleanPolyData.h"
+#include "vtkImageData.h"
+#include "vtkImageDilateErode3D.h"
+#include "vtkImageReslice.h"
+#include "vtkImageThreshold.h"
+#include "vtkMarchingCubes.h"
+#include "vtkPolyData.h"
+#include "vtkPolyDataConnectivityFilter.h"
+#include "vtkPolyDataNormals.h"
+#include "vtkTriangleFilter.h"
+#include "vtkWindowedSincPolyDataFilter.h"
+
+// voxels around the bounding box a label's pipeline can reach: one for the
+// marching cubes cells and the upsampling, one more for the dilation
+#define LABEL_CONTOUR_PAD 2
+
+namespace {
+
+const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+const unsigned long long FNV_PRIME = 1099511628211ULL;
+
+void AddVoxel(vtkLabelContourExtractor::LabelInfo& li, int i, int j, int k, size_t n, unsigned long long bits)
+{
+  li.Extent[0] = std::min(li.Extent[0], i);
+  li.Extent[1] = std::max(li.Extent[1], i);
+  li.Extent[2] = std::min(li.Extent[2], j);
+  li.Extent[3] = std::max(li.Extent[3], j);
+  li.Extent[4] = std::min(li.Extent[4], k);
+  li.Extent[5] = std::max(li.Extent[5], k);
+  li.Count++;
+  li.Hash = (li.Hash ^ n) * FNV_PRIME;
+  li.Hash = (li.Hash ^ bits) * FNV_PRIME;
+}
+
+template <class T>
+void ScanLabelsT(const T* p, const int* ext, const std::vector<int>& labels,
+                 std::vector<vtkLabelContourExtractor::LabelInfo>& info)
+{
+  int lmin = *std::min_element(labels.begin(), labels.end());
+  int lmax = *std::max_element(labels.begin(), labels.end());
+  std::vector<int> slot(lmax - lmin + 1, -1);
+  for (size_t n = 0; n < labels.size(); n++)
+    slot[labels[n] - lmin] = n;
+
+  size_t n = 0;
+  for (int k = ext[4]; k <= ext[5]; k++)
+  {
+    for (int j = ext[2]; j <= ext[3]; j++)
+    {
+      for (int i = ext[0]; i <= ext[1]; i++, n++)
+      {
+        double v = p[n];
+        if (!(v >= lmin - 0.5 && v <= lmax + 0.5))
+          continue;
+        long l = lround(v);
+        // halfway values are kept by the thresholds of both neighbouring
+        // labels, lround() only gives the one away from zero
+        long l2 = (l - v == 0.5) ? l - 1 : ((v - l == 0.5) ? l + 1 : l);
+
+        unsigned long long bits = 0;
+        memcpy(&bits, &p[n], sizeof(T));
+        if (l >= lmin && l <= lmax && slot[l - lmin] >= 0)
+          AddVoxel(info[slot[l - lmin]], i, j, k, n, bits);
+        if (l2 != l && l2 >= lmin && l2 <= lmax && slot[l2 - lmin] >= 0)
+          AddVoxel(info[slot[l2 - lmin]], i, j, k, n, bits);
+      }
+    }
+  }
+}
+}
+
+std::map<int, vtkLabelContourExtractor::LabelInfo> vtkLabelContourExtractor::ScanLabels(vtkImageData* image,
+                                                                                      const std::vector<int>& labels)
+{
+  std::map<int, LabelInfo> result;
+  if (labels.empty())
+    return result;
+
+  std::vector<LabelInfo> info(labels.size());
+  for (size_t n = 0; n < info.size(); n++)
+  {
+    for (int a = 0; a < 3; a++)
+    {
+      info[n].Extent[2*a] = INT_MAX;
+      info[n].Extent[2*a+1] = INT_MIN;
+    }
+    info[n].Count = 0;
+    info[n].Hash = FNV_OFFSET;
+  }
+
+  int* ext = image->GetExtent();
+  void* p = image->GetScalarPointer();
+  switch (image->GetScalarType())
+  {
+  vtkTemplateMacro(ScanLabelsT(static_cast<VTK_TT*>(p), ext, labels, info));
+  }
+
+  for (size_t n = 0; n < labels.size(); n++)
+    result[labels[n]] = info[n];
+  return result;
+}
+
+vtkSmartPointer<vtkPolyData> vtkLabelContourExtractor::BuildContour(vtkImageData* image, int label,
+                                                                    const LabelInfo& info, const Options& options)
+{
+  if (info.Count == 0)
+    return vtkSmartPointer<vtkPolyData>::New();
+
+  // copy the padded bounding box out of the volume, in the same voxel grid
+  int* whole = image->GetExtent();
+  int crop[6];
+  for (int a = 0; a < 3; a++)
+  {
+    crop[2*a] = std::max(whole[2*a], info.Extent[2*a] - LABEL_CONTOUR_PAD);
+    crop[2*a+1] = std::min(whole[2*a+1], info.Extent[2*a+1] + LABEL_CONTOUR_PAD);
+  }
+  vtkSmartPointer<vtkImageData> sub = vtkSmartPointer<vtkImageData>::New();
+  sub->SetOrigin(image->GetOrigin());
+  sub->SetSpacing(image->GetSpacing());
+#if VTK_MAJOR_VERSION > 8
+  sub->SetDirectionMatrix(image->GetDirectionMatrix());
+#endif
+  sub->SetExtent(crop);
+#if VTK_MAJOR_VERSION > 5
+  sub->AllocateScalars(image->GetScalarType(), 1);
+#else
+  sub->SetScalarType(image->GetScalarType());
+  sub->SetNumberOfScalarComponents(1);
+  sub->AllocateScalars();
+#endif
+  const char* src = static_cast<const char*>(image->GetScalarPointer());
+  char* dst = static_cast<char*>(sub->GetScalarPointer());
+  size_t nBytes = image->GetScalarSize();
+  size_t nx = whole[1] - whole[0] + 1, ny = whole[3] - whole[2] + 1;
+  size_t nRow = (crop[1] - crop[0] + 1) * nBytes;
+  for (int k = crop[4]; k <= crop[5]; k++)
+  {
+    for (int j = crop[2]; j <= crop[3]; j++)
+    {
+      size_t offset = ((k - whole[4]) * ny + (j - whole[2])) * nx + (crop[0] - whole[0]);
+      memcpy(dst, src + offset * nBytes, nRow);
+      dst += nRow;
+    }
+  }
+
+  vtkSmartPointer<vtkImageThreshold> threshold = vtkSmartPointer<vtkImageThreshold>::New();
+#if VTK_MAJOR_VERSION > 5
+  threshold->SetInputData( sub );
+#else
+  threshold->SetInput( sub );
+#endif
+  threshold->ThresholdBetween( label-0.5, label+0.5 );
+  threshold->ReplaceOutOn();
+  threshold->SetOutValue( 0 );
+  vtkSmartPointer<vtkImageReslice> resampler = vtkSmartPointer<vtkImageReslice>::New();
+  if (options.Upsample)
+  {
+    double vs[3];
+    image->GetSpacing(vs);
+    resampler->SetOutputSpacing(vs[0]/2, vs[1]/2, vs[2]/2);
+    resampler->SetInputConnection(threshold->GetOutputPort());
+  }
+
+  vtkSmartPointer<vtkMarchingCubes> contour = vtkSmartPointer<vtkMarchingCubes>::New();
+  vtkSmartPointer<vtkImageDilateErode3D> dilate = vtkSmartPointer<vtkImageDilateErode3D>::New();
+  if (options.Dilate)
+  {
+    int nSwell = 2;
+    dilate->SetInputConnection(options.Upsample? resampler->GetOutputPort() : threshold->GetOutputPort());
+    dilate->SetKernelSize(nSwell, nSwell, nSwell);
+    dilate->SetDilateValue(label);
+    dilate->SetErodeValue(0);
+    contour->SetInputConnection(dilate->GetOutputPort());
+  }
+  else
+    contour->SetInputConnection(options.Upsample? resampler->GetOutputPort() : threshold->GetOutputPort());
+  contour->SetValue(0, label);
+
+  vtkSmartPointer<vtkPolyDataConnectivityFilter> conn = vtkSmartPointer<vtkPolyDataConnectivityFilter>::New();
+  conn->SetInputConnection( contour->GetOutputPort() );
+  conn->SetExtractionModeToLargestRegion();
+  vtkSmartPointer<vtkWindowedSincPolyDataFilter> smoother = vtkSmartPointer<vtkWindowedSincPolyDataFilter>::New();
+  if ( options.AllRegions )
+    smoother->SetInputConnection( contour->GetOutputPort() );
+  else
+    smoother->SetInputConnection( conn->GetOutputPort() );
+  smoother->SetNumberOfIterations( options.SmoothIterations );
+  vtkSmartPointer<vtkPolyDataNormals> normals = vtkSmartPointer<vtkPolyDataNormals>::New();
+  normals->SetInputConnection( smoother->GetOutputPort() );
+  normals->SetFeatureAngle( 90 );
+  vtkSmartPointer<vtkTriangleFilter> stripper = vtkSmartPointer<vtkTriangleFilter>::New();
+  stripper->SetInputConnection( normals->GetOutputPort() );
+  vtkSmartPointer<vtkCleanPolyData> cleaner = vtkSmartPointer<vtkCleanPolyData>::New();
+  cleaner->SetInputConnection(stripper->GetOutputPort());
+  cleaner->Update();
+
+  vtkSmartPointer<vtkPolyData> polydata = cleaner->GetOutput();
+  return polydata;
+}
+
+std::map<int, vtkSmartPointer<vtkPolyData> > vtkLabelContourExtractor::BuildContours(vtkImageData* image,
+                                                                                    const std::map<int, LabelInfo>& labels,
+                                                                                    const Options& options, int nThreads)
+{
+  std::vector<int> ids;
+  std::vector<const LabelInfo*> infos;
+  for (std::map<int, LabelInfo>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+  {
+    ids.push_back(it->first);
+    infos.push_back(&it->second);
+  }
+  std::vector<vtkSmartPointer<vtkPolyData> > polys(ids.size());
+
+  if (nThreads <= 0)
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  nThreads = std::min<int>(nThreads, ids.size());
+
+  // each label has its own sub-volume and pipeline, so the threads only share
+  // read access to the image's scalars
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nThreads; t++)
+  {
+    threads.push_back(std::thread([&]()
+    {
+      for (size_t n = next++; n < ids.size(); n = next++)
+        polys[n] = BuildContour(image, ids[n], *infos[n], options);
+    }));
+  }
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+
+  std::map<int, vtkSmartPointer<vtkPolyData> > result;
+  for (size_t n = 0; n < ids.size(); n++)
+    result[ids[n]] = polys[n];
+  return result;
+}
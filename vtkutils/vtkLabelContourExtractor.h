@@ -0,0 +1,74 @@
+/**
+ * @brief Builds 3D contours of many labels of a segmentation volume
+ *
+ * One sweep over the volume finds the bounding box of every label,
+ * together with a signature of its voxels that tells whether the label
+ * changed since its contour was last built. Each label's contour is then
+ * made by the usual threshold / marching cubes / smoothing pipeline, but
+ * only over its bounding box (padded so the filters see the same
+ * neighbourhood as on the whole volume, which gives the same polydata),
+ * and the labels are processed in parallel.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef vtkLabelContourExtractor_h
+#define vtkLabelContourExtractor_h
+
+#include <map>
+#include <vector>
+#include "vtkSmartPointer.h"
+
+class vtkImageData;
+class vtkPolyData;
+
+class vtkLabelContourExtractor
+{
+public:
+  struct LabelInfo
+  {
+    int       Extent[6];   // voxels of the label, empty (min > max) if there are none
+    long long Count;
+    unsigned long long Hash;  // of the positions and values of the voxels
+
+    bool operator==(const LabelInfo& info) const
+    {
+      return Count == info.Count && Hash == info.Hash;
+    }
+    bool operator!=(const LabelInfo& info) const { return !(*this == info); }
+  };
+
+  struct Options
+  {
+    int  SmoothIterations = 0;
+    bool AllRegions = false;  // otherwise only the largest connected region is kept
+    bool Upsample = false;
+    bool Dilate = false;
+  };
+
+  // A voxel of value v belongs to every label whose threshold, between
+  // label-0.5 and label+0.5, keeps it: lround(v), and both neighbouring labels
+  // when v is exactly halfway. The image must have a single component.
+  static std::map<int, LabelInfo> ScanLabels(vtkImageData* image, const std::vector<int>& labels);
+
+  // The contour of one label, as built by MyVTKUtils::BuildLabelContourActor.
+  static vtkSmartPointer<vtkPolyData> BuildContour(vtkImageData* image, int label, const LabelInfo& info,
+                                                   const Options& options);
+
+  // BuildContour for each label, on nThreads threads (0 for one per core).
+  static std::map<int, vtkSmartPointer<vtkPolyData> > BuildContours(vtkImageData* image,
+                                                                    const std::map<int, LabelInfo>& labels,
+                                                                    const Options& options, int nThreads = 0);
+};
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @brief Tests the label scan of vtkLabelContourExtractor
+ *
+ * ScanLabels must count a voxel for the same labels whose threshold keeps
+ * it in BuildContour, on integer and on non-integer label volumes.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+
+#include "vtkImageData.h"
+#include "vtkSmartPointer.h"
+#include "vtkLabelContourExtractor.h"
+
+using namespace std;
+
+static int errs=0;
+
+static vtkSmartPointer<vtkImageData> MakeImage(int type, const double* values, int nx, int ny, int nz)
+{
+  vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+  image->SetExtent(0, nx-1, 0, ny-1, 0, nz-1);
+#if VTK_MAJOR_VERSION > 5
+  image->AllocateScalars(type, 1);
+#else
+  image->SetScalarType(type);
+  image->SetNumberOfScalarComponents(1);
+  image->AllocateScalars();
+#endif
+  for (int k = 0; k < nz; k++)
+    for (int j = 0; j < ny; j++)
+      for (int i = 0; i < nx; i++)
+        image->SetScalarComponentFromDouble(i, j, k, 0, values[(k*ny + j)*nx + i]);
+  return image;
+}
+
+static void Check(const map<int, vtkLabelContourExtractor::LabelInfo>& info, int label,
+                  long long count, int imin, int imax, const char* what)
+{
+  const vtkLabelContourExtractor::LabelInfo& li = info.at(label);
+  if (li.Count != count || (count > 0 && (li.Extent[0] != imin || li.Extent[1] != imax)))
+  {
+    cerr << what << ": label " << label << " has " << li.Count << " voxels in x "
+         << li.Extent[0] << ".." << li.Extent[1] << ", expected " << count
+         << " in " << imin << ".." << imax << endl;
+    errs++;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  // a row of voxels along x
+  const double ints[8] = { 0, 1, 1, 2, 2, 2, 0, 3 };
+  vector<int> labels;
+  labels.push_back(1);
+  labels.push_back(2);
+  labels.push_back(4);
+  map<int, vtkLabelContourExtractor::LabelInfo> info =
+      vtkLabelContourExtractor::ScanLabels(MakeImage(VTK_UNSIGNED_CHAR, ints, 8, 1, 1), labels);
+  Check(info, 1, 2, 1, 2, "integer volume");
+  Check(info, 2, 3, 3, 5, "integer volume");
+  Check(info, 4, 0, 0, 0, "integer volume");
+
+  // the threshold of label l keeps l-0.5 <= v <= l+0.5
+  const double reals[8] = { 1.6, 2.0, 2.4, 2.5, 2.6, 3.5, -1.5, -0.7 };
+  labels.clear();
+  labels.push_back(-2);
+  labels.push_back(-1);
+  labels.push_back(2);
+  labels.push_back(3);
+  info = vtkLabelContourExtractor::ScanLabels(MakeImage(VTK_FLOAT, reals, 8, 1, 1), labels);
+  Check(info, 2, 4, 0, 3, "float volume");
+  Check(info, 3, 3, 3, 5, "float volume");
+  Check(info, -1, 2, 6, 7, "float volume");
+  Check(info, -2, 1, 6, 6, "float volume");
+
+  // the signature of a label only changes with its own voxels
+  double changed[8];
+  for (int n = 0; n < 8; n++)
+    changed[n] = reals[n];
+  changed[7] = -1.2;
+  map<int, vtkLabelContourExtractor::LabelInfo> info2 =
+      vtkLabelContourExtractor::ScanLabels(MakeImage(VTK_FLOAT, changed, 8, 1, 1), labels);
+  if (info2.at(-1) == info.at(-1) || info2.at(2) != info.at(2) || info2.at(3) != info.at(3))
+  {
+    cerr << "label signatures do not follow the voxels that changed" << endl;
+    errs++;
+  }
+
+  if (errs)
+  {
+    cout << "FAILED" << endl;
+    return 1;
+  }
+  cout << "PASSED" << endl;
+  return 0;
+}